@@ -0,0 +1,776 @@
+/*
+ * ClusterRows
+ * Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// gmmEval : clustering quality versus throughput of every engine mode on the same data.
+//
+// The data is either drawn from a Gaussian mixture by a streaming generator modelled on
+// testdocs/gen_data.py::genGMM (any number of rows, columns and clusters, spherical, diagonal or
+// full covariances and unequal cluster sizes), or read from a CSV file in the format genGMM
+// writes: a header line and the true cluster index in the last column.
+//
+// Each mode runs in a child process so that its peak RSS can be reported. For each mode the
+// harness prints the adjusted Rand index against the true labels, the average log-likelihood
+// of the rows under the mixture re-estimated from the returned labels (full covariances, so
+// that all modes are scored alike), the wall time of the engine call and the peak RSS.
+
+#include <em.h>
+
+#include <Eigen/Dense>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <numbers>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace
+{
+
+using Eigen::MatrixXd;
+using Eigen::VectorXd;
+
+enum class Shape
+{
+    SPHERICAL,
+    DIAGONAL,
+    FULL
+};
+
+struct EvalOptions
+{
+    long long rows = 100000;
+    int dims = 2;
+    int clusters = 0; // 0: 4 for generated data, the number of true clusters of an input
+    Shape shape = Shape::FULL;
+    double imbalance = 1.0;
+    double separation = 5.0;
+    unsigned seed = 42;
+    int epochs = 10;
+    std::string input;
+    std::string modes;
+    bool perf = false;
+};
+
+/// @brief A source of rows and their true labels that can be read more than once.
+class RowSource
+{
+public:
+    virtual ~RowSource() = default;
+    [[nodiscard]] virtual int cols() const = 0;
+    [[nodiscard]] virtual long long rows() const = 0;
+    /// @brief Reads up to @p maxRows rows and their labels, returns the number read.
+    virtual int read(double* buffer, int* truth, int maxRows) = 0;
+    virtual void rewind() = 0;
+};
+
+/// @brief Draws rows from a Gaussian mixture on the fly, the same rows after every rewind().
+/// As in genGMM the cluster sizes follow the mixing weights, here by sampling each row's
+/// cluster rather than by shuffling fixed size blocks so that no row needs to be kept.
+class MixtureGenerator : public RowSource
+{
+public:
+    explicit MixtureGenerator(const EvalOptions& opts)
+        : num_rows(opts.rows)
+        , seed(opts.seed)
+    {
+        std::mt19937_64 setup(opts.seed ^ 0x5eedULL);
+        std::normal_distribution<double> normal;
+        std::uniform_real_distribution<double> scale(0.5, 1.5);
+
+        // Weights from 1 down to 1/imbalance in geometric steps.
+        const int k = opts.clusters;
+        for (int cluster = 0; cluster < k; ++cluster)
+            weights.push_back(std::pow(opts.imbalance, -cluster / std::max(k - 1.0, 1.0)));
+
+        const int d = opts.dims;
+        for (int cluster = 0; cluster < k; ++cluster)
+        {
+            VectorXd mean(d);
+            for (int dim = 0; dim < d; ++dim)
+                mean(dim) = opts.separation * normal(setup);
+            means.push_back(mean);
+
+            VectorXd sd(d);
+            if (opts.shape == Shape::SPHERICAL)
+                sd.setConstant(scale(setup));
+            else
+                for (int dim = 0; dim < d; ++dim)
+                    sd(dim) = scale(setup);
+
+            MatrixXd factor = sd.asDiagonal();
+            if (opts.shape == Shape::FULL)
+            {
+                MatrixXd gaussian(d, d);
+                for (int row = 0; row < d; ++row)
+                    for (int col = 0; col < d; ++col)
+                        gaussian(row, col) = normal(setup);
+                const MatrixXd rotation = Eigen::HouseholderQR<MatrixXd>(gaussian).householderQ();
+                factor = rotation * sd.asDiagonal();
+            }
+            factors.push_back(factor);
+        }
+        rewind();
+    }
+
+    [[nodiscard]] int cols() const override { return static_cast<int>(means[0].size()); }
+    [[nodiscard]] long long rows() const override { return num_rows; }
+
+    int read(double* buffer, int* truth, int maxRows) override
+    {
+        const int count = static_cast<int>(std::min<long long>(maxRows, num_rows - next));
+        const int d = cols();
+        VectorXd z(d);
+        for (int row = 0; row < count; ++row)
+        {
+            const int cluster = pick(generator);
+            for (int dim = 0; dim < d; ++dim)
+                z(dim) = normal(generator);
+            Eigen::Map<VectorXd>(buffer + static_cast<size_t>(row) * d, d)
+                = means[cluster] + factors[cluster] * z;
+            truth[row] = cluster;
+        }
+        next += count;
+        return count;
+    }
+
+    void rewind() override
+    {
+        generator.seed(seed);
+        pick = std::discrete_distribution<int>(weights.begin(), weights.end());
+        normal.reset();
+        next = 0;
+    }
+
+    /// @brief The parameters of the generating mixture, to score the data against them.
+    void oracle(std::vector<double>& outWeights, std::vector<VectorXd>& outMeans,
+                std::vector<MatrixXd>& outCovs) const
+    {
+        const double total = std::accumulate(weights.begin(), weights.end(), 0.0);
+        outWeights.clear();
+        outMeans = means;
+        outCovs.clear();
+        for (size_t cluster = 0; cluster < weights.size(); ++cluster)
+        {
+            outWeights.push_back(weights[cluster] / total);
+            outCovs.push_back(factors[cluster] * factors[cluster].transpose());
+        }
+    }
+
+private:
+    const long long num_rows;
+    const unsigned seed;
+    std::vector<double> weights;
+    std::vector<VectorXd> means;
+    std::vector<MatrixXd> factors;
+    std::mt19937_64 generator;
+    std::discrete_distribution<int> pick;
+    std::normal_distribution<double> normal;
+    long long next = 0;
+};
+
+/// @brief Rows held in memory, from a CSV file or materialized from a generator.
+class MemorySource : public RowSource
+{
+public:
+    MemorySource(std::vector<double> values_, std::vector<int> truth_, int cols_)
+        : values(std::move(values_))
+        , labels(std::move(truth_))
+        , num_cols(cols_)
+    {
+    }
+
+    [[nodiscard]] int cols() const override { return num_cols; }
+    [[nodiscard]] long long rows() const override { return static_cast<long long>(labels.size()); }
+    [[nodiscard]] const double* data() const { return values.data(); }
+    [[nodiscard]] const std::vector<int>& truth() const { return labels; }
+
+    int read(double* buffer, int* truth, int maxRows) override
+    {
+        const int count = static_cast<int>(std::min<long long>(maxRows, rows() - next));
+        std::copy_n(values.data() + next * num_cols, static_cast<size_t>(count) * num_cols,
+                    buffer);
+        std::copy_n(labels.data() + next, count, truth);
+        next += count;
+        return count;
+    }
+
+    void rewind() override { next = 0; }
+
+private:
+    std::vector<double> values;
+    std::vector<int> labels;
+    const int num_cols;
+    long long next = 0;
+};
+
+std::unique_ptr<MemorySource> materialize(RowSource& source)
+{
+    const int d = source.cols();
+    std::vector<double> values(static_cast<size_t>(source.rows()) * d);
+    std::vector<int> truth(source.rows());
+    source.rewind();
+    for (long long row = 0; row < source.rows();)
+        row += source.read(values.data() + row * d, truth.data() + row, 65536);
+    return std::make_unique<MemorySource>(std::move(values), std::move(truth), d);
+}
+
+std::unique_ptr<MemorySource> readCsv(const std::string& path)
+{
+    std::ifstream file(path);
+    std::string line;
+    if (!file || !std::getline(file, line)) // header
+        return nullptr;
+
+    std::vector<double> values;
+    std::vector<int> truth;
+    int cols = -1;
+    std::vector<double> fields;
+    while (std::getline(file, line))
+    {
+        fields.clear();
+        std::stringstream stream(line);
+        std::string field;
+        while (std::getline(stream, field, ','))
+            fields.push_back(std::strtod(field.c_str(), nullptr));
+        if (fields.empty())
+            continue;
+        if (cols < 0)
+            cols = static_cast<int>(fields.size()) - 1;
+        if (cols < 1 || static_cast<int>(fields.size()) != cols + 1)
+            return nullptr;
+        values.insert(values.end(), fields.begin(), fields.end() - 1);
+        truth.push_back(static_cast<int>(std::lround(fields.back())));
+    }
+    if (truth.empty())
+        return nullptr;
+    return std::make_unique<MemorySource>(std::move(values), std::move(truth), cols);
+}
+
+/// @brief Adjusted Rand index of two labelings, negative labels form a class of their own.
+double adjustedRandIndex(const std::vector<int>& truth, const std::vector<int>& labels)
+{
+    const int numTruth = *std::max_element(truth.begin(), truth.end()) + 2;
+    const int numLabels = *std::max_element(labels.begin(), labels.end()) + 2;
+    std::vector<double> table(static_cast<size_t>(numTruth) * numLabels, 0.0);
+    for (size_t row = 0; row < truth.size(); ++row)
+        table[(std::max(truth[row], -1) + 1) * numLabels + std::max(labels[row], -1) + 1] += 1.0;
+
+    auto pairs = [](double count) { return count * (count - 1.0) / 2.0; };
+    std::vector<double> rowSums(numTruth, 0.0);
+    std::vector<double> colSums(numLabels, 0.0);
+    double index = 0.0;
+    for (int t = 0; t < numTruth; ++t)
+    {
+        for (int l = 0; l < numLabels; ++l)
+        {
+            const double count = table[t * numLabels + l];
+            index += pairs(count);
+            rowSums[t] += count;
+            colSums[l] += count;
+        }
+    }
+
+    double truthPairs = 0.0;
+    double labelPairs = 0.0;
+    for (double sum : rowSums)
+        truthPairs += pairs(sum);
+    for (double sum : colSums)
+        labelPairs += pairs(sum);
+    const double expected = truthPairs * labelPairs / pairs(static_cast<double>(truth.size()));
+    const double maximum = 0.5 * (truthPairs + labelPairs);
+    return maximum == expected ? 1.0 : (index - expected) / (maximum - expected);
+}
+
+/// @brief Average log-likelihood of the rows of @p source under the given mixture.
+double averageLogLikelihood(RowSource& source, const std::vector<double>& weights,
+                            const std::vector<VectorXd>& means, const std::vector<MatrixXd>& covs)
+{
+    const int d = source.cols();
+    const int k = static_cast<int>(weights.size());
+    std::vector<Eigen::LLT<MatrixXd>> factors;
+    std::vector<double> constants;
+    for (int cluster = 0; cluster < k; ++cluster)
+    {
+        factors.emplace_back(covs[cluster]);
+        const double logDet
+            = 2.0 * factors.back().matrixLLT().diagonal().array().log().sum();
+        constants.push_back(std::log(weights[cluster])
+                            - 0.5 * (d * std::log(2.0 * std::numbers::pi) + logDet));
+    }
+
+    constexpr int chunk = 4096;
+    std::vector<double> buffer(static_cast<size_t>(chunk) * d);
+    std::vector<int> truth(chunk);
+    std::vector<double> logDensity(k);
+    double total = 0.0;
+    source.rewind();
+    for (int count; (count = source.read(buffer.data(), truth.data(), chunk)) > 0;)
+    {
+        for (int row = 0; row < count; ++row)
+        {
+            const Eigen::Map<const VectorXd> x(buffer.data() + static_cast<size_t>(row) * d, d);
+            double largest = -INFINITY;
+            for (int cluster = 0; cluster < k; ++cluster)
+            {
+                const VectorXd z = factors[cluster].matrixL().solve(x - means[cluster]);
+                logDensity[cluster] = constants[cluster] - 0.5 * z.squaredNorm();
+                largest = std::max(largest, logDensity[cluster]);
+            }
+            double sum = 0.0;
+            for (int cluster = 0; cluster < k; ++cluster)
+                sum += std::exp(logDensity[cluster] - largest);
+            total += largest + std::log(sum);
+        }
+    }
+    return total / static_cast<double>(source.rows());
+}
+
+/// @brief Maximum likelihood mixture of the clusters given by @p labels, with full covariances
+/// lightly regularized so that tiny clusters stay usable. Rows labelled negative are left out.
+void refitFromLabels(RowSource& source, const std::vector<int>& labels,
+                     std::vector<double>& weights, std::vector<VectorXd>& means,
+                     std::vector<MatrixXd>& covs)
+{
+    const int d = source.cols();
+    const int k = std::max(*std::max_element(labels.begin(), labels.end()) + 1, 0);
+    std::vector<double> counts(k, 0.0);
+    means.assign(k, VectorXd::Zero(d));
+    covs.assign(k, MatrixXd::Zero(d, d));
+
+    constexpr int chunk = 4096;
+    std::vector<double> buffer(static_cast<size_t>(chunk) * d);
+    std::vector<int> truth(chunk);
+    long long first = 0;
+    source.rewind();
+    for (int count; (count = source.read(buffer.data(), truth.data(), chunk)) > 0; first += count)
+    {
+        for (int row = 0; row < count; ++row)
+        {
+            const int label = labels[first + row];
+            if (label < 0)
+                continue;
+            const Eigen::Map<const VectorXd> x(buffer.data() + static_cast<size_t>(row) * d, d);
+            counts[label] += 1.0;
+            means[label] += x;
+            covs[label].noalias() += x * x.transpose();
+        }
+    }
+
+    weights.clear();
+    const double total = std::accumulate(counts.begin(), counts.end(), 0.0);
+    std::vector<VectorXd> keptMeans;
+    std::vector<MatrixXd> keptCovs;
+    for (int cluster = 0; cluster < k; ++cluster)
+    {
+        if (counts[cluster] < 1.0)
+            continue;
+        const VectorXd mean = means[cluster] / counts[cluster];
+        MatrixXd cov = covs[cluster] / counts[cluster] - mean * mean.transpose();
+        cov.diagonal().array() += 1e-6 * std::max(cov.trace() / d, 1.0);
+        weights.push_back(counts[cluster] / total);
+        keptMeans.push_back(mean);
+        keptCovs.push_back(cov);
+    }
+    means.swap(keptMeans);
+    covs.swap(keptCovs);
+}
+
+/// @brief One engine configuration to evaluate.
+struct Mode
+{
+    const char* name;
+    std::function<void(GMMOptions&, const EvalOptions&)> configure;
+    bool stream = false;
+};
+
+std::vector<Mode> allModes(int cols)
+{
+    std::vector<Mode> modes{
+        { "dense", [](GMMOptions&, const EvalOptions&) {} },
+        { "topk", [](GMMOptions& o, const EvalOptions&) { o.topK = 2; } },
+        { "stream", [](GMMOptions&, const EvalOptions&) {}, true },
+        { "auto", [](GMMOptions& o, const EvalOptions&) { o.numClusters = 0; } },
+        { "vb",
+          [](GMMOptions& o, const EvalOptions& e)
+          {
+              o.numClusters = 0;
+              o.vbMaxClusters = e.clusters + 3;
+          } },
+        { "order",
+          [](GMMOptions& o, const EvalOptions& e)
+          {
+              o.numClusters = 0;
+              o.orderSearchMaxClusters = e.clusters + 3;
+          } },
+    };
+    if (cols <= 6)
+        modes.push_back(
+            { "tree", [](GMMOptions& o, const EvalOptions&) { o.treeTolerance = 0.01; } });
+    if (cols > 2)
+        modes.push_back({ "pca", [](GMMOptions& o, const EvalOptions&) { o.pcaVariance = 0.95; } });
+    return modes;
+}
+
+struct Result
+{
+    int status;
+    int clusters;
+    double ari;
+    double logLikelihood;
+    double wallMs;
+    GMMStats stats;
+};
+
+struct StreamContext
+{
+    RowSource* source;
+    std::vector<int>* truth;
+    std::vector<int>* labels;
+    long long readNext;
+    long long writeNext;
+
+    static int read(void* context, double* buffer, int maxRows)
+    {
+        auto* self = static_cast<StreamContext*>(context);
+        const int count = self->source->read(buffer, self->truth->data() + self->readNext, maxRows);
+        self->readNext += count;
+        return count;
+    }
+
+    static void rewind(void* context)
+    {
+        auto* self = static_cast<StreamContext*>(context);
+        self->source->rewind();
+        self->readNext = 0;
+    }
+
+    static void write(void* context, const int* labels, const double*, int rows)
+    {
+        auto* self = static_cast<StreamContext*>(context);
+        std::copy_n(labels, rows, self->labels->data() + self->writeNext);
+        self->writeNext += rows;
+    }
+};
+
+Result runMode(const Mode& mode, RowSource& generated, const EvalOptions& opts)
+{
+    GMMOptions options;
+    gmmInitOptions(&options);
+    options.numClusters = opts.clusters;
+    options.numEpochs = opts.epochs;
+    options.fullGMM = opts.shape == Shape::FULL        ? CR_COVARIANCE_FULL
+                      : opts.shape == Shape::DIAGONAL ? CR_COVARIANCE_DIAGONAL
+                                                      : CR_COVARIANCE_SPHERICAL;
+    mode.configure(options, opts);
+    options.perfCounters = opts.perf;
+
+    Result result{};
+    GMMStats stats;
+    const long long rows = generated.rows();
+    std::vector<int> labels(rows, -1);
+    std::vector<int> truth(rows, -1);
+    std::unique_ptr<MemorySource> memory;
+    RowSource* source = &generated;
+    std::chrono::steady_clock::time_point start;
+    if (mode.stream)
+    {
+        StreamContext context{ source, &truth, &labels, 0, 0 };
+        start = std::chrono::steady_clock::now();
+        result.status = gmmStreamMain(source->cols(), StreamContext::read, StreamContext::rewind,
+                                      &context, &options, StreamContext::write, &context, &stats);
+    }
+    else
+    {
+        // Materialized outside the timing, in the child so that it counts in the peak RSS.
+        auto* existing = dynamic_cast<MemorySource*>(source);
+        if (!existing)
+        {
+            memory = materialize(*source);
+            existing = memory.get();
+            source = existing;
+        }
+        truth = existing->truth();
+        std::vector<double> confidences(rows);
+        start = std::chrono::steady_clock::now();
+        result.status = gmmMainEx(existing->data(), static_cast<int>(rows), existing->cols(),
+                                  &options, labels.data(), confidences.data(), &stats);
+    }
+    result.wallMs
+        = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+              .count();
+    if (result.status != 0)
+        return result;
+
+    result.clusters = stats.bestNumClusters;
+    result.stats = stats;
+    result.ari = adjustedRandIndex(truth, labels);
+    std::vector<double> weights;
+    std::vector<VectorXd> means;
+    std::vector<MatrixXd> covs;
+    refitFromLabels(*source, labels, weights, means, covs);
+    result.logLikelihood
+        = weights.empty() ? -INFINITY : averageLogLikelihood(*source, weights, means, covs);
+    return result;
+}
+
+/// @brief Runs @p mode in a child process and returns its result and peak RSS in MiB.
+bool runIsolated(const Mode& mode, RowSource& source, const EvalOptions& opts, Result& result,
+                 double& peakRssMiB)
+{
+    int fds[2];
+    if (::pipe(fds) != 0)
+        return false;
+
+    std::fflush(stdout);
+    const pid_t pid = ::fork();
+    if (pid < 0)
+        return false;
+    if (pid == 0)
+    {
+        ::close(fds[0]);
+        const Result childResult = runMode(mode, source, opts);
+        const bool written = ::write(fds[1], &childResult, sizeof(childResult))
+                             == static_cast<ssize_t>(sizeof(childResult));
+        ::_exit(written ? 0 : 1);
+    }
+
+    ::close(fds[1]);
+    const bool received = ::read(fds[0], &result, sizeof(result))
+                          == static_cast<ssize_t>(sizeof(result));
+    ::close(fds[0]);
+    int status = 0;
+    rusage usage{};
+    ::wait4(pid, &status, 0, &usage);
+    peakRssMiB = usage.ru_maxrss / 1024.0; // kilobytes on Linux
+    return received && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+void usage(const char* program)
+{
+    std::fprintf(
+        stderr,
+        "Usage: %s [options]\n"
+        "\n"
+        "Evaluates every engine mode on the same data and prints the adjusted Rand index against\n"
+        "the true labels, the log-likelihood per row of the mixture refitted from the labels,\n"
+        "the wall time and the peak RSS.\n"
+        "\n"
+        "  --rows N            rows to generate (default 100000)\n"
+        "  --dims D            columns to generate (default 2)\n"
+        "  -k, --clusters K    clusters to generate and to fit (default 4, or the number of\n"
+        "                      true clusters of an --input)\n"
+        "  --shape S           covariances to generate and to fit: spherical, diag or full\n"
+        "                      (default full)\n"
+        "  --imbalance R       size ratio of the largest to the smallest cluster (default 1)\n"
+        "  --separation S      standard deviation of the cluster means (default 5), the\n"
+        "                      clusters have standard deviations between 0.5 and 1.5\n"
+        "  --seed N            random seed of the generator (default 42)\n"
+        "  --epochs N          epochs of each fit (default 10)\n"
+        "  --input FILE.csv    evaluate on a CSV with a header line and the true cluster in the\n"
+        "                      last column (as written by testdocs/gen_data.py) instead\n"
+        "  --modes LIST        comma separated subset of dense, topk, stream, auto, vb, order,\n"
+        "                      tree (up to 6 columns) and pca (more than 2 columns)\n"
+        "  --perf              also print per phase IPC and cycles, last level cache misses\n"
+        "                      and branch misses per row from hardware counters\n",
+        program);
+}
+
+template <typename T> bool parseNumber(const char* text, T& value)
+{
+    const char* end = text + std::strlen(text);
+    auto [ptr, ec] = std::from_chars(text, end, value);
+    return ec == std::errc() && ptr == end;
+}
+
+bool parseArgs(int argc, char** argv, EvalOptions& opts)
+{
+    for (int idx = 1; idx < argc; ++idx)
+    {
+        const std::string_view arg(argv[idx]);
+        if (arg == "--perf")
+        {
+            opts.perf = true;
+            continue;
+        }
+        if (arg == "-h" || arg == "--help" || idx + 1 >= argc)
+            return false;
+
+        const char* value = argv[++idx];
+        bool ok = true;
+        if (arg == "--rows")
+            ok = parseNumber(value, opts.rows) && opts.rows > 0;
+        else if (arg == "--dims")
+            ok = parseNumber(value, opts.dims) && opts.dims > 0;
+        else if (arg == "-k" || arg == "--clusters")
+            ok = parseNumber(value, opts.clusters) && opts.clusters > 0;
+        else if (arg == "--shape")
+        {
+            const std::string_view shape(value);
+            if (shape == "spherical")
+                opts.shape = Shape::SPHERICAL;
+            else if (shape == "diag")
+                opts.shape = Shape::DIAGONAL;
+            else if (shape == "full")
+                opts.shape = Shape::FULL;
+            else
+                ok = false;
+        }
+        else if (arg == "--imbalance")
+            ok = parseNumber(value, opts.imbalance) && opts.imbalance >= 1.0;
+        else if (arg == "--separation")
+            ok = parseNumber(value, opts.separation) && opts.separation > 0.0;
+        else if (arg == "--seed")
+            ok = parseNumber(value, opts.seed);
+        else if (arg == "--epochs")
+            ok = parseNumber(value, opts.epochs) && opts.epochs > 0;
+        else if (arg == "--input")
+            opts.input = value;
+        else if (arg == "--modes")
+            opts.modes = std::string(",") + value + ",";
+        else
+            ok = false;
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
+/// @brief Prints the hardware counters of each phase that ran, per row of the input.
+void printCounters(const GMMStats& stats, long long rows)
+{
+    if (stats.perfStatus < 0)
+    {
+        std::printf("  hardware counters are not available (see perf_event_paranoid)\n");
+        return;
+    }
+
+    static const char* const phases[CR_NUM_PHASES]{ "init", "e-step", "m-step", "select" };
+    for (int phase = 0; phase < CR_NUM_PHASES; ++phase)
+    {
+        const long long cycles = stats.perfCycles[phase];
+        if (cycles <= 0)
+            continue;
+        const long long instructions = stats.perfInstructions[phase];
+        std::printf("  %-8s IPC %6.2f  cycles/row %10.1f  LLC-misses/row %8.3f  "
+                    "branch-misses/row %8.3f\n",
+                    phases[phase],
+                    instructions >= 0 ? static_cast<double>(instructions) / cycles : NAN,
+                    static_cast<double>(cycles) / rows,
+                    stats.perfCacheMisses[phase] >= 0
+                        ? static_cast<double>(stats.perfCacheMisses[phase]) / rows
+                        : NAN,
+                    stats.perfBranchMisses[phase] >= 0
+                        ? static_cast<double>(stats.perfBranchMisses[phase]) / rows
+                        : NAN);
+    }
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    EvalOptions opts;
+    if (!parseArgs(argc, argv, opts))
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    std::unique_ptr<RowSource> source;
+    double oracleLogLikelihood = NAN;
+    if (!opts.input.empty())
+    {
+        source = readCsv(opts.input);
+        if (!source)
+        {
+            std::fprintf(stderr, "gmmEval: '%s' is not a numeric CSV with a header line\n",
+                         opts.input.c_str());
+            return 1;
+        }
+        opts.rows = source->rows();
+        opts.dims = source->cols();
+        if (!opts.clusters)
+        {
+            const auto& truth = static_cast<MemorySource&>(*source).truth();
+            opts.clusters = *std::max_element(truth.begin(), truth.end()) + 1;
+        }
+    }
+    else
+    {
+        if (!opts.clusters)
+            opts.clusters = 4;
+        auto generator = std::make_unique<MixtureGenerator>(opts);
+        std::vector<double> weights;
+        std::vector<VectorXd> means;
+        std::vector<MatrixXd> covs;
+        generator->oracle(weights, means, covs);
+        oracleLogLikelihood = averageLogLikelihood(*generator, weights, means, covs);
+        source = std::move(generator);
+    }
+    if (opts.rows > std::numeric_limits<int>::max())
+    {
+        std::fprintf(stderr, "gmmEval: at most %d rows\n", std::numeric_limits<int>::max());
+        return 1;
+    }
+
+    std::printf("rows = %lld, cols = %d, clusters = %d", opts.rows, opts.dims, opts.clusters);
+    if (opts.input.empty())
+        std::printf(", log-likelihood per row of the generating mixture = %.4f",
+                    oracleLogLikelihood);
+    std::printf("\n");
+    std::printf("%-8s %8s %8s %12s %12s %12s\n", "mode", "clusters", "ARI", "loglik/row",
+                "wall(ms)", "peakRSS(MiB)");
+    int failures = 0;
+    for (const Mode& mode : allModes(opts.dims))
+    {
+        if (!opts.modes.empty()
+            && opts.modes.find(std::string(",") + mode.name + ",") == std::string::npos)
+            continue;
+
+        Result result;
+        double peakRssMiB = 0.0;
+        if (!runIsolated(mode, *source, opts, result, peakRssMiB) || result.status != 0)
+        {
+            std::printf("%-8s %8s\n", mode.name, "failed");
+            ++failures;
+            continue;
+        }
+        std::printf("%-8s %8d %8.4f %12.4f %12.1f %12.1f\n", mode.name, result.clusters,
+                    result.ari, result.logLikelihood, result.wallMs, peakRssMiB);
+        if (opts.perf)
+            printCounters(result.stats, opts.rows);
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,173 @@
+/*
+ * ClusterRows
+ * Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <em.h>
+#include <kernels.hxx>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+// Times the ISA dispatched kernels at every instruction set level the CPU supports, and a full
+// 16 column fit (which runs its E-step and M-step on the kernels) per level.
+// Usage: kernelBench [rows] [cols]
+
+namespace
+{
+
+using util::kernels::Isa;
+
+template <typename Func> double best_time_ms(int repeats, Func&& func)
+{
+    double best = 1e300;
+    for (int rep = 0; rep < repeats; ++rep)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        func();
+        const auto end = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    return best;
+}
+
+/// EM time per iteration in milliseconds of a 4 cluster fit of @p data, and the instructions
+/// per cycle of its E-step in @p ipc (0 without hardware counters).
+double fit_ms_per_iteration(const std::vector<double>& data, int rows, int cols, int type,
+                            double& ipc)
+{
+    GMMOptions options;
+    gmmInitOptions(&options);
+    options.numClusters = 4;
+    options.numEpochs = 2;
+    options.fullGMM = type;
+    options.perfCounters = 1;
+    std::vector<int> labels(rows);
+    std::vector<double> confidences(rows);
+    double best = 1e300;
+    ipc = 0.0;
+    for (int rep = 0; rep < 3; ++rep)
+    {
+        GMMStats stats;
+        if (gmmMainEx(data.data(), rows, cols, &options, labels.data(), confidences.data(),
+                      &stats)
+            || stats.totalIterations == 0)
+            return 0.0;
+        best = std::min(best, (stats.eStepTimeMs + stats.mStepTimeMs) / stats.totalIterations);
+        const long long cycles = stats.perfCycles[CR_PHASE_ESTEP];
+        const long long instructions = stats.perfInstructions[CR_PHASE_ESTEP];
+        if (cycles > 0 && instructions >= 0)
+            ipc = std::max(ipc, static_cast<double>(instructions) / cycles);
+    }
+    return best;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    const int m = argc > 1 ? std::atoi(argv[1]) : 20000;
+    const int n = argc > 2 ? std::atoi(argv[2]) : 16;
+    if (m <= 0 || n <= 8)
+    {
+        std::fprintf(stderr, "Usage: %s [rows] [cols > 8]\n", argv[0]);
+        return 1;
+    }
+
+    std::mt19937 generator(42);
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+    std::vector<double> X(static_cast<size_t>(m) * n);
+    for (int row = 0; row < m; ++row)
+    {
+        // Four well separated blobs, so that the fits below converge alike at every level.
+        const double offset = 6.0 * (row % 4);
+        for (int col = 0; col < n; ++col)
+            X[static_cast<size_t>(row) * n + col] = offset + uniform(generator);
+    }
+    std::vector<double> mu(n);
+    std::vector<double> inv_var(n);
+    std::vector<double> P(static_cast<size_t>(n) * n);
+    for (int a = 0; a < n; ++a)
+    {
+        mu[a] = uniform(generator);
+        inv_var[a] = 1.0 + uniform(generator) * 0.5;
+        for (int b = 0; b <= a; ++b)
+            P[static_cast<size_t>(a) * n + b] = P[static_cast<size_t>(b) * n + a] =
+                (a == b ? 2.0 : 0.1 * uniform(generator));
+    }
+    std::vector<double> w(m, 0.5);
+    std::vector<double> out(m);
+    std::vector<double> S(static_cast<size_t>(n) * n);
+    const int gn = 256;
+    std::vector<double> gA(static_cast<size_t>(gn) * gn, 0.5);
+    std::vector<double> gC(static_cast<size_t>(gn) * gn);
+
+    std::printf("best isa: %s, rows = %d, cols = %d\n",
+                util::kernels::isa_name(util::kernels::best_isa()), m, n);
+    std::printf("%8s %10s %10s %10s %10s %10s %12s %12s\n", "isa", "gemm256", "maha_diag",
+                "maha_full", "scatter", "sq_dev", "fit_diag/it", "fit_full/it");
+
+    double base[7] = {};
+    for (Isa isa : { Isa::GENERIC, Isa::AVX2, Isa::AVX512 })
+    {
+        if (!util::kernels::select_isa(isa))
+            continue;
+
+        double ms[7];
+        ms[0] = best_time_ms(5, [&] {
+            util::kernels::gemm(gn, gn, gn, gA.data(), gn, gA.data(), gn, false, gC.data(), gn);
+        });
+        ms[1] = best_time_ms(10, [&] {
+            util::kernels::sq_mahalanobis_diag(m, n, X.data(), n, mu.data(), inv_var.data(),
+                                               out.data(), 1);
+        });
+        ms[2] = best_time_ms(10, [&] {
+            util::kernels::sq_mahalanobis_full(m, n, X.data(), n, mu.data(), P.data(), n,
+                                               out.data(), 1);
+        });
+        ms[3] = best_time_ms(10, [&] {
+            util::kernels::weighted_scatter(m, n, X.data(), n, mu.data(), w.data(), S.data(), n);
+        });
+        ms[4] = best_time_ms(10, [&] {
+            util::kernels::weighted_sq_dev(m, n, X.data(), n, mu.data(), w.data(), S.data());
+        });
+        double ipc[2];
+        ms[5] = fit_ms_per_iteration(X, m, n, CR_COVARIANCE_DIAGONAL, ipc[0]);
+        ms[6] = fit_ms_per_iteration(X, m, n, CR_COVARIANCE_FULL, ipc[1]);
+
+        std::printf("%8s", util::kernels::isa_name(isa));
+        for (int k = 0; k < 7; ++k)
+            std::printf(k < 5 ? " %10.3f" : " %12.3f", ms[k]);
+        std::printf("  (ms)\n");
+        if (ipc[0] > 0.0 || ipc[1] > 0.0)
+            std::printf("%8s %54s %12.2f %12.2f  (E-step IPC)\n", "", "", ipc[0], ipc[1]);
+        if (isa == Isa::GENERIC)
+        {
+            std::copy(ms, ms + 7, base);
+            continue;
+        }
+        std::printf("%8s", "speedup");
+        for (int k = 0; k < 7; ++k)
+            std::printf(k < 5 ? " %9.2fx" : " %11.2fx", ms[k] > 0.0 ? base[k] / ms[k] : 0.0);
+        std::printf("\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * ClusterRows
+ * Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <matrix.hxx>
+
+#include <Eigen/Dense>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+// The original util::Matrix::dot : naive triple loop with bounds checked element access.
+void naive_dot(const util::Matrix& left, const util::Matrix& right, util::Matrix& res)
+{
+    for (int row = 0; row < left.rows(); ++row)
+    {
+        for (int col = 0; col < right.cols(); ++col)
+        {
+            double val = 0;
+            for (int inner = 0; inner < left.cols(); ++inner)
+                val += left.at(row, inner) * right.at(inner, col);
+            res.at(row, col) = val;
+        }
+    }
+}
+
+template <typename Func> double best_time_ms(int repeats, Func&& func)
+{
+    double best = 1e300;
+    for (int rep = 0; rep < repeats; ++rep)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        func();
+        const auto end = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    return best;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<int> sizes{ 64, 128, 256, 512 };
+    if (argc > 1)
+    {
+        sizes.clear();
+        for (int arg = 1; arg < argc; ++arg)
+            sizes.push_back(std::atoi(argv[arg]));
+    }
+
+    std::mt19937 generator(42);
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+
+    std::printf("%6s %12s %12s %12s %12s %10s %10s\n", "n", "naive(ms)", "dot(ms)",
+                "dot_tr(ms)", "eigen(ms)", "speedup", "vs eigen");
+    for (int n : sizes)
+    {
+        util::Matrix A(n, n);
+        util::Matrix B(n, n);
+        Eigen::MatrixXd eA(n, n);
+        Eigen::MatrixXd eB(n, n);
+        for (int row = 0; row < n; ++row)
+        {
+            for (int col = 0; col < n; ++col)
+            {
+                A.at(row, col) = eA(row, col) = uniform(generator);
+                B.at(row, col) = eB(row, col) = uniform(generator);
+            }
+        }
+
+        const int repeats = n <= 128 ? 10 : 3;
+        util::Matrix naive_res(n, n);
+        const double naive_ms = best_time_ms(repeats, [&] { naive_dot(A, B, naive_res); });
+        const double dot_ms = best_time_ms(repeats, [&] { auto res = A.dot(B); });
+        const double dot_tr_ms = best_time_ms(repeats, [&] { auto res = A.dot_transpose(B); });
+        Eigen::MatrixXd eRes(n, n);
+        const double eigen_ms = best_time_ms(repeats, [&] { eRes.noalias() = eA * eB; });
+
+        if (!(A.dot(B) == naive_res))
+        {
+            std::fprintf(stderr, "Mismatch between blocked and naive products for n = %d\n", n);
+            return 1;
+        }
+
+        std::printf("%6d %12.3f %12.3f %12.3f %12.3f %9.1fx %9.2fx\n", n, naive_ms, dot_ms,
+                    dot_tr_ms, eigen_ms, naive_ms / dot_ms, eigen_ms / dot_ms);
+    }
+
+    return 0;
+}
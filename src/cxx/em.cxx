@@ -18,7 +18,21 @@
 
 #include <em.h>
 #include <model.hxx>
-#include <legacy_gmm.hxx>
+#include <trace.hxx>
+#include <gmm/covariance.hxx>
+#include <gmm/dbscan.hxx>
+#include <gmm/ingest.hxx>
+#include <gmm/planner.hxx>
+#include <gmm/stats.hxx>
+#include <gmm/stream.hxx>
+#include <gmm/workspace.hxx>
+#include <threadpool.hxx>
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <vector>
 
 namespace
 {
@@ -35,55 +49,468 @@ void fillConstLabel(int label, double confidence, int rows, int* clusterLabels,
     }
 }
 
+class CallbackReader : public gmm::ChunkReader
+{
+public:
+    CallbackReader(int cols_, CRReadRowsFn readRows_, CRRewindFn rewind_, void* context_)
+        : numCols(cols_)
+        , readRows(readRows_)
+        , rewindFn(rewind_)
+        , context(context_)
+    {
+    }
+
+    [[nodiscard]] int cols() const override { return numCols; }
+    int read(double* buffer, int maxRows) override { return readRows(context, buffer, maxRows); }
+    void rewind() override { rewindFn(context); }
+
+private:
+    const int numCols;
+    CRReadRowsFn readRows;
+    CRRewindFn rewindFn;
+    void* context;
+};
+
+class CallbackWriter : public gmm::LabelWriter
+{
+public:
+    CallbackWriter(CRWriteLabelsFn writeLabels_, void* context_)
+        : writeLabels(writeLabels_)
+        , context(context_)
+    {
+    }
+
+    void write(const int* labels, const double* confidences, int rows) override
+    {
+        writeLabels(context, labels, confidences, rows);
+    }
+
+private:
+    CRWriteLabelsFn writeLabels;
+    void* context;
+};
+
+/// @brief Reads a row major array in memory, for running the streaming engine on it.
+class ArrayReader : public gmm::ChunkReader
+{
+public:
+    ArrayReader(const double* array_, int rows_, int cols_)
+        : array(array_)
+        , numRows(rows_)
+        , numCols(cols_)
+    {
+    }
+
+    [[nodiscard]] int cols() const override { return numCols; }
+    int read(double* buffer, int maxRows) override
+    {
+        const int rows = std::min(maxRows, numRows - next);
+        std::copy_n(array + static_cast<size_t>(next) * numCols,
+                    static_cast<size_t>(rows) * numCols, buffer);
+        next += rows;
+        return rows;
+    }
+    void rewind() override { next = 0; }
+
+private:
+    const double* array;
+    const int numRows;
+    const int numCols;
+    int next = 0;
+};
+
+/// @brief Writes the labels of the streaming engine to arrays in memory.
+class ArrayWriter : public gmm::LabelWriter
+{
+public:
+    ArrayWriter(int* clusterLabels_, double* labelConfidence_)
+        : clusterLabels(clusterLabels_)
+        , labelConfidence(labelConfidence_)
+    {
+    }
+
+    void write(const int* labels, const double* confidences, int rows) override
+    {
+        std::copy_n(labels, rows, clusterLabels + next);
+        std::copy_n(confidences, rows, labelConfidence + next);
+        next += rows;
+    }
+
+private:
+    int* clusterLabels;
+    double* labelConfidence;
+    int next = 0;
+};
+
+/// @brief Fits the streaming engine for the cluster counts of @p options and writes the labels
+/// of the best one. Returns 0 on success and -1 on read errors.
+int fitStream(gmm::ChunkReader& reader, gmm::LabelWriter& writer, const GMMOptions& options,
+              gmm::Stats* stats)
+{
+    const bool autoMode{ options.numClusters <= 0 };
+    const int minClusters = autoMode ? 2 : options.numClusters;
+    const int maxClusters = autoMode ? 5 : options.numClusters;
+    std::unique_ptr<gmm::StreamingModel> bestModel;
+    double bestBIC{ 1.0E10 };
+    for (int clusters = minClusters; clusters <= maxClusters; ++clusters)
+    {
+        auto model = std::make_unique<gmm::StreamingModel>(
+            reader, clusters, gmm::full_covariance(options.fullGMM), options.chunkRows,
+            options.seed, stats);
+        const double bic = model->fit(options.numEpochs, options.numIterations);
+        if (bic < 0)
+            return -1;
+        if (bic < bestBIC || !bestModel)
+        {
+            bestBIC = bic;
+            bestModel = std::move(model);
+        }
+    }
+
+    if (!bestModel->write_labels(writer))
+        return -1;
+
+    if (stats)
+        stats->set_best_clusters(bestModel->clusters());
+    return 0;
+}
+
+}
+
+extern "C" void CR_DLLPUBLIC_EXPORT gmmInitOptions(GMMOptions* options)
+{
+    if (!options)
+        return;
+
+    options->numClusters = 0;
+    options->numEpochs = 10;
+    options->numIterations = 100;
+    options->fullGMM = 0;
+    options->chunkRows = 65536;
+    options->treeTolerance = 0.0;
+    options->topK = 0;
+    options->topKRefresh = 5;
+    options->vbMaxClusters = 0;
+    options->vbConcentration = 1e-3;
+    options->pcaVariance = 0.0;
+    options->orderSearchMaxClusters = 0;
+    options->autoPlan = 0;
+    options->maxMemoryMB = 0.0;
+    options->maxThreads = 0;
+    options->timeBudgetMs = 0.0;
+    options->perfCounters = 0;
+    options->normalize = 0;
+    options->seed = 0;
 }
 
 extern "C" int CR_DLLPUBLIC_EXPORT gmmMain(const double* array, int rows, int cols, int numClusters,
                                            int numEpochs, int numIterations, int* clusterLabels,
                                            double* labelConfidence, int fullGMM)
 {
-    if (!array || !clusterLabels || !labelConfidence)
+    GMMOptions options;
+    gmmInitOptions(&options);
+    options.numClusters = numClusters;
+    options.numEpochs = numEpochs;
+    options.numIterations = numIterations;
+    options.fullGMM = fullGMM;
+    return gmmMainEx(array, rows, cols, &options, clusterLabels, labelConfidence, nullptr);
+}
+
+namespace
+{
+
+/// @brief gmmMainEx() without the trace dump, with the working buffers of @p workspace if given
+/// and ingesting large inputs on @p pool if given.
+int runGMM(const double* array, int rows, int cols, const GMMOptions* options, int* clusterLabels,
+           double* labelConfidence, GMMStats* stats, gmm::Workspace* workspace,
+           util::ThreadPool* pool)
+{
+    if (!array || !clusterLabels || !labelConfidence || rows < 0 || cols <= 0)
         return -1;
 
-    if (numClusters == 1)
+    const auto start = std::chrono::steady_clock::now();
+    GMMOptions defaults;
+    if (!options)
+    {
+        gmmInitOptions(&defaults);
+        options = &defaults;
+    }
+
+    const int numClusters = options->numClusters;
+    gmm::Stats collector;
+    gmm::Stats* pStats = stats ? &collector : nullptr;
+    if (stats && options->perfCounters)
+        collector.enable_counters();
+
+    // Rows with NaN or infinite values are left out and labelled -1.
+    const gmm::Ingest input(array, rows, cols, options->normalize, pool, pStats);
+    collector.set_invalid_rows(input.invalid_rows());
+    const int validRows = input.rows();
+    std::vector<int> validLabels;
+    std::vector<double> validConfidence;
+    int* outLabels = clusterLabels;
+    double* outConfidence = labelConfidence;
+    if (input.invalid_rows())
     {
-        fillConstLabel(0, 1, rows, clusterLabels, labelConfidence);
-        return 0;
+        validLabels.resize(validRows);
+        validConfidence.resize(validRows);
+        outLabels = validLabels.data();
+        outConfidence = validConfidence.data();
     }
 
-    if (rows < 10)
+    gmm::Plan plan{ CR_STRATEGY_NONE, *options, 0.0, 0.0 };
+    if (options->autoPlan && numClusters != 1 && validRows >= 10)
     {
-        fillConstLabel(-1, 0, rows, clusterLabels, labelConfidence);
-        return 0;
+        plan = gmm::plan_job(validRows, cols, *options, gmm::available_resources());
+        collector.set_plan(plan.strategy, plan.estimated_ms, plan.estimated_mb);
+        options = &plan.options;
     }
 
-    if (fullGMM)
+    if (validRows < 10 && numClusters != 1)
+    {
+        fillConstLabel(-1, 0, validRows, outLabels, outConfidence);
+    }
+    else if (numClusters == 1)
+    {
+        fillConstLabel(0, 1, validRows, outLabels, outConfidence);
+    }
+    else if (plan.strategy == CR_STRATEGY_STREAMING)
+    {
+        ArrayReader reader(input.data(), validRows, cols);
+        ArrayWriter writer(outLabels, outConfidence);
+        if (fitStream(reader, writer, *options, pStats) < 0)
+            return -1;
+    }
+    else
     {
         bool autoMode{ numClusters <= 0 };
         int min_clusters = autoMode ? 2 : numClusters;
         int max_clusters = autoMode ? 5 : numClusters;
-        gmm::GMM trainer{ array,        rows,      cols,          min_clusters,
-                          max_clusters, numEpochs, numIterations, bool(fullGMM) };
-        trainer.fit();
-        trainer.get_labels(clusterLabels, labelConfidence);
+        gmm::GMM trainer{ input.data(), validRows, cols, min_clusters, max_clusters,
+                          *options, pStats, &input.moments() };
+        if (workspace)
+            trainer.fit(*workspace);
+        else
+            trainer.fit();
+        trainer.get_labels(outLabels, outConfidence);
     }
-    else
+
+    if (input.invalid_rows())
+        input.scatter(outLabels, outConfidence, clusterLabels, labelConfidence);
+
+    if (stats)
     {
-        util::DataMatrix mat(array, rows, cols);
+        *stats = GMMStats{};
+        collector.export_to(*stats, std::chrono::duration<double, std::milli>(
+                                        std::chrono::steady_clock::now() - start)
+                                        .count());
+    }
+
+    return 0;
+}
+
+/// @brief Rough relative cost of a job for ordering the batch: rows times the per row cost of
+/// an E-step summed over the candidate cluster counts.
+double estimatedCost(const GMMJob& job)
+{
+    const GMMOptions* options = job.options;
+    const double cols = std::max(job.cols, 1);
+    const double perCluster
+        = (options && gmm::full_covariance(options->fullGMM)) ? cols * cols : cols;
+    const int numClusters = options ? options->numClusters : 0;
+    const double clusters = numClusters > 0 ? numClusters : 2 + 3 + 4 + 5;
+    const double epochs = options ? std::max(options->numEpochs, 1) : 10;
+    return static_cast<double>(std::max(job.rows, 0)) * perCluster * clusters * epochs;
+}
+
+} // anonymous namespace
+
+extern "C" int CR_DLLPUBLIC_EXPORT gmmMainEx(const double* array, int rows, int cols,
+                                             const GMMOptions* options, int* clusterLabels,
+                                             double* labelConfidence, GMMStats* stats)
+{
+    const int status = runGMM(array, rows, cols, options, clusterLabels, labelConfidence, stats,
+                              nullptr, &util::ThreadPool::shared());
+
+    if constexpr (CR_TRACE_LEVEL > 0)
+        trace::dump_from_env();
+
+    return status;
+}
+
+extern "C" int CR_DLLPUBLIC_EXPORT gmmBatchMain(GMMJob* jobs, int numJobs, int numThreads)
+{
+    if (!jobs || numJobs < 0)
+        return -1;
 
-        em::GMM gmm(array, rows, cols, numEpochs, numIterations);
-        if (numClusters <= 0) // Auto computer optimum number of clusters
+    // Largest first, so that the small jobs fill in the gaps at the end.
+    std::vector<int> order(numJobs);
+    std::vector<double> costs(numJobs);
+    for (int job = 0; job < numJobs; ++job)
+    {
+        order[job] = job;
+        costs[job] = estimatedCost(jobs[job]);
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [&costs](int lhs, int rhs) { return costs[lhs] > costs[rhs]; });
+
+    // Without an explicit count the planned jobs may cap the threads, the tightest cap wins.
+    if (numThreads <= 0)
+    {
+        const gmm::Resources resources = gmm::available_resources();
+        for (int job = 0; job < numJobs; ++job)
+        {
+            if (!jobs[job].options)
+                continue;
+            const int planned = gmm::planned_threads(*jobs[job].options, resources);
+            if (planned > 0)
+                numThreads = numThreads > 0 ? std::min(numThreads, planned) : planned;
+        }
+    }
+
+    std::unique_ptr<util::ThreadPool> ownPool;
+    if (numThreads > 0)
+        ownPool = std::make_unique<util::ThreadPool>(std::min(numThreads, std::max(numJobs, 1)));
+    util::ThreadPool& pool = ownPool ? *ownPool : util::ThreadPool::shared();
+
+    // The buffers of the shared pool's threads are kept for later calls, so that a long running
+    // caller like crworker does not reallocate them for every batch. parallel_for() serializes
+    // the calls and a thread index is used by one task at a time, so no locking is needed.
+    static std::vector<std::unique_ptr<gmm::Workspace>> sharedWorkspaces(
+        util::ThreadPool::shared().threads());
+    std::vector<std::unique_ptr<gmm::Workspace>> ownWorkspaces(ownPool ? pool.threads() : 0);
+    auto& workspaces = ownPool ? ownWorkspaces : sharedWorkspaces;
+    pool.parallel_for(numJobs, [&](int index, int thread) {
+        GMMJob& job = jobs[order[index]];
+        try
         {
-            const std::vector<int> numClustersArray = { 2, 3, 4, 5 };
-            gmm.TrainModel(numClustersArray);
+            if (!workspaces[thread])
+                workspaces[thread] = std::make_unique<gmm::Workspace>();
+            // The jobs already run in parallel, so each is ingested on its own thread.
+            job.status = runGMM(job.array, job.rows, job.cols, job.options, job.clusterLabels,
+                                job.labelConfidence, job.stats, workspaces[thread].get(), nullptr);
         }
-        else // numClusters > 1
+        catch (const std::exception&)
         {
-            const std::vector<int> numClustersArray = { numClusters };
-            gmm.TrainModel(numClustersArray);
+            job.status = -1;
         }
+    });
+
+    if constexpr (CR_TRACE_LEVEL > 0)
+        trace::dump_from_env();
+
+    return std::all_of(jobs, jobs + numJobs, [](const GMMJob& job) { return job.status == 0; })
+               ? 0
+               : -1;
+}
 
-        gmm.GetClusterLabels(clusterLabels, labelConfidence);
+extern "C" int CR_DLLPUBLIC_EXPORT gmmLabelRuns(const int* clusterLabels, int rows, int* runLabels,
+                                                int* runStarts, int* runLengths)
+{
+    if (!clusterLabels || !runLabels || !runStarts || !runLengths || rows < 0)
+        return -1;
+
+    // Counting sort of the runs by label: count, place the first run of each label, then fill.
+    int maxLabel = -1;
+    for (int row = 0; row < rows; ++row)
+        maxLabel = std::max(maxLabel, clusterLabels[row]);
+    std::vector<int> offsets(maxLabel + 2, 0);
+    for (int row = 0; row < rows; ++row)
+    {
+        const int label = clusterLabels[row];
+        if (label >= 0 && (row == 0 || clusterLabels[row - 1] != label))
+            ++offsets[label + 1];
     }
+    for (int label = 0; label <= maxLabel; ++label)
+        offsets[label + 1] += offsets[label];
+    const int numRuns = offsets[maxLabel + 1];
+
+    for (int row = 0; row < rows;)
+    {
+        const int label = clusterLabels[row];
+        int end = row + 1;
+        while (end < rows && clusterLabels[end] == label)
+            ++end;
+        if (label >= 0)
+        {
+            const int run = offsets[label]++;
+            runLabels[run] = label;
+            runStarts[run] = row;
+            runLengths[run] = end - row;
+        }
+        row = end;
+    }
+
+    return numRuns;
+}
+
+extern "C" int CR_DLLPUBLIC_EXPORT gmmStreamMain(int cols, CRReadRowsFn readRows, CRRewindFn rewind,
+                                                 void* readerContext, const GMMOptions* options,
+                                                 CRWriteLabelsFn writeLabels, void* writerContext,
+                                                 GMMStats* stats)
+{
+    if (cols <= 0 || !readRows || !rewind || !writeLabels)
+        return -1;
+
+    const auto start = std::chrono::steady_clock::now();
+    GMMOptions defaults;
+    if (!options)
+    {
+        gmmInitOptions(&defaults);
+        options = &defaults;
+    }
+
+    gmm::Stats collector;
+    gmm::Stats* pStats = stats ? &collector : nullptr;
+    if (stats && options->perfCounters)
+        collector.enable_counters();
+    CallbackReader reader(cols, readRows, rewind, readerContext);
+    CallbackWriter writer(writeLabels, writerContext);
+
+    if (fitStream(reader, writer, *options, pStats) < 0)
+        return -1;
+
+    if (stats)
+    {
+        *stats = GMMStats{};
+        collector.export_to(*stats, std::chrono::duration<double, std::milli>(
+                                        std::chrono::steady_clock::now() - start)
+                                        .count());
+    }
+
+    if constexpr (CR_TRACE_LEVEL > 0)
+        trace::dump_from_env();
 
     return 0;
 }
+
+extern "C" int CR_DLLPUBLIC_EXPORT dbscanMain(const double* array, int rows, int cols, double eps,
+                                              int minPoints, int* clusterLabels,
+                                              double* labelConfidence)
+{
+    if (!array || !clusterLabels || !labelConfidence || rows < 0 || cols <= 0
+        || cols > gmm::DBSCAN::MAX_DIMS)
+        return -1;
+
+    util::ThreadPool* pool = &util::ThreadPool::shared();
+    // Rows with NaN or infinite values are left out and labelled -1 like noise.
+    const gmm::Ingest input(array, rows, cols, false, pool, nullptr);
+    gmm::DBSCAN engine(input.data(), input.rows(), cols, eps, minPoints, pool);
+    const int numClusters = engine.fit();
+    if (input.invalid_rows())
+    {
+        std::vector<int> validLabels(input.rows());
+        std::vector<double> validConfidence(input.rows());
+        engine.get_labels(validLabels.data(), validConfidence.data());
+        input.scatter(validLabels.data(), validConfidence.data(), clusterLabels, labelConfidence);
+    }
+    else
+    {
+        engine.get_labels(clusterLabels, labelConfidence);
+    }
+
+    if constexpr (CR_TRACE_LEVEL > 0)
+        trace::dump_from_env();
+
+    return numClusters;
+}
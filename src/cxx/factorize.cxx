@@ -0,0 +1,375 @@
+/*
+* ClusterRows
+* Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "factorize.hxx"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+namespace util
+{
+
+namespace
+{
+
+/// Pivots below this are treated as zero, as in DiagonalMatrix::is_singular().
+constexpr double tiny{ DBL_MIN * 100 };
+
+void check_square(const Matrix& A, const char* what)
+{
+    if (A.rows() != A.cols())
+        throw std::runtime_error(std::string(what) + ": matrix needs to be square!");
+}
+
+void check_rhs(const Matrix& B, int rows, const char* what)
+{
+    if (B.rows() != rows)
+        throw std::runtime_error(std::string(what) + ": right hand side has wrong number of rows");
+}
+
+/// Solves U X = B in place for the upper triangle U of the n x n leading block of @p U.
+void back_substitute(const double* U, int ldu, int n, double* B, int k)
+{
+    for (int row = n - 1; row >= 0; --row)
+    {
+        double* x = B + static_cast<size_t>(row) * k;
+        for (int col = row + 1; col < n; ++col)
+        {
+            const double u = U[static_cast<size_t>(row) * ldu + col];
+            const double* xc = B + static_cast<size_t>(col) * k;
+            for (int rhs = 0; rhs < k; ++rhs)
+                x[rhs] -= u * xc[rhs];
+        }
+        const double diag = U[static_cast<size_t>(row) * ldu + row];
+        for (int rhs = 0; rhs < k; ++rhs)
+            x[rhs] /= diag;
+    }
+}
+
+} // anonymous namespace
+
+LU::LU(Matrix& A, int* pivots)
+    : m_lu(A)
+    , m_pivots(pivots)
+    , m_sign(1)
+    , m_singular(false)
+{
+    check_square(A, "LU");
+    const int n = A.rows();
+    double* a = A.data();
+    for (int k = 0; k < n; ++k)
+    {
+        int pivot = k;
+        double largest = std::abs(a[static_cast<size_t>(k) * n + k]);
+        for (int row = k + 1; row < n; ++row)
+        {
+            const double value = std::abs(a[static_cast<size_t>(row) * n + k]);
+            if (value > largest)
+            {
+                largest = value;
+                pivot = row;
+            }
+        }
+        m_pivots[k] = pivot;
+        if (largest < tiny)
+        {
+            m_singular = true;
+            continue;
+        }
+        if (pivot != k)
+        {
+            std::swap_ranges(a + static_cast<size_t>(k) * n, a + static_cast<size_t>(k + 1) * n,
+                             a + static_cast<size_t>(pivot) * n);
+            m_sign = -m_sign;
+        }
+
+        const double* urow = a + static_cast<size_t>(k) * n;
+        for (int row = k + 1; row < n; ++row)
+        {
+            double* arow = a + static_cast<size_t>(row) * n;
+            const double l = (arow[k] /= urow[k]);
+            for (int col = k + 1; col < n; ++col)
+                arow[col] -= l * urow[col];
+        }
+    }
+}
+
+void LU::solve(Matrix& B) const
+{
+    const int n = m_lu.rows();
+    check_rhs(B, n, "LU::solve");
+    const int k = B.cols();
+    const double* a = m_lu.data();
+    double* b = B.data();
+
+    for (int row = 0; row < n; ++row)
+    {
+        if (m_pivots[row] != row)
+            std::swap_ranges(b + static_cast<size_t>(row) * k, b + static_cast<size_t>(row + 1) * k,
+                             b + static_cast<size_t>(m_pivots[row]) * k);
+    }
+
+    // L Y = P B with the unit lower triangle.
+    for (int row = 1; row < n; ++row)
+    {
+        double* y = b + static_cast<size_t>(row) * k;
+        for (int col = 0; col < row; ++col)
+        {
+            const double l = a[static_cast<size_t>(row) * n + col];
+            const double* yc = b + static_cast<size_t>(col) * k;
+            for (int rhs = 0; rhs < k; ++rhs)
+                y[rhs] -= l * yc[rhs];
+        }
+    }
+
+    back_substitute(a, n, n, b, k);
+}
+
+void LU::inverse(Matrix& inverse) const
+{
+    check_square(inverse, "LU::inverse");
+    inverse.set_identity();
+    solve(inverse);
+}
+
+double LU::determinant() const
+{
+    const int n = m_lu.rows();
+    double det = m_sign;
+    for (int k = 0; k < n; ++k)
+        det *= m_lu.data()[static_cast<size_t>(k) * n + k];
+    return det;
+}
+
+double LU::log_determinant() const
+{
+    const int n = m_lu.rows();
+    double logdet = 0.0;
+    for (int k = 0; k < n; ++k)
+        logdet += std::log(std::abs(m_lu.data()[static_cast<size_t>(k) * n + k]));
+    return logdet;
+}
+
+int LU::sign() const
+{
+    const int n = m_lu.rows();
+    int sign = m_sign;
+    for (int k = 0; k < n; ++k)
+    {
+        const double diag = m_lu.data()[static_cast<size_t>(k) * n + k];
+        if (diag == 0.0)
+            return 0;
+        if (diag < 0.0)
+            sign = -sign;
+    }
+    return sign;
+}
+
+Cholesky::Cholesky(Matrix& A)
+    : m_L(A)
+    , m_positive_definite(true)
+{
+    check_square(A, "Cholesky");
+    const int n = A.rows();
+    double* a = A.data();
+    for (int col = 0; col < n; ++col)
+    {
+        double* lcol = a + static_cast<size_t>(col) * n;
+        double diag = lcol[col];
+        for (int k = 0; k < col; ++k)
+            diag -= lcol[k] * lcol[k];
+        if (!(diag > tiny))
+        {
+            m_positive_definite = false;
+            return;
+        }
+        diag = std::sqrt(diag);
+        lcol[col] = diag;
+        std::fill(lcol + col + 1, lcol + n, 0.0);
+
+        for (int row = col + 1; row < n; ++row)
+        {
+            double* lrow = a + static_cast<size_t>(row) * n;
+            double value = lrow[col];
+            for (int k = 0; k < col; ++k)
+                value -= lrow[k] * lcol[k];
+            lrow[col] = value / diag;
+        }
+    }
+}
+
+void Cholesky::solve(Matrix& B) const
+{
+    const int n = m_L.rows();
+    check_rhs(B, n, "Cholesky::solve");
+    const int k = B.cols();
+    const double* l = m_L.data();
+    double* b = B.data();
+
+    // L Y = B
+    for (int row = 0; row < n; ++row)
+    {
+        double* y = b + static_cast<size_t>(row) * k;
+        for (int col = 0; col < row; ++col)
+        {
+            const double lv = l[static_cast<size_t>(row) * n + col];
+            const double* yc = b + static_cast<size_t>(col) * k;
+            for (int rhs = 0; rhs < k; ++rhs)
+                y[rhs] -= lv * yc[rhs];
+        }
+        const double diag = l[static_cast<size_t>(row) * n + row];
+        for (int rhs = 0; rhs < k; ++rhs)
+            y[rhs] /= diag;
+    }
+
+    // L^T X = Y
+    for (int row = n - 1; row >= 0; --row)
+    {
+        double* x = b + static_cast<size_t>(row) * k;
+        for (int col = row + 1; col < n; ++col)
+        {
+            const double lv = l[static_cast<size_t>(col) * n + row];
+            const double* xc = b + static_cast<size_t>(col) * k;
+            for (int rhs = 0; rhs < k; ++rhs)
+                x[rhs] -= lv * xc[rhs];
+        }
+        const double diag = l[static_cast<size_t>(row) * n + row];
+        for (int rhs = 0; rhs < k; ++rhs)
+            x[rhs] /= diag;
+    }
+}
+
+void Cholesky::inverse(Matrix& inverse) const
+{
+    check_square(inverse, "Cholesky::inverse");
+    inverse.set_identity();
+    solve(inverse);
+}
+
+double Cholesky::log_determinant() const
+{
+    const int n = m_L.rows();
+    double logdet = 0.0;
+    for (int k = 0; k < n; ++k)
+        logdet += std::log(m_L.data()[static_cast<size_t>(k) * n + k]);
+    return 2.0 * logdet;
+}
+
+QR::QR(Matrix& A, double* tau)
+    : m_qr(A)
+    , m_tau(tau)
+    , m_rank_deficient(false)
+{
+    const int m = A.rows();
+    const int n = A.cols();
+    if (m < n)
+        throw std::runtime_error("QR: matrix needs at least as many rows as columns!");
+    double* a = A.data();
+    for (int k = 0; k < n; ++k)
+    {
+        // Householder reflector H = I - tau v v^T with v[0] = 1 mapping A[k:, k] to beta e1.
+        const double alpha = a[static_cast<size_t>(k) * n + k];
+        double norm_sq = 0.0;
+        for (int row = k + 1; row < m; ++row)
+            norm_sq += a[static_cast<size_t>(row) * n + k] * a[static_cast<size_t>(row) * n + k];
+
+        if (norm_sq == 0.0)
+        {
+            m_tau[k] = 0.0;
+            if (std::abs(alpha) < tiny)
+                m_rank_deficient = true;
+            continue;
+        }
+
+        const double norm = std::sqrt(alpha * alpha + norm_sq);
+        const double beta = alpha >= 0.0 ? -norm : norm;
+        m_tau[k] = (beta - alpha) / beta;
+        const double scale = 1.0 / (alpha - beta);
+        for (int row = k + 1; row < m; ++row)
+            a[static_cast<size_t>(row) * n + k] *= scale;
+        a[static_cast<size_t>(k) * n + k] = beta;
+        if (std::abs(beta) < tiny)
+            m_rank_deficient = true;
+
+        // Apply H to the trailing columns.
+        for (int col = k + 1; col < n; ++col)
+        {
+            double dot = a[static_cast<size_t>(k) * n + col];
+            for (int row = k + 1; row < m; ++row)
+                dot += a[static_cast<size_t>(row) * n + k] * a[static_cast<size_t>(row) * n + col];
+            dot *= m_tau[k];
+            a[static_cast<size_t>(k) * n + col] -= dot;
+            for (int row = k + 1; row < m; ++row)
+                a[static_cast<size_t>(row) * n + col] -= dot * a[static_cast<size_t>(row) * n + k];
+        }
+    }
+}
+
+void QR::solve(Matrix& B) const
+{
+    const int m = m_qr.rows();
+    const int n = m_qr.cols();
+    check_rhs(B, m, "QR::solve");
+    const int k = B.cols();
+    const double* a = m_qr.data();
+    double* b = B.data();
+
+    // B = Q^T B = H_{n-1} ... H_0 B
+    for (int step = 0; step < n; ++step)
+    {
+        if (m_tau[step] == 0.0)
+            continue;
+        for (int rhs = 0; rhs < k; ++rhs)
+        {
+            const double* v = a + step;
+            double* x = b + rhs;
+            double dot = x[static_cast<size_t>(step) * k];
+            for (int row = step + 1; row < m; ++row)
+                dot += v[static_cast<size_t>(row) * n] * x[static_cast<size_t>(row) * k];
+            dot *= m_tau[step];
+            x[static_cast<size_t>(step) * k] -= dot;
+            for (int row = step + 1; row < m; ++row)
+                x[static_cast<size_t>(row) * k] -= dot * v[static_cast<size_t>(row) * n];
+        }
+    }
+
+    back_substitute(a, n, n, b, k);
+}
+
+void QR::inverse(Matrix& inverse) const
+{
+    check_square(m_qr, "QR::inverse");
+    check_square(inverse, "QR::inverse");
+    inverse.set_identity();
+    solve(inverse);
+}
+
+double QR::log_determinant() const
+{
+    check_square(m_qr, "QR::log_determinant");
+    const int n = m_qr.rows();
+    double logdet = 0.0;
+    for (int k = 0; k < n; ++k)
+        logdet += std::log(std::abs(m_qr.data()[static_cast<size_t>(k) * n + k]));
+    return logdet;
+}
+
+}
@@ -16,128 +16,43 @@
 * along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-#include <cfloat>
 #include <gmm/cluster.hxx>
 
-#include <cmath>
 #include <iostream>
-#include <optional>
 
-gmm::Cluster::Cluster(int idx_, const Data& data_, int num_clusters_, bool full_gmm_)
+template <int Dim, gmm::CovarianceType Type>
+gmm::Cluster<Dim, Type>::Cluster(int idx_, const Data& data_, int num_clusters_)
     : data{ data_ }
-    , mu(data_.cols(), 1)
+    , mu(data_.cols())
+    , cov(data_.cols())
     , num_clusters{ num_clusters_ }
     , idx{ idx_ }
-    , full_gmm{ full_gmm_ }
+    , diff(data_.cols())
 {
-    if (full_gmm)
-    {
-        sigma = std::make_optional<MatrixXd>(data_.cols(), data_.cols());
-    }
-    else
-    {
-        stds = std::make_optional<std::vector<double>>(data_.cols());
-    }
 }
 
-void gmm::Cluster::init(int use_sample)
+template <int Dim, gmm::CovarianceType Type> void gmm::Cluster<Dim, Type>::init(int use_sample)
 {
     // std::cerr << "[DEBUG] inside Cluster::init() use_sample = " << use_sample << '\n';
-    const int n = dims();
     const int c = clusters();
 
     phi = 1.0 / c;
 
-    mu = data(use_sample).reshaped(n, 1);
-    if (full_gmm)
-    {
-        sigma->setIdentity();
-        (*sigma) *= 5;
-    }
-    else
-    {
-        for (int dim = 0; dim < n; ++dim)
-        {
-            (*stds)[dim] = 1.5;
-        }
-    }
+    mu = data.point<Dim>(use_sample);
+    cov.init(data.variances());
 }
 
-void gmm::Cluster::clear_mu_sigma()
+template <int Dim, gmm::CovarianceType Type> void gmm::Cluster<Dim, Type>::clear_mu_sigma()
 {
     // std::cerr << "[DEBUG] inside Cluster::clear_mu_sigma()\n";
     mu.setZero();
-    if (full_gmm)
-    {
-        sigma->setZero();
-    }
-    else
-    {
-        const int n = dims();
-        for (int dim = 0; dim < n; ++dim)
-        {
-            (*stds)[dim] = 0.0;
-        }
-    }
-}
-
-namespace
-{
-static const double norm_dist_scale = 1.0 / std::sqrt(2 * M_PI);
-double dnorm(double x, double mean, double stdev)
-{
-    const double scale = norm_dist_scale / stdev;
-    double arg = (x - mean) / stdev;
-    return std::exp(-0.5 * (arg * arg)) * scale;
-}
-}
-
-double gmm::Cluster::sample_probability(int sample) const
-{
-    const int n = dims();
-    double prob = phi;
-    for (int dim = 0; dim < n; ++dim)
-    {
-        prob *= dnorm(data(sample, dim), mu(dim, 0), (*stds)[dim]);
-    }
-    return prob;
-}
-
-double gmm::Cluster::sample_probability(int sample, const MatrixXd& cov_inv,
-                                        const double cov_determinant) const
-{
-    // if (sample == 0)
-    //     std::cerr << "<<<Data>>> " << data(sample).reshaped(1, dims()) << '\n';
-    double prob;
-    const int n = dims();
-    (void)(n);
-    (void)(dnorm);
-
-    MatrixXd X = data(sample).reshaped(dims(), 1);
-    auto res = (X - mu).transpose() * cov_inv * (X - mu);
-    double exp_arg{ -0.5 * res(0, 0) };
-    double density = (exp_arg < DBL_MAX_EXP) ? std::exp(exp_arg) / std::pow(2 * M_PI, dims() / 2.0)
-                                                   / std::sqrt(cov_determinant)
-                                             : 0;
-
-    prob = density * phi;
-    // if (sample == 0)
-    //     std::cerr << "(" << res.rows() << ',' << res.cols() << ") res(0,0) = " << res(0, 0);
-
-    // if (sample == 0)
-    //     std::cerr << '\n';
-    // if (sample < 5)
-    //     std::cerr << "[exp_arg = " << exp_arg << " density = " << density << ", phi = " << phi
-    //               << " prob = " << prob << "]  ";
-    // if (sample == 5)
-    //     std::cerr << '\n';
-
-    return prob;
+    cov.clear();
 }
 
 namespace gmm
 {
-std::ostream& operator<<(std::ostream& os, const gmm::Cluster& clusterObj)
+template <int Dim, CovarianceType Type>
+std::ostream& operator<<(std::ostream& os, const gmm::Cluster<Dim, Type>& clusterObj)
 {
     os << "Cluster(id = " << clusterObj.idx << "): " << "data(" << clusterObj.data.rows() << ", "
        << clusterObj.data.cols() << ") \tmu(" << clusterObj.mu.rows() << ", "
@@ -146,4 +61,20 @@ std::ostream& operator<<(std::ostream& os, const gmm::Cluster& clusterObj)
        << " clusters = " << clusterObj.clusters();
     return os;
 }
+
+#define CR_INSTANTIATE_CLUSTER(Dim)                                                               \
+    template class Cluster<Dim, CovarianceType::DIAGONAL>;                                       \
+    template class Cluster<Dim, CovarianceType::FULL>;                                           \
+    template class Cluster<Dim, CovarianceType::SPHERICAL>;                                      \
+    template class Cluster<Dim, CovarianceType::TIED>;
+
+CR_INSTANTIATE_CLUSTER(1)
+CR_INSTANTIATE_CLUSTER(2)
+CR_INSTANTIATE_CLUSTER(3)
+CR_INSTANTIATE_CLUSTER(4)
+CR_INSTANTIATE_CLUSTER(5)
+CR_INSTANTIATE_CLUSTER(6)
+CR_INSTANTIATE_CLUSTER(7)
+CR_INSTANTIATE_CLUSTER(8)
+CR_INSTANTIATE_CLUSTER(Dynamic)
 }
@@ -17,51 +17,163 @@
 */
 
 #include <gmm/data.hxx>
-#include <iostream>
+#include <trace.hxx>
 
-#define DATA_NOOP 1
+#include <bit>
+#include <cstdint>
+#include <iostream>
+#include <new>
 
-gmm::Data::Data(const Map<const MatrixXdRM>& data_)
+gmm::Data::Data(const Map<const MatrixXdRM>& data_, const ColumnMoments* moments)
     : _data{ data_ }
-    , _mean{ data_.cols() }
-    , _stdev{ data_.cols() }
+    , _points{ data_.data(), data_.rows(), data_.cols() }
+    , _counts{ VectorXd::Ones(data_.rows()) }
+{
+    ColumnMoments computed(_data.cols());
+    if (!moments)
+    {
+        // Row by row, so that the row major input is read contiguously.
+        for (int sample = 0; sample < _data.rows(); ++sample)
+            computed.add(_data.data() + static_cast<size_t>(sample) * _data.cols());
+        moments = &computed;
+    }
+    _mean = moments->mean;
+    _stdev = moments->stdev();
+    const double mean_var = mean_variance();
+    _variances = (_stdev > 0.0).select(_stdev.square(), mean_var > 0.0 ? mean_var : 1.0);
+
+    compress();
+}
+
+void gmm::ColumnMoments::add(const double* row)
+{
+    ++count;
+    const double inv_count = 1.0 / static_cast<double>(count);
+    const int cols = static_cast<int>(mean.size());
+    for (int col = 0; col < cols; ++col)
+    {
+        const double delta = row[col] - mean[col];
+        mean[col] += delta * inv_count;
+        m2[col] += delta * (row[col] - mean[col]);
+    }
+}
+
+void gmm::ColumnMoments::merge(const ColumnMoments& other)
 {
-    int n = _data.cols();
-    int m = _data.rows();
-    for (int dim = 0; dim < n; ++dim)
+    if (other.count == 0)
+        return;
+    if (count == 0)
     {
-        double& mean = _mean(dim);
-        double& stdev = _stdev(dim);
-        mean = 0;
-        stdev = 0;
-        for (int sample = 0; sample < m; ++sample)
+        *this = other;
+        return;
+    }
+
+    const double total = static_cast<double>(count + other.count);
+    const ArrayXd delta = other.mean - mean;
+    mean += delta * (static_cast<double>(other.count) / total);
+    const double weight = static_cast<double>(count) * static_cast<double>(other.count) / total;
+    m2 += other.m2 + delta.square() * weight;
+    count += other.count;
+}
+
+Eigen::ArrayXd gmm::ColumnMoments::stdev() const
+{
+    if (count < 2)
+        return ArrayXd::Zero(mean.size());
+    return (m2 / static_cast<double>(count - 1)).sqrt();
+}
+
+namespace
+{
+
+uint64_t hash_row(const double* row, int cols)
+{
+    uint64_t hash = 0x9E3779B97F4A7C15ull;
+    for (int dim = 0; dim < cols; ++dim)
+    {
+        // Adding 0.0 maps -0.0 to 0.0 so that rows comparing equal hash equally.
+        uint64_t bits = std::bit_cast<uint64_t>(row[dim] + 0.0);
+        bits ^= bits >> 33;
+        bits *= 0xFF51AFD7ED558CCDull;
+        bits ^= bits >> 33;
+        hash = (hash ^ bits) * 0x100000001B3ull;
+    }
+    return hash ^ (hash >> 29);
+}
+
+bool equal_rows(const double* left, const double* right, int cols)
+{
+    for (int dim = 0; dim < cols; ++dim)
+        if (left[dim] != right[dim])
+            return false;
+    return true;
+}
+
+}
+
+void gmm::Data::compress()
+{
+    // Collapsing repeated rows only pays off if it removes a good fraction of them.
+    constexpr int min_rows = 64;
+    const int m = _data.rows();
+    const int n = _data.cols();
+    if (m < min_rows)
+        return;
+
+    trace::Span<trace::FIT> span("Data::compress", m);
+    const int max_unique = m - m / 4;
+    // Open addressing table of first occurrences, at most half full.
+    const size_t mask = std::bit_ceil(static_cast<size_t>(2 * max_unique)) - 1;
+    std::vector<int> table(mask + 1, -1);
+    std::vector<int> first_rows;
+    std::vector<int> row_map(m);
+    for (int sample = 0; sample < m; ++sample)
+    {
+        const double* row = _data.data() + static_cast<size_t>(sample) * n;
+        size_t slot = hash_row(row, n) & mask;
+        while (table[slot] >= 0
+               && !equal_rows(_data.data() + static_cast<size_t>(first_rows[table[slot]]) * n,
+                              row, n))
+            slot = (slot + 1) & mask;
+
+        if (table[slot] < 0)
         {
-            double val = _data(sample, dim);
-            double oldMean = mean;
-            mean += (val - mean) / (sample + 1);
-            stdev += (val - mean) * (val - oldMean);
+            if (static_cast<int>(first_rows.size()) == max_unique)
+                return;
+            table[slot] = static_cast<int>(first_rows.size());
+            first_rows.push_back(sample);
         }
-
-        // Store std-dev.
-        stdev = std::sqrt(stdev / (m - 1));
+        row_map[sample] = table[slot];
     }
+
+    const int unique = static_cast<int>(first_rows.size());
+    _unique.resize(unique, n);
+    _counts.setZero(unique);
+    for (int point = 0; point < unique; ++point)
+        _unique.row(point) = _data.row(first_rows[point]);
+    for (int sample = 0; sample < m; ++sample)
+        _counts[row_map[sample]] += 1.0;
+
+    // Rebind the map to the unique rows, this is how Eigen documents changing a Map.
+    new (&_points) Map<const MatrixXdRM>(_unique.data(), unique, n);
+    _row_map.swap(row_map);
 }
 
 Eigen::MatrixXd gmm::Data::operator()(int sample) const
 {
 #ifndef DATA_NOOP
-    return ((_data.row(sample).reshaped().array() - _mean) / _stdev);
+    return ((_points.row(sample).reshaped().array() - _mean) / _stdev);
 #else
-    return _data.row(sample);
+    return _points.row(sample);
 #endif
 }
 
 double gmm::Data::operator()(int sample, int dim) const
 {
 #ifndef DATA_NOOP
-    return (_data(sample, dim) - _mean(dim)) / _stdev(dim);
+    return (_points(sample, dim) - _mean(dim)) / _stdev(dim);
 #else
-    return _data(sample, dim);
+    return _points(sample, dim);
 #endif
 }
 
@@ -79,7 +191,8 @@ void gmm::Data::transform(Eigen::ArrayXd& raw) const
 
 void gmm::Data::display() const
 {
-    std::cerr << "Data : samples = " << _data.rows() << ", dims = " << _data.cols() << '\n';
+    std::cerr << "Data : samples = " << _data.rows() << ", unique = " << _points.rows()
+              << ", dims = " << _data.cols() << '\n';
     std::cerr << "First sample = ";
     for (int dim = 0; dim < _mean.size(); ++dim)
     {
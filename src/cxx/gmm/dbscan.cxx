@@ -0,0 +1,415 @@
+/*
+ * ClusterRows
+ * Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gmm/dbscan.hxx>
+#include <trace.hxx>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <numeric>
+
+namespace
+{
+
+/// Smaller inputs are clustered on the calling thread.
+constexpr int PARALLEL_MIN_ROWS = 4096;
+/// Rows or cells handed to a task at a time.
+constexpr int BLOCK_SIZE = 1024;
+/// Rows whose nearest neighbour distances are sampled to estimate eps.
+constexpr int EPS_SAMPLES = 256;
+/// Share of the sample rows the estimated eps makes core points.
+constexpr double CORE_SHARE = 0.9;
+/// Ratio of the estimated eps to the distance the CORE_SHARE of sample rows have k neighbours in.
+constexpr double REACH_FACTOR = 2.0;
+/// Keeps the grid coordinates well inside long long for tiny radii.
+constexpr double MIN_EPS_PER_RANGE = 1e-12;
+
+/// @brief Calls @p task (begin, end) for consecutive blocks of [0, count).
+void for_each_block(int count, util::ThreadPool* pool, const std::function<void(int, int)>& task)
+{
+    const int blocks = (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    const auto run = [count, &task](int block) {
+        task(block * BLOCK_SIZE, std::min(count, (block + 1) * BLOCK_SIZE));
+    };
+    if (pool && blocks > 1)
+    {
+        pool->parallel_for(blocks, [&run](int block, int) { run(block); });
+        return;
+    }
+    for (int block = 0; block < blocks; ++block)
+        run(block);
+}
+
+double distance_squared(const double* row, const double* other, int cols)
+{
+    double sum = 0.0;
+    for (int col = 0; col < cols; ++col)
+    {
+        const double diff = row[col] - other[col];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+/// @brief Twice the distance within which most sample rows have their k nearest neighbours, so
+/// that most rows of the clusters are core points and reach each other across the sparser
+/// stretches of a cluster. The knee of the sorted distances is not used as it lands between the
+/// clusters when their densities differ.
+double estimate_eps(const double* data, int rows, int cols, int k, util::ThreadPool* pool)
+{
+    k = std::min(k, rows - 1);
+    if (k <= 0)
+        return 1.0;
+
+    const int samples = std::min(rows, EPS_SAMPLES);
+    std::vector<double> distances(samples);
+    const auto sample = [&](int idx) {
+        const int row = static_cast<int>(static_cast<long long>(idx) * rows / samples);
+        const double* values = data + static_cast<size_t>(row) * cols;
+        // Max-heap of the k smallest squared distances to the other rows.
+        std::vector<double> nearest;
+        nearest.reserve(k + 1);
+        for (int other = 0; other < rows; ++other)
+        {
+            if (other == row)
+                continue;
+            const double dist
+                = distance_squared(values, data + static_cast<size_t>(other) * cols, cols);
+            if (static_cast<int>(nearest.size()) == k && dist >= nearest.front())
+                continue;
+            nearest.push_back(dist);
+            std::push_heap(nearest.begin(), nearest.end());
+            if (static_cast<int>(nearest.size()) > k)
+            {
+                std::pop_heap(nearest.begin(), nearest.end());
+                nearest.pop_back();
+            }
+        }
+        distances[idx] = std::sqrt(nearest.front());
+    };
+    if (pool)
+        pool->parallel_for(samples, [&sample](int idx, int) { sample(idx); });
+    else
+        for (int idx = 0; idx < samples; ++idx)
+            sample(idx);
+
+    std::sort(distances.begin(), distances.end());
+    if (distances.back() <= 0.0)
+        return 1.0; // all sampled rows have k duplicates, any radius joins them
+
+    // Past the duplicates, a zero radius would only join identical rows.
+    const auto pick = distances.begin() + static_cast<int>(CORE_SHARE * (samples - 1));
+    return REACH_FACTOR * *std::upper_bound(pick, distances.end(), 0.0);
+}
+
+/// @brief The usual 2 * cols, raised with the number of rows as small dense groups of a few rows
+/// turn up in the sparse fringes of large clusters.
+int default_min_points(int rows, int cols)
+{
+    return std::max({ 4, 2 * cols, static_cast<int>(std::log(std::max(rows, 1))) });
+}
+
+} // anonymous namespace
+
+gmm::DBSCAN::DBSCAN(const double* data_, int rows_, int cols_, double eps_, int min_points_,
+                    util::ThreadPool* pool_)
+    : input{ data_ }
+    , num_rows{ rows_ }
+    , num_cols{ cols_ }
+    , eps{ eps_ }
+    , min_points{ min_points_ > 0 ? min_points_ : default_min_points(rows_, cols_) }
+    , pool{ rows_ >= PARALLEL_MIN_ROWS ? pool_ : nullptr }
+{
+}
+
+int gmm::DBSCAN::fit()
+{
+    trace::Span<trace::FIT> span("DBSCAN", num_rows);
+    if (!(eps > 0.0))
+        eps = estimate_eps(input, num_rows, num_cols, min_points - 1, pool);
+
+    build_grid();
+    find_neighbour_cells();
+    count_neighbours();
+    join_core_points();
+    assign_border_points();
+    number_clusters();
+    return num_clusters;
+}
+
+void gmm::DBSCAN::get_labels(int* labels_, double* confidence_scores) const
+{
+    std::copy(labels.begin(), labels.end(), labels_);
+    std::copy(confidences.begin(), confidences.end(), confidence_scores);
+}
+
+bool gmm::DBSCAN::within(int pos, int other) const
+{
+    return distance_squared(point(pos), point(other), num_cols) <= eps * eps;
+}
+
+int gmm::DBSCAN::find(int pos)
+{
+    // Path halving, safe to run concurrently with unite().
+    while (true)
+    {
+        int up = parent[pos].load();
+        if (up == pos)
+            return pos;
+        const int grand = parent[up].load();
+        if (up != grand)
+            parent[pos].compare_exchange_weak(up, grand);
+        pos = grand;
+    }
+}
+
+void gmm::DBSCAN::unite(int pos, int other)
+{
+    // Linking the larger root below the smaller one cannot form cycles, so a failed exchange
+    // only means another thread linked the root first.
+    while (true)
+    {
+        pos = find(pos);
+        other = find(other);
+        if (pos == other)
+            return;
+        if (pos < other)
+            std::swap(pos, other);
+        int root = pos;
+        if (parent[pos].compare_exchange_strong(root, other))
+            return;
+    }
+}
+
+void gmm::DBSCAN::build_grid()
+{
+    std::vector<double> low(num_cols, std::numeric_limits<double>::infinity());
+    std::vector<double> high(num_cols, -std::numeric_limits<double>::infinity());
+    for (int row = 0; row < num_rows; ++row)
+    {
+        const double* values = input + static_cast<size_t>(row) * num_cols;
+        for (int col = 0; col < num_cols; ++col)
+        {
+            low[col] = std::min(low[col], values[col]);
+            high[col] = std::max(high[col], values[col]);
+        }
+    }
+    for (int col = 0; col < num_cols; ++col)
+        eps = std::max(eps, (high[col] - low[col]) * MIN_EPS_PER_RANGE);
+
+    std::vector<long long> coords(static_cast<size_t>(num_rows) * num_cols);
+    for_each_block(num_rows, pool, [&](int begin, int end) {
+        for (size_t idx = static_cast<size_t>(begin) * num_cols;
+             idx < static_cast<size_t>(end) * num_cols; ++idx)
+        {
+            const int col = static_cast<int>(idx % num_cols);
+            coords[idx] = static_cast<long long>(std::floor((input[idx] - low[col]) / eps));
+        }
+    });
+
+    const auto row_coords = [&coords, this](int row) {
+        return coords.data() + static_cast<size_t>(row) * num_cols;
+    };
+    order.resize(num_rows);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](int row, int other) {
+        const long long* lhs = row_coords(row);
+        const long long* rhs = row_coords(other);
+        for (int col = 0; col < num_cols; ++col)
+        {
+            if (lhs[col] != rhs[col])
+                return lhs[col] < rhs[col];
+        }
+        return row < other;
+    });
+
+    points.resize(static_cast<size_t>(num_rows) * num_cols);
+    cell_coords.clear();
+    cell_start.clear();
+    for (int pos = 0; pos < num_rows; ++pos)
+    {
+        const long long* cell = row_coords(order[pos]);
+        std::copy(input + static_cast<size_t>(order[pos]) * num_cols,
+                  input + static_cast<size_t>(order[pos] + 1) * num_cols,
+                  points.begin() + static_cast<size_t>(pos) * num_cols);
+        if (pos == 0 || !std::equal(cell, cell + num_cols, row_coords(order[pos - 1])))
+        {
+            cell_start.push_back(pos);
+            cell_coords.insert(cell_coords.end(), cell, cell + num_cols);
+        }
+    }
+    cell_start.push_back(num_rows);
+}
+
+void gmm::DBSCAN::find_neighbour_cells()
+{
+    const int cells = static_cast<int>(cell_start.size()) - 1;
+    int offsets = 1;
+    for (int col = 0; col < num_cols; ++col)
+        offsets *= 3;
+
+    const auto cell_less = [this](int cell, const long long* target) {
+        const long long* coords = cell_coords.data() + static_cast<size_t>(cell) * num_cols;
+        return std::lexicographical_compare(coords, coords + num_cols, target,
+                                            target + num_cols);
+    };
+
+    neighbours.assign(cells, {});
+    for_each_block(cells, pool, [&](int begin, int end) {
+        std::vector<long long> target(num_cols);
+        for (int cell = begin; cell < end; ++cell)
+        {
+            const long long* coords = cell_coords.data() + static_cast<size_t>(cell) * num_cols;
+            for (int offset = 0; offset < offsets; ++offset)
+            {
+                // Digits of offset in base 3 are the steps -1, 0 or +1 along each column.
+                for (int col = 0, rest = offset; col < num_cols; ++col, rest /= 3)
+                    target[col] = coords[col] + rest % 3 - 1;
+                int low = 0;
+                int high = cells;
+                while (low < high)
+                {
+                    const int mid = low + (high - low) / 2;
+                    if (cell_less(mid, target.data()))
+                        low = mid + 1;
+                    else
+                        high = mid;
+                }
+                if (low < cells
+                    && std::equal(target.begin(), target.end(),
+                                  cell_coords.begin() + static_cast<size_t>(low) * num_cols))
+                    neighbours[cell].push_back(low);
+            }
+        }
+    });
+}
+
+void gmm::DBSCAN::count_neighbours()
+{
+    const int cells = static_cast<int>(cell_start.size()) - 1;
+    counts.assign(num_rows, 0);
+    for_each_block(cells, pool, [&](int begin, int end) {
+        for (int cell = begin; cell < end; ++cell)
+        {
+            for (int pos = cell_start[cell]; pos < cell_start[cell + 1]; ++pos)
+            {
+                int count = 0;
+                for (int near : neighbours[cell])
+                {
+                    for (int other = cell_start[near];
+                         other < cell_start[near + 1] && count < min_points; ++other)
+                        count += within(pos, other);
+                }
+                counts[pos] = count;
+            }
+        }
+    });
+}
+
+void gmm::DBSCAN::join_core_points()
+{
+    const int cells = static_cast<int>(cell_start.size()) - 1;
+    parent = std::vector<std::atomic<int>>(num_rows);
+    for (int pos = 0; pos < num_rows; ++pos)
+        parent[pos].store(pos);
+
+    for_each_block(cells, pool, [&](int begin, int end) {
+        for (int cell = begin; cell < end; ++cell)
+        {
+            for (int pos = cell_start[cell]; pos < cell_start[cell + 1]; ++pos)
+            {
+                if (counts[pos] < min_points)
+                    continue;
+                for (int near : neighbours[cell])
+                {
+                    for (int other = std::max(pos + 1, cell_start[near]);
+                         other < cell_start[near + 1]; ++other)
+                    {
+                        if (counts[other] >= min_points && find(pos) != find(other)
+                            && within(pos, other))
+                            unite(pos, other);
+                    }
+                }
+            }
+        }
+    });
+}
+
+void gmm::DBSCAN::assign_border_points()
+{
+    const int cells = static_cast<int>(cell_start.size()) - 1;
+    owner.assign(num_rows, -1);
+    for_each_block(cells, pool, [&](int begin, int end) {
+        for (int cell = begin; cell < end; ++cell)
+        {
+            for (int pos = cell_start[cell]; pos < cell_start[cell + 1]; ++pos)
+            {
+                if (counts[pos] >= min_points)
+                {
+                    owner[pos] = pos;
+                    continue;
+                }
+                // A border point within eps of several clusters joins the nearest core point.
+                double nearest = eps * eps;
+                for (int near : neighbours[cell])
+                {
+                    for (int other = cell_start[near]; other < cell_start[near + 1]; ++other)
+                    {
+                        if (counts[other] < min_points)
+                            continue;
+                        const double dist = distance_squared(point(pos), point(other), num_cols);
+                        if (dist < nearest || (dist == nearest && owner[pos] < 0))
+                        {
+                            nearest = dist;
+                            owner[pos] = other;
+                        }
+                    }
+                }
+            }
+        }
+    });
+}
+
+void gmm::DBSCAN::number_clusters()
+{
+    std::vector<int> position(num_rows);
+    for (int pos = 0; pos < num_rows; ++pos)
+        position[order[pos]] = pos;
+
+    std::vector<int> root_label(num_rows, -1);
+    labels.resize(num_rows);
+    confidences.resize(num_rows);
+    num_clusters = 0;
+    for (int row = 0; row < num_rows; ++row)
+    {
+        const int pos = position[row];
+        if (owner[pos] < 0)
+        {
+            labels[row] = -1;
+            confidences[row] = 0.0;
+            continue;
+        }
+        const int root = find(owner[pos]);
+        if (root_label[root] < 0)
+            root_label[root] = num_clusters++;
+        labels[row] = root_label[root];
+        confidences[row] = std::min(1.0, static_cast<double>(counts[pos]) / min_points);
+    }
+}
@@ -0,0 +1,147 @@
+/*
+ * ClusterRows
+ * Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gmm/ingest.hxx>
+#include <trace.hxx>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+namespace
+{
+
+/// Rows summarized by one task, a few hundred KB of a typical input.
+constexpr int BLOCK_ROWS = 8192;
+/// Inputs with fewer cells are ingested on the calling thread.
+constexpr long long PARALLEL_MIN_CELLS = 1 << 18;
+
+void for_each_block(int blocks, util::ThreadPool* pool, const std::function<void(int)>& task)
+{
+    if (pool && blocks > 1)
+    {
+        pool->parallel_for(blocks, [&task](int block, int) { task(block); });
+        return;
+    }
+    for (int block = 0; block < blocks; ++block)
+        task(block);
+}
+
+bool is_finite_row(const double* row, int cols)
+{
+    // Summing is branch free and propagates NaN, and Inf - Inf, into the result.
+    double sum = 0.0;
+    for (int col = 0; col < cols; ++col)
+        sum += row[col] * 0.0;
+    return sum == 0.0;
+}
+
+} // anonymous namespace
+
+gmm::Ingest::Ingest(const double* data_, int rows_, int cols_, bool normalize,
+                    util::ThreadPool* pool, Stats* stats)
+    : input{ data_ }
+    , input_rows{ rows_ }
+    , num_cols{ cols_ }
+    , valid_rows{ rows_ }
+    , data_moments(cols_)
+{
+    trace::Span<trace::FIT> span("Ingest", rows_);
+    Stats::Timer timer(stats, Stats::INIT);
+    if (static_cast<long long>(input_rows) * num_cols < PARALLEL_MIN_CELLS)
+        pool = nullptr;
+    if (pool && stats)
+        stats->set_threads(pool->threads());
+
+    const int blocks = (input_rows + BLOCK_ROWS - 1) / BLOCK_ROWS;
+    std::vector<ColumnMoments> block_moments(blocks, ColumnMoments(num_cols));
+    std::vector<char> flags(input_rows);
+    for_each_block(blocks, pool, [&](int block) {
+        const int end = std::min(input_rows, (block + 1) * BLOCK_ROWS);
+        ColumnMoments& moments = block_moments[block];
+        for (int row = block * BLOCK_ROWS; row < end; ++row)
+        {
+            const double* values = input + static_cast<size_t>(row) * num_cols;
+            flags[row] = is_finite_row(values, num_cols);
+            if (flags[row])
+                moments.add(values);
+        }
+    });
+
+    // Merged in block order, so the result does not depend on the scheduling.
+    for (const ColumnMoments& moments : block_moments)
+        data_moments.merge(moments);
+    valid_rows = static_cast<int>(data_moments.count);
+    if (valid_rows < input_rows)
+        valid.swap(flags);
+    if (valid.empty() && !normalize)
+        return;
+
+    const ArrayXd mean = normalize ? data_moments.mean : ArrayXd::Zero(num_cols);
+    ArrayXd scale = ArrayXd::Ones(num_cols);
+    if (normalize)
+    {
+        // Constant columns are only centered.
+        const ArrayXd stdev = data_moments.stdev();
+        scale = (stdev > 0.0).select(stdev.inverse(), 1.0);
+    }
+
+    std::vector<int> offsets(blocks + 1, 0);
+    for (int block = 0; block < blocks; ++block)
+        offsets[block + 1] = offsets[block] + static_cast<int>(block_moments[block].count);
+    copy.resize(static_cast<size_t>(valid_rows) * num_cols);
+    for_each_block(blocks, pool, [&](int block) {
+        const int end = std::min(input_rows, (block + 1) * BLOCK_ROWS);
+        double* out = copy.data() + static_cast<size_t>(offsets[block]) * num_cols;
+        for (int row = block * BLOCK_ROWS; row < end; ++row)
+        {
+            if (!valid.empty() && !valid[row])
+                continue;
+            const double* values = input + static_cast<size_t>(row) * num_cols;
+            for (int col = 0; col < num_cols; ++col)
+                out[col] = (values[col] - mean[col]) * scale[col];
+            out += num_cols;
+        }
+    });
+
+    if (normalize)
+    {
+        data_moments.mean -= mean;
+        data_moments.m2 *= scale.square();
+    }
+}
+
+void gmm::Ingest::scatter(const int* labels, const double* confidences, int* all_labels,
+                          double* all_confidences) const
+{
+    int next = 0;
+    for (int row = 0; row < input_rows; ++row)
+    {
+        if (valid.empty() || valid[row])
+        {
+            all_labels[row] = labels[next];
+            all_confidences[row] = confidences[next];
+            ++next;
+        }
+        else
+        {
+            all_labels[row] = -1;
+            all_confidences[row] = 0.0;
+        }
+    }
+}
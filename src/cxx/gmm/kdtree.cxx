@@ -0,0 +1,360 @@
+/*
+ * ClusterRows
+ * Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gmm/covariance.hxx>
+#include <gmm/kdtree.hxx>
+#include <macros.h>
+#include <logging.hxx>
+#include <trace.hxx>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <numeric>
+
+gmm::KDTree::KDTree(const Data& data_, int leaf_size_)
+    : data{ data_ }
+    , n{ data_.cols() }
+    , leaf_size{ std::max(leaf_size_, 1) }
+    , order(data_.rows())
+{
+    trace::Span<trace::FIT> span("KDTree::build", data.rows());
+    std::iota(order.begin(), order.end(), 0);
+    const size_t max_nodes = 4 * (static_cast<size_t>(data.rows()) / leaf_size + 1);
+    nodes.reserve(max_nodes);
+    sums.reserve(max_nodes * n);
+    outers.reserve(max_nodes * n * n);
+    centers.reserve(max_nodes * n);
+    half_widths.reserve(max_nodes * n);
+    build(add_node(), 0, data.rows());
+}
+
+int gmm::KDTree::add_node()
+{
+    const int node = static_cast<int>(nodes.size());
+    nodes.push_back({ 0, 0, -1, 0.0 });
+    sums.resize(sums.size() + n, 0.0);
+    outers.resize(outers.size() + static_cast<size_t>(n) * n, 0.0);
+    centers.resize(centers.size() + n, 0.0);
+    half_widths.resize(half_widths.size() + n, 0.0);
+    return node;
+}
+
+void gmm::KDTree::build(int node, int begin, int end)
+{
+    nodes[node].begin = begin;
+    nodes[node].end = end;
+
+    VectorXd lower = VectorXd::Constant(n, INFINITY);
+    VectorXd upper = VectorXd::Constant(n, -INFINITY);
+    for (int pos = begin; pos < end; ++pos)
+    {
+        const auto x = data.row(order[pos]);
+        lower = lower.cwiseMin(x);
+        upper = upper.cwiseMax(x);
+    }
+
+    const size_t offset = static_cast<size_t>(node) * n;
+    Map<VectorXd>(centers.data() + offset, n) = 0.5 * (lower + upper);
+    Map<VectorXd>(half_widths.data() + offset, n) = 0.5 * (upper - lower);
+
+    int split_dim;
+    const double width = (upper - lower).maxCoeff(&split_dim);
+    if (end - begin <= leaf_size || width <= 0.0)
+    {
+        Map<VectorXd> sum(sums.data() + offset, n);
+        Map<MatrixXd> outer(outers.data() + offset * n, n, n);
+        double count = 0.0;
+        for (int pos = begin; pos < end; ++pos)
+        {
+            const int point = order[pos];
+            const double wt = data.weight(point);
+            const auto x = data.row(point);
+            count += wt;
+            sum.noalias() += wt * x;
+            outer.noalias() += wt * x * x.transpose();
+        }
+        nodes[node].count = count;
+        return;
+    }
+
+    // Median split along the widest dimension of the box.
+    const int mid = begin + (end - begin) / 2;
+    std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+                     [this, split_dim](int left, int right)
+                     { return data(left, split_dim) < data(right, split_dim); });
+
+    const int left = add_node();
+    add_node();
+    nodes[node].left = left;
+    build(left, begin, mid);
+    build(left + 1, mid, end);
+
+    nodes[node].count = nodes[left].count + nodes[left + 1].count;
+    for (int idx = 0; idx < n; ++idx)
+        sums[offset + idx] = sums[(left * n) + idx] + sums[((left + 1) * n) + idx];
+    const size_t outer_size = static_cast<size_t>(n) * n;
+    for (size_t idx = 0; idx < outer_size; ++idx)
+        outers[offset * n + idx] = outers[left * outer_size + idx]
+                                   + outers[(left + 1) * outer_size + idx];
+}
+
+struct gmm::TreeModel::Scratch
+{
+    explicit Scratch(int num_clusters, int dims)
+        : resp(num_clusters)
+        , tmp(dims)
+        , mean(dims)
+        , diff(dims)
+        , center_log(num_clusters)
+        , gradients(dims, num_clusters)
+        , slack(num_clusters, num_clusters)
+        , curvatures(static_cast<size_t>(num_clusters) * num_clusters)
+    {
+    }
+
+    /// @brief Caches |P_j - P_k| for every pair of clusters, P being the precision matrices.
+    void prepare(const GaussianMixture& mixture)
+    {
+        const int c = mixture.clusters();
+        for (int first = 0; first < c; ++first)
+            for (int second = 0; second < c; ++second)
+                curvatures[first * c + second] =
+                    (mixture.precision(first) - mixture.precision(second)).cwiseAbs();
+    }
+
+    VectorXd resp;
+    VectorXd tmp;
+    VectorXd mean;
+    VectorXd diff;
+    VectorXd center_log; // log weighted density of each cluster at the box center
+    MatrixXd gradients; // P_k (center - mu_k) as columns
+    MatrixXd slack; // bound of the variation of log(p_j / p_k) over the box
+    std::vector<MatrixXd> curvatures;
+};
+
+namespace
+{
+
+/// @brief Bounds how much the responsibilities can vary over an axis aligned box.
+/// For clusters j and k, D(x) = log(p_j(x) / p_k(x)) is quadratic in x, so with x = c + t and
+/// |t| <= h element-wise, |D(x) - D(c)| <= |grad D(c)| . h + 0.5 h' |P_j - P_k| h. Bounding the
+/// ratios directly is far tighter than bounding each density on its own when the clusters have
+/// similar shapes, which lets much larger boxes be pruned.
+double responsibility_spread(const gmm::GaussianMixture& mixture,
+                             const Eigen::Ref<const Eigen::VectorXd>& center,
+                             const Eigen::Ref<const Eigen::VectorXd>& half_width,
+                             gmm::TreeModel::Scratch& scratch)
+{
+    const int c = mixture.clusters();
+    for (int cluster = 0; cluster < c; ++cluster)
+    {
+        const double log_norm = mixture.log_normalizer(cluster);
+        if (!std::isfinite(log_norm))
+            continue;
+        scratch.diff = center - mixture.mean(cluster);
+        scratch.gradients.col(cluster).noalias() = mixture.precision(cluster) * scratch.diff;
+        scratch.center_log(cluster) =
+            log_norm - 0.5 * scratch.diff.dot(scratch.gradients.col(cluster));
+    }
+
+    for (int first = 0; first < c; ++first)
+    {
+        for (int second = first + 1; second < c; ++second)
+        {
+            const double slack =
+                (scratch.gradients.col(first) - scratch.gradients.col(second)).cwiseAbs().dot(
+                    half_width)
+                + 0.5 * half_width.dot(scratch.curvatures[first * c + second] * half_width);
+            scratch.slack(first, second) = slack;
+            scratch.slack(second, first) = slack;
+        }
+    }
+
+    double spread = 0.0;
+    for (int cluster = 0; cluster < c; ++cluster)
+    {
+        if (!std::isfinite(mixture.log_normalizer(cluster)))
+            continue;
+        // r_k = 1 / (1 + sum_j exp(D_jk)) is decreasing in every D_jk = log(p_j / p_k).
+        double min_sum = 0.0;
+        double max_sum = 0.0;
+        for (int other = 0; other < c; ++other)
+        {
+            if (other == cluster || !std::isfinite(mixture.log_normalizer(other)))
+                continue;
+            const double ratio = scratch.center_log(other) - scratch.center_log(cluster);
+            min_sum += std::exp(ratio - scratch.slack(cluster, other));
+            max_sum += std::exp(ratio + scratch.slack(cluster, other));
+        }
+        spread = std::max(spread, 1.0 / (1.0 + min_sum) - 1.0 / (1.0 + max_sum));
+    }
+    return spread;
+}
+
+}
+
+gmm::TreeModel::TreeModel(const KDTree& tree_, const Data& data_, int num_clusters_,
+                          const GMMOptions& options, Stats* stats_)
+    : tree{ tree_ }
+    , data{ data_ }
+    , num_clusters{ num_clusters_ }
+    , full_gmm{ gmm::full_covariance(options.fullGMM) }
+    , tolerance{ options.treeTolerance }
+    , best(num_clusters_, data_.cols(), gmm::full_covariance(options.fullGMM))
+    , stats{ stats_ }
+{
+}
+
+double gmm::TreeModel::traverse(int node, const GaussianMixture& mixture, SufficientStats& suff,
+                                Scratch& scratch) const
+{
+    const int c = num_clusters;
+    const double count = tree.count(node);
+    if (tree.end(node) - tree.begin(node) > 1)
+    {
+        const double spread =
+            responsibility_spread(mixture, tree.center(node), tree.half_width(node), scratch);
+        if (spread <= tolerance)
+        {
+            // Every point of the node gets the responsibilities of the node's mean.
+            scratch.mean = tree.sum(node) / count;
+            mixture.responsibilities(scratch.mean, scratch.resp, scratch.tmp);
+            for (int cluster = 0; cluster < c; ++cluster)
+            {
+                if (scratch.resp(cluster) > 1e-12)
+                    suff.accumulate(cluster, scratch.resp(cluster), count, tree.sum(node),
+                                    tree.outer(node));
+            }
+            return count * -std::log(scratch.resp.maxCoeff());
+        }
+
+        if (!tree.is_leaf(node))
+            return traverse(tree.left(node), mixture, suff, scratch)
+                   + traverse(tree.right(node), mixture, suff, scratch);
+    }
+
+    double score = 0.0;
+    for (int pos = tree.begin(node); pos < tree.end(node); ++pos)
+    {
+        const int point = tree.point(pos);
+        const double wt = data.weight(point);
+        const auto x = data.row(point);
+        mixture.responsibilities(x, scratch.resp, scratch.tmp);
+        score += wt * -std::log(scratch.resp.maxCoeff());
+        for (int cluster = 0; cluster < c; ++cluster)
+        {
+            if (scratch.resp(cluster) > 1e-12)
+                suff.accumulate(cluster, wt * scratch.resp(cluster), x);
+        }
+    }
+    return score;
+}
+
+double gmm::TreeModel::fit(int num_epochs, int num_iterations, Workspace& workspace)
+{
+    trace::Span<trace::FIT> span("TreeModel::fit", num_clusters);
+    const int n = data.cols();
+    if (stats)
+        stats->add_candidate(num_epochs);
+
+    // Clusters start with the covariance of the whole data set, read off the root node.
+    const double total = tree.count(0);
+    const VectorXd global_mean = tree.sum(0) / total;
+    MatrixXd global_cov = tree.outer(0) / total;
+    global_cov.noalias() -= global_mean * global_mean.transpose();
+
+    double bic{ 1.0E10 };
+    GaussianMixture mixture(num_clusters, n, full_gmm);
+    GaussianMixture epoch_best(num_clusters, n, full_gmm);
+    SufficientStats suff(num_clusters, n);
+    Scratch scratch(num_clusters, n);
+    for (int epoch = 0; epoch < num_epochs; ++epoch)
+    {
+        trace::Span<trace::EPOCH> epoch_span("epoch", epoch);
+        {
+            trace::Span<trace::STEP> init_span("init");
+            Stats::Timer timer(stats, Stats::INIT);
+            const auto& seeds = workspace.select_seeds(num_clusters, data.rows());
+            for (int cluster = 0; cluster < num_clusters; ++cluster)
+                mixture.set(cluster, 1.0 / num_clusters,
+                            data.row(seeds[cluster % seeds.size()]), global_cov);
+        }
+
+        double epoch_bic{ 1.0E10 };
+        int iter = 0;
+        for (; iter < num_iterations; ++iter)
+        {
+            trace::Span<trace::ITERATION> iter_span("iteration", iter);
+            double score;
+            {
+                trace::Span<trace::STEP> estep_span("E-step");
+                Stats::Timer timer(stats, Stats::ESTEP);
+                suff.clear();
+                scratch.prepare(mixture);
+                score = traverse(0, mixture, suff, scratch);
+                estep_span.set_arg(score);
+            }
+
+            if (score < epoch_bic && (epoch_bic - score > EPSILON))
+            {
+                epoch_bic = score;
+                epoch_best = mixture;
+            }
+            else
+            {
+                break;
+            }
+
+            trace::Span<trace::STEP> mstep_span("M-step");
+            Stats::Timer timer(stats, Stats::MSTEP);
+            mixture.update(suff);
+        }
+
+        if (stats)
+            stats->add_epoch(iter);
+        writeLog("\tEpoch#%d : epoch_bic = %f\n", epoch, epoch_bic);
+        if (epoch_bic < bic)
+        {
+            bic = epoch_bic;
+            best = epoch_best;
+        }
+    }
+
+    return bic;
+}
+
+void gmm::TreeModel::get_labels(int* labels, double* confidence_scores) const
+{
+    const int m = data.rows();
+    std::vector<int> point_labels(m);
+    std::vector<double> point_scores(m);
+    VectorXd resp(num_clusters);
+    VectorXd scratch(data.cols());
+    for (int point = 0; point < m; ++point)
+    {
+        best.responsibilities(data.row(point), resp, scratch);
+        point_scores[point] = resp.maxCoeff(&point_labels[point]);
+    }
+
+    for (int row = 0; row < data.input_rows(); ++row)
+    {
+        labels[row] = point_labels[data.point_of(row)];
+        confidence_scores[row] = point_scores[data.point_of(row)];
+    }
+}
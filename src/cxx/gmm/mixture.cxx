@@ -0,0 +1,156 @@
+/*
+ * ClusterRows
+ * Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gmm/mixture.hxx>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+gmm::SufficientStats::SufficientStats(int num_clusters, int dims)
+    : weights(num_clusters, 0.0)
+    , sums(num_clusters, VectorXd::Zero(dims))
+    , outers(num_clusters, MatrixXd::Zero(dims, dims))
+{
+}
+
+void gmm::SufficientStats::clear()
+{
+    for (size_t cluster = 0; cluster < weights.size(); ++cluster)
+    {
+        weights[cluster] = 0.0;
+        sums[cluster].setZero();
+        outers[cluster].setZero();
+    }
+}
+
+void gmm::SufficientStats::merge(const SufficientStats& other)
+{
+    for (size_t cluster = 0; cluster < weights.size(); ++cluster)
+    {
+        weights[cluster] += other.weights[cluster];
+        sums[cluster] += other.sums[cluster];
+        outers[cluster] += other.outers[cluster];
+    }
+}
+
+double gmm::SufficientStats::total_weight() const
+{
+    double total = 0.0;
+    for (double wt : weights)
+        total += wt;
+    return total;
+}
+
+void gmm::SufficientStats::parameters(int cluster, VectorXd& mu, MatrixXd& sigma) const
+{
+    const double wt = weights[cluster];
+    mu = sums[cluster] / wt;
+    sigma = outers[cluster].selfadjointView<Lower>();
+    sigma /= wt;
+    sigma.noalias() -= mu * mu.transpose();
+}
+
+gmm::GaussianMixture::GaussianMixture(int num_clusters, int dims, bool full_gmm_)
+    : dims_{ dims }
+    , full_gmm{ full_gmm_ }
+    , phi(num_clusters, 1.0 / num_clusters)
+    , mu(num_clusters, VectorXd::Zero(dims))
+    , sigma(num_clusters, MatrixXd::Identity(dims, dims))
+    , chol(num_clusters, MatrixXd::Identity(dims, dims))
+    , prec(num_clusters, MatrixXd::Identity(dims, dims))
+    , log_norm(num_clusters, 0.0)
+{
+}
+
+void gmm::GaussianMixture::set(int cluster, double phi_, const VectorXd& mu_,
+                               const MatrixXd& sigma_)
+{
+    phi[cluster] = phi_;
+    mu[cluster] = mu_;
+    if (full_gmm)
+        sigma[cluster] = sigma_;
+    else
+        sigma[cluster] = sigma_.diagonal().asDiagonal();
+    factorize(cluster);
+}
+
+void gmm::GaussianMixture::factorize(int cluster)
+{
+    MatrixXd& cov = sigma[cluster];
+    LLT<MatrixXd> llt(cov);
+    // Load the diagonal progressively until the covariance is numerically positive definite.
+    double loading = 1e-9 * std::max(cov.trace() / dims_, DBL_MIN);
+    while (llt.info() != Success && std::isfinite(loading))
+    {
+        cov.diagonal().array() += loading;
+        loading *= 10;
+        llt.compute(cov);
+    }
+
+    chol[cluster] = llt.matrixL();
+    prec[cluster] = llt.solve(MatrixXd::Identity(dims_, dims_));
+    const double log_det = 2.0 * chol[cluster].diagonal().array().log().sum();
+    log_norm[cluster] = std::log(phi[cluster]) - 0.5 * (dims_ * std::log(2 * M_PI) + log_det);
+}
+
+void gmm::GaussianMixture::update(const SufficientStats& suff)
+{
+    const double total = suff.total_weight();
+    VectorXd new_mu;
+    MatrixXd new_sigma;
+    for (int cluster = 0; cluster < clusters(); ++cluster)
+    {
+        const double wt = suff.weight(cluster);
+        if (wt > DBL_MIN)
+        {
+            suff.parameters(cluster, new_mu, new_sigma);
+            set(cluster, wt / total, new_mu, new_sigma);
+        }
+        else
+        {
+            phi[cluster] = 0.0;
+            log_norm[cluster] = -INFINITY;
+        }
+    }
+}
+
+double gmm::GaussianMixture::responsibilities(const Ref<const VectorXd>& x, VectorXd& resp,
+                                              VectorXd& scratch) const
+{
+    const int c = clusters();
+    double max_log = -INFINITY;
+    for (int cluster = 0; cluster < c; ++cluster)
+    {
+        scratch = x - mu[cluster];
+        chol[cluster].triangularView<Lower>().solveInPlace(scratch);
+        const double log_prob = log_norm[cluster] - 0.5 * scratch.squaredNorm();
+        resp(cluster) = log_prob;
+        max_log = std::max(max_log, log_prob);
+    }
+
+    double sum = 0.0;
+    for (int cluster = 0; cluster < c; ++cluster)
+    {
+        resp(cluster) = std::exp(resp(cluster) - max_log);
+        sum += resp(cluster);
+    }
+    resp /= sum;
+    return max_log + std::log(sum);
+}
+
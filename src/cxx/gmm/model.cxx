@@ -18,24 +18,45 @@
 
 #include <gmm/model.hxx>
 #include <gmm/cluster.hxx>
+#include <gmm/variational.hxx>
 #include <macros.h>
 #include <logging.hxx>
+#include <trace.hxx>
 
+#include <algorithm>
 #include <cfloat>
 #include <cmath>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <numeric>
 #include <stdexcept>
 #include <vector>
-#include <chrono>
-#include <random>
 
-gmm::Model::Model(const Map<const MatrixXdRM>& data_, int num_clusters_, bool full_gmm)
-    : weights(num_clusters_, data_.rows()) // c x m
-    , data(data_)
+template <int Dim, gmm::CovarianceType Type>
+gmm::Model<Dim, Type>::Model(const Data& data_, int num_clusters_, const GMMOptions& options_,
+                             Stats* stats_)
+    : data(data_)
+    , options(options_)
     , num_clusters(num_clusters_)
-    , full_gmm{ full_gmm }
+    , top_k{ (options_.topK > 0 && options_.topK < num_clusters_) ? options_.topK : 0 }
+    , refresh_interval{ std::max(1, options_.topKRefresh) }
+    , variance_floor{ VARIANCE_FLOOR
+                      * (data_.mean_variance() > 0.0 ? data_.mean_variance() : 1.0) }
+    , stats{ stats_ }
 {
+    if (truncated())
+    {
+        sparse_weights.resize(data.rows(), top_k); // m x K
+        if (stats)
+            stats->add_alloc(sparse_weights.bytes());
+    }
+    else
+    {
+        weights.resize(num_clusters, data.rows()); // c x m
+        if (stats)
+            stats->add_alloc(weights.size() * sizeof(double));
+    }
 }
 
 namespace
@@ -43,8 +64,9 @@ namespace
 
 using namespace Eigen;
 
-void init_clusters(std::vector<gmm::Cluster>& clusters, int num_clusters, const gmm::Data& data,
-                   bool full_gmm)
+template <int Dim, gmm::CovarianceType Type>
+void init_clusters(std::vector<gmm::Cluster<Dim, Type>>& clusters, int num_clusters,
+                   const gmm::Data& data, gmm::Workspace& workspace)
 {
     if (static_cast<int>(clusters.size()) != num_clusters)
     {
@@ -53,51 +75,59 @@ void init_clusters(std::vector<gmm::Cluster>& clusters, int num_clusters, const
         for (int cidx = 0; cidx < num_clusters; ++cidx)
         {
             // std::cerr << "[INFO] \t cluster = " << cidx << '\n';
-            clusters.push_back({ cidx, data, num_clusters, full_gmm });
+            clusters.push_back({ cidx, data, num_clusters });
         }
     }
 
-    // obtain a time-based seed:
-    unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
-    std::vector<int> sample_indices(data.rows());
-    for (int sample = 0; sample < data.rows(); ++sample)
-    {
-        sample_indices[sample] = sample;
-    }
-
-    std::shuffle(sample_indices.begin(), sample_indices.end(), std::default_random_engine(seed));
-
+    const auto& seeds = workspace.select_seeds(num_clusters, data.rows());
     for (int cluster = 0; cluster < num_clusters; ++cluster)
     {
-        const int sample = sample_indices[cluster];
-        clusters[cluster].init(sample);
+        clusters[cluster].init(seeds[cluster % seeds.size()]);
     }
 }
 
 } // anonymous namespace
 
-double gmm::Model::fit(int num_epochs, int num_iterations)
+template <int Dim, gmm::CovarianceType Type>
+double gmm::Model<Dim, Type>::fit(int num_epochs, int num_iterations, Workspace& workspace)
 {
+    trace::Span<trace::FIT> span("Model::fit", num_clusters);
     double bic{ 1.0E10 };
-    std::vector<gmm::Cluster> epoch_clusters;
-    MatrixXd epoch_weights{ num_clusters, data.rows() };
+    std::vector<gmm::Cluster<Dim, Type>> epoch_clusters;
+    MatrixXd* epoch_weights
+        = truncated() ? nullptr : &workspace.epoch_weights(num_clusters, data.rows());
+    SparseResponsibilities* epoch_sparse_weights
+        = truncated() ? &workspace.epoch_sparse_weights(data.rows(), top_k) : nullptr;
+    if (stats)
+        stats->add_candidate(num_epochs);
     // data.display();
 
     for (int epoch = 0; epoch < num_epochs; ++epoch)
     {
-        // std::cerr << "[INFO] epoch = " << epoch << " started.\n";
-        // No need to initialize weights.
-        init_clusters(epoch_clusters, num_clusters, data, full_gmm);
-        writeLog("\tEpoch#%d : ", epoch);
-        double epoch_bic = run_epoch(num_iterations, epoch_weights, epoch_clusters);
-        writeLog("\n\tepoch_bic = %f\n", epoch_bic);
+        trace::Span<trace::EPOCH> epoch_span("epoch", epoch);
+        {
+            // No need to initialize weights.
+            trace::Span<trace::STEP> init_span("init");
+            Stats::Timer timer(stats, Stats::INIT);
+            init_clusters(epoch_clusters, num_clusters, data, workspace);
+        }
+        double epoch_bic
+            = truncated()
+                  ? run_truncated_epoch(num_iterations, *epoch_sparse_weights, epoch_clusters,
+                                        workspace)
+                  : run_epoch(num_iterations, *epoch_weights, epoch_clusters, workspace);
+        writeLog("\tEpoch#%d : epoch_bic = %f\n", epoch, epoch_bic);
 
         if (epoch_bic < bic)
         {
-            const auto& better_weights{ epoch_weights };
             // Optimization: No need to save epoch_clusters as we can determine
-            // best cluster allocation from epoch_weights.
-            weights = better_weights; // Uses copy ctor.
+            // best cluster allocation from epoch_weights. The previous best buffer
+            // becomes the scratch buffer of the next epoch, so nothing is copied.
+            if (truncated())
+                sparse_weights.swap(*epoch_sparse_weights);
+            else
+                weights.swap(*epoch_weights);
+            keep_clusters(epoch_clusters);
             writeLog("Improvement in global bic from %f to %f\n", bic, epoch_bic);
             bic = epoch_bic;
         }
@@ -112,15 +142,237 @@ double gmm::Model::fit(int num_epochs, int num_iterations)
             std::cerr << "Cluster#" << cluster << ":\n";
             std::cerr << "phi = " << ecluster.phi << '\n';
             std::cerr << "mu = \n" << ecluster.mu << '\n';
-            if (ecluster.full_gmm)
-                std::cerr << "sigma = \n" << *ecluster.sigma << '\n';
+            std::cerr << "sigma = \n" << ecluster.cov.matrix() << '\n';
         }
     }
 
     return bic;
 }
 
-void gmm::Model::get_labels(int* labels, double* confidence_scores) const
+template <int Dim, gmm::CovarianceType Type>
+void gmm::Model<Dim, Type>::keep_clusters(const std::vector<Cluster<Dim, Type>>& epoch_clusters)
+{
+    // Cluster is not assignable (it refers to the data), so copy construct.
+    best_clusters.clear();
+    best_clusters.reserve(epoch_clusters.size());
+    for (const auto& ecluster : epoch_clusters)
+        best_clusters.push_back(ecluster);
+}
+
+template <int Dim, gmm::CovarianceType Type>
+void gmm::Model<Dim, Type>::refine(std::vector<Cluster<Dim, Type>>& start_clusters,
+                                   int num_iterations, Workspace& workspace)
+{
+    trace::Span<trace::FIT> span("Model::refine", num_clusters);
+    if (stats)
+        stats->add_candidate(1);
+
+    for (int cluster = 0; cluster < num_clusters; ++cluster)
+    {
+        start_clusters[cluster].idx = cluster;
+        start_clusters[cluster].num_clusters = num_clusters;
+    }
+
+    double bic;
+    if (truncated())
+    {
+        auto& epoch_sparse_weights = workspace.epoch_sparse_weights(data.rows(), top_k);
+        bic = run_truncated_epoch(num_iterations, epoch_sparse_weights, start_clusters,
+                                  workspace);
+        sparse_weights.swap(epoch_sparse_weights);
+    }
+    else
+    {
+        auto& epoch_weights = workspace.epoch_weights(num_clusters, data.rows());
+        bic = run_epoch(num_iterations, epoch_weights, start_clusters, workspace);
+        weights.swap(epoch_weights);
+    }
+    keep_clusters(start_clusters);
+    writeLog("\tRefined #clusters = %d : bic = %f\n", num_clusters, bic);
+}
+
+template <int Dim, gmm::CovarianceType Type>
+double gmm::Model<Dim, Type>::information_criterion() const
+{
+    if (best_clusters.empty())
+        return std::numeric_limits<double>::quiet_NaN();
+
+    const int m = samples();
+    const int n = dims();
+    const int c = clusters();
+    double log_likelihood{ 0.0 };
+    for (int sample = 0; sample < m; ++sample)
+    {
+        double density{ 0.0 };
+        for (int cluster = 0; cluster < c; ++cluster)
+            density += best_clusters[cluster].sample_probability(sample);
+        log_likelihood += data.weight(sample) * std::log(density);
+    }
+
+    const int covariances = Covariance<Dim, Type>::SHARED ? 1 : c;
+    const double parameters
+        = (c - 1) + c * n + covariances * Covariance<Dim, Type>::parameters(n);
+    return -2.0 * log_likelihood + parameters * std::log(data.total_weight());
+}
+
+template <int Dim, gmm::CovarianceType Type>
+std::unique_ptr<gmm::MixtureModel> gmm::Model<Dim, Type>::split(int num_iterations,
+                                                                Workspace& workspace) const
+{
+    using Square = typename Covariance<Dim, Type>::Square;
+    using Vector = typename Cluster<Dim, Type>::Vector;
+    if (best_clusters.empty())
+        return nullptr;
+
+    const int m = samples();
+    const int n = dims();
+    const int c = clusters();
+
+    // The worst fit is taken to be the cluster with the largest share of the scatter.
+    int widest = 0;
+    double widest_scatter{ -1.0 };
+    for (int cluster = 0; cluster < c; ++cluster)
+    {
+        const auto& bcluster = best_clusters[cluster];
+        const double scatter = bcluster.phi * bcluster.cov.matrix().trace();
+        if (scatter > widest_scatter)
+        {
+            widest = cluster;
+            widest_scatter = scatter;
+        }
+    }
+
+    // Its scatter matrix from the responsibilities, as the fitted covariance may be diagonal or
+    // spherical and so does not show the direction in which the cluster is spread.
+    const auto& parent = best_clusters[widest];
+    Square scatter = Square::Zero(n, n);
+    Vector diff(n);
+    double scatter_weight{ 0.0 };
+    for (int sample = 0; sample < m; ++sample)
+    {
+        double density{ 0.0 };
+        for (int cluster = 0; cluster < c; ++cluster)
+            density += best_clusters[cluster].sample_probability(sample);
+        if (!(density > 0.0))
+            continue;
+        const double wt = data.weight(sample) * parent.sample_probability(sample) / density;
+        diff = data.point<Dim>(sample) - parent.mu;
+        scatter.noalias() += wt * diff * diff.transpose();
+        scatter_weight += wt;
+    }
+    if (!(scatter_weight > 0.0))
+        return nullptr;
+    scatter /= scatter_weight;
+
+    // Cut the cluster through its mean across the principal axis. Each half of a Gaussian has
+    // its mean sqrt(2 lambda / pi) along the axis and 2 lambda / pi less variance along it.
+    SelfAdjointEigenSolver<Square> eigen(scatter);
+    const double lambda = std::max(eigen.eigenvalues()(n - 1), 0.0);
+    const Vector axis = eigen.eigenvectors().col(n - 1);
+    const Vector offset = std::sqrt(2.0 * lambda / M_PI) * axis;
+    Square half = scatter;
+    half.noalias() -= (2.0 * lambda / M_PI) * axis * axis.transpose();
+
+    std::vector<Cluster<Dim, Type>> start_clusters(best_clusters);
+    start_clusters.push_back(parent);
+    auto& first = start_clusters[widest];
+    auto& second = start_clusters.back();
+    first.mu += offset;
+    second.mu -= offset;
+    for (auto* halved : { &first, &second })
+    {
+        halved->cov.set(half);
+        halved->phi *= 0.5;
+    }
+
+    auto model = std::make_unique<Model>(data, c + 1, options, stats);
+    model->refine(start_clusters, num_iterations, workspace);
+    return model;
+}
+
+template <int Dim, gmm::CovarianceType Type>
+std::unique_ptr<gmm::MixtureModel> gmm::Model<Dim, Type>::merge(int num_iterations,
+                                                                Workspace& workspace) const
+{
+    using Square = typename Covariance<Dim, Type>::Square;
+    using Vector = typename Cluster<Dim, Type>::Vector;
+    const int c = clusters();
+    if (best_clusters.empty() || c <= 2)
+        return nullptr;
+
+    const int n = dims();
+    std::vector<double> log_determinants(c);
+    for (int cluster = 0; cluster < c; ++cluster)
+    {
+        const LLT<Square> llt(best_clusters[cluster].cov.matrix());
+        log_determinants[cluster]
+            = 2.0 * llt.matrixLLT().diagonal().array().log().sum();
+    }
+
+    // The closest pair by Bhattacharyya distance.
+    int first = -1;
+    int second = -1;
+    double closest{ DBL_MAX };
+    Vector diff(n);
+    for (int one = 0; one < c; ++one)
+    {
+        for (int other = one + 1; other < c; ++other)
+        {
+            const auto& lhs = best_clusters[one];
+            const auto& rhs = best_clusters[other];
+            const Square mean_sigma = 0.5 * (lhs.cov.matrix() + rhs.cov.matrix());
+            const LLT<Square> llt(mean_sigma);
+            if (llt.info() != Success)
+                continue;
+            diff = lhs.mu - rhs.mu;
+            const double distance
+                = 0.125 * diff.dot(llt.solve(diff))
+                  + 0.5
+                        * (2.0 * llt.matrixLLT().diagonal().array().log().sum()
+                           - 0.5 * (log_determinants[one] + log_determinants[other]));
+            if (distance < closest)
+            {
+                first = one;
+                second = other;
+                closest = distance;
+            }
+        }
+    }
+    if (first < 0)
+        return nullptr;
+
+    // Replace the pair by the Gaussian with the same first two moments as their mixture.
+    const auto& lhs = best_clusters[first];
+    const auto& rhs = best_clusters[second];
+    const double phi = lhs.phi + rhs.phi;
+    if (!(phi > 0.0))
+        return nullptr;
+    const Vector mu = (lhs.phi * lhs.mu + rhs.phi * rhs.mu) / phi;
+    Square sigma = (lhs.phi / phi) * lhs.cov.matrix() + (rhs.phi / phi) * rhs.cov.matrix();
+    diff = lhs.mu - mu;
+    sigma.noalias() += (lhs.phi / phi) * diff * diff.transpose();
+    diff = rhs.mu - mu;
+    sigma.noalias() += (rhs.phi / phi) * diff * diff.transpose();
+
+    std::vector<Cluster<Dim, Type>> start_clusters;
+    start_clusters.reserve(c - 1);
+    for (int cluster = 0; cluster < c; ++cluster)
+    {
+        if (cluster != second)
+            start_clusters.push_back(best_clusters[cluster]);
+    }
+    auto& merged = start_clusters[first];
+    merged.mu = mu;
+    merged.cov.set(sigma);
+    merged.phi = phi;
+
+    auto model = std::make_unique<Model>(data, c - 1, options, stats);
+    model->refine(start_clusters, num_iterations, workspace);
+    return model;
+}
+
+template <int Dim, gmm::CovarianceType Type>
+void gmm::Model<Dim, Type>::get_labels(int* labels, double* confidence_scores) const
 {
     if (!labels || !confidence_scores)
     {
@@ -128,10 +380,31 @@ void gmm::Model::get_labels(int* labels, double* confidence_scores) const
             "Model::get_labels: no labels or confidence_scores array to store to.");
     }
 
-    const int m{ samples() };
+    const int rows{ data.input_rows() };
     const int c{ clusters() };
-    for (int sample = 0; sample < m; ++sample)
+    if (truncated())
+    {
+        // The kept responsibilities are already normalized.
+        for (int row = 0; row < rows; ++row)
+        {
+            const size_t offset{ static_cast<size_t>(data.point_of(row)) * top_k };
+            labels[row] = -1;
+            confidence_scores[row] = -1.0;
+            for (int entry = 0; entry < top_k; ++entry)
+            {
+                if (sparse_weights.weights[offset + entry] > confidence_scores[row])
+                {
+                    labels[row] = sparse_weights.clusters[offset + entry];
+                    confidence_scores[row] = sparse_weights.weights[offset + entry];
+                }
+            }
+        }
+        return;
+    }
+
+    for (int row = 0; row < rows; ++row)
     {
+        const int sample{ data.point_of(row) };
         double best_confidence{ -1.0 };
         double sum{ 0.0 };
         for (int cluster = 0; cluster < c; ++cluster)
@@ -141,72 +414,83 @@ void gmm::Model::get_labels(int* labels, double* confidence_scores) const
             if (confidence > best_confidence)
             {
                 best_confidence = confidence;
-                labels[sample] = cluster;
-                confidence_scores[sample] = confidence;
+                labels[row] = cluster;
+                confidence_scores[row] = confidence;
             }
         }
 
         // Normalize the score.
-        confidence_scores[sample] /= sum;
+        confidence_scores[row] /= sum;
     }
 }
 
-double gmm::Model::run_epoch(int num_iterations, MatrixXd& epoch_weights,
-                             std::vector<gmm::Cluster>& epoch_clusters) const
+template <int Dim, gmm::CovarianceType Type>
+double gmm::Model<Dim, Type>::run_epoch(int num_iterations, MatrixXd& epoch_weights,
+                                        std::vector<gmm::Cluster<Dim, Type>>& epoch_clusters,
+                                        Workspace& workspace) const
 {
     double epoch_bic{ 1.0E10 };
-    for (int iter = 0; iter < num_iterations; ++iter)
+    double log_likelihood{ -DBL_MAX };
+    bool reseeded{ false };
+    int restarts = 0;
+    int iter = 0;
+    for (; iter < num_iterations; ++iter)
     {
-        double bic = compute_expectation(epoch_weights, epoch_clusters);
-        writeLog("%f ", bic);
+        trace::Span<trace::ITERATION> iter_span("iteration", iter);
+        std::vector<double>& normalizers = workspace.normalizers(samples());
+        double bic;
+        {
+            trace::Span<trace::STEP> estep_span("E-step");
+            Stats::Timer timer(stats, Stats::ESTEP);
+            bic = compute_expectation(epoch_weights, epoch_clusters, normalizers);
+            estep_span.set_arg(bic);
+        }
 
-        if (bic < epoch_bic && (epoch_bic - bic > EPSILON))
+        // EM never lowers the likelihood, so its gain per row tells when the epoch has
+        // converged. The confidence score in bic need not improve on the way, e.g. it worsens
+        // while the covariances grow from their initial size. A reseeded cluster restarts the
+        // check as it may cost some likelihood first, at most clusters() times so that a cluster
+        // that keeps collapsing does not hold the epoch until num_iterations.
+        double new_log_likelihood{ 0.0 };
+        for (int sample = 0; sample < samples(); ++sample)
+            new_log_likelihood += data.weight(sample) * std::log(normalizers[sample]);
+        const double gain = (new_log_likelihood - log_likelihood) / data.total_weight();
+        if (reseeded || gain > EPSILON || (bic < epoch_bic && (epoch_bic - bic > EPSILON)))
         {
             epoch_bic = bic;
+            log_likelihood = new_log_likelihood;
         }
         else
         {
             break;
         }
 
-        // std::cerr << "[INFO] \t\t iter = " << iter << " bic = " << bic << '\n';
-        maximize_likelihood(epoch_weights, epoch_clusters);
+        trace::Span<trace::STEP> mstep_span("M-step");
+        Stats::Timer timer(stats, Stats::MSTEP);
+        reseeded = maximize_likelihood(epoch_weights, normalizers, epoch_clusters, workspace) > 0
+                   && ++restarts <= clusters();
     }
 
-    writeLog("\n[INFO] Best BIC score of epoch = %f\n", epoch_bic);
+    if (stats)
+        stats->add_epoch(iter);
     return epoch_bic;
 }
 
-double gmm::Model::compute_expectation(MatrixXd& epoch_weights,
-                                       const std::vector<gmm::Cluster>& epoch_clusters) const
+template <int Dim, gmm::CovarianceType Type>
+double gmm::Model<Dim, Type>::compute_expectation(
+    MatrixXd& epoch_weights, const std::vector<gmm::Cluster<Dim, Type>>& epoch_clusters,
+    std::vector<double>& normalizers) const
 {
     const int m = samples();
     const int c = clusters();
     double bic = 0.0;
-    std::vector<double> normalizers(m, 0.0);
+    // epoch_weights is column major, so the weights of one cluster are c apart.
     for (int cluster = 0; cluster < c; ++cluster)
+        epoch_clusters[cluster].sample_probabilities(epoch_weights.data() + cluster, c);
+    for (int sample = 0; sample < m; ++sample)
     {
-        const auto& ecluster = epoch_clusters[cluster];
-        if (full_gmm)
-        {
-            const auto cov_inverse = ecluster.inv_covar_matrix();
-            const double cov_determinant = ecluster.cov_determinant();
-            for (int sample = 0; sample < m; ++sample)
-            {
-                double wt = ecluster.sample_probability(sample, cov_inverse, cov_determinant);
-                epoch_weights(cluster, sample) = wt;
-                normalizers[sample] += wt;
-            }
-        }
-        else
-        {
-            for (int sample = 0; sample < m; ++sample)
-            {
-                double wt = ecluster.sample_probability(sample);
-                epoch_weights(cluster, sample) = wt;
-                normalizers[sample] += wt;
-            }
-        }
+        for (int cluster = 0; cluster < c; ++cluster)
+            normalizers[sample] += epoch_weights(cluster, sample);
     }
 
     // std::cerr << "\n[Best cluster allocation] : ";
@@ -231,113 +515,568 @@ double gmm::Model::compute_expectation(MatrixXd& epoch_weights,
                 best_cluster_weight = wt;
             }
         }
-        bic += (-std::log(std::abs(best_cluster_weight)));
+        bic += data.weight(sample) * (-std::log(std::abs(best_cluster_weight)));
     }
 
     return bic;
 }
 
-void gmm::Model::maximize_likelihood(const MatrixXd& epoch_weights,
-                                     std::vector<Cluster>& epoch_clusters) const
+template <int Dim, gmm::CovarianceType Type>
+int gmm::Model<Dim, Type>::maximize_likelihood(
+    const MatrixXd& epoch_weights, const std::vector<double>& normalizers,
+    std::vector<Cluster<Dim, Type>>& epoch_clusters, Workspace& workspace) const
 {
     const int m = samples();
-    const int n = dims();
     const int c = clusters();
+    std::vector<double>& cluster_weights = workspace.cluster_weights(c);
 
-    // update phi and mu. Also initialize sigma to zero matrix.
+    // update phi and mu. Also initialize sigma to zero.
     for (int cluster = 0; cluster < c; ++cluster)
     {
         auto& ecluster{ epoch_clusters[cluster] };
         ecluster.clear_mu_sigma();
-        double cluster_weight{ 0.0 };
+        double& cluster_weight{ cluster_weights[cluster] };
         for (int sample = 0; sample < m; ++sample)
         {
-            double wt = epoch_weights(cluster, sample);
+            double wt = epoch_weights(cluster, sample) * data.weight(sample);
             cluster_weight += wt;
-            ecluster.mu += (wt * data(sample).reshaped(n, 1));
+            ecluster.mu += wt * data.point<Dim>(sample);
         }
-        ecluster.phi = cluster_weight / m;
-        //if (cluster_weight > DBL_MIN)
-        {
+        ecluster.phi = cluster_weight / data.total_weight();
+        if (cluster_weight > 0.0)
             ecluster.mu /= cluster_weight;
-        }
     }
+    const int reseeded = reseed_collapsed(cluster_weights, normalizers, epoch_clusters);
 
     // Update sigma
-    if (full_gmm)
+    std::vector<double>& sample_weights = workspace.sample_weights(Dim == Dynamic ? m : 0);
+    for (int cluster = 0; cluster < c; ++cluster)
     {
-        for (int cluster = 0; cluster < c; ++cluster)
+        if (cluster_weights[cluster] <= 0.0)
+            continue;
+        auto& ecluster{ epoch_clusters[cluster] };
+        if constexpr (Dim == Dynamic)
         {
-            auto& ecluster{ epoch_clusters[cluster] };
-            double cluster_weight{ 0.0 };
+            for (int sample = 0; sample < m; ++sample)
+                sample_weights[sample] = epoch_weights(cluster, sample) * data.weight(sample);
+            ecluster.cov.accumulate_all(m, data.points(), ecluster.mu.data(),
+                                        sample_weights.data());
+        }
+        else
+        {
+            auto& diff = ecluster.diff;
             for (int sample = 0; sample < m; ++sample)
             {
-                double wt = epoch_weights(cluster, sample);
-                cluster_weight += wt;
-
-                MatrixXd x = data(sample).reshaped(n, 1);
-                (*ecluster.sigma) += (wt * ((x - ecluster.mu) * (x - ecluster.mu).transpose()));
+                diff = data.point<Dim>(sample) - ecluster.mu;
+                ecluster.cov.accumulate(epoch_weights(cluster, sample) * data.weight(sample),
+                                        diff);
             }
+        }
+    }
 
-            // if (cluster_weight > DBL_MIN)
-            if (full_gmm)
-            {
-                (*ecluster.sigma) /= cluster_weight;
-            }
+    finish_covariances(cluster_weights, epoch_clusters);
+    return reseeded;
+}
+
+template <int Dim, gmm::CovarianceType Type>
+int gmm::Model<Dim, Type>::reseed_collapsed(std::vector<double>& cluster_weights,
+                                            const std::vector<double>& normalizers,
+                                            std::vector<Cluster<Dim, Type>>& epoch_clusters) const
+{
+    const int c = clusters();
+    std::vector<int> collapsed;
+    for (int cluster = 0; cluster < c; ++cluster)
+    {
+        if (!(cluster_weights[cluster] >= MIN_CLUSTER_WEIGHT)
+            || !epoch_clusters[cluster].mu.allFinite())
+            collapsed.push_back(cluster);
+    }
+    if (collapsed.empty())
+        return 0;
+
+    // The samples with the smallest mixture density are the ones explained worst.
+    const int m = samples();
+    const int count = std::min(static_cast<int>(collapsed.size()), m);
+    std::vector<int> worst(m);
+    std::iota(worst.begin(), worst.end(), 0);
+    std::partial_sort(worst.begin(), worst.begin() + count, worst.end(),
+                      [&normalizers](int lhs, int rhs)
+                      { return normalizers[lhs] < normalizers[rhs]; });
+    for (size_t idx = 0; idx < collapsed.size(); ++idx)
+    {
+        epoch_clusters[collapsed[idx]].init(worst[idx % count]);
+        cluster_weights[collapsed[idx]] = 0.0;
+    }
+
+    double phi_sum{ 0.0 };
+    for (const auto& ecluster : epoch_clusters)
+        phi_sum += ecluster.phi;
+    for (auto& ecluster : epoch_clusters)
+        ecluster.phi /= phi_sum;
+
+    writeLog("\tReseeded %d collapsed clusters\n", static_cast<int>(collapsed.size()));
+    if (stats)
+        stats->add_reseeded(static_cast<int>(collapsed.size()));
+    return static_cast<int>(collapsed.size());
+}
+
+template <int Dim, gmm::CovarianceType Type>
+void gmm::Model<Dim, Type>::finish_covariances(
+    const std::vector<double>& cluster_weights,
+    std::vector<Cluster<Dim, Type>>& epoch_clusters) const
+{
+    const int c = clusters();
+    if constexpr (Covariance<Dim, Type>::SHARED)
+    {
+        // Pool the scatter of all the clusters into the first one with any weight.
+        int pooled = -1;
+        double pooled_weight = 0.0;
+        for (int cluster = 0; cluster < c; ++cluster)
+        {
+            if (cluster_weights[cluster] <= 0.0)
+                continue;
+            pooled_weight += cluster_weights[cluster];
+            if (pooled < 0)
+                pooled = cluster;
+            else
+                epoch_clusters[pooled].cov.add(epoch_clusters[cluster].cov);
+        }
+        if (pooled < 0)
+            return;
+
+        if (epoch_clusters[pooled].cov.finish(pooled_weight, variance_floor) && stats)
+            stats->add_regularized(1);
+        for (int cluster = 0; cluster < c; ++cluster)
+        {
+            if (cluster != pooled)
+                epoch_clusters[cluster].cov = epoch_clusters[pooled].cov;
         }
     }
     else
     {
+        int regularized = 0;
         for (int cluster = 0; cluster < c; ++cluster)
         {
+            if (cluster_weights[cluster] > 0.0
+                && epoch_clusters[cluster].cov.finish(cluster_weights[cluster], variance_floor))
+                ++regularized;
+        }
+        if (stats)
+            stats->add_regularized(regularized);
+    }
+}
+
+template <int Dim, gmm::CovarianceType Type>
+double gmm::Model<Dim, Type>::run_truncated_epoch(
+    int num_iterations, SparseResponsibilities& epoch_weights,
+    std::vector<gmm::Cluster<Dim, Type>>& epoch_clusters, Workspace& workspace) const
+{
+    double epoch_bic{ 1.0E10 };
+    bool refresh{ true };
+    bool reseeded{ false };
+    int restarts = 0;
+    int iter = 0;
+    for (int since_refresh = 0; iter < num_iterations; ++iter, ++since_refresh)
+    {
+        trace::Span<trace::ITERATION> iter_span("iteration", iter);
+        refresh = refresh || since_refresh >= refresh_interval;
+        if (refresh)
+            since_refresh = 0;
+        std::vector<double>& normalizers = workspace.normalizers(samples());
+        double bic;
+        {
+            trace::Span<trace::STEP> estep_span("E-step");
+            Stats::Timer timer(stats, Stats::ESTEP);
+            bic = compute_truncated_expectation(epoch_weights, epoch_clusters, refresh,
+                                                normalizers);
+            estep_span.set_arg(bic);
+        }
+
+        // As in run_epoch(), a reseeded cluster may cost some score first, so the next E-step does
+        // not end the epoch, at most clusters() times.
+        if (reseeded || (bic < epoch_bic && (epoch_bic - bic > EPSILON)))
+        {
+            epoch_bic = bic;
+            refresh = false;
+        }
+        else if (refresh)
+        {
+            break;
+        }
+        else
+        {
+            // The kept clusters may be stale, so look at all of them before giving up.
+            refresh = true;
+            continue;
+        }
+
+        trace::Span<trace::STEP> mstep_span("M-step");
+        Stats::Timer timer(stats, Stats::MSTEP);
+        const int collapsed
+            = maximize_truncated_likelihood(epoch_weights, normalizers, epoch_clusters, workspace);
+        // A reseeded cluster is in no sample's kept list until all clusters are looked at.
+        if (collapsed > 0)
+            refresh = true;
+        reseeded = collapsed > 0 && ++restarts <= clusters();
+    }
+
+    if (stats)
+        stats->add_epoch(iter);
+    return epoch_bic;
+}
+
+template <int Dim, gmm::CovarianceType Type>
+void gmm::Model<Dim, Type>::keep_largest_densities(
+    int sample, const std::vector<gmm::Cluster<Dim, Type>>& epoch_clusters, int* kept_clusters,
+    double* kept_weights) const
+{
+    // Insert every cluster into the descending list of the top_k largest densities.
+    const int c = clusters();
+    std::fill_n(kept_clusters, top_k, 0);
+    std::fill_n(kept_weights, top_k, -1.0);
+    for (int cluster = 0; cluster < c; ++cluster)
+    {
+        const double wt = epoch_clusters[cluster].sample_probability(sample);
+        if (!(wt > kept_weights[top_k - 1]))
+            continue;
+        int pos = top_k - 1;
+        for (; pos > 0 && kept_weights[pos - 1] < wt; --pos)
+        {
+            kept_weights[pos] = kept_weights[pos - 1];
+            kept_clusters[pos] = kept_clusters[pos - 1];
+        }
+        kept_weights[pos] = wt;
+        kept_clusters[pos] = cluster;
+    }
+}
+
+template <int Dim, gmm::CovarianceType Type>
+double gmm::Model<Dim, Type>::kept_density(double* kept_weights) const
+{
+    double density{ 0.0 };
+    for (int entry = 0; entry < top_k; ++entry)
+    {
+        kept_weights[entry] = std::max(kept_weights[entry], 0.0);
+        density += kept_weights[entry];
+    }
+    return density;
+}
+
+template <int Dim, gmm::CovarianceType Type>
+double gmm::Model<Dim, Type>::compute_truncated_expectation(
+    SparseResponsibilities& epoch_weights,
+    const std::vector<gmm::Cluster<Dim, Type>>& epoch_clusters, bool refresh,
+    std::vector<double>& normalizers) const
+{
+    const int m = samples();
+    double bic = 0.0;
+    for (int sample = 0; sample < m; ++sample)
+    {
+        const size_t offset{ static_cast<size_t>(sample) * top_k };
+        int* kept_clusters = epoch_weights.clusters.data() + offset;
+        double* kept_weights = epoch_weights.weights.data() + offset;
+        if (refresh)
+        {
+            keep_largest_densities(sample, epoch_clusters, kept_clusters, kept_weights);
+        }
+        else
+        {
+            for (int entry = 0; entry < top_k; ++entry)
+                kept_weights[entry]
+                    = epoch_clusters[kept_clusters[entry]].sample_probability(sample);
+        }
+
+        double normalizer = kept_density(kept_weights);
+        if (!(normalizer > 0.0) && !refresh)
+        {
+            // All the kept densities underflowed, the sample may now belong to other clusters.
+            keep_largest_densities(sample, epoch_clusters, kept_clusters, kept_weights);
+            normalizer = kept_density(kept_weights);
+        }
+        normalizers[sample] = normalizer;
+        if (!(normalizer > 0.0))
+        {
+            // Too far from every cluster to tell them apart, spread the sample evenly.
+            std::fill_n(kept_weights, top_k, 1.0);
+            normalizer = top_k;
+        }
+        double best_cluster_weight{ 0.0 };
+        for (int entry = 0; entry < top_k; ++entry)
+        {
+            kept_weights[entry] /= normalizer;
+            best_cluster_weight = std::max(best_cluster_weight, kept_weights[entry]);
+        }
+        bic += data.weight(sample) * (-std::log(std::abs(best_cluster_weight)));
+    }
+
+    return bic;
+}
+
+template <int Dim, gmm::CovarianceType Type>
+int gmm::Model<Dim, Type>::maximize_truncated_likelihood(
+    const SparseResponsibilities& epoch_weights, const std::vector<double>& normalizers,
+    std::vector<Cluster<Dim, Type>>& epoch_clusters, Workspace& workspace) const
+{
+    const int m = samples();
+    const int c = clusters();
+    std::vector<double>& cluster_weights = workspace.cluster_weights(c);
+    for (int sample = 0; sample < m; ++sample)
+    {
+        const size_t offset{ static_cast<size_t>(sample) * top_k };
+        for (int entry = 0; entry < top_k; ++entry)
+        {
+            cluster_weights[epoch_weights.clusters[offset + entry]]
+                += epoch_weights.weights[offset + entry] * data.weight(sample);
+        }
+    }
+
+    for (int cluster = 0; cluster < c; ++cluster)
+    {
+        if (cluster_weights[cluster] > 0.0)
+            epoch_clusters[cluster].clear_mu_sigma();
+    }
+
+    // update phi and mu.
+    for (int sample = 0; sample < m; ++sample)
+    {
+        const size_t offset{ static_cast<size_t>(sample) * top_k };
+        const auto x = data.point<Dim>(sample);
+        for (int entry = 0; entry < top_k; ++entry)
+        {
+            const int cluster{ epoch_weights.clusters[offset + entry] };
+            if (cluster_weights[cluster] <= 0.0)
+                continue;
+            const double wt = epoch_weights.weights[offset + entry] * data.weight(sample);
+            epoch_clusters[cluster].mu += wt * x;
+        }
+    }
+
+    for (int cluster = 0; cluster < c; ++cluster)
+    {
+        if (cluster_weights[cluster] <= 0.0)
+            continue;
+        auto& ecluster{ epoch_clusters[cluster] };
+        ecluster.phi = cluster_weights[cluster] / data.total_weight();
+        ecluster.mu /= cluster_weights[cluster];
+    }
+    // A cluster that is in no sample's top_k, or in too few, would keep a zero mixing weight and
+    // never come back, so it restarts like a collapsed one of the dense M-step.
+    const int reseeded = reseed_collapsed(cluster_weights, normalizers, epoch_clusters);
+
+    // Update sigma
+    for (int sample = 0; sample < m; ++sample)
+    {
+        const size_t offset{ static_cast<size_t>(sample) * top_k };
+        for (int entry = 0; entry < top_k; ++entry)
+        {
+            const int cluster{ epoch_weights.clusters[offset + entry] };
+            if (cluster_weights[cluster] <= 0.0)
+                continue;
             auto& ecluster{ epoch_clusters[cluster] };
-            double den = (m * ecluster.phi);
-            for (int dim = 0; dim < n; ++dim)
-            {
-                const double mean = ecluster.mu(dim, 0);
-                double num = 0.0;
-                for (int sample = 0; sample < m; ++sample)
-                {
-                    const double x = data(sample, dim);
-                    num += (epoch_weights(cluster, sample) * x * x);
-                }
-                (*ecluster.stds)[dim] = std::sqrt((num / den) - (mean * mean));
-            }
+            const double wt = epoch_weights.weights[offset + entry] * data.weight(sample);
+            ecluster.diff = data.point<Dim>(sample) - ecluster.mu;
+            ecluster.cov.accumulate(wt, ecluster.diff);
         }
     }
+
+    finish_covariances(cluster_weights, epoch_clusters);
+    return reseeded;
 }
 
+namespace
+{
+
+std::unique_ptr<gmm::PrincipalComponents> make_pca(const double* data, int rows, int cols,
+                                                   const GMMOptions& options, gmm::Stats* stats)
+{
+    if (!(options.pcaVariance > 0.0))
+        return nullptr;
+
+    gmm::Stats::Timer timer(stats, gmm::Stats::INIT);
+    auto pca = std::make_unique<gmm::PrincipalComponents>(data, rows, cols, options.pcaVariance,
+                                                          stats);
+    writeLog("PCA: %d of %d columns explain %f of the variance\n", pca->components(), cols,
+             pca->explained());
+    if (pca->components() >= cols)
+        return nullptr;
+    return pca;
+}
+
+} // anonymous namespace
+
 gmm::GMM::GMM(const double* data_, int rows_, int cols_, int min_clusters_, int max_clusters_,
-              int num_epochs_, int num_iterations_, bool full_gmm_)
-    : data{ data_, rows_, cols_ }
+              const GMMOptions& options_, Stats* stats_, const ColumnMoments* moments_)
+    : pca{ make_pca(data_, rows_, cols_, options_, stats_) }
+    , rows{ pca ? pca->projected() : data_, rows_, pca ? pca->components() : cols_ }
+    , data{ rows, pca ? nullptr : moments_ }
+    , options(options_)
     , min_clusters{ min_clusters_ }
     , max_clusters{ max_clusters_ }
-    , num_epochs{ num_epochs_ }
-    , num_iterations{ num_iterations_ }
-    , full_gmm{ full_gmm_ }
+    , stats{ stats_ }
+{
+}
+
+namespace
+{
+
+/// @brief Model<Dim, Type> for the number of columns of @p data.
+template <gmm::CovarianceType Type>
+std::unique_ptr<gmm::MixtureModel> make_fixed_model(const gmm::Data& data, int num_clusters,
+                                                    const GMMOptions& options, gmm::Stats* stats)
+{
+    // Fixed size vectors and matrices for the common small dimensions.
+    switch (data.cols())
+    {
+        case 1:
+            return std::make_unique<gmm::Model<1, Type>>(data, num_clusters, options, stats);
+        case 2:
+            return std::make_unique<gmm::Model<2, Type>>(data, num_clusters, options, stats);
+        case 3:
+            return std::make_unique<gmm::Model<3, Type>>(data, num_clusters, options, stats);
+        case 4:
+            return std::make_unique<gmm::Model<4, Type>>(data, num_clusters, options, stats);
+        case 5:
+            return std::make_unique<gmm::Model<5, Type>>(data, num_clusters, options, stats);
+        case 6:
+            return std::make_unique<gmm::Model<6, Type>>(data, num_clusters, options, stats);
+        case 7:
+            return std::make_unique<gmm::Model<7, Type>>(data, num_clusters, options, stats);
+        case 8:
+            return std::make_unique<gmm::Model<8, Type>>(data, num_clusters, options, stats);
+        default:
+            return std::make_unique<gmm::Model<Eigen::Dynamic, Type>>(data, num_clusters, options,
+                                                                      stats);
+    }
+}
+
+} // anonymous namespace
+
+std::unique_ptr<gmm::MixtureModel> gmm::GMM::make_model(int num_clusters) const
 {
+    if (variational())
+        return std::make_unique<VariationalModel>(data, num_clusters, options, stats);
+    if (tree)
+        return std::make_unique<TreeModel>(*tree, data, num_clusters, options, stats);
+
+    switch (covariance_type(options.fullGMM))
+    {
+        case CovarianceType::DIAGONAL:
+            return make_fixed_model<CovarianceType::DIAGONAL>(data, num_clusters, options, stats);
+        case CovarianceType::SPHERICAL:
+            return make_fixed_model<CovarianceType::SPHERICAL>(data, num_clusters, options, stats);
+        case CovarianceType::TIED:
+            return make_fixed_model<CovarianceType::TIED>(data, num_clusters, options, stats);
+        case CovarianceType::FULL:
+        default:
+            return make_fixed_model<CovarianceType::FULL>(data, num_clusters, options, stats);
+    }
 }
 
 void gmm::GMM::fit()
 {
+    Workspace workspace(stats);
+    fit(workspace);
+}
+
+void gmm::GMM::fit(Workspace& workspace)
+{
+    trace::Span<trace::FIT> span("GMM::fit");
     double best_bic{ 1.0E10 };
     int best_numclusters = min_clusters;
-    for (int clusters = min_clusters; clusters <= max_clusters; ++clusters)
+    workspace.set_statistics(stats);
+    if (options.seed)
+        workspace.seed(options.seed);
+    if (stats)
+    {
+        stats->set_unique_rows(data.rows());
+        stats->set_pca_components(pca ? pca->components() : 0);
+    }
+    if (options.treeTolerance > 0.0 && data.cols() <= KDTree::MAX_DIMS && !variational()
+        && !order_search())
+    {
+        Stats::Timer timer(stats, Stats::INIT);
+        tree = std::make_unique<KDTree>(data);
+    }
+
+    if (order_search())
+    {
+        search_order(workspace);
+        return;
+    }
+
+    // A variational fit picks the number of clusters itself, from a single upper bound.
+    const int first = variational() ? options.vbMaxClusters : min_clusters;
+    const int last = variational() ? options.vbMaxClusters : max_clusters;
+    for (int clusters = first; clusters <= last; ++clusters)
     {
         writeLog("\nFitting for #clusters = %d\n", clusters);
-        auto model{ std::make_unique<Model>(data, clusters, full_gmm) };
-        double bic = model->fit(num_epochs, num_iterations);
-        if (bic < best_bic)
+        auto model{ make_model(clusters) };
+        double bic = model->fit(options.numEpochs, options.numIterations, workspace);
+        if (!best_model || bic < best_bic)
         {
             best_model = std::move(model);
             best_bic = bic;
-            best_numclusters = clusters;
+            best_numclusters = best_model->clusters();
         }
     }
 
+    if (stats)
+        stats->set_best_clusters(best_numclusters);
     writeLog("\nBest model BIC score = %f, num clusters = %d\n", best_bic, best_numclusters);
 }
 
+void gmm::GMM::search_order(Workspace& workspace)
+{
+    // Only the smallest count is fitted from scratch, each larger one splits a cluster of the
+    // previous. Going back down, merging two clusters of the next larger count replaces a count
+    // when that scores better, as the splits can leave it in a poor local optimum.
+    std::vector<std::unique_ptr<MixtureModel>> models; // models[idx] has idx + 2 clusters
+    models.push_back(make_model(2));
+    models.back()->fit(options.numEpochs, options.numIterations, workspace);
+    while (models.back()->clusters() < options.orderSearchMaxClusters
+           && models.back()->clusters() < data.rows())
+    {
+        writeLog("\nSplitting to #clusters = %d\n", models.back()->clusters() + 1);
+        auto model{ models.back()->split(options.numIterations, workspace) };
+        if (!model)
+            break;
+        models.push_back(std::move(model));
+    }
+
+    std::vector<double> scores(models.size());
+    {
+        Stats::Timer timer(stats, Stats::SELECT);
+        for (size_t idx = 0; idx < models.size(); ++idx)
+            scores[idx] = models[idx]->information_criterion();
+    }
+    for (int idx = static_cast<int>(models.size()) - 2; idx >= 0; --idx)
+    {
+        writeLog("\nMerging to #clusters = %d\n", models[idx]->clusters());
+        auto model{ models[idx + 1]->merge(options.numIterations, workspace) };
+        if (!model)
+            continue;
+        Stats::Timer timer(stats, Stats::SELECT);
+        const double score = model->information_criterion();
+        if (score < scores[idx] || std::isnan(scores[idx]))
+        {
+            models[idx] = std::move(model);
+            scores[idx] = score;
+        }
+    }
+
+    size_t best = 0;
+    for (size_t idx = 1; idx < models.size(); ++idx)
+    {
+        if (scores[idx] < scores[best] || std::isnan(scores[best]))
+            best = idx;
+    }
+    best_model = std::move(models[best]);
+    if (stats)
+        stats->set_best_clusters(best_model->clusters());
+    writeLog("\nBest model BIC = %f, num clusters = %d\n", scores[best],
+             best_model->clusters());
+}
+
 void gmm::GMM::get_labels(int* labels, double* confidence_scores) const
 {
     if (!best_model)
@@ -347,3 +1086,19 @@ void gmm::GMM::get_labels(int* labels, double* confidence_scores) const
 
     best_model->get_labels(labels, confidence_scores);
 }
+
+#define CR_INSTANTIATE_MODEL(Dim)                                                                 \
+    template class gmm::Model<Dim, gmm::CovarianceType::DIAGONAL>;                               \
+    template class gmm::Model<Dim, gmm::CovarianceType::FULL>;                                   \
+    template class gmm::Model<Dim, gmm::CovarianceType::SPHERICAL>;                              \
+    template class gmm::Model<Dim, gmm::CovarianceType::TIED>;
+
+CR_INSTANTIATE_MODEL(1)
+CR_INSTANTIATE_MODEL(2)
+CR_INSTANTIATE_MODEL(3)
+CR_INSTANTIATE_MODEL(4)
+CR_INSTANTIATE_MODEL(5)
+CR_INSTANTIATE_MODEL(6)
+CR_INSTANTIATE_MODEL(7)
+CR_INSTANTIATE_MODEL(8)
+CR_INSTANTIATE_MODEL(Eigen::Dynamic)
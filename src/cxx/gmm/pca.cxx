@@ -0,0 +1,119 @@
+/*
+ * ClusterRows
+ * Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gmm/pca.hxx>
+#include <gmm/data.hxx>
+#include <svd.hxx>
+
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+
+namespace
+{
+
+using namespace Eigen;
+
+/// @brief Orthonormal basis of the columns of @p mat (thin Q of its QR decomposition).
+MatrixXd orthonormalize(const MatrixXd& mat)
+{
+    HouseholderQR<MatrixXd> qr(mat);
+    return qr.householderQ() * MatrixXd::Identity(mat.rows(), mat.cols());
+}
+
+} // anonymous namespace
+
+gmm::PrincipalComponents::PrincipalComponents(const double* data, int rows, int cols,
+                                              double explained_variance, Stats* stats)
+    : num_components{ cols }
+    , explained_fraction{ 1.0 }
+{
+    const Map<const MatrixXdRM> x(data, rows, cols);
+    const RowVectorXd mean = x.colwise().mean();
+    const double total_variance = x.rowwise().squaredNorm().mean() - mean.squaredNorm();
+    if (rows < 2 || cols < 2 || !(total_variance > 0.0))
+        return;
+
+    // Products with the centred rows without materializing them: (x - 1 mean) * m.
+    const auto centred_times = [&](const MatrixXd& right) -> MatrixXd
+    { return (x * right).rowwise() - mean * right; };
+    const auto centred_transpose_times = [&](const MatrixXd& right) -> MatrixXd
+    { return x.transpose() * right - mean.transpose() * right.colwise().sum(); };
+
+    std::mt19937 generator(rows ^ (cols << 16));
+    std::normal_distribution<double> normal(0.0, 1.0);
+    int sketch = std::min(cols, 2 * OVERSAMPLING);
+    std::vector<double> variances;
+    MatrixXd axes;
+    while (true)
+    {
+        MatrixXd omega(cols, sketch);
+        for (Index idx = 0; idx < omega.size(); ++idx)
+            omega.data()[idx] = normal(generator);
+
+        MatrixXd basis = orthonormalize(centred_times(omega));
+        for (int iter = 0; iter < POWER_ITERATIONS; ++iter)
+            basis = orthonormalize(centred_times(orthonormalize(centred_transpose_times(basis))));
+
+        // Core: B^T = (x - 1 mean)^T Q is cols x sketch; its left singular vectors are the axes.
+        const MatrixXdRM core = centred_transpose_times(basis);
+        const util::SVD svd(util::Matrix(cols, sketch, core.data()));
+
+        std::vector<int> order(sketch);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(),
+                  [&svd](int a, int b) { return svd.S.at(a) > svd.S.at(b); });
+        const double largest = svd.S.at(order[0]);
+        variances.clear();
+        axes.resize(cols, sketch);
+        for (int idx : order)
+        {
+            const double value = svd.S.at(idx);
+            // Rank deficient sketches give (near) zero singular values with no usable axis.
+            if (!(value > 1e-12 * largest))
+                break;
+            for (int row = 0; row < cols; ++row)
+                axes(row, variances.size()) = svd.U.at(row, idx);
+            variances.push_back(value * value / rows);
+        }
+
+        const double found = std::accumulate(variances.begin(), variances.end(), 0.0);
+        if (found >= explained_variance * total_variance || sketch == cols)
+            break;
+        sketch = std::min(cols, 2 * sketch);
+    }
+
+    int kept = 0;
+    double explained_sum = 0.0;
+    while (kept < static_cast<int>(variances.size())
+           && explained_sum < explained_variance * total_variance)
+        explained_sum += variances[kept++];
+
+    if (kept == 0 || kept >= cols)
+        return;
+
+    num_components = kept;
+    explained_fraction = explained_sum / total_variance;
+    scores.resize(static_cast<size_t>(rows) * kept);
+    Map<MatrixXdRM> projection(scores.data(), rows, kept);
+    projection = centred_times(axes.leftCols(kept));
+    if (stats)
+        stats->add_alloc(scores.size() * sizeof(double));
+}
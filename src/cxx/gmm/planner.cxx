@@ -0,0 +1,342 @@
+/*
+ * ClusterRows
+ * Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gmm/planner.hxx>
+#include <gmm/covariance.hxx>
+#include <gmm/kdtree.hxx>
+#include <logging.hxx>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+constexpr double MB = 1024.0 * 1024.0;
+/// Sustained flop rate of the E-step and M-step loops of one core, per millisecond.
+constexpr double FLOPS_PER_MS = 2e6;
+/// EM iterations an epoch takes before it converges, on typical inputs.
+constexpr int TYPICAL_ITERATIONS = 25;
+/// Share of the available memory a job may take when no cap is given.
+constexpr double MEMORY_SHARE = 0.5;
+/// An approximate strategy has to be this many times cheaper than dense EM to be picked.
+constexpr double APPROXIMATION_GAIN = 2.0;
+/// Smallest input for which building the kd-tree pays off, and its tolerance.
+constexpr int TREE_MIN_ROWS = 10000;
+constexpr double TREE_TOLERANCE = 1e-3;
+/// Share of the rows the kd-tree EM touches per iteration, seen on well separated data.
+constexpr double TREE_ROW_SHARE = 0.125;
+/// Truncated EM is considered from this many clusters on, keeping this many per row.
+constexpr int TRUNCATED_MIN_CLUSTERS = 8;
+constexpr int TRUNCATED_TOP_K = 3;
+/// PCA is considered from this many columns on, keeping this fraction of the variance. The
+/// number of components is not known before the projection, a quarter of the columns is taken.
+constexpr int PCA_MIN_COLS = 32;
+constexpr double PCA_VARIANCE = 0.95;
+/// Smallest chunk the streaming engine is given when shrinking chunks to fit the memory cap.
+constexpr int MIN_CHUNK_ROWS = 1024;
+
+/// @brief Sum over the fitted candidate counts of clusters times epochs, and the largest count.
+void count_cluster_epochs(const GMMOptions& options, bool streaming, double& cluster_epochs,
+                          int& max_clusters)
+{
+    const double epochs = std::max(options.numEpochs, 1);
+    if (options.numClusters > 0)
+    {
+        max_clusters = options.numClusters;
+        cluster_epochs = max_clusters * epochs;
+    }
+    else if (!streaming && options.vbMaxClusters > 0)
+    {
+        max_clusters = options.vbMaxClusters;
+        cluster_epochs = max_clusters * epochs;
+    }
+    else if (!streaming && options.orderSearchMaxClusters > 2)
+    {
+        // Two clusters are fitted with all epochs, every larger count once from a split.
+        max_clusters = options.orderSearchMaxClusters;
+        cluster_epochs = 2 * epochs;
+        for (int clusters = 3; clusters <= max_clusters; ++clusters)
+            cluster_epochs += 2 * clusters; // the split and the merge back
+    }
+    else
+    {
+        max_clusters = 5;
+        cluster_epochs = (2 + 3 + 4 + 5) * epochs;
+    }
+}
+
+/// @brief Flops of one E-step and M-step visit of a row by a cluster.
+double visit_flops(double cols, bool full)
+{
+    return (full ? 2.0 * cols * cols : 0.0) + 6.0 * cols + 30.0;
+}
+
+/// @brief Fills the estimates of @p plan for its strategy and options.
+void estimate(gmm::Plan& plan, int rows, int cols)
+{
+    const GMMOptions& options = plan.options;
+    const bool streaming = plan.strategy == CR_STRATEGY_STREAMING;
+    const bool full = gmm::full_covariance(options.fullGMM);
+    double cluster_epochs = 0.0;
+    int max_clusters = 0;
+    count_cluster_epochs(options, streaming, cluster_epochs, max_clusters);
+
+    const double m = rows;
+    const double k = max_clusters;
+    const double iterations = std::min(options.numIterations, TYPICAL_ITERATIONS);
+    double d = cols;
+    double setup_flops = 0.0;
+    double row_share = 1.0; // rows visited per iteration relative to all rows
+    double cluster_share = 1.0; // clusters visited per row relative to all clusters
+    double weights_per_row = 2.0 * k; // responsibilities of the best and the current epoch
+    double extra_bytes = 0.0;
+
+    switch (plan.strategy)
+    {
+        case CR_STRATEGY_TREE:
+            setup_flops = m * std::log2(std::max(m, 2.0)) * d;
+            row_share = TREE_ROW_SHARE;
+            extra_bytes = 2.0 * m * d * 8.0;
+            break;
+        case CR_STRATEGY_TRUNCATED:
+        {
+            const double top_k = options.topK;
+            const double refresh = std::max(options.topKRefresh, 1);
+            cluster_share = (top_k * (refresh - 1.0) + k) / (refresh * k);
+            weights_per_row = 2.0 * top_k * 1.5; // weight and cluster index
+            break;
+        }
+        case CR_STRATEGY_PCA:
+        {
+            const double components = std::max(2, cols / 4);
+            setup_flops = 4.0 * m * d * (components + 10.0);
+            extra_bytes = m * components * 8.0;
+            d = components;
+            break;
+        }
+        case CR_STRATEGY_STREAMING:
+            // Each iteration re-reads the input and repeated rows are not collapsed.
+            row_share = 1.25;
+            break;
+        default:
+            break;
+    }
+
+    plan.estimated_ms = (setup_flops
+                         + m * row_share * cluster_epochs * cluster_share * iterations
+                               * visit_flops(d, full))
+                        / FLOPS_PER_MS;
+
+    const double cluster_bytes = 2.0 * k * (full ? d * d : d) * 8.0;
+    if (streaming)
+    {
+        const double chunk = options.chunkRows;
+        plan.estimated_mb = (chunk * (d + k + 2.0) * 8.0 + cluster_bytes) / MB;
+    }
+    else
+    {
+        // Responsibilities, normalizers, the row map and the unique rows of the input.
+        plan.estimated_mb
+            = (m * (weights_per_row * 8.0 + 12.0 + d * 8.0) + extra_bytes + cluster_bytes) / MB;
+    }
+}
+
+gmm::Plan make_plan(CRStrategy strategy, int rows, int cols, const GMMOptions& options)
+{
+    gmm::Plan plan{ strategy, options, 0.0, 0.0 };
+    GMMOptions& planned = plan.options;
+    planned.treeTolerance = 0.0;
+    planned.topK = 0;
+    planned.pcaVariance = 0.0;
+    // The user's own parameters are kept for the strategy they belong to.
+    if (strategy == CR_STRATEGY_TREE)
+        planned.treeTolerance = options.treeTolerance > 0.0 ? options.treeTolerance
+                                                            : TREE_TOLERANCE;
+    else if (strategy == CR_STRATEGY_TRUNCATED)
+        planned.topK = options.topK > 0 ? options.topK : TRUNCATED_TOP_K;
+    else if (strategy == CR_STRATEGY_PCA)
+        planned.pcaVariance = options.pcaVariance > 0.0 ? options.pcaVariance : PCA_VARIANCE;
+    estimate(plan, rows, cols);
+    return plan;
+}
+
+const char* strategy_name(CRStrategy strategy)
+{
+    switch (strategy)
+    {
+        case CR_STRATEGY_DENSE:
+            return "dense";
+        case CR_STRATEGY_TREE:
+            return "kd-tree";
+        case CR_STRATEGY_TRUNCATED:
+            return "truncated";
+        case CR_STRATEGY_PCA:
+            return "pca";
+        case CR_STRATEGY_STREAMING:
+            return "streaming";
+        default:
+            return "none";
+    }
+}
+
+double available_memory_mb()
+{
+#if defined(_WIN32)
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if (GlobalMemoryStatusEx(&status))
+        return static_cast<double>(status.ullAvailPhys) / MB;
+    return 0.0;
+#else
+    // MemAvailable counts the reclaimable page cache, which _SC_AVPHYS_PAGES does not.
+    std::ifstream meminfo("/proc/meminfo");
+    std::string key;
+    double value = 0.0;
+    std::string unit;
+    while (meminfo >> key >> value >> unit)
+    {
+        if (key == "MemAvailable:")
+            return value / 1024.0;
+    }
+#if defined(_SC_AVPHYS_PAGES)
+    const long pages = sysconf(_SC_AVPHYS_PAGES);
+    const long page_size = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && page_size > 0)
+        return static_cast<double>(pages) * static_cast<double>(page_size) / MB;
+#endif
+    return 0.0;
+#endif
+}
+
+} // anonymous namespace
+
+gmm::Resources gmm::available_resources()
+{
+    return { available_memory_mb(),
+             std::max(static_cast<int>(std::thread::hardware_concurrency()), 1) };
+}
+
+int gmm::planned_threads(const GMMOptions& options, const Resources& resources)
+{
+    if (!options.autoPlan || options.maxThreads <= 0)
+        return 0;
+    return std::min(options.maxThreads, resources.threads);
+}
+
+gmm::Plan gmm::plan_job(int rows, int cols, const GMMOptions& options, const Resources& resources)
+{
+    double memory_cap = std::numeric_limits<double>::infinity();
+    if (resources.memory_mb > 0.0)
+        memory_cap = resources.memory_mb * MEMORY_SHARE;
+    if (options.maxMemoryMB > 0.0)
+        memory_cap = std::min(memory_cap, options.maxMemoryMB);
+
+    const bool variational = options.numClusters <= 0 && options.vbMaxClusters > 0;
+    const bool order_search
+        = options.numClusters <= 0 && options.orderSearchMaxClusters > 2 && !variational;
+    const bool budgeted = options.timeBudgetMs > 0.0;
+    // The kd-tree and streaming engines only fit diagonal and full covariances, spherical and
+    // tied ones must stay with the engines that honour them.
+    const CovarianceType type = covariance_type(options.fullGMM);
+    const bool any_engine = type == CovarianceType::DIAGONAL || type == CovarianceType::FULL;
+
+    std::vector<Plan> plans;
+    plans.push_back(make_plan(CR_STRATEGY_DENSE, rows, cols, options));
+    if (cols <= KDTree::MAX_DIMS && rows >= TREE_MIN_ROWS && !variational && !order_search
+        && any_engine)
+        plans.push_back(make_plan(CR_STRATEGY_TREE, rows, cols, options));
+    if (options.numClusters >= TRUNCATED_MIN_CLUSTERS)
+        plans.push_back(make_plan(CR_STRATEGY_TRUNCATED, rows, cols, options));
+    // The projection loses information, so it is only used to meet a time budget.
+    if (cols >= PCA_MIN_COLS && (options.pcaVariance > 0.0 || budgeted))
+        plans.push_back(make_plan(CR_STRATEGY_PCA, rows, cols, options));
+
+    const Plan* best = nullptr;
+    double best_score = 0.0;
+    for (const Plan& plan : plans)
+    {
+        if (plan.estimated_mb > memory_cap)
+            continue;
+        const double score
+            = plan.estimated_ms * (plan.strategy == CR_STRATEGY_DENSE ? 1.0 : APPROXIMATION_GAIN);
+        if (!best || score < best_score)
+        {
+            best = &plan;
+            best_score = score;
+        }
+    }
+
+    Plan chosen;
+    if (best)
+    {
+        chosen = *best;
+    }
+    else if (!any_engine)
+    {
+        // Nothing fits in memory and streaming would change the covariance structure: take the
+        // in-memory strategy that needs the least.
+        chosen = *std::min_element(plans.begin(), plans.end(),
+                                   [](const Plan& lhs, const Plan& rhs)
+                                   { return lhs.estimated_mb < rhs.estimated_mb; });
+    }
+    else
+    {
+        // Nothing fits in memory: stream, with chunks small enough for the cap.
+        chosen = make_plan(CR_STRATEGY_STREAMING, rows, cols, options);
+        if (chosen.estimated_mb > memory_cap)
+        {
+            // The memory is the cluster parameters plus a linear term in the chunk rows.
+            const int chunk_rows = chosen.options.chunkRows;
+            const double chunk_mb = chosen.estimated_mb;
+            chosen.options.chunkRows = 0;
+            estimate(chosen, rows, cols);
+            const double share
+                = (memory_cap - chosen.estimated_mb) / (chunk_mb - chosen.estimated_mb);
+            chosen.options.chunkRows
+                = std::max(static_cast<int>(chunk_rows * share), MIN_CHUNK_ROWS);
+            estimate(chosen, rows, cols);
+        }
+    }
+
+    if (budgeted && chosen.estimated_ms > options.timeBudgetMs && chosen.options.numEpochs > 1)
+    {
+        // The run time is about linear in the epochs.
+        const double share = options.timeBudgetMs / chosen.estimated_ms;
+        chosen.options.numEpochs
+            = std::max(1, static_cast<int>(chosen.options.numEpochs * share));
+        estimate(chosen, rows, cols);
+    }
+
+    writeLog("Plan: %s strategy, %d epochs, estimated %.1f ms and %.1f MB (cap %.1f MB)\n",
+             strategy_name(chosen.strategy), chosen.options.numEpochs, chosen.estimated_ms,
+             chosen.estimated_mb, memory_cap);
+    return chosen;
+}
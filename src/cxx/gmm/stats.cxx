@@ -0,0 +1,104 @@
+/*
+* ClusterRows
+* Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gmm/stats.hxx>
+
+#include <algorithm>
+
+void gmm::Stats::add_candidate(int epochs_)
+{
+    ++candidates;
+    epochs_per_k = epochs_;
+}
+
+void gmm::Stats::add_epoch(int iterations_)
+{
+    min_iterations = epochs ? std::min(min_iterations, iterations_) : iterations_;
+    max_iterations = std::max(max_iterations, iterations_);
+    iterations += iterations_;
+    ++epochs;
+}
+
+void gmm::Stats::add_alloc(size_t bytes)
+{
+    ++alloc_count;
+    alloc_bytes += static_cast<long long>(bytes);
+}
+
+void gmm::Stats::enable_counters()
+{
+    counters = std::make_unique<util::PerfCounters>();
+    counters_status = counters->available() ? 1 : -1;
+    // Events that are not counted read as -1 in every phase.
+    Counts start_counts;
+    counters->read(start_counts);
+    for (auto& counts : phase_counts)
+    {
+        for (int event = 0; event < util::PerfCounters::NUM_EVENTS; ++event)
+            counts[event] = start_counts[event] < 0 ? -1 : 0;
+    }
+    if (!counters->available())
+        counters.reset();
+}
+
+void gmm::Stats::add_counts(Phase phase, const Counts& start_counts)
+{
+    Counts end_counts;
+    counters->read(end_counts);
+    for (int event = 0; event < util::PerfCounters::NUM_EVENTS; ++event)
+    {
+        if (end_counts[event] >= 0)
+            phase_counts[phase][event] += end_counts[event] - start_counts[event];
+    }
+}
+
+void gmm::Stats::export_to(GMMStats& out, double total_ms) const
+{
+    out.initTimeMs = phase_ms[INIT];
+    out.eStepTimeMs = phase_ms[ESTEP];
+    out.mStepTimeMs = phase_ms[MSTEP];
+    out.totalTimeMs = total_ms;
+    out.numCandidates = candidates;
+    out.epochsPerCandidate = epochs_per_k;
+    out.totalEpochs = epochs;
+    out.totalIterations = iterations;
+    out.minIterationsPerEpoch = min_iterations;
+    out.maxIterationsPerEpoch = max_iterations;
+    out.bestNumClusters = best_clusters;
+    out.threadsUsed = threads;
+    out.allocCount = alloc_count;
+    out.allocBytes = alloc_bytes;
+    out.uniqueRows = unique_rows;
+    out.pcaComponents = pca_components;
+    out.regularizedCovariances = regularized;
+    out.reseededClusters = reseeded;
+    out.planStrategy = plan_strategy;
+    out.planEstimatedMs = plan_ms;
+    out.planEstimatedMB = plan_mb;
+    out.selectTimeMs = phase_ms[SELECT];
+    out.perfStatus = counters_status;
+    out.invalidRows = invalid_rows;
+    for (int phase = 0; phase < NUM_PHASES; ++phase)
+    {
+        const Counts& counts = phase_counts[phase];
+        out.perfCycles[phase] = counts[util::PerfCounters::CYCLES];
+        out.perfInstructions[phase] = counts[util::PerfCounters::INSTRUCTIONS];
+        out.perfCacheMisses[phase] = counts[util::PerfCounters::CACHE_MISSES];
+        out.perfBranchMisses[phase] = counts[util::PerfCounters::BRANCH_MISSES];
+    }
+}
@@ -0,0 +1,198 @@
+/*
+* ClusterRows
+* Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gmm/stream.hxx>
+#include <macros.h>
+#include <logging.hxx>
+#include <trace.hxx>
+
+#include <chrono>
+#include <cmath>
+#include <random>
+
+gmm::StreamingModel::StreamingModel(ChunkReader& reader_, int num_clusters_, bool full_gmm_,
+                                    int chunk_rows_, unsigned seed_, Stats* stats_)
+    : reader{ reader_ }
+    , num_clusters{ num_clusters_ }
+    , full_gmm{ full_gmm_ }
+    , chunk_rows{ std::max(chunk_rows_, 1) }
+    , chunk(static_cast<size_t>(chunk_rows) * reader_.cols())
+    , best(num_clusters_, reader_.cols(), full_gmm_)
+    , seed{ seed_ }
+    , stats{ stats_ }
+{
+    if (stats)
+        stats->add_alloc(chunk.size() * sizeof(double));
+}
+
+bool gmm::StreamingModel::seed_pass(int num_epochs, std::vector<VectorXd>& seeds,
+                                    MatrixXd& global_cov)
+{
+    const int n = reader.cols();
+    const size_t num_seeds = static_cast<size_t>(num_epochs) * num_clusters;
+    std::default_random_engine generator(
+        seed ? seed : std::chrono::system_clock::now().time_since_epoch().count());
+    SufficientStats global(1, n);
+    seeds.clear();
+
+    // Reservoir sampling of the seeds of all epochs in a single pass.
+    long long seen = 0;
+    reader.rewind();
+    int rows;
+    while ((rows = reader.read(chunk.data(), chunk_rows)) > 0)
+    {
+        for (int row = 0; row < rows; ++row, ++seen)
+        {
+            Map<const VectorXd> x(chunk.data() + static_cast<size_t>(row) * n, n);
+            global.accumulate(0, 1.0, x);
+            if (seeds.size() < num_seeds)
+            {
+                seeds.emplace_back(x);
+                continue;
+            }
+            const long long slot = std::uniform_int_distribution<long long>(0, seen)(generator);
+            if (slot < static_cast<long long>(num_seeds))
+                seeds[slot] = x;
+        }
+    }
+
+    if (rows < 0 || seeds.empty())
+        return false;
+
+    VectorXd global_mean;
+    global.parameters(0, global_mean, global_cov);
+    return true;
+}
+
+double gmm::StreamingModel::run_pass(const GaussianMixture& mixture, SufficientStats& suff)
+{
+    const int n = reader.cols();
+    VectorXd resp(num_clusters);
+    VectorXd scratch(n);
+    double score = 0.0;
+    suff.clear();
+    reader.rewind();
+    int rows;
+    while ((rows = reader.read(chunk.data(), chunk_rows)) > 0)
+    {
+        for (int row = 0; row < rows; ++row)
+        {
+            Map<const VectorXd> x(chunk.data() + static_cast<size_t>(row) * n, n);
+            mixture.responsibilities(x, resp, scratch);
+            score += -std::log(resp.maxCoeff());
+            for (int cluster = 0; cluster < num_clusters; ++cluster)
+            {
+                // Negligible responsibilities do not move the statistics.
+                if (resp(cluster) > 1e-12)
+                    suff.accumulate(cluster, resp(cluster), x);
+            }
+        }
+    }
+
+    return rows < 0 ? -1.0 : score;
+}
+
+double gmm::StreamingModel::fit(int num_epochs, int num_iterations)
+{
+    trace::Span<trace::FIT> span("StreamingModel::fit", num_clusters);
+    const int n = reader.cols();
+    std::vector<VectorXd> seeds;
+    MatrixXd global_cov;
+    {
+        Stats::Timer timer(stats, Stats::INIT);
+        if (!seed_pass(num_epochs, seeds, global_cov))
+            return -1.0;
+    }
+    if (stats)
+        stats->add_candidate(num_epochs);
+
+    double bic{ 1.0E10 };
+    GaussianMixture mixture(num_clusters, n, full_gmm);
+    GaussianMixture epoch_best(num_clusters, n, full_gmm);
+    SufficientStats suff(num_clusters, n);
+    for (int epoch = 0; epoch < num_epochs; ++epoch)
+    {
+        trace::Span<trace::EPOCH> epoch_span("epoch", epoch);
+        for (int cluster = 0; cluster < num_clusters; ++cluster)
+        {
+            const auto& seed = seeds[(static_cast<size_t>(epoch) * num_clusters + cluster)
+                                     % seeds.size()];
+            mixture.set(cluster, 1.0 / num_clusters, seed, global_cov);
+        }
+
+        double epoch_bic{ 1.0E10 };
+        int iter = 0;
+        for (; iter < num_iterations; ++iter)
+        {
+            trace::Span<trace::ITERATION> iter_span("iteration", iter);
+            double score;
+            {
+                Stats::Timer timer(stats, Stats::ESTEP);
+                score = run_pass(mixture, suff);
+            }
+            if (score < 0)
+                return -1.0;
+
+            if (score < epoch_bic && (epoch_bic - score > EPSILON))
+            {
+                epoch_bic = score;
+                epoch_best = mixture;
+            }
+            else
+            {
+                break;
+            }
+
+            Stats::Timer timer(stats, Stats::MSTEP);
+            mixture.update(suff);
+        }
+
+        if (stats)
+            stats->add_epoch(iter);
+        writeLog("\tEpoch#%d : epoch_bic = %f\n", epoch, epoch_bic);
+        if (epoch_bic < bic)
+        {
+            bic = epoch_bic;
+            best = epoch_best;
+        }
+    }
+
+    return bic;
+}
+
+bool gmm::StreamingModel::write_labels(LabelWriter& writer)
+{
+    const int n = reader.cols();
+    std::vector<int> labels(chunk_rows);
+    std::vector<double> confidence_scores(chunk_rows);
+    VectorXd resp(num_clusters);
+    VectorXd scratch(n);
+    reader.rewind();
+    int rows;
+    while ((rows = reader.read(chunk.data(), chunk_rows)) > 0)
+    {
+        for (int row = 0; row < rows; ++row)
+        {
+            Map<const VectorXd> x(chunk.data() + static_cast<size_t>(row) * n, n);
+            best.responsibilities(x, resp, scratch);
+            confidence_scores[row] = resp.maxCoeff(&labels[row]);
+        }
+        writer.write(labels.data(), confidence_scores.data(), rows);
+    }
+    return rows == 0;
+}
@@ -0,0 +1,380 @@
+/*
+ * ClusterRows
+ * Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gmm/covariance.hxx>
+#include <gmm/variational.hxx>
+#include <macros.h>
+#include <logging.hxx>
+#include <trace.hxx>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace
+{
+
+/// @brief Digamma function by recurrence up to x >= 6 and the asymptotic series.
+double digamma(double x)
+{
+    double result = 0.0;
+    for (; x < 6.0; x += 1.0)
+        result -= 1.0 / x;
+    const double f = 1.0 / (x * x);
+    return result + std::log(x) - 0.5 / x
+           - f * (1.0 / 12 - f * (1.0 / 120 - f * (1.0 / 252 - f * (1.0 / 240 - f / 132))));
+}
+
+constexpr double PRIOR_BETA = 1.0;
+
+/// @brief Zeroes the off-diagonal elements of the square matrix @p mat.
+void keep_diagonal(Eigen::MatrixXd& mat)
+{
+    for (int col = 0; col < mat.cols(); ++col)
+        for (int row = 0; row < mat.rows(); ++row)
+            if (row != col)
+                mat(row, col) = 0.0;
+}
+
+} // anonymous namespace
+
+gmm::VariationalModel::VariationalModel(const Data& data_, int max_clusters_,
+                                        const GMMOptions& options, Stats* stats_)
+    : weights(max_clusters_, data_.rows())
+    , labels_of(max_clusters_, -1)
+    , data{ data_ }
+    , max_clusters{ max_clusters_ }
+    , concentration{ options.vbConcentration }
+    , full_gmm{ full_covariance(options.fullGMM) }
+    , num_kept{ max_clusters_ }
+    , stats{ stats_ }
+{
+    if (stats)
+        stats->add_alloc(weights.size() * sizeof(double));
+
+    // Data driven priors: the mean and the covariance of all the rows.
+    const int m = data.rows();
+    const int n = data.cols();
+    prior_mean = VectorXd::Zero(n);
+    for (int sample = 0; sample < m; ++sample)
+        prior_mean += data.weight(sample) * data.row(sample);
+    prior_mean /= data.total_weight();
+
+    prior_scale_inv = MatrixXd::Zero(n, n);
+    VectorXd diff(n);
+    for (int sample = 0; sample < m; ++sample)
+    {
+        diff = data.row(sample) - prior_mean;
+        prior_scale_inv.noalias() += data.weight(sample) * diff * diff.transpose();
+    }
+    prior_scale_inv /= data.total_weight();
+    if (!full_gmm)
+        keep_diagonal(prior_scale_inv);
+    // Keeps the prior positive definite for constant columns.
+    const double ridge = 1e-6 * std::max(1.0, prior_scale_inv.trace() / n);
+    prior_scale_inv.diagonal().array() += ridge;
+}
+
+void gmm::VariationalModel::reset_to_prior(Component& component) const
+{
+    const int n = data.cols();
+    component.alpha = concentration;
+    component.beta = PRIOR_BETA;
+    component.nu = n;
+    component.mean = prior_mean;
+    component.scale_inv = prior_scale_inv;
+    const LLT<MatrixXd> llt(prior_scale_inv);
+    component.scale = llt.solve(MatrixXd::Identity(n, n));
+    component.log_det_scale = -2.0 * llt.matrixL().toDenseMatrix().diagonal().array().log().sum();
+    component.count = 0.0;
+}
+
+void gmm::VariationalModel::init_responsibilities(MatrixXd& resp, Workspace& workspace) const
+{
+    // Hard assignment of every row to the nearest of randomly picked seed rows.
+    const int m = data.rows();
+    const auto& seeds = workspace.select_seeds(max_clusters, m);
+    resp.setZero();
+    for (int sample = 0; sample < m; ++sample)
+    {
+        int nearest = 0;
+        double nearest_distance = std::numeric_limits<double>::max();
+        for (int cluster = 0; cluster < static_cast<int>(seeds.size()); ++cluster)
+        {
+            const double distance = (data.row(sample) - data.row(seeds[cluster])).squaredNorm();
+            if (distance < nearest_distance)
+            {
+                nearest_distance = distance;
+                nearest = cluster;
+            }
+        }
+        resp(nearest, sample) = 1.0;
+    }
+}
+
+void gmm::VariationalModel::update_components(const MatrixXd& resp,
+                                              std::vector<Component>& components) const
+{
+    const int m = data.rows();
+    const int n = data.cols();
+    VectorXd xbar(n);
+    VectorXd diff(n);
+    for (int cluster = 0; cluster < max_clusters; ++cluster)
+    {
+        auto& component = components[cluster];
+        if (!component.active)
+            continue;
+
+        double count = 0.0;
+        xbar.setZero();
+        for (int sample = 0; sample < m; ++sample)
+        {
+            const double wt = resp(cluster, sample) * data.weight(sample);
+            count += wt;
+            xbar += wt * data.row(sample);
+        }
+
+        // Once empty a component stays at the prior and out of the E-step.
+        if (count < PRUNE_FRACTION * data.total_weight())
+        {
+            component.active = false;
+            reset_to_prior(component);
+            continue;
+        }
+
+        xbar /= count;
+        MatrixXd& scale_inv = component.scale_inv;
+        scale_inv = prior_scale_inv;
+        for (int sample = 0; sample < m; ++sample)
+        {
+            const double wt = resp(cluster, sample) * data.weight(sample);
+            diff = data.row(sample) - xbar;
+            scale_inv.noalias() += wt * diff * diff.transpose();
+        }
+        diff = xbar - prior_mean;
+        const double shrinkage = PRIOR_BETA * count / (PRIOR_BETA + count);
+        scale_inv.noalias() += shrinkage * diff * diff.transpose();
+        if (!full_gmm)
+            keep_diagonal(scale_inv);
+
+        component.count = count;
+        component.alpha = concentration + count;
+        component.beta = PRIOR_BETA + count;
+        component.nu = n + count;
+        component.mean = (PRIOR_BETA * prior_mean + count * xbar) / component.beta;
+        const LLT<MatrixXd> llt(scale_inv);
+        component.scale = llt.solve(MatrixXd::Identity(n, n));
+        component.log_det_scale
+            = -2.0 * llt.matrixL().toDenseMatrix().diagonal().array().log().sum();
+    }
+}
+
+double
+gmm::VariationalModel::update_responsibilities(MatrixXd& resp,
+                                               const std::vector<Component>& components) const
+{
+    const int m = data.rows();
+    const int n = data.cols();
+    double alpha_sum = 0.0;
+    for (const auto& component : components)
+        alpha_sum += component.alpha;
+
+    // The terms of log rho that do not depend on the row (PRML 10.64 - 10.66).
+    std::vector<double> offsets(max_clusters, 0.0);
+    for (int cluster = 0; cluster < max_clusters; ++cluster)
+    {
+        const auto& component = components[cluster];
+        if (!component.active)
+            continue;
+        double log_det_precision = n * std::log(2.0) + component.log_det_scale;
+        for (int dim = 0; dim < n; ++dim)
+            log_det_precision += digamma(0.5 * (component.nu - dim));
+        offsets[cluster] = digamma(component.alpha) - digamma(alpha_sum)
+                           + 0.5 * log_det_precision - 0.5 * n * std::log(2 * M_PI)
+                           - 0.5 * n / component.beta;
+    }
+
+    double neg_entropy = 0.0;
+    VectorXd diff(n);
+    VectorXd tmp(n);
+    for (int sample = 0; sample < m; ++sample)
+    {
+        double max_log_rho = -std::numeric_limits<double>::infinity();
+        for (int cluster = 0; cluster < max_clusters; ++cluster)
+        {
+            const auto& component = components[cluster];
+            if (!component.active)
+                continue;
+            diff = data.row(sample) - component.mean;
+            tmp.noalias() = component.scale * diff;
+            const double log_rho = offsets[cluster] - 0.5 * component.nu * diff.dot(tmp);
+            resp(cluster, sample) = log_rho;
+            max_log_rho = std::max(max_log_rho, log_rho);
+        }
+
+        double normalizer = 0.0;
+        for (int cluster = 0; cluster < max_clusters; ++cluster)
+        {
+            if (!components[cluster].active)
+            {
+                resp(cluster, sample) = 0.0;
+                continue;
+            }
+            resp(cluster, sample) = std::exp(resp(cluster, sample) - max_log_rho);
+            normalizer += resp(cluster, sample);
+        }
+
+        for (int cluster = 0; cluster < max_clusters; ++cluster)
+        {
+            double& wt = resp(cluster, sample);
+            wt /= normalizer;
+            if (wt > 0.0)
+                neg_entropy += data.weight(sample) * wt * std::log(wt);
+        }
+    }
+
+    return neg_entropy;
+}
+
+double gmm::VariationalModel::lower_bound(const std::vector<Component>& components,
+                                          double neg_entropy) const
+{
+    // The bound up to constants right after the M-step, as in scikit-learn's
+    // BayesianGaussianMixture: entropy of the responsibilities, Wishart and Dirichlet
+    // normalizers and the mean precisions.
+    const int n = data.cols();
+    double bound = -neg_entropy;
+    double alpha_sum = 0.0;
+    double log_gamma_alpha = 0.0;
+    for (const auto& component : components)
+    {
+        double log_wishart_norm = 0.5 * component.nu * component.log_det_scale
+                                  + 0.5 * component.nu * n * std::log(2.0);
+        for (int dim = 0; dim < n; ++dim)
+            log_wishart_norm += std::lgamma(0.5 * (component.nu - dim));
+        bound += log_wishart_norm - 0.5 * n * std::log(component.beta);
+        alpha_sum += component.alpha;
+        log_gamma_alpha += std::lgamma(component.alpha);
+    }
+    return bound - (std::lgamma(alpha_sum) - log_gamma_alpha);
+}
+
+double gmm::VariationalModel::fit(int num_epochs, int num_iterations, Workspace& workspace)
+{
+    trace::Span<trace::FIT> span("VariationalModel::fit", max_clusters);
+    double best_bound = -std::numeric_limits<double>::infinity();
+    MatrixXd& resp = workspace.epoch_weights(max_clusters, data.rows());
+    std::vector<Component> components(max_clusters);
+    std::vector<Component> best_components;
+    if (stats)
+        stats->add_candidate(num_epochs);
+
+    for (int epoch = 0; epoch < num_epochs; ++epoch)
+    {
+        trace::Span<trace::EPOCH> epoch_span("epoch", epoch);
+        {
+            trace::Span<trace::STEP> init_span("init");
+            Stats::Timer timer(stats, Stats::INIT);
+            for (auto& component : components)
+            {
+                reset_to_prior(component);
+                component.active = true;
+            }
+            init_responsibilities(resp, workspace);
+            update_components(resp, components);
+        }
+
+        double bound = -std::numeric_limits<double>::infinity();
+        int iter = 0;
+        for (; iter < num_iterations; ++iter)
+        {
+            trace::Span<trace::ITERATION> iter_span("iteration", iter);
+            double neg_entropy;
+            {
+                trace::Span<trace::STEP> estep_span("E-step");
+                Stats::Timer timer(stats, Stats::ESTEP);
+                neg_entropy = update_responsibilities(resp, components);
+            }
+            {
+                trace::Span<trace::STEP> mstep_span("M-step");
+                Stats::Timer timer(stats, Stats::MSTEP);
+                update_components(resp, components);
+            }
+
+            const double previous = bound;
+            bound = lower_bound(components, neg_entropy);
+            if (std::abs(bound - previous) < EPSILON)
+                break;
+        }
+
+        if (stats)
+            stats->add_epoch(iter);
+        writeLog("\tEpoch#%d : lower bound = %f\n", epoch, bound);
+        if (bound > best_bound || best_components.empty())
+        {
+            best_bound = bound;
+            best_components = components;
+        }
+    }
+
+    {
+        // The responsibilities of the last E-step predate the last M-step, label the rows with
+        // those of the returned components instead.
+        trace::Span<trace::STEP> estep_span("E-step");
+        Stats::Timer timer(stats, Stats::ESTEP);
+        update_responsibilities(weights, best_components);
+    }
+
+    num_kept = 0;
+    for (int cluster = 0; cluster < max_clusters; ++cluster)
+        labels_of[cluster] = best_components[cluster].active ? num_kept++ : -1;
+
+    return -best_bound;
+}
+
+void gmm::VariationalModel::get_labels(int* labels, double* confidence_scores) const
+{
+    if (!labels || !confidence_scores)
+    {
+        throw std::runtime_error(
+            "VariationalModel::get_labels: no labels or confidence_scores array to store to.");
+    }
+
+    const int rows{ data.input_rows() };
+    for (int row = 0; row < rows; ++row)
+    {
+        const int sample{ data.point_of(row) };
+        double best_confidence{ -1.0 };
+        double sum{ 0.0 };
+        for (int cluster = 0; cluster < max_clusters; ++cluster)
+        {
+            if (labels_of[cluster] < 0)
+                continue;
+            const double& confidence{ weights(cluster, sample) };
+            sum += confidence;
+            if (confidence > best_confidence)
+            {
+                best_confidence = confidence;
+                labels[row] = labels_of[cluster];
+                confidence_scores[row] = confidence;
+            }
+        }
+        confidence_scores[row] /= sum;
+    }
+}
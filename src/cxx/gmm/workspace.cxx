@@ -0,0 +1,95 @@
+/*
+* ClusterRows
+* Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gmm/workspace.hxx>
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+void gmm::SparseResponsibilities::resize(int samples, int k_)
+{
+    k = k_;
+    clusters.resize(static_cast<size_t>(samples) * k);
+    weights.resize(static_cast<size_t>(samples) * k);
+}
+
+void gmm::SparseResponsibilities::swap(SparseResponsibilities& other) noexcept
+{
+    std::swap(k, other.k);
+    clusters.swap(other.clusters);
+    weights.swap(other.weights);
+}
+
+gmm::Workspace::Workspace(Stats* stats_)
+    : generator(std::chrono::system_clock::now().time_since_epoch().count())
+    , stats{ stats_ }
+{
+}
+
+Eigen::MatrixXd& gmm::Workspace::epoch_weights(int num_clusters, int samples)
+{
+    if (weights_buffer.rows() != num_clusters || weights_buffer.cols() != samples)
+    {
+        weights_buffer.resize(num_clusters, samples);
+        if (stats)
+            stats->add_alloc(weights_buffer.size() * sizeof(double));
+    }
+    return weights_buffer;
+}
+
+gmm::SparseResponsibilities& gmm::Workspace::epoch_sparse_weights(int samples, int k)
+{
+    if (sparse_buffer.k != k || sparse_buffer.clusters.size() != static_cast<size_t>(samples) * k)
+    {
+        sparse_buffer.resize(samples, k);
+        if (stats)
+            stats->add_alloc(sparse_buffer.bytes());
+    }
+    return sparse_buffer;
+}
+
+std::vector<double>& gmm::Workspace::normalizers(int samples)
+{
+    if (normalizer_buffer.capacity() < static_cast<size_t>(samples) && stats)
+        stats->add_alloc(samples * sizeof(double));
+    normalizer_buffer.assign(samples, 0.0);
+    return normalizer_buffer;
+}
+
+std::vector<double>& gmm::Workspace::cluster_weights(int num_clusters)
+{
+    if (cluster_weight_buffer.capacity() < static_cast<size_t>(num_clusters) && stats)
+        stats->add_alloc(num_clusters * sizeof(double));
+    cluster_weight_buffer.assign(num_clusters, 0.0);
+    return cluster_weight_buffer;
+}
+
+std::vector<double>& gmm::Workspace::sample_weights(int samples)
+{
+    if (sample_weight_buffer.capacity() < static_cast<size_t>(samples) && stats)
+        stats->add_alloc(samples * sizeof(double));
+    sample_weight_buffer.resize(samples);
+    return sample_weight_buffer;
+}
+
+const std::vector<int>& gmm::Workspace::select_seeds(int count, int population)
+{
+    select_distinct(count, population, seeds, generator);
+    return seeds;
+}
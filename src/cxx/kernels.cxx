@@ -0,0 +1,529 @@
+/*
+* ClusterRows
+* Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "kernels.hxx"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+// The kernels are compiled once per instruction set level and picked at load time, so that the
+// library still runs on any x86-64 while using AVX2/AVX-512 where available. The bodies are
+// force inlined into per ISA entry points carrying a target attribute, which lets the compiler
+// vectorize them for that ISA.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CR_KERNELS_X86 1
+#define CR_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define CR_TARGET_AVX512                                                                          \
+    __attribute__((target("avx512f,avx512dq,avx512vl,avx2,fma,prefer-vector-width=512")))
+#else
+#define CR_KERNELS_X86 0
+#endif
+#define CR_TARGET_GENERIC
+#define CR_KERNEL_INLINE inline __attribute__((always_inline))
+
+namespace
+{
+
+using util::kernels::Isa;
+
+// Cache blocking: a KC x NC panel of B is packed once and reused by all MC row panels of A.
+constexpr int KC = 256;
+constexpr int MC = 64;
+constexpr int NC = 512;
+// Samples handled together by the per sample kernels, which vectorize across the block. It
+// gives enough independent accumulators to hide the latency of the adds at every ISA level.
+constexpr int SB = 32;
+
+// Packs op(B)[pc : pc + kc, jc : jc + nc] into column panels of width NR, zero padded.
+template <int NR>
+CR_KERNEL_INLINE void pack_b(int kc, int nc, const double* B, int ldb, bool transpose_b, int pc,
+                             int jc, double* Bp)
+{
+    for (int jr = 0; jr < nc; jr += NR)
+    {
+        const int nr = std::min(NR, nc - jr);
+        for (int p = 0; p < kc; ++p)
+        {
+            for (int j = 0; j < nr; ++j)
+            {
+                const int col = jc + jr + j;
+                const int row = pc + p;
+                Bp[j] = transpose_b ? B[static_cast<size_t>(col) * ldb + row]
+                                    : B[static_cast<size_t>(row) * ldb + col];
+            }
+            for (int j = nr; j < NR; ++j)
+                Bp[j] = 0.0;
+            Bp += NR;
+        }
+    }
+}
+
+// Packs A[ic : ic + mc, pc : pc + kc] into row panels of height MR, zero padded.
+template <int MR>
+CR_KERNEL_INLINE void pack_a(int mc, int kc, const double* A, int lda, int ic, int pc, double* Ap)
+{
+    for (int ir = 0; ir < mc; ir += MR)
+    {
+        const int mr = std::min(MR, mc - ir);
+        for (int p = 0; p < kc; ++p)
+        {
+            for (int i = 0; i < mr; ++i)
+                Ap[i] = A[static_cast<size_t>(ic + ir + i) * lda + pc + p];
+            for (int i = mr; i < MR; ++i)
+                Ap[i] = 0.0;
+            Ap += MR;
+        }
+    }
+}
+
+// C[0 : mr, 0 : nr] += Ap * Bp where Ap is a packed MR x kc panel and Bp a packed kc x NR panel.
+// The MR x NR register tile is sized per ISA to fill its vector registers.
+template <int MR, int NR>
+CR_KERNEL_INLINE void micro_kernel(int kc, const double* Ap, const double* Bp, double* C, int ldc,
+                                   int mr, int nr)
+{
+    double acc[MR][NR] = {};
+    for (int p = 0; p < kc; ++p)
+    {
+        for (int i = 0; i < MR; ++i)
+        {
+            const double a = Ap[i];
+            for (int j = 0; j < NR; ++j)
+                acc[i][j] += a * Bp[j];
+        }
+        Ap += MR;
+        Bp += NR;
+    }
+
+    for (int i = 0; i < mr; ++i)
+    {
+        double* crow = C + static_cast<size_t>(i) * ldc;
+        for (int j = 0; j < nr; ++j)
+            crow[j] += acc[i][j];
+    }
+}
+
+template <int MR, int NR>
+CR_KERNEL_INLINE void gemm_body(int m, int n, int k, const double* A, int lda, const double* B,
+                                int ldb, bool transpose_b, double* C, int ldc)
+{
+    for (int i = 0; i < m; ++i)
+        std::fill_n(C + static_cast<size_t>(i) * ldc, n, 0.0);
+
+    if (m <= 0 || n <= 0 || k <= 0)
+        return;
+
+    const int kc_max = std::min(KC, k);
+    const int nc_max = std::min(NC, n);
+    const int mc_max = std::min(MC, m);
+    auto Bp = std::make_unique<double[]>(static_cast<size_t>(kc_max) * (nc_max + NR));
+    auto Ap = std::make_unique<double[]>(static_cast<size_t>(kc_max) * (mc_max + MR));
+
+    for (int jc = 0; jc < n; jc += NC)
+    {
+        const int nc = std::min(NC, n - jc);
+        for (int pc = 0; pc < k; pc += KC)
+        {
+            const int kc = std::min(KC, k - pc);
+            pack_b<NR>(kc, nc, B, ldb, transpose_b, pc, jc, Bp.get());
+            for (int ic = 0; ic < m; ic += MC)
+            {
+                const int mc = std::min(MC, m - ic);
+                pack_a<MR>(mc, kc, A, lda, ic, pc, Ap.get());
+                for (int jr = 0; jr < nc; jr += NR)
+                {
+                    const int nr = std::min(NR, nc - jr);
+                    const double* bpanel = Bp.get() + static_cast<size_t>(jr) * kc;
+                    for (int ir = 0; ir < mc; ir += MR)
+                    {
+                        const int mr = std::min(MR, mc - ir);
+                        const double* apanel = Ap.get() + static_cast<size_t>(ir) * kc;
+                        double* cblock = C + static_cast<size_t>(ic + ir) * ldc + jc + jr;
+                        micro_kernel<MR, NR>(kc, apanel, bpanel, cblock, ldc, mr, nr);
+                    }
+                }
+            }
+        }
+    }
+}
+
+CR_KERNEL_INLINE void scale_cols_body(int m, int n, const double* A, int lda, const double* diag,
+                                      bool inverse, double* C, int ldc)
+{
+    auto scale = std::make_unique<double[]>(n);
+    for (int col = 0; col < n; ++col)
+        scale[col] = inverse ? (1.0 / diag[col]) : diag[col];
+
+    for (int row = 0; row < m; ++row)
+    {
+        const double* arow = A + static_cast<size_t>(row) * lda;
+        double* crow = C + static_cast<size_t>(row) * ldc;
+        for (int col = 0; col < n; ++col)
+            crow[col] = arow[col] * scale[col];
+    }
+}
+
+CR_KERNEL_INLINE double cols_dot_body(int m, const double* A, int lda, int col1, int col2)
+{
+    // Two independent accumulators to break the dependency chain of the sum.
+    double ip0 = 0.0;
+    double ip1 = 0.0;
+    const double* a1 = A + col1;
+    const double* a2 = A + col2;
+    int row = 0;
+    for (; row + 1 < m; row += 2)
+    {
+        ip0 += a1[0] * a2[0];
+        ip1 += a1[lda] * a2[lda];
+        a1 += 2 * static_cast<size_t>(lda);
+        a2 += 2 * static_cast<size_t>(lda);
+    }
+    if (row < m)
+        ip0 += a1[0] * a2[0];
+    return ip0 + ip1;
+}
+
+CR_KERNEL_INLINE void rotate_cols_body(int m, double* A, int lda, int col1, int col2, double c,
+                                       double s)
+{
+    double* a1 = A + col1;
+    double* a2 = A + col2;
+    for (int row = 0; row < m; ++row)
+    {
+        const double x = *a1;
+        const double y = *a2;
+        *a1 = x * c + y * s;
+        *a2 = y * c - x * s;
+        a1 += lda;
+        a2 += lda;
+    }
+}
+
+// Stores X[first : first + count, :] - mu transposed into D (n x SB), zero padding the block, so
+// that the loops over the samples of a block are contiguous and free of reductions.
+CR_KERNEL_INLINE void centred_block(int first, int count, int n, const double* X, int ldx,
+                                    const double* mu, double* D)
+{
+    for (int s = 0; s < count; ++s)
+    {
+        const double* x = X + static_cast<size_t>(first + s) * ldx;
+        for (int j = 0; j < n; ++j)
+            D[j * SB + s] = x[j] - mu[j];
+    }
+    for (int s = count; s < SB; ++s)
+        for (int j = 0; j < n; ++j)
+            D[j * SB + s] = 0.0;
+}
+
+CR_KERNEL_INLINE void sq_mahalanobis_diag_body(int m, int n, const double* X, int ldx,
+                                               const double* mu, const double* inv_var,
+                                               double* out, int incout)
+{
+    auto D = std::make_unique<double[]>(static_cast<size_t>(n) * SB);
+    for (int first = 0; first < m; first += SB)
+    {
+        const int count = std::min(SB, m - first);
+        centred_block(first, count, n, X, ldx, mu, D.get());
+        double q[SB] = {};
+        for (int j = 0; j < n; ++j)
+        {
+            const double* d = D.get() + j * SB;
+            for (int s = 0; s < SB; ++s)
+                q[s] += d[s] * d[s] * inv_var[j];
+        }
+        for (int s = 0; s < count; ++s)
+            out[static_cast<size_t>(first + s) * incout] = q[s];
+    }
+}
+
+CR_KERNEL_INLINE void sq_mahalanobis_full_body(int m, int n, const double* X, int ldx,
+                                               const double* mu, const double* P, int ldp,
+                                               double* out, int incout)
+{
+    auto D = std::make_unique<double[]>(static_cast<size_t>(n) * SB);
+    for (int first = 0; first < m; first += SB)
+    {
+        const int count = std::min(SB, m - first);
+        centred_block(first, count, n, X, ldx, mu, D.get());
+        double q[SB] = {};
+        for (int a = 0; a < n; ++a)
+        {
+            const double* prow = P + static_cast<size_t>(a) * ldp;
+            double t[SB] = {};
+            for (int b = 0; b < n; ++b)
+            {
+                const double* d = D.get() + b * SB;
+                for (int s = 0; s < SB; ++s)
+                    t[s] += prow[b] * d[s];
+            }
+            const double* d = D.get() + a * SB;
+            for (int s = 0; s < SB; ++s)
+                q[s] += d[s] * t[s];
+        }
+        for (int s = 0; s < count; ++s)
+            out[static_cast<size_t>(first + s) * incout] = q[s];
+    }
+}
+
+CR_KERNEL_INLINE void weighted_scatter_body(int m, int n, const double* X, int ldx,
+                                            const double* mu, const double* w, double* S, int lds)
+{
+    auto d = std::make_unique<double[]>(n);
+    for (int i = 0; i < m; ++i)
+    {
+        if (w[i] == 0.0)
+            continue;
+        const double* x = X + static_cast<size_t>(i) * ldx;
+        for (int j = 0; j < n; ++j)
+            d[j] = x[j] - mu[j];
+        for (int a = 0; a < n; ++a)
+        {
+            const double coef = w[i] * d[a];
+            double* srow = S + static_cast<size_t>(a) * lds;
+            for (int b = 0; b < n; ++b)
+                srow[b] += coef * d[b];
+        }
+    }
+}
+
+CR_KERNEL_INLINE void weighted_sq_dev_body(int m, int n, const double* X, int ldx,
+                                           const double* mu, const double* w, double* v)
+{
+    for (int i = 0; i < m; ++i)
+    {
+        const double* x = X + static_cast<size_t>(i) * ldx;
+        const double wt = w[i];
+        for (int j = 0; j < n; ++j)
+        {
+            const double d = x[j] - mu[j];
+            v[j] += wt * d * d;
+        }
+    }
+}
+
+struct KernelTable
+{
+    Isa isa;
+    void (*gemm)(int, int, int, const double*, int, const double*, int, bool, double*, int);
+    void (*scale_cols)(int, int, const double*, int, const double*, bool, double*, int);
+    double (*cols_dot)(int, const double*, int, int, int);
+    void (*rotate_cols)(int, double*, int, int, int, double, double);
+    void (*sq_mahalanobis_diag)(int, int, const double*, int, const double*, const double*,
+                                double*, int);
+    void (*sq_mahalanobis_full)(int, int, const double*, int, const double*, const double*, int,
+                                double*, int);
+    void (*weighted_scatter)(int, int, const double*, int, const double*, const double*, double*,
+                             int);
+    void (*weighted_sq_dev)(int, int, const double*, int, const double*, const double*, double*);
+};
+
+// Defines the entry points of one ISA level in namespace NS and their table.
+#define CR_KERNEL_SET(NS, ISA, TARGET, MR, NR)                                                    \
+    namespace NS                                                                                  \
+    {                                                                                             \
+    TARGET void gemm(int m, int n, int k, const double* A, int lda, const double* B, int ldb,     \
+                     bool transpose_b, double* C, int ldc)                                        \
+    {                                                                                             \
+        gemm_body<MR, NR>(m, n, k, A, lda, B, ldb, transpose_b, C, ldc);                          \
+    }                                                                                             \
+    TARGET void scale_cols(int m, int n, const double* A, int lda, const double* diag,            \
+                           bool inverse, double* C, int ldc)                                      \
+    {                                                                                             \
+        scale_cols_body(m, n, A, lda, diag, inverse, C, ldc);                                     \
+    }                                                                                             \
+    TARGET double cols_dot(int m, const double* A, int lda, int col1, int col2)                   \
+    {                                                                                             \
+        return cols_dot_body(m, A, lda, col1, col2);                                              \
+    }                                                                                             \
+    TARGET void rotate_cols(int m, double* A, int lda, int col1, int col2, double c, double s)    \
+    {                                                                                             \
+        rotate_cols_body(m, A, lda, col1, col2, c, s);                                            \
+    }                                                                                             \
+    TARGET void sq_mahalanobis_diag(int m, int n, const double* X, int ldx, const double* mu,     \
+                                    const double* inv_var, double* out, int incout)               \
+    {                                                                                             \
+        sq_mahalanobis_diag_body(m, n, X, ldx, mu, inv_var, out, incout);                         \
+    }                                                                                             \
+    TARGET void sq_mahalanobis_full(int m, int n, const double* X, int ldx, const double* mu,     \
+                                    const double* P, int ldp, double* out, int incout)            \
+    {                                                                                             \
+        sq_mahalanobis_full_body(m, n, X, ldx, mu, P, ldp, out, incout);                          \
+    }                                                                                             \
+    TARGET void weighted_scatter(int m, int n, const double* X, int ldx, const double* mu,        \
+                                 const double* w, double* S, int lds)                             \
+    {                                                                                             \
+        weighted_scatter_body(m, n, X, ldx, mu, w, S, lds);                                       \
+    }                                                                                             \
+    TARGET void weighted_sq_dev(int m, int n, const double* X, int ldx, const double* mu,         \
+                                const double* w, double* v)                                       \
+    {                                                                                             \
+        weighted_sq_dev_body(m, n, X, ldx, mu, w, v);                                             \
+    }                                                                                             \
+    const KernelTable table{ ISA,                                                                 \
+                             &gemm,                                                               \
+                             &scale_cols,                                                         \
+                             &cols_dot,                                                           \
+                             &rotate_cols,                                                        \
+                             &sq_mahalanobis_diag,                                                \
+                             &sq_mahalanobis_full,                                                \
+                             &weighted_scatter,                                                   \
+                             &weighted_sq_dev };                                                  \
+    }
+
+// Register tiles of the gemm micro kernel: 8 SSE2, 8 AVX2 and 4 AVX-512 accumulator registers.
+CR_KERNEL_SET(generic, Isa::GENERIC, CR_TARGET_GENERIC, 4, 4)
+#if CR_KERNELS_X86
+CR_KERNEL_SET(avx2, Isa::AVX2, CR_TARGET_AVX2, 4, 8)
+CR_KERNEL_SET(avx512, Isa::AVX512, CR_TARGET_AVX512, 4, 8)
+#endif
+
+const KernelTable* table_of(Isa isa)
+{
+    switch (isa)
+    {
+#if CR_KERNELS_X86
+        case Isa::AVX512:
+            return &avx512::table;
+        case Isa::AVX2:
+            return &avx2::table;
+#endif
+        default:
+            return &generic::table;
+    }
+}
+
+Isa detect_isa()
+{
+#if CR_KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq")
+            && __builtin_cpu_supports("avx512vl"))
+            return Isa::AVX512;
+        return Isa::AVX2;
+    }
+#endif
+    return Isa::GENERIC;
+}
+
+/// The table in use: the best the CPU supports, lowered by CLUSTERROWS_ISA if set.
+std::atomic<const KernelTable*>& current()
+{
+    static std::atomic<const KernelTable*> table{ [] {
+        Isa isa = util::kernels::best_isa();
+        if (const char* name = std::getenv("CLUSTERROWS_ISA"))
+        {
+            for (Isa requested : { Isa::GENERIC, Isa::AVX2, Isa::AVX512 })
+            {
+                if (!std::strcmp(name, util::kernels::isa_name(requested)))
+                    isa = std::min(isa, requested);
+            }
+        }
+        return table_of(isa);
+    }() };
+    return table;
+}
+
+const KernelTable& active_table() { return *current().load(std::memory_order_relaxed); }
+
+}
+
+namespace util::kernels
+{
+
+Isa best_isa()
+{
+    static const Isa isa = detect_isa();
+    return isa;
+}
+
+Isa active_isa() { return active_table().isa; }
+
+bool select_isa(Isa isa)
+{
+    if (isa > best_isa())
+        return false;
+    current().store(table_of(isa), std::memory_order_relaxed);
+    return true;
+}
+
+const char* isa_name(Isa isa)
+{
+    switch (isa)
+    {
+        case Isa::AVX512:
+            return "avx512";
+        case Isa::AVX2:
+            return "avx2";
+        case Isa::GENERIC:
+        default:
+            return "generic";
+    }
+}
+
+void gemm(int m, int n, int k, const double* A, int lda, const double* B, int ldb,
+          bool transpose_b, double* C, int ldc)
+{
+    active_table().gemm(m, n, k, A, lda, B, ldb, transpose_b, C, ldc);
+}
+
+void scale_cols(int m, int n, const double* A, int lda, const double* diag, bool inverse,
+                double* C, int ldc)
+{
+    active_table().scale_cols(m, n, A, lda, diag, inverse, C, ldc);
+}
+
+double cols_dot(int m, const double* A, int lda, int col1, int col2)
+{
+    return active_table().cols_dot(m, A, lda, col1, col2);
+}
+
+void rotate_cols(int m, double* A, int lda, int col1, int col2, double c, double s)
+{
+    active_table().rotate_cols(m, A, lda, col1, col2, c, s);
+}
+
+void sq_mahalanobis_diag(int m, int n, const double* X, int ldx, const double* mu,
+                         const double* inv_var, double* out, int incout)
+{
+    active_table().sq_mahalanobis_diag(m, n, X, ldx, mu, inv_var, out, incout);
+}
+
+void sq_mahalanobis_full(int m, int n, const double* X, int ldx, const double* mu,
+                         const double* P, int ldp, double* out, int incout)
+{
+    active_table().sq_mahalanobis_full(m, n, X, ldx, mu, P, ldp, out, incout);
+}
+
+void weighted_scatter(int m, int n, const double* X, int ldx, const double* mu, const double* w,
+                      double* S, int lds)
+{
+    active_table().weighted_scatter(m, n, X, ldx, mu, w, S, lds);
+}
+
+void weighted_sq_dev(int m, int n, const double* X, int ldx, const double* mu, const double* w,
+                     double* v)
+{
+    active_table().weighted_sq_dev(m, n, X, ldx, mu, w, v);
+}
+
+}
@@ -18,7 +18,8 @@
 
 #include "matrix.hxx"
 #include "diagonal.hxx"
-#include "svd.hxx"
+#include "factorize.hxx"
+#include "kernels.hxx"
 
 #include <memory>
 #include <stdexcept>
@@ -26,6 +27,7 @@
 #include <algorithm>
 #include <numeric>
 #include <iostream>
+#include <vector>
 
 namespace util
 {
@@ -37,17 +39,8 @@ Matrix Matrix::dot(const Matrix& right) const
         throw std::runtime_error("dot: A.cols != B.rows");
     }
     Matrix res(m_rows, right.m_cols);
-
-    for (int row = 0; row < m_rows; ++row)
-    {
-        for (int col = 0; col < right.m_cols; ++col)
-        {
-            double val = 0;
-            for (int inner = 0; inner < m_cols; ++inner)
-                val += at(row, inner) * right.at(inner, col);
-            res.at(row, col) = val;
-        }
-    }
+    kernels::gemm(m_rows, right.m_cols, m_cols, m_data.get(), m_cols, right.m_data.get(),
+                  right.m_cols, false, res.m_data.get(), res.m_cols);
     return res;
 }
 
@@ -101,33 +94,22 @@ Matrix Matrix::givens_rot(int col1, int col2, double theta) const
     {
         throw std::runtime_error("givens_rot: invalid col1 and/or col2");
     }
-    if (col1 > col2)
-        std::swap(col1, col2);
-
-    Matrix res(m_rows, m_cols);
-
-    double c = std::cos(theta);
-    double s = std::sin(theta);
+    Matrix res(*this);
+    res.apply_givens_rot(col1, col2, theta);
+    return res;
+}
 
-    int res_index = 0;
-    int row_begin_index = 0;
-    for (int i = 0; i < m_rows; ++i)
+void Matrix::apply_givens_rot(int col1, int col2, double theta)
+{
+    if (col1 < 0 || col1 >= m_cols || col2 < 0 || col2 >= m_cols || col1 == col2)
     {
-        for (int j = 0; j < m_cols; ++j)
-        {
-            double& res_val = res.m_data[res_index];
-            if (j != col1 && j != col2)
-                res_val = m_data[res_index];
-            else if (j == col1)
-                res_val = m_data[res_index] * c + m_data[row_begin_index + col2] * s;
-            else /* j == col2 */
-                res_val = m_data[res_index] * c - m_data[row_begin_index + col1] * s;
-
-            ++res_index;
-        }
-        row_begin_index += m_cols;
+        throw std::runtime_error("apply_givens_rot: invalid col1 and/or col2");
     }
-    return res;
+    if (col1 > col2)
+        std::swap(col1, col2);
+
+    kernels::rotate_cols(m_rows, m_data.get(), m_cols, col1, col2, std::cos(theta),
+                         std::sin(theta));
 }
 
 Matrix::Matrix(const Matrix& other)
@@ -181,14 +163,7 @@ double Matrix::cols_inner_product(int col1, int col2) const
         throw std::runtime_error("cols_inner_product: invalid col1 or col2");
     }
 
-    int row_start = 0;
-    double ip = 0;
-    for (int k = 0; k < m_rows; ++k)
-    {
-        ip += (m_data[row_start + col1] * m_data[row_start + col2]);
-        row_start += m_cols;
-    }
-    return ip;
+    return kernels::cols_dot(m_rows, m_data.get(), m_cols, col1, col2);
 }
 
 Matrix Matrix::dot_inverse(const DiagonalMatrix& right) const { return dot_impl(right, true); }
@@ -200,24 +175,16 @@ Matrix Matrix::dot_impl(const DiagonalMatrix& right, bool inverse) const
         throw std::runtime_error("dot: A.cols != BDiag.size");
     }
 
-    Matrix res(m_rows, m_cols);
-    int index = 0;
-    for (int row = 0; row < m_rows; ++row)
+    if (inverse)
     {
         for (int col = 0; col < m_cols; ++col)
-        {
-            double scale = right.m_data[col];
-            if (inverse)
-            {
-                if (scale == 0.0)
-                    throw std::runtime_error("dot: zero diagonal element in right");
-
-                scale = 1 / scale;
-            }
-            res.m_data[index] = m_data[index] * scale;
-            ++index;
-        }
+            if (right.m_data[col] == 0.0)
+                throw std::runtime_error("dot: zero diagonal element in right");
     }
+
+    Matrix res(m_rows, m_cols);
+    kernels::scale_cols(m_rows, m_cols, m_data.get(), m_cols, right.m_data.get(), inverse,
+                        res.m_data.get(), res.m_cols);
     return res;
 }
 
@@ -228,17 +195,8 @@ Matrix Matrix::dot_transpose(const Matrix& right) const
         throw std::runtime_error("dot: A.cols != B.cols");
     }
     Matrix res(m_rows, right.m_rows);
-
-    for (int rowl = 0; rowl < m_rows; ++rowl)
-    {
-        for (int rowr = 0; rowr < right.m_rows; ++rowr)
-        {
-            double val = 0;
-            for (int inner = 0; inner < m_cols; ++inner)
-                val += at(rowl, inner) * right.at(rowr, inner);
-            res.at(rowl, rowr) = val;
-        }
-    }
+    kernels::gemm(m_rows, right.m_rows, m_cols, m_data.get(), m_cols, right.m_data.get(),
+                  right.m_cols, true, res.m_data.get(), res.m_cols);
     return res;
 }
 
@@ -249,13 +207,41 @@ Matrix Matrix::inverse() const
         throw std::runtime_error("inverse: matrix needs to be square!");
     }
 
-    SVD factors(*this);
-    if (factors.S.is_singular())
+    Matrix factors(*this);
+    std::vector<int> pivots(m_rows);
+    const LU lu(factors, pivots.data());
+    if (lu.is_singular())
     {
         throw std::runtime_error("inverse: input matrix is singular!");
     }
 
-    return factors.V.dot_inverse(factors.S).dot_transpose(factors.U);
+    Matrix res(m_rows, m_cols);
+    lu.inverse(res);
+    return res;
+}
+
+double Matrix::determinant() const
+{
+    if (m_cols != m_rows)
+    {
+        throw std::runtime_error("determinant: matrix needs to be square!");
+    }
+
+    Matrix factors(*this);
+    std::vector<int> pivots(m_rows);
+    return LU(factors, pivots.data()).determinant();
+}
+
+double Matrix::log_determinant() const
+{
+    if (m_cols != m_rows)
+    {
+        throw std::runtime_error("log_determinant: matrix needs to be square!");
+    }
+
+    Matrix factors(*this);
+    std::vector<int> pivots(m_rows);
+    return LU(factors, pivots.data()).log_determinant();
 }
 
 void Matrix::display() const
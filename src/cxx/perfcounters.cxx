@@ -0,0 +1,127 @@
+/*
+* ClusterRows
+* Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "perfcounters.hxx"
+
+#include <algorithm>
+
+#if defined(__linux__)
+#include <cstdint>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace util
+{
+
+#if defined(__linux__)
+
+namespace
+{
+
+constexpr uint64_t event_configs[PerfCounters::NUM_EVENTS]{
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+int open_event(uint64_t config, int group_fd)
+{
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.read_format
+        = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // The leader starts the group, user space only counting works with perf_event_paranoid 2.
+    attr.disabled = group_fd < 0 ? 1 : 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0));
+}
+
+} // anonymous namespace
+
+PerfCounters::PerfCounters()
+    : m_leader(-1)
+{
+    for (int event = 0; event < NUM_EVENTS; ++event)
+    {
+        m_fds[event] = open_event(event_configs[event], m_leader);
+        if (m_fds[event] >= 0 && m_leader < 0)
+            m_leader = m_fds[event];
+    }
+
+    if (m_leader >= 0)
+    {
+        ioctl(m_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(m_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+PerfCounters::~PerfCounters()
+{
+    for (int fd : m_fds)
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+}
+
+void PerfCounters::read(long long* values) const
+{
+    std::fill(values, values + NUM_EVENTS, -1LL);
+    if (m_leader < 0)
+        return;
+
+    // { nr, time_enabled, time_running, value[nr] } with the values in the order of opening.
+    uint64_t buffer[3 + NUM_EVENTS];
+    if (::read(m_leader, buffer, sizeof(buffer)) < static_cast<ssize_t>(3 * sizeof(uint64_t)))
+        return;
+
+    const uint64_t enabled = buffer[1];
+    const uint64_t running = buffer[2];
+    const double scale = running > 0 ? static_cast<double>(enabled) / running : 0.0;
+    uint64_t next = 0;
+    for (int event = 0; event < NUM_EVENTS && next < buffer[0]; ++event)
+    {
+        if (m_fds[event] >= 0)
+            values[event] = static_cast<long long>(static_cast<double>(buffer[3 + next++]) * scale);
+    }
+}
+
+#else
+
+PerfCounters::PerfCounters()
+    : m_leader(-1)
+{
+    std::fill(m_fds, m_fds + NUM_EVENTS, -1);
+}
+
+PerfCounters::~PerfCounters() = default;
+
+void PerfCounters::read(long long* values) const { std::fill(values, values + NUM_EVENTS, -1LL); }
+
+#endif
+
+}
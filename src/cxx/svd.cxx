@@ -55,8 +55,8 @@ SVD::SVD(const Matrix& A)
 
                 double theta = 0.5 * std::atan2(2 * r, p - q);
 
-                U = U.givens_rot(i, j, theta);
-                V = V.givens_rot(i, j, theta);
+                U.apply_givens_rot(i, j, theta);
+                V.apply_givens_rot(i, j, theta);
             }
         }
     }
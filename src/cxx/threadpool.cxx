@@ -0,0 +1,98 @@
+/*
+* ClusterRows
+* Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "threadpool.hxx"
+
+#include <algorithm>
+
+util::ThreadPool::ThreadPool(int num_threads)
+{
+    const int num_workers = std::max(1, num_threads) - 1;
+    workers.reserve(num_workers);
+    for (int thread = 1; thread <= num_workers; ++thread)
+        workers.emplace_back(&ThreadPool::work, this, thread);
+}
+
+util::ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+}
+
+void util::ThreadPool::parallel_for(int count_, const std::function<void(int, int)>& task)
+{
+    if (count_ <= 0)
+        return;
+
+    std::lock_guard<std::mutex> call_lock(call_mutex);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        current = &task;
+        count = count_;
+        next = 0;
+        busy = static_cast<int>(workers.size());
+        ++generation;
+    }
+    wake.notify_all();
+
+    drain(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return busy == 0; });
+    current = nullptr;
+}
+
+util::ThreadPool& util::ThreadPool::shared()
+{
+    // Never destroyed: joining threads from static destructors can deadlock while the library
+    // is being unloaded, and the sleeping workers hold no resources worth releasing.
+    static ThreadPool* pool = new ThreadPool(static_cast<int>(std::thread::hardware_concurrency()));
+    return *pool;
+}
+
+void util::ThreadPool::work(int thread)
+{
+    unsigned seen = 0;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this, seen] { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+        }
+
+        drain(thread);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--busy == 0)
+            done.notify_one();
+    }
+}
+
+void util::ThreadPool::drain(int thread)
+{
+    for (int index = next++; index < count; index = next++)
+        (*current)(index, thread);
+}
@@ -0,0 +1,147 @@
+/*
+* ClusterRows
+* Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <trace.hxx>
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+
+struct Event
+{
+    const char* name;
+    uint64_t begin_ns;
+    uint64_t end_ns;
+    double arg;
+};
+
+// Single producer ring buffer owned by one thread; the dumper only reads it.
+struct ThreadBuffer
+{
+    static constexpr uint64_t capacity = 1 << 16;
+
+    explicit ThreadBuffer(int tid_)
+        : events(std::make_unique<Event[]>(capacity))
+        , tid(tid_)
+    {
+    }
+
+    std::unique_ptr<Event[]> events;
+    std::atomic<uint64_t> head{ 0 };
+    const int tid;
+};
+
+struct Registry
+{
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+};
+
+Registry& registry()
+{
+    static Registry instance;
+    return instance;
+}
+
+ThreadBuffer& thread_buffer()
+{
+    // Buffers are never freed so that events of finished threads can still be dumped.
+    thread_local ThreadBuffer* buffer = nullptr;
+    if (!buffer)
+    {
+        auto& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.buffers.push_back(std::make_unique<ThreadBuffer>(static_cast<int>(reg.buffers.size())));
+        buffer = reg.buffers.back().get();
+    }
+    return *buffer;
+}
+
+}
+
+namespace trace
+{
+
+uint64_t now_ns()
+{
+    const auto elapsed = std::chrono::steady_clock::now() - registry().start;
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+}
+
+void record(const char* name, uint64_t begin_ns, uint64_t end_ns, double arg)
+{
+    auto& buffer = thread_buffer();
+    const uint64_t idx = buffer.head.load(std::memory_order_relaxed);
+    buffer.events[idx & (ThreadBuffer::capacity - 1)] = { name, begin_ns, end_ns, arg };
+    buffer.head.store(idx + 1, std::memory_order_release);
+}
+
+bool dump_chrome_json(const char* path)
+{
+    FILE* fp = std::fopen(path, "w");
+    if (!fp)
+        return false;
+
+    auto& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    std::fputs("{\"traceEvents\":[", fp);
+    bool first = true;
+    for (const auto& buffer : reg.buffers)
+    {
+        const uint64_t head = buffer->head.load(std::memory_order_acquire);
+        const uint64_t begin = head > ThreadBuffer::capacity ? head - ThreadBuffer::capacity : 0;
+        for (uint64_t idx = begin; idx < head; ++idx)
+        {
+            const Event& event = buffer->events[idx & (ThreadBuffer::capacity - 1)];
+            std::fprintf(fp,
+                         "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,"
+                         "\"dur\":%.3f,\"args\":{\"value\":%.17g}}",
+                         first ? "" : ",", event.name, buffer->tid, event.begin_ns / 1000.0,
+                         (event.end_ns - event.begin_ns) / 1000.0,
+                         std::isfinite(event.arg) ? event.arg : 0.0);
+            first = false;
+        }
+    }
+    std::fputs("\n],\"displayTimeUnit\":\"ms\"}\n", fp);
+    return std::fclose(fp) == 0;
+}
+
+void dump_from_env()
+{
+    if (const char* path = std::getenv("CLUSTERROWS_TRACE"))
+        dump_chrome_json(path);
+}
+
+void clear()
+{
+    auto& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (auto& buffer : reg.buffers)
+        buffer->head.store(0, std::memory_order_release);
+}
+
+}
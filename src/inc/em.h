@@ -23,6 +23,186 @@
 extern "C"
 {
 #endif
+    /// @brief Covariance structures of the clusters, the values of GMMOptions::fullGMM.
+    typedef enum CRCovarianceType
+    {
+        /// a variance per dimension.
+        CR_COVARIANCE_DIAGONAL = 0,
+        /// a full covariance matrix per cluster.
+        CR_COVARIANCE_FULL = 1,
+        /// a single variance per cluster.
+        CR_COVARIANCE_SPHERICAL = 2,
+        /// one full covariance matrix shared by all clusters.
+        CR_COVARIANCE_TIED = 3,
+    } CRCovarianceType;
+
+    /// @brief Engine strategies picked by the planner, the values of GMMStats::planStrategy.
+    typedef enum CRStrategy
+    {
+        /// the options were used as given (GMMOptions::autoPlan is 0).
+        CR_STRATEGY_NONE = 0,
+        /// in-memory EM over all rows and clusters.
+        CR_STRATEGY_DENSE = 1,
+        /// kd-tree accelerated EM for inputs with few columns.
+        CR_STRATEGY_TREE = 2,
+        /// truncated EM keeping the most responsible clusters of each row.
+        CR_STRATEGY_TRUNCATED = 3,
+        /// EM on the principal components of wide inputs.
+        CR_STRATEGY_PCA = 4,
+        /// out-of-core EM reading the rows in chunks, for inputs whose responsibilities do not
+        /// fit in memory.
+        CR_STRATEGY_STREAMING = 5,
+    } CRStrategy;
+
+    /// @brief Engine phases, the indices of the per phase counters of GMMStats.
+    typedef enum CRPhase
+    {
+        /// cluster initialization, kd-tree building and PCA.
+        CR_PHASE_INIT = 0,
+        /// expectation steps.
+        CR_PHASE_ESTEP = 1,
+        /// maximization steps.
+        CR_PHASE_MSTEP = 2,
+        /// scoring of candidate models to pick the number of clusters.
+        CR_PHASE_SELECT = 3,
+        CR_NUM_PHASES = 4,
+    } CRPhase;
+
+    /// @brief Clustering parameters for gmmMainEx().
+    /// Always initialize with gmmInitOptions() before setting the fields of interest so that
+    /// fields added in later versions get their defaults.
+    typedef struct GMMOptions
+    {
+        /// desired number of clusters (It will auto compute this if 0 is provided).
+        int numClusters;
+        /// desired number of epochs.
+        int numEpochs;
+        /// maximum number of iterations in each epoch.
+        int numIterations;
+        /// covariance structure, one of CRCovarianceType (other non-zero values mean full).
+        /// The kd-tree, streaming and variational engines fit tied ones as full and spherical
+        /// ones as diagonal.
+        int fullGMM;
+        /// number of rows read per chunk by the streaming engine.
+        int chunkRows;
+        /// kd-tree accelerated EM for inputs with at most 6 columns: the largest variation of
+        /// responsibilities over a tree node below which the node is treated as a whole.
+        /// 0 disables the kd-tree.
+        double treeTolerance;
+        /// truncated EM: number of most responsible clusters kept per row, so that the E-step
+        /// and M-step cost scales with it instead of the number of clusters. 0 keeps all.
+        int topK;
+        /// truncated EM: all clusters are evaluated to re-pick the kept ones every this many
+        /// iterations (and before an epoch is declared converged). Values below 1 mean 1.
+        int topKRefresh;
+        /// when numClusters is 0: fit a variational Bayes GMM with at most this many clusters
+        /// once, and keep the clusters that are not emptied by the prior. 0 searches 2..5.
+        int vbMaxClusters;
+        /// Dirichlet concentration of the mixing weights in variational Bayes fits, smaller
+        /// values prune more aggressively.
+        double vbConcentration;
+        /// project the rows onto the principal components that explain this fraction of the
+        /// variance (randomized PCA) before clustering wide data. 0 disables the projection.
+        double pcaVariance;
+        /// when numClusters is 0: search 2..orderSearchMaxClusters clusters incrementally, each
+        /// count starting from its neighbour by splitting or merging clusters and ranked by BIC,
+        /// instead of fitting 2..5 clusters from scratch. 0 disables the search.
+        int orderSearchMaxClusters;
+        /// let the planner pick the engine strategy (dense, kd-tree, truncated, PCA or
+        /// streaming) and its parameters from the shape of the input and the resources below,
+        /// overriding treeTolerance, topK and pcaVariance. 0 uses the options as given.
+        int autoPlan;
+        /// with autoPlan: memory the engine may use in MB, 0 for most of the available memory.
+        double maxMemoryMB;
+        /// with autoPlan: most threads gmmBatchMain() may use when its numThreads is 0,
+        /// 0 for one per hardware thread. A single job runs on one thread.
+        int maxThreads;
+        /// with autoPlan: wall time the run should stay within in milliseconds, reached by
+        /// cheaper strategies and fewer epochs. 0 means no budget.
+        double timeBudgetMs;
+        /// count CPU cycles, instructions, last level cache misses and branch misses per phase
+        /// with hardware performance counters (Linux only). See GMMStats::perfStatus.
+        int perfCounters;
+        /// standardize the columns to zero mean and unit variance before clustering. Diagonal,
+        /// full and tied fits do not depend on the scale of the columns without it, as the
+        /// initial covariances follow the column variances. Spherical fits weigh all columns
+        /// alike, so this matters for them when the columns have very different scales.
+        int normalize;
+        /// seed of the random choices of the engines (cluster seeds and the streaming
+        /// engine's sample), so that repeated runs give the same result. 0 seeds them from the
+        /// clock.
+        unsigned int seed;
+    } GMMOptions;
+
+    /// @brief Timings and counters of a clustering run, filled by gmmMainEx().
+    typedef struct GMMStats
+    {
+        /// time spent in cluster initialization in milliseconds.
+        double initTimeMs;
+        /// time spent in expectation steps in milliseconds.
+        double eStepTimeMs;
+        /// time spent in maximization steps in milliseconds.
+        double mStepTimeMs;
+        /// wall time of the whole call in milliseconds.
+        double totalTimeMs;
+        /// number of candidate cluster counts that were fitted.
+        int numCandidates;
+        /// number of epochs run for each candidate cluster count.
+        int epochsPerCandidate;
+        /// total number of epochs over all candidates.
+        int totalEpochs;
+        /// total number of EM iterations over all epochs.
+        int totalIterations;
+        /// fewest iterations taken by an epoch.
+        int minIterationsPerEpoch;
+        /// most iterations taken by an epoch.
+        int maxIterationsPerEpoch;
+        /// number of clusters of the chosen model.
+        int bestNumClusters;
+        /// number of threads used.
+        int threadsUsed;
+        /// number of working buffer allocations done by the engine.
+        long long allocCount;
+        /// total bytes of working buffers allocated by the engine.
+        long long allocBytes;
+        /// number of distinct rows EM ran on after collapsing repeated rows (0 if not applicable).
+        int uniqueRows;
+        /// number of principal components EM ran on (0 if the rows were not projected).
+        int pcaComponents;
+        /// number of M-steps that floored the variances of a covariance or loaded its diagonal
+        /// because it was (nearly) singular.
+        int regularizedCovariances;
+        /// number of collapsed clusters that were reseeded at a poorly explained sample.
+        int reseededClusters;
+        /// engine strategy chosen by the planner, one of CRStrategy.
+        int planStrategy;
+        /// run time the planner estimated for the chosen strategy in milliseconds.
+        double planEstimatedMs;
+        /// memory the planner estimated for the chosen strategy in MB.
+        double planEstimatedMB;
+        /// time spent in model selection in milliseconds.
+        double selectTimeMs;
+        /// 1 if the hardware counters below were sampled, 0 if GMMOptions::perfCounters was not
+        /// set and -1 if the system does not permit counting (the counters are then -1).
+        int perfStatus;
+        /// CPU cycles per phase (CRPhase), -1 if the event is not available. This and the
+        /// counters below only count the thread that called gmmMainEx(): large inputs are
+        /// ingested in blocks on the shared thread pool, and that part of CR_PHASE_INIT is left
+        /// out.
+        long long perfCycles[CR_NUM_PHASES];
+        /// retired instructions per phase, -1 if the event is not available.
+        long long perfInstructions[CR_NUM_PHASES];
+        /// last level cache misses per phase, -1 if the event is not available.
+        long long perfCacheMisses[CR_NUM_PHASES];
+        /// mispredicted branches per phase, -1 if the event is not available.
+        long long perfBranchMisses[CR_NUM_PHASES];
+        /// number of input rows with NaN or infinite values, which were labelled -1.
+        int invalidRows;
+    } GMMStats;
+
+    /// @brief Fills @p options with the default parameters.
+    void CR_DLLPUBLIC_EXPORT gmmInitOptions(GMMOptions* options);
+
     /// @brief computes cluster assignments for each row of data according to gaussian mixture model.
     /// @param array input matrix stored in column major form.
     /// @param rows number of rows of the input matrix.
@@ -32,12 +212,116 @@ extern "C"
     /// @param numIterations maximum number of iterations in each epoch.
     /// @param clusterLabels output array to put each row's cluster assignment label.
     /// @param labelConfidence output array to store confidence score of each cluster assignment.
-    /// @param fullGMM specifies whether to perform a full covariance matrix GMM or not.
+    /// @param fullGMM covariance structure, one of CRCovarianceType (1 is a full covariance GMM).
     /// @return 0 on success and -1 on failure.
     int CR_DLLPUBLIC_EXPORT gmmMain(const double* array, int rows, int cols, int numClusters,
                                     int numEpochs, int numIterations, int* clusterLabels,
                                     double* labelConfidence, int fullGMM);
 
+    /// @brief Same as gmmMain() but takes its parameters as a GMMOptions struct and optionally
+    /// reports statistics of the run. Rows with NaN or infinite values are not clustered and get
+    /// label -1 with confidence 0.
+    /// @param array input matrix stored in row major form.
+    /// @param rows number of rows of the input matrix.
+    /// @param cols number of columns of the input matrix.
+    /// @param options clustering parameters, defaults are used if null.
+    /// @param clusterLabels output array to put each row's cluster assignment label.
+    /// @param labelConfidence output array to store confidence score of each cluster assignment.
+    /// @param stats optional output for timings and counters of the run (may be null).
+    /// @return 0 on success and -1 on failure.
+    int CR_DLLPUBLIC_EXPORT gmmMainEx(const double* array, int rows, int cols,
+                                      const GMMOptions* options, int* clusterLabels,
+                                      double* labelConfidence, GMMStats* stats);
+
+    /// @brief One clustering problem of a gmmBatchMain() call, with the arguments of gmmMainEx().
+    typedef struct GMMJob
+    {
+        /// input matrix stored in row major form.
+        const double* array;
+        /// number of rows of the input matrix.
+        int rows;
+        /// number of columns of the input matrix.
+        int cols;
+        /// clustering parameters, defaults are used if null.
+        const GMMOptions* options;
+        /// output array to put each row's cluster assignment label.
+        int* clusterLabels;
+        /// output array to store confidence score of each cluster assignment.
+        double* labelConfidence;
+        /// optional output for timings and counters of the job (may be null).
+        GMMStats* stats;
+        /// output: what gmmMainEx() would have returned for the job.
+        int status;
+    } GMMJob;
+
+    /// @brief Runs gmmMainEx() on every job, in parallel. The jobs are started largest first on
+    /// a shared pool of threads (longest processing time first scheduling), each thread reusing
+    /// one set of working buffers for all the jobs it runs, and on the shared pool across calls.
+    /// @param jobs the jobs, their status fields are set on return.
+    /// @param numJobs number of jobs.
+    /// @param numThreads number of threads to use, 0 for one per hardware thread or the smallest
+    /// GMMOptions::maxThreads of the jobs that set autoPlan.
+    /// @return 0 if every job succeeded and -1 otherwise.
+    int CR_DLLPUBLIC_EXPORT gmmBatchMain(GMMJob* jobs, int numJobs, int numThreads);
+
+    /// @brief Compresses cluster labels into runs of consecutive rows with the same label, so
+    /// that per cluster formatting can be applied to a few ranges instead of row by row. Runs are
+    /// ordered by label and then by first row. Rows with negative labels are skipped.
+    /// @param clusterLabels labels of the rows, e.g. from gmmMainEx().
+    /// @param rows number of rows.
+    /// @param runLabels output: label of each run, room for @p rows entries.
+    /// @param runStarts output: first row of each run, room for @p rows entries.
+    /// @param runLengths output: number of rows of each run, room for @p rows entries.
+    /// @return number of runs, or -1 on invalid arguments.
+    int CR_DLLPUBLIC_EXPORT gmmLabelRuns(const int* clusterLabels, int rows, int* runLabels,
+                                         int* runStarts, int* runLengths);
+
+    /// @brief Reads up to @p maxRows rows in row major form into @p buffer.
+    /// @return number of rows read, 0 at the end of the input and -1 on error.
+    typedef int (*CRReadRowsFn)(void* context, double* buffer, int maxRows);
+    /// @brief Restarts reading from the first row.
+    typedef void (*CRRewindFn)(void* context);
+    /// @brief Receives the labels and confidences of the next @p rows rows.
+    typedef void (*CRWriteLabelsFn)(void* context, const int* clusterLabels,
+                                    const double* labelConfidence, int rows);
+
+    /// @brief Out-of-core variant of gmmMainEx(). The input is pulled chunk by chunk through
+    /// @p readRows, fitting makes one pass over the input per EM iteration and the labels are
+    /// pushed to @p writeLabels in a final pass, so memory use does not depend on the number of
+    /// rows.
+    /// @param cols number of columns of the input.
+    /// @param readRows callback reading the next chunk of rows.
+    /// @param rewind callback restarting the input.
+    /// @param readerContext context passed to @p readRows and @p rewind.
+    /// @param options clustering parameters, defaults are used if null.
+    /// @param writeLabels callback receiving labels and confidences in input order.
+    /// @param writerContext context passed to @p writeLabels.
+    /// @param stats optional output for timings and counters of the run (may be null).
+    /// @return 0 on success and -1 on failure.
+    int CR_DLLPUBLIC_EXPORT gmmStreamMain(int cols, CRReadRowsFn readRows, CRRewindFn rewind,
+                                          void* readerContext, const GMMOptions* options,
+                                          CRWriteLabelsFn writeLabels, void* writerContext,
+                                          GMMStats* stats);
+
+    /// @brief Density based clustering (DBSCAN) for clusters of any shape in up to 8 columns,
+    /// with the output of gmmMainEx(). Rows within @p eps of at least @p minPoints rows (counting
+    /// themselves) are core rows, core rows within @p eps of each other form a cluster, and rows
+    /// within @p eps of a core row join its cluster. The other rows, and rows with NaN or
+    /// infinite values, are noise and get label -1 with confidence 0.
+    /// @param array input matrix stored in row major form.
+    /// @param rows number of rows of the input matrix.
+    /// @param cols number of columns of the input matrix, at most 8.
+    /// @param eps neighbourhood radius, 0 to estimate it as twice the distance within which 90%
+    /// of sample rows have minPoints neighbours, which suits inputs with little noise.
+    /// @param minPoints rows a neighbourhood needs to be dense, 0 for max(4, 2 * cols, ln(rows)).
+    /// @param clusterLabels output array to put each row's cluster assignment label.
+    /// @param labelConfidence output array to store confidence score of each cluster assignment:
+    /// 1 for core rows and the fraction of minPoints neighbours for the others.
+    /// @return number of clusters found, or -1 on failure.
+    int CR_DLLPUBLIC_EXPORT dbscanMain(const double* array, int rows, int cols, double eps,
+                                       int minPoints, int* clusterLabels,
+                                       double* labelConfidence);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,104 @@
+/*
+* ClusterRows
+* Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "macros.h"
+#include "matrix.hxx"
+
+namespace util
+{
+
+/// @brief LU factorization with partial pivoting, PA = LU, computed in place: the matrix is
+/// overwritten by L (unit diagonal, not stored) below the diagonal and U on and above it, and
+/// the row interchanges go to caller provided storage. Both must outlive the object.
+class CR_DLLPUBLIC_EXPORT LU
+{
+public:
+    /// @brief Factorizes the square matrix @p A, @p pivots must have room for A.rows() ints.
+    LU(Matrix& A, int* pivots);
+
+    /// @brief True if a pivot vanished, in which case solve() and inverse() must not be used.
+    [[nodiscard]] bool is_singular() const { return m_singular; }
+
+    /// @brief Overwrites the n x k matrix @p B by the solution X of A X = B.
+    void solve(Matrix& B) const;
+    /// @brief Stores the inverse of A in the n x n matrix @p inverse.
+    void inverse(Matrix& inverse) const;
+    [[nodiscard]] double determinant() const;
+    /// @brief Returns log |det A|, see sign() for the sign of the determinant.
+    [[nodiscard]] double log_determinant() const;
+    [[nodiscard]] int sign() const;
+
+private:
+    Matrix& m_lu;
+    int* m_pivots;
+    int m_sign;
+    bool m_singular;
+};
+
+/// @brief Cholesky factorization A = L L^T of a symmetric positive definite matrix, computed in
+/// place: the matrix is overwritten by L (its upper triangle is zeroed). Only the lower
+/// triangle of A is read. The matrix must outlive the object.
+class CR_DLLPUBLIC_EXPORT Cholesky
+{
+public:
+    explicit Cholesky(Matrix& A);
+
+    /// @brief False if A is not (numerically) positive definite, in which case the other
+    /// methods must not be used.
+    [[nodiscard]] bool is_positive_definite() const { return m_positive_definite; }
+
+    /// @brief Overwrites the n x k matrix @p B by the solution X of A X = B.
+    void solve(Matrix& B) const;
+    /// @brief Stores the inverse of A in the n x n matrix @p inverse.
+    void inverse(Matrix& inverse) const;
+    [[nodiscard]] double log_determinant() const;
+
+private:
+    Matrix& m_L;
+    bool m_positive_definite;
+};
+
+/// @brief Householder QR factorization A = QR of an m x n matrix with m >= n, computed in
+/// place as in LAPACK's dgeqrf: R is stored on and above the diagonal and the Householder
+/// vectors (with an implicit leading 1) below it, their scale factors go to caller provided
+/// storage. Both must outlive the object.
+class CR_DLLPUBLIC_EXPORT QR
+{
+public:
+    /// @brief Factorizes @p A, @p tau must have room for A.cols() doubles.
+    QR(Matrix& A, double* tau);
+
+    /// @brief True if R has a vanishing diagonal element, i.e. A is rank deficient.
+    [[nodiscard]] bool is_rank_deficient() const { return m_rank_deficient; }
+
+    /// @brief Overwrites the m x k matrix @p B by Q^T B and solves R X = (Q^T B)[0:n] into its
+    /// first n rows, giving the least squares solution of A X = B.
+    void solve(Matrix& B) const;
+    /// @brief Stores the inverse of the square A in the n x n matrix @p inverse.
+    void inverse(Matrix& inverse) const;
+    /// @brief Returns log |det A| of the square A.
+    [[nodiscard]] double log_determinant() const;
+
+private:
+    Matrix& m_qr;
+    double* m_tau;
+    bool m_rank_deficient;
+};
+
+}
@@ -18,54 +18,75 @@
 
 #pragma once
 
+#include <gmm/covariance.hxx>
 #include <gmm/data.hxx>
 
 #include <Eigen/Dense>
-#include <optional>
+#include <cmath>
 #include <ostream>
 
 namespace gmm
 {
 using namespace Eigen;
-class Model;
+template <int Dim, CovarianceType Type> class Model;
 class Data;
 
-class Cluster
+/// @brief A mixture component. @p Dim is the dimension of the samples when known at compile
+/// time, so that the small vectors and matrices are fixed size (no heap, unrolled loops and
+/// closed form inverse/determinant for Dim <= 4), or Eigen::Dynamic otherwise. @p Type picks
+/// the gmm::Covariance policy.
+template <int Dim = Dynamic, CovarianceType Type = CovarianceType::FULL> class Cluster
 {
+public:
+    using Vector = Matrix<double, Dim, 1>;
+
+private:
     const Data& data; // m x n
-    MatrixXd mu;
-    std::optional<MatrixXd> sigma; // full
-    std::optional<std::vector<double>> stds;
+    Vector mu;
+    Covariance<Dim, Type> cov;
     double phi;
     int num_clusters;
     int idx;
-    bool full_gmm;
+    // Scratch vector for density evaluation, allocated once per cluster.
+    mutable Vector diff;
 
 public:
     [[nodiscard]] int samples() const { return data.rows(); }
-    [[nodiscard]] int dims() const { return data.cols(); }
+    [[nodiscard]] int dims() const { return Dim == Dynamic ? data.cols() : Dim; }
     [[nodiscard]] int clusters() const { return num_clusters; }
 
-    Cluster(int idx_, const Data& data_, int num_clusters_, bool full_gmm);
+    Cluster(int idx_, const Data& data_, int num_clusters_);
     void init(int use_sample);
 
     void clear_mu_sigma();
 
-    [[nodiscard]] MatrixXd inv_covar_matrix() const
+    /// @brief Mixing weight times the density of the cluster at @p sample.
+    [[nodiscard]] double sample_probability(int sample) const
     {
-        assert(full_gmm);
-        return sigma->inverse();
+        diff = data.point<Dim>(sample) - mu;
+        return phi * cov.density(diff);
     }
-    [[nodiscard]] double cov_determinant() const
+
+    /// @brief Stores sample_probability() of every sample in out[sample * inc].
+    void sample_probabilities(double* out, int inc) const
     {
-        assert(full_gmm);
-        return sigma->determinant();
+        const int m = samples();
+        if constexpr (Dim == Dynamic)
+        {
+            cov.sq_distances(m, data.points(), mu.data(), out, inc);
+            const double coef = phi * cov.normalizer();
+            for (int sample = 0; sample < m; ++sample)
+                out[sample * inc] = coef * std::exp(-0.5 * out[sample * inc]);
+        }
+        else
+        {
+            for (int sample = 0; sample < m; ++sample)
+                out[sample * inc] = sample_probability(sample);
+        }
     }
-    [[nodiscard]] double sample_probability(int sample, const MatrixXd& cov_inv,
-                                            const double cov_determinant) const;
-    [[nodiscard]] double sample_probability(int sample) const;
 
-    friend class Model;
-    friend std::ostream& operator<<(std::ostream&, const Cluster&);
+    template <int, CovarianceType> friend class Model;
+    template <int D, CovarianceType T>
+    friend std::ostream& operator<<(std::ostream&, const Cluster<D, T>&);
 };
 }
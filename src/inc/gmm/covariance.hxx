@@ -0,0 +1,315 @@
+/*
+ * ClusterRows
+ * Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <em.h>
+#include <kernels.hxx>
+
+#include <Eigen/Dense>
+
+#include <cmath>
+
+namespace gmm
+{
+
+using namespace Eigen;
+
+/// @brief Covariance structure of the clusters, see CRCovarianceType.
+enum class CovarianceType
+{
+    DIAGONAL = CR_COVARIANCE_DIAGONAL,
+    FULL = CR_COVARIANCE_FULL,
+    SPHERICAL = CR_COVARIANCE_SPHERICAL,
+    TIED = CR_COVARIANCE_TIED,
+};
+
+/// @brief Maps GMMOptions::fullGMM to a covariance type. Unknown non-zero values mean full, as
+/// before the other structures existed.
+inline CovarianceType covariance_type(int option)
+{
+    switch (option)
+    {
+        case CR_COVARIANCE_DIAGONAL:
+        case CR_COVARIANCE_SPHERICAL:
+        case CR_COVARIANCE_TIED:
+            return static_cast<CovarianceType>(option);
+        default:
+            return CovarianceType::FULL;
+    }
+}
+
+/// @brief Whether the engines that only know diagonal and full covariances (kd-tree, streaming,
+/// variational) should fit full ones for GMMOptions::fullGMM = @p option.
+inline bool full_covariance(int option)
+{
+    const CovarianceType type = covariance_type(option);
+    return type == CovarianceType::FULL || type == CovarianceType::TIED;
+}
+
+/// @brief Covariance parameters of one cluster, as a policy of gmm::Cluster and gmm::Model.
+/// Each specialization provides init() from the column variances of the data, the M-step
+/// accumulation clear(), accumulate(), add() and finish(), and density() of a centred sample
+/// which only uses what init() and finish() precomputed, so that the E-step never branches on
+/// the covariance structure. set() assigns the nearest covariance of the structure to a full
+/// matrix and parameters() counts the free parameters. finish() keeps the variances at or above
+/// a floor so that a cluster shrinking onto a few samples stays invertible, and returns whether
+/// it had to raise them. If SHARED, the M-step pools the accumulations of all clusters into one
+/// covariance.
+/// For Dim = Dynamic the E-step and M-step work on all samples at once through sq_distances(),
+/// normalizer() and accumulate_all(), which use the ISA dispatched util::kernels.
+template <int Dim, CovarianceType Type> class Covariance;
+
+template <int Dim> class Covariance<Dim, CovarianceType::FULL>
+{
+public:
+    using Vector = Matrix<double, Dim, 1>;
+    using Square = Matrix<double, Dim, Dim>;
+    static constexpr bool SHARED = false;
+
+    explicit Covariance(int n)
+        : sigma(n, n)
+        , inverse(n, n)
+        , tmp(n)
+    {
+    }
+
+    void init(const ArrayXd& data_variances)
+    {
+        sigma.setZero();
+        sigma.diagonal() = 5.0 * data_variances.matrix();
+        update();
+    }
+    void clear() { sigma.setZero(); }
+    void accumulate(double wt, const Vector& diff)
+    {
+        sigma.noalias() += wt * diff * diff.transpose();
+    }
+    void add(const Covariance& other) { sigma += other.sigma; }
+    bool finish(double weight, double floor)
+    {
+        sigma /= weight;
+        // Load the diagonal progressively, as in GaussianMixture::factorize(), until the
+        // covariance is positive definite with no variance conditional on the preceding axes
+        // (the squared pivots of its Cholesky factor) below the floor.
+        bool loaded = false;
+        LLT<Square> llt(sigma);
+        for (double loading = floor;
+             (llt.info() != Success
+              || (llt.matrixLLT().diagonal().array().square() < floor).any())
+             && std::isfinite(loading);
+             loading *= 10)
+        {
+            sigma.diagonal().array() += loading;
+            llt.compute(sigma);
+            loaded = true;
+        }
+        update();
+        return loaded;
+    }
+    void set(const Square& matrix)
+    {
+        sigma = matrix;
+        update();
+    }
+    static int parameters(int n) { return n * (n + 1) / 2; }
+
+    void accumulate_all(int m, const double* points, const double* mean, const double* wts)
+    {
+        const int n = sigma.rows();
+        util::kernels::weighted_scatter(m, n, points, n, mean, wts, sigma.data(), n);
+    }
+
+    [[nodiscard]] double density(const Vector& diff) const
+    {
+        tmp.noalias() = inverse * diff;
+        return std::exp(-0.5 * diff.dot(tmp)) * scale;
+    }
+    void sq_distances(int m, const double* points, const double* mean, double* out, int inc) const
+    {
+        // The inverse is symmetric, so its storage order does not matter.
+        const int n = inverse.rows();
+        util::kernels::sq_mahalanobis_full(m, n, points, n, mean, inverse.data(), n, out, inc);
+    }
+    [[nodiscard]] double normalizer() const { return scale; }
+    [[nodiscard]] Square matrix() const { return sigma; }
+
+private:
+    void update()
+    {
+        inverse = sigma.inverse();
+        scale = 1.0 / std::sqrt(std::pow(2 * M_PI, sigma.rows()) * sigma.determinant());
+    }
+
+    Square sigma;
+    Square inverse;
+    double scale;
+    mutable Vector tmp;
+};
+
+/// @brief Full covariance shared by all clusters.
+template <int Dim>
+class Covariance<Dim, CovarianceType::TIED> : public Covariance<Dim, CovarianceType::FULL>
+{
+public:
+    static constexpr bool SHARED = true;
+    using Covariance<Dim, CovarianceType::FULL>::Covariance;
+};
+
+template <int Dim> class Covariance<Dim, CovarianceType::DIAGONAL>
+{
+public:
+    using Vector = Matrix<double, Dim, 1>;
+    using Square = Matrix<double, Dim, Dim>;
+    static constexpr bool SHARED = false;
+
+    explicit Covariance(int n)
+        : variances(n)
+        , inverses(n)
+    {
+    }
+
+    void init(const ArrayXd& data_variances)
+    {
+        variances = 1.5 * 1.5 * data_variances;
+        update();
+    }
+    void clear() { variances.setZero(); }
+    void accumulate(double wt, const Vector& diff) { variances += wt * diff.array().square(); }
+    void add(const Covariance& other) { variances += other.variances; }
+    bool finish(double weight, double floor)
+    {
+        variances /= weight;
+        const bool floored = (variances < floor).any();
+        if (floored)
+            variances = variances.max(floor);
+        update();
+        return floored;
+    }
+    void set(const Square& matrix)
+    {
+        variances = matrix.diagonal().array();
+        update();
+    }
+    static int parameters(int n) { return n; }
+
+    void accumulate_all(int m, const double* points, const double* mean, const double* wts)
+    {
+        const int n = variances.size();
+        util::kernels::weighted_sq_dev(m, n, points, n, mean, wts, variances.data());
+    }
+
+    [[nodiscard]] double density(const Vector& diff) const
+    {
+        return std::exp(-0.5 * (diff.array().square() * inverses).sum()) * scale;
+    }
+    void sq_distances(int m, const double* points, const double* mean, double* out, int inc) const
+    {
+        const int n = inverses.size();
+        util::kernels::sq_mahalanobis_diag(m, n, points, n, mean, inverses.data(), out, inc);
+    }
+    [[nodiscard]] double normalizer() const { return scale; }
+    [[nodiscard]] Square matrix() const { return variances.matrix().asDiagonal(); }
+
+private:
+    void update()
+    {
+        inverses = variances.inverse();
+        scale = 1.0 / std::sqrt(std::pow(2 * M_PI, variances.size()) * variances.prod());
+    }
+
+    Array<double, Dim, 1> variances;
+    Array<double, Dim, 1> inverses;
+    double scale;
+};
+
+/// @brief A single variance for all dimensions.
+template <int Dim> class Covariance<Dim, CovarianceType::SPHERICAL>
+{
+public:
+    using Vector = Matrix<double, Dim, 1>;
+    using Square = Matrix<double, Dim, Dim>;
+    static constexpr bool SHARED = false;
+
+    explicit Covariance(int n_)
+        : n{ n_ }
+        , inverses(n_)
+        , deviations(n_)
+    {
+    }
+
+    void init(const ArrayXd& data_variances)
+    {
+        variance = 1.5 * 1.5 * data_variances.mean();
+        update();
+    }
+    void clear() { variance = 0.0; }
+    void accumulate(double wt, const Vector& diff) { variance += wt * diff.squaredNorm(); }
+    void add(const Covariance& other) { variance += other.variance; }
+    bool finish(double weight, double floor)
+    {
+        variance /= (weight * n);
+        const bool floored = variance < floor;
+        if (floored)
+            variance = floor;
+        update();
+        return floored;
+    }
+    void set(const Square& matrix)
+    {
+        variance = matrix.trace() / n;
+        update();
+    }
+    static int parameters(int) { return 1; }
+
+    void accumulate_all(int m, const double* points, const double* mean, const double* wts)
+    {
+        deviations.setZero();
+        util::kernels::weighted_sq_dev(m, n, points, n, mean, wts, deviations.data());
+        variance += deviations.sum();
+    }
+
+    [[nodiscard]] double density(const Vector& diff) const
+    {
+        return std::exp(-0.5 * diff.squaredNorm() * inverse) * scale;
+    }
+    void sq_distances(int m, const double* points, const double* mean, double* out, int inc) const
+    {
+        util::kernels::sq_mahalanobis_diag(m, n, points, n, mean, inverses.data(), out, inc);
+    }
+    [[nodiscard]] double normalizer() const { return scale; }
+    [[nodiscard]] Square matrix() const { return variance * Square::Identity(n, n); }
+
+private:
+    void update()
+    {
+        inverse = 1.0 / variance;
+        inverses.setConstant(inverse);
+        scale = std::pow(2 * M_PI * variance, -0.5 * n);
+    }
+
+    int n;
+    double variance;
+    double inverse;
+    double scale;
+    // inverse repeated per dimension and the M-step scratch for the kernels.
+    Array<double, Dim, 1> inverses;
+    Array<double, Dim, 1> deviations;
+};
+
+}
@@ -21,25 +21,98 @@
 #include "Eigen/Core"
 #include <Eigen/Dense>
 
+#include <vector>
+
+// Samples are used as is, without standardization.
+#define DATA_NOOP 1
+
 namespace gmm
 {
 
 using namespace Eigen;
 using MatrixXdRM = Matrix<double, Dynamic, Dynamic, RowMajor>;
 
+/// @brief Running mean and sum of squared deviations of each column, updated a row at a time
+/// (Welford) so that row major data is read contiguously. Moments of disjoint sets of rows
+/// merge exactly (Chan et al.), which lets blocks of rows be summarized in parallel.
+struct ColumnMoments
+{
+    explicit ColumnMoments(int cols = 0)
+        : mean{ ArrayXd::Zero(cols) }
+        , m2{ ArrayXd::Zero(cols) }
+    {
+    }
+
+    void add(const double* row);
+    void merge(const ColumnMoments& other);
+    /// @brief Sample standard deviations, 0 for fewer than two rows.
+    [[nodiscard]] ArrayXd stdev() const;
+
+    long long count = 0;
+    ArrayXd mean;
+    ArrayXd m2;
+};
+
+/// @brief Samples of a fit. Repeated rows are collapsed into unique points with multiplicities,
+/// EM runs on the weighted unique points and results are mapped back to the input rows.
 class Data
 {
     const Map<const MatrixXdRM>& _data;
+    // Unique rows, only allocated when compression pays off.
+    MatrixXdRM _unique;
+    // Points EM runs on : either _data or _unique.
+    Map<const MatrixXdRM> _points;
+    // Multiplicity of each point.
+    VectorXd _counts;
+    // Point index of each input row, empty if the points are the input rows.
+    std::vector<int> _row_map;
     // To store global mean and std.dev of the data.
     ArrayXd _mean;
     ArrayXd _stdev; // diagonal elements only.
+    // Column variances with those of constant columns replaced, see variances().
+    ArrayXd _variances;
+
+    void compress();
 
 public:
-    Data(const Map<const MatrixXdRM>& data_);
+    /// @param moments column moments of @p data_ if already known, computed otherwise.
+    Data(const Map<const MatrixXdRM>& data_, const ColumnMoments* moments = nullptr);
+    Data(const Data&) = delete;
+    Data& operator=(const Data&) = delete;
+
     MatrixXd operator()(int sample) const;
     double operator()(int sample, int dim) const;
-    int rows() const { return _data.rows(); }
-    int cols() const { return _data.cols(); }
+    /// @brief Returns a column vector view of the sample without copying it.
+    auto row(int sample) const { return _points.row(sample).transpose(); }
+    /// @brief Same as row() but with the size fixed at compile time when @p Dim is not Dynamic.
+    template <int Dim> Map<const Matrix<double, Dim, 1>> point(int sample) const
+    {
+        return Map<const Matrix<double, Dim, 1>>(
+            _points.data() + static_cast<Index>(sample) * _points.cols(), _points.cols());
+    }
+    /// @brief The points as a row-major matrix with cols() columns and no padding.
+    const double* points() const { return _points.data(); }
+    /// @brief Number of unique points.
+    int rows() const { return _points.rows(); }
+    int cols() const { return _points.cols(); }
+    /// @brief Number of input rows.
+    int input_rows() const { return _data.rows(); }
+    /// @brief Multiplicity of a point.
+    double weight(int sample) const { return _counts[sample]; }
+    /// @brief Sum of multiplicities, i.e. the number of input rows.
+    double total_weight() const { return _data.rows(); }
+    /// @brief Mean over the columns of the variance of the input rows, a scale for the
+    /// variance floor of the clusters.
+    double mean_variance() const { return _stdev.square().mean(); }
+    /// @brief Variance of each input column, the mean variance (or 1) for constant columns.
+    /// Scales the initial covariance of the clusters so that the fit does not depend on the
+    /// units of the columns.
+    const ArrayXd& variances() const { return _variances; }
+    /// @brief Point index of an input row.
+    int point_of(int input_row) const
+    {
+        return _row_map.empty() ? input_row : _row_map[input_row];
+    }
     void transform(ArrayXd& raw) const;
     void display() const;
 };
@@ -0,0 +1,102 @@
+/*
+ * ClusterRows
+ * Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <threadpool.hxx>
+
+#include <atomic>
+#include <vector>
+
+namespace gmm
+{
+
+/// @brief Density based clustering (DBSCAN, Ester et al. 1996) for clusters of any shape in a
+/// few columns. The points are bucketed into a uniform grid of cells of side eps, sorted by cell
+/// so that the cells are found by binary search, and the eps-neighbourhood of a point is searched
+/// in the 3^cols cells around its own. Points with at least min_points neighbours (counting
+/// themselves) are core points, core points within eps of each other are joined into clusters
+/// with a concurrent union-find, and other points join the cluster of their nearest core point
+/// within eps or are noise. Every phase runs in parallel over blocks of cells, and the result
+/// does not depend on the order of the rows or on the scheduling.
+class DBSCAN
+{
+public:
+    /// Above this many columns the 3^cols cells around a cell get too many to visit.
+    static constexpr int MAX_DIMS = 8;
+
+    /// @param data_ rows_ x cols_ finite values in row major form.
+    /// @param eps neighbourhood radius, 0 or less for twice the distance within which 90% of
+    /// sample rows have min_points neighbours.
+    /// @param min_points neighbours that make a core point, 0 or less for
+    /// max(4, 2 * cols_, ln(rows_)).
+    /// @param pool threads to use for large inputs, may be null to run on the calling thread.
+    DBSCAN(const double* data_, int rows_, int cols_, double eps, int min_points,
+           util::ThreadPool* pool);
+    DBSCAN(const DBSCAN&) = delete;
+    DBSCAN& operator=(const DBSCAN&) = delete;
+
+    /// @brief Clusters the rows and returns the number of clusters found.
+    int fit();
+
+    /// @brief Labels are numbered in the order of the first row of each cluster, noise gets -1.
+    /// The confidence is 1 for core points, the fraction of min_points neighbours a border point
+    /// has and 0 for noise.
+    void get_labels(int* labels, double* confidence_scores) const;
+
+    [[nodiscard]] double radius() const { return eps; }
+    [[nodiscard]] int core_threshold() const { return min_points; }
+    [[nodiscard]] int clusters() const { return num_clusters; }
+
+private:
+    void build_grid();
+    void find_neighbour_cells();
+    void count_neighbours();
+    void join_core_points();
+    void assign_border_points();
+    void number_clusters();
+
+    [[nodiscard]] const double* point(int pos) const
+    {
+        return points.data() + static_cast<size_t>(pos) * num_cols;
+    }
+    [[nodiscard]] bool within(int pos, int other) const;
+    int find(int pos);
+    void unite(int pos, int other);
+
+    const double* input;
+    const int num_rows;
+    const int num_cols;
+    double eps;
+    int min_points;
+    util::ThreadPool* pool;
+    int num_clusters = 0;
+
+    std::vector<int> order;                    // input row of each sorted position
+    std::vector<double> points;                // rows sorted by cell
+    std::vector<long long> cell_coords;        // num_cols grid coordinates per cell, sorted
+    std::vector<int> cell_start;               // first sorted position of each cell and the end
+    std::vector<std::vector<int>> neighbours;  // non-empty cells around each cell, itself too
+    std::vector<int> counts;                   // neighbours of each position, up to min_points
+    std::vector<std::atomic<int>> parent;      // union-find over the core positions
+    std::vector<int> owner;                    // core position whose cluster a position joined
+    std::vector<int> labels;                   // per input row
+    std::vector<double> confidences;           // per input row
+};
+
+}
@@ -0,0 +1,69 @@
+/*
+ * ClusterRows
+ * Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <gmm/data.hxx>
+#include <gmm/stats.hxx>
+#include <threadpool.hxx>
+
+#include <vector>
+
+namespace gmm
+{
+
+/// @brief Validates and summarizes a row major input matrix in one pass over its memory, in
+/// parallel over blocks of rows: rows with NaN or infinite values are set aside and the column
+/// moments of the others are computed. The rows EM runs on are the input itself when all rows
+/// are valid, otherwise (or when normalizing) a compacted copy written in a second parallel pass.
+class Ingest
+{
+public:
+    /// @param pool threads to use for large inputs, may be null to run on the calling thread.
+    /// @param normalize standardize the columns to zero mean and unit variance.
+    Ingest(const double* data_, int rows_, int cols_, bool normalize, util::ThreadPool* pool,
+           Stats* stats);
+    Ingest(const Ingest&) = delete;
+    Ingest& operator=(const Ingest&) = delete;
+
+    /// @brief The valid rows, rows() x cols() in row major form.
+    [[nodiscard]] const double* data() const { return copy.empty() ? input : copy.data(); }
+    /// @brief Number of valid rows.
+    [[nodiscard]] int rows() const { return valid_rows; }
+    [[nodiscard]] int cols() const { return num_cols; }
+    /// @brief Number of rows with NaN or infinite values.
+    [[nodiscard]] int invalid_rows() const { return input_rows - valid_rows; }
+    /// @brief Column moments of data(), i.e. after normalization if requested.
+    [[nodiscard]] const ColumnMoments& moments() const { return data_moments; }
+
+    /// @brief Spreads the labels and confidences of the valid rows to all input rows, the
+    /// invalid rows get label -1 and confidence 0.
+    void scatter(const int* labels, const double* confidences, int* all_labels,
+                 double* all_confidences) const;
+
+private:
+    const double* input;
+    const int input_rows;
+    const int num_cols;
+    int valid_rows;
+    std::vector<char> valid; // per input row, empty if all rows are valid
+    std::vector<double> copy;
+    ColumnMoments data_moments;
+};
+
+}
@@ -0,0 +1,121 @@
+/*
+ * ClusterRows
+ * Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <gmm/data.hxx>
+#include <gmm/mixture.hxx>
+#include <gmm/mixture_model.hxx>
+#include <gmm/stats.hxx>
+#include <gmm/workspace.hxx>
+
+#include <Eigen/Dense>
+
+#include <vector>
+
+namespace gmm
+{
+
+using namespace Eigen;
+
+/// @brief Multi-resolution kd-tree over the points of a Data. Every node caches the weighted
+/// count, sum and sum of outer products of its points along with its bounding box, so that EM
+/// can use a whole subtree at once when the responsibilities over its box are nearly constant
+/// (Moore, "Very fast EM-based mixture model clustering using multiresolution kd-trees").
+class KDTree
+{
+public:
+    /// Above this many dimensions the box bounds get too loose for pruning to pay off.
+    static constexpr int MAX_DIMS = 6;
+
+    explicit KDTree(const Data& data, int leaf_size = 16);
+
+    [[nodiscard]] int dims() const { return n; }
+    [[nodiscard]] bool is_leaf(int node) const { return nodes[node].left < 0; }
+    [[nodiscard]] int left(int node) const { return nodes[node].left; }
+    [[nodiscard]] int right(int node) const { return nodes[node].left + 1; }
+    [[nodiscard]] int begin(int node) const { return nodes[node].begin; }
+    [[nodiscard]] int end(int node) const { return nodes[node].end; }
+    /// @brief Point index at position @p pos of the tree order.
+    [[nodiscard]] int point(int pos) const { return order[pos]; }
+    [[nodiscard]] double count(int node) const { return nodes[node].count; }
+    [[nodiscard]] Map<const VectorXd> sum(int node) const { return vec(sums, node); }
+    [[nodiscard]] Map<const MatrixXd> outer(int node) const
+    {
+        return Map<const MatrixXd>(outers.data() + static_cast<size_t>(node) * n * n, n, n);
+    }
+    [[nodiscard]] Map<const VectorXd> center(int node) const { return vec(centers, node); }
+    [[nodiscard]] Map<const VectorXd> half_width(int node) const { return vec(half_widths, node); }
+
+private:
+    struct Node
+    {
+        int begin;
+        int end;
+        int left; // children are left and left + 1, -1 for leaves
+        double count;
+    };
+
+    int add_node();
+    void build(int node, int begin, int end);
+    Map<const VectorXd> vec(const std::vector<double>& store, int node) const
+    {
+        return Map<const VectorXd>(store.data() + static_cast<size_t>(node) * n, n);
+    }
+
+    const Data& data;
+    const int n;
+    const int leaf_size;
+    std::vector<int> order;
+    std::vector<Node> nodes;
+    std::vector<double> sums;
+    std::vector<double> outers;
+    std::vector<double> centers;
+    std::vector<double> half_widths;
+};
+
+/// @brief EM on the weighted points of a KDTree. The E-step and M-step are fused into one
+/// traversal that accumulates sufficient statistics and stops descending where the
+/// responsibilities of all clusters vary by less than the tolerance over a node's box.
+class TreeModel : public MixtureModel
+{
+public:
+    TreeModel(const KDTree& tree, const Data& data, int num_clusters, const GMMOptions& options,
+              Stats* stats = nullptr);
+
+    [[nodiscard]] int clusters() const override { return num_clusters; }
+
+    double fit(int num_epochs, int num_iterations, Workspace& workspace) override;
+    void get_labels(int* labels, double* confidence_scores) const override;
+
+    struct Scratch;
+
+private:
+    double traverse(int node, const GaussianMixture& mixture, SufficientStats& suff,
+                    Scratch& scratch) const;
+
+    const KDTree& tree;
+    const Data& data;
+    const int num_clusters;
+    const bool full_gmm;
+    const double tolerance;
+    GaussianMixture best;
+    Stats* stats;
+};
+
+}
@@ -0,0 +1,108 @@
+/*
+ * ClusterRows
+ * Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Eigen/Dense>
+
+#include <vector>
+
+namespace gmm
+{
+
+using namespace Eigen;
+
+/// @brief Per cluster sufficient statistics of a weighted sample set:
+/// sum of weights, weighted sum of samples and weighted sum of outer products.
+class SufficientStats
+{
+public:
+    SufficientStats(int num_clusters, int dims);
+
+    void clear();
+    void accumulate(int cluster, double wt, const Ref<const VectorXd>& x)
+    {
+        weights[cluster] += wt;
+        sums[cluster].noalias() += wt * x;
+        outers[cluster].selfadjointView<Lower>().rankUpdate(x, wt);
+    }
+
+    /// @brief Adds node level statistics (n samples summarized by sum and outer) with a
+    /// common responsibility @p wt.
+    void accumulate(int cluster, double wt, double n, const Ref<const VectorXd>& sum,
+                    const Ref<const MatrixXd>& outer)
+    {
+        weights[cluster] += wt * n;
+        sums[cluster].noalias() += wt * sum;
+        outers[cluster].noalias() += wt * outer;
+    }
+
+    void merge(const SufficientStats& other);
+
+    [[nodiscard]] int clusters() const { return static_cast<int>(weights.size()); }
+    [[nodiscard]] double weight(int cluster) const { return weights[cluster]; }
+    [[nodiscard]] double total_weight() const;
+
+    /// @brief Computes the M-step parameters of @p cluster. Only the lower triangle of the
+    /// accumulated outer products is used, the returned covariance is full.
+    void parameters(int cluster, VectorXd& mu, MatrixXd& sigma) const;
+
+private:
+    std::vector<double> weights;
+    std::vector<VectorXd> sums;
+    std::vector<MatrixXd> outers; // lower triangle only
+};
+
+/// @brief Gaussian mixture parameters with cached Cholesky factors for density evaluation.
+class GaussianMixture
+{
+public:
+    GaussianMixture(int num_clusters, int dims, bool full_gmm);
+
+    [[nodiscard]] int clusters() const { return static_cast<int>(phi.size()); }
+    [[nodiscard]] int dims() const { return dims_; }
+
+    /// @brief Sets the parameters of @p cluster and refreshes its cached factorization.
+    void set(int cluster, double phi_, const VectorXd& mu_, const MatrixXd& sigma_);
+    /// @brief Runs the M-step from sufficient statistics.
+    void update(const SufficientStats& suff);
+    /// @brief Computes normalized responsibilities of @p x into @p resp.
+    /// @return log of the mixture density at x.
+    double responsibilities(const Ref<const VectorXd>& x, VectorXd& resp, VectorXd& scratch) const;
+    [[nodiscard]] const VectorXd& mean(int cluster) const { return mu[cluster]; }
+    [[nodiscard]] const MatrixXd& covariance(int cluster) const { return sigma[cluster]; }
+    [[nodiscard]] double weight(int cluster) const { return phi[cluster]; }
+    /// @brief Inverse of the covariance of @p cluster.
+    [[nodiscard]] const MatrixXd& precision(int cluster) const { return prec[cluster]; }
+    /// @brief log(phi) - 0.5 * (d * log(2 pi) + log det sigma), -inf for empty clusters.
+    [[nodiscard]] double log_normalizer(int cluster) const { return log_norm[cluster]; }
+
+private:
+    void factorize(int cluster);
+
+    int dims_;
+    bool full_gmm;
+    std::vector<double> phi;
+    std::vector<VectorXd> mu;
+    std::vector<MatrixXd> sigma;
+    std::vector<MatrixXd> chol; // lower Cholesky factor of sigma
+    std::vector<MatrixXd> prec; // inverse of sigma
+    std::vector<double> log_norm; // log(phi) - 0.5 * (d * log(2 pi) + log det sigma)
+};
+
+}
@@ -0,0 +1,62 @@
+/*
+ * ClusterRows
+ * Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <gmm/workspace.hxx>
+
+#include <limits>
+#include <memory>
+
+namespace gmm
+{
+
+/// @brief Interface of the EM engines that gmm::GMM fits for each candidate cluster count.
+class MixtureModel
+{
+public:
+    virtual ~MixtureModel() = default;
+
+    [[nodiscard]] virtual int clusters() const = 0;
+    /// @brief Fits the model with @p num_epochs random restarts.
+    /// @return the best score over the epochs, lower is better.
+    virtual double fit(int num_epochs, int num_iterations, Workspace& workspace) = 0;
+    virtual void get_labels(int* labels, double* confidence_scores) const = 0;
+
+    /// @brief Bayesian information criterion of the fitted model, lower is better. NaN for the
+    /// engines that do not take part in the incremental order search.
+    [[nodiscard]] virtual double information_criterion() const
+    {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    /// @brief A model with one more cluster, initialized by splitting a cluster of this fitted
+    /// model and refined by one epoch of at most @p num_iterations. nullptr if unsupported.
+    [[nodiscard]] virtual std::unique_ptr<MixtureModel> split(int /*num_iterations*/,
+                                                              Workspace& /*workspace*/) const
+    {
+        return nullptr;
+    }
+    /// @brief Like split() but with one cluster less, by merging two similar clusters.
+    [[nodiscard]] virtual std::unique_ptr<MixtureModel> merge(int /*num_iterations*/,
+                                                              Workspace& /*workspace*/) const
+    {
+        return nullptr;
+    }
+};
+
+}
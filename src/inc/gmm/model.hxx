@@ -18,7 +18,13 @@
 
 #pragma once
 
+#include <gmm/covariance.hxx>
 #include <gmm/data.hxx>
+#include <gmm/kdtree.hxx>
+#include <gmm/mixture_model.hxx>
+#include <gmm/pca.hxx>
+#include <gmm/stats.hxx>
+#include <gmm/workspace.hxx>
 
 #include <Eigen/Dense>
 
@@ -29,51 +35,138 @@ namespace gmm
 {
 
 using namespace Eigen;
-class Cluster;
+template <int Dim, CovarianceType Type> class Cluster;
 
-class Model
+/// @brief EM on the points of a Data. @p Dim is the number of columns when it is known at
+/// compile time (see GMM::make_model for the dispatch) or Eigen::Dynamic. @p Type is the
+/// covariance structure, a compile time policy so that the E-step and M-step loops do not
+/// branch on it.
+/// With GMMOptions::topK below the number of clusters the model runs truncated EM: only the
+/// top K responsibilities of every sample are kept and the candidate clusters are re-picked
+/// from all of them every GMMOptions::topKRefresh iterations.
+/// The clusters of the best epoch are kept so that split() and merge() can start the models of
+/// the neighbouring cluster counts from them (GMMOptions::orderSearchMaxClusters).
+template <int Dim = Dynamic, CovarianceType Type = CovarianceType::FULL>
+class Model : public MixtureModel
 {
 public:
-    Model(const Map<const MatrixXdRM>& data, int num_clusters, bool full_gmm);
+    Model(const Data& data, int num_clusters, const GMMOptions& options, Stats* stats = nullptr);
 
-    [[nodiscard]] int clusters() const { return num_clusters; }
+    [[nodiscard]] int clusters() const override { return num_clusters; }
     [[nodiscard]] int samples() const { return data.rows(); }
     [[nodiscard]] int dims() const { return data.cols(); }
 
-    double fit(int num_epochs, int num_iterations);
-    void get_labels(int* labels, double* confidence_scores) const;
+    double fit(int num_epochs, int num_iterations, Workspace& workspace) override;
+    void get_labels(int* labels, double* confidence_scores) const override;
+
+    [[nodiscard]] double information_criterion() const override;
+    [[nodiscard]] std::unique_ptr<MixtureModel> split(int num_iterations,
+                                                      Workspace& workspace) const override;
+    [[nodiscard]] std::unique_ptr<MixtureModel> merge(int num_iterations,
+                                                      Workspace& workspace) const override;
 
 private:
+    void refine(std::vector<Cluster<Dim, Type>>& start_clusters, int num_iterations,
+                Workspace& workspace);
+    void keep_clusters(const std::vector<Cluster<Dim, Type>>& epoch_clusters);
+
     [[nodiscard]] double run_epoch(int num_iterations, MatrixXd& epoch_weights,
-                                   std::vector<Cluster>& epoch_clusters) const;
+                                   std::vector<Cluster<Dim, Type>>& epoch_clusters,
+                                   Workspace& workspace) const;
     [[nodiscard]] double compute_expectation(MatrixXd& epoch_weights,
-                                             const std::vector<Cluster>& epoch_clusters) const;
-    void maximize_likelihood(const MatrixXd& epoch_weights,
-                             std::vector<Cluster>& epoch_clusters) const;
+                                             const std::vector<Cluster<Dim, Type>>& epoch_clusters,
+                                             std::vector<double>& normalizers) const;
+    /// @brief M-step from the responsibilities and the mixture densities @p normalizers of the
+    /// last E-step. Returns the number of collapsed clusters it reseeded.
+    int maximize_likelihood(const MatrixXd& epoch_weights, const std::vector<double>& normalizers,
+                            std::vector<Cluster<Dim, Type>>& epoch_clusters,
+                            Workspace& workspace) const;
+    /// @brief Restarts the clusters left with less than MIN_CLUSTER_WEIGHT of the samples at the
+    /// samples the mixture explains worst and zeroes their weights, so that the rest of the
+    /// M-step skips them. Returns the number of reseeded clusters.
+    int reseed_collapsed(std::vector<double>& cluster_weights,
+                         const std::vector<double>& normalizers,
+                         std::vector<Cluster<Dim, Type>>& epoch_clusters) const;
+
+    void finish_covariances(const std::vector<double>& cluster_weights,
+                            std::vector<Cluster<Dim, Type>>& epoch_clusters) const;
+
+    [[nodiscard]] bool truncated() const { return top_k > 0; }
+    [[nodiscard]] double run_truncated_epoch(int num_iterations,
+                                             SparseResponsibilities& epoch_weights,
+                                             std::vector<Cluster<Dim, Type>>& epoch_clusters,
+                                             Workspace& workspace) const;
+    /// @brief Truncated E-step, also storing the density of each sample summed over its kept
+    /// clusters in @p normalizers.
+    [[nodiscard]] double
+    compute_truncated_expectation(SparseResponsibilities& epoch_weights,
+                                  const std::vector<Cluster<Dim, Type>>& epoch_clusters,
+                                  bool refresh, std::vector<double>& normalizers) const;
+    /// @brief Fills the top_k entries of @p sample with its largest cluster densities.
+    void keep_largest_densities(int sample, const std::vector<Cluster<Dim, Type>>& epoch_clusters,
+                                int* kept_clusters, double* kept_weights) const;
+    /// @brief Clamps the top_k kept densities at 0 and returns their sum.
+    double kept_density(double* kept_weights) const;
+    /// @brief M-step from the truncated responsibilities. Returns the number of collapsed
+    /// clusters it reseeded, which no sample keeps until the next refresh.
+    int maximize_truncated_likelihood(const SparseResponsibilities& epoch_weights,
+                                      const std::vector<double>& normalizers,
+                                      std::vector<Cluster<Dim, Type>>& epoch_clusters,
+                                      Workspace& workspace) const;
 
 private:
-    MatrixXd weights; // shape is c x m
-    Data data; // shape is m x n
+    MatrixXd weights; // shape is c x m, m being the number of unique points
+    SparseResponsibilities sparse_weights; // m x top_k, used instead of weights when truncated
+    std::vector<Cluster<Dim, Type>> best_clusters; // parameters behind weights
+    const Data& data; // shape is m x n
+    const GMMOptions options;
     const int num_clusters;
-    bool full_gmm : 1;
+    const int top_k; // 0 when not truncated
+    const int refresh_interval;
+    // Smallest variance of a cluster along any axis, relative to the variance of the data.
+    static constexpr double VARIANCE_FLOOR = 1e-6;
+    const double variance_floor;
+    // A cluster with less total responsibility (in rows) is taken to have collapsed.
+    static constexpr double MIN_CLUSTER_WEIGHT = 0.5;
+    Stats* stats;
 };
 
 class GMM
 {
 public:
+    /// @param moments_ column moments of the rows if already known (see Ingest).
     GMM(const double* data_, int rows_, int cols_, int min_clusters_, int max_clusters_,
-        int num_epochs_, int num_iterations_, bool full_gmm_);
+        const GMMOptions& options_, Stats* stats_ = nullptr,
+        const ColumnMoments* moments_ = nullptr);
     void fit();
+    /// @brief Same as fit() but with the working buffers of @p workspace, which may be reused
+    /// across GMMs. Its allocations are then accounted to the Stats of this GMM.
+    void fit(Workspace& workspace);
     void get_labels(int* labels, double* confidence_scores) const;
 
 private:
-    const Map<const MatrixXdRM> data;
-    std::unique_ptr<Model> best_model;
+    [[nodiscard]] std::unique_ptr<MixtureModel> make_model(int num_clusters) const;
+    [[nodiscard]] bool variational() const
+    {
+        return options.numClusters <= 0 && options.vbMaxClusters > 0;
+    }
+    [[nodiscard]] bool order_search() const
+    {
+        return options.numClusters <= 0 && options.orderSearchMaxClusters > 2 && !variational();
+    }
+    void search_order(Workspace& workspace);
+
+    // Set when the rows are projected onto their principal components (GMMOptions::pcaVariance).
+    const std::unique_ptr<PrincipalComponents> pca;
+    const Map<const MatrixXdRM> rows;
+    const Data data; // shared by the models of all candidate cluster counts
+    std::unique_ptr<MixtureModel> best_model;
+    // kd-tree accelerated EM, used for low dimensional data when the tolerance is positive.
+    std::unique_ptr<KDTree> tree;
+    const GMMOptions options;
     const int min_clusters;
     const int max_clusters;
-    const int num_epochs;
-    const int num_iterations;
-    const bool full_gmm : 1;
+    Stats* stats;
 };
 
 }
@@ -0,0 +1,58 @@
+/*
+ * ClusterRows
+ * Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <gmm/stats.hxx>
+
+#include <vector>
+
+namespace gmm
+{
+
+/// @brief Projection of rows onto their leading principal components, found with a randomized
+/// SVD (Halko, Martinsson and Tropp 2011): a Gaussian sketch of the centred rows refined by power
+/// iterations gives an orthonormal basis whose small core is decomposed by util::SVD. The sketch
+/// grows until the components explain the requested fraction of the variance.
+class PrincipalComponents
+{
+public:
+    /// @param data row major @p rows x @p cols matrix.
+    /// @param explained_variance fraction of the total variance the kept components must explain.
+    PrincipalComponents(const double* data, int rows, int cols, double explained_variance,
+                        Stats* stats = nullptr);
+
+    /// @brief Number of kept components r; equal to the number of columns if projecting would
+    /// not reduce the dimension.
+    [[nodiscard]] int components() const { return num_components; }
+    /// @brief Fraction of the variance explained by the kept components.
+    [[nodiscard]] double explained() const { return explained_fraction; }
+    /// @brief The rows x r row major projected data (centred), empty if nothing is kept out.
+    [[nodiscard]] const double* projected() const { return scores.data(); }
+
+    /// Extra sketch columns beyond the components looked for.
+    static constexpr int OVERSAMPLING = 10;
+    static constexpr int POWER_ITERATIONS = 2;
+
+private:
+    std::vector<double> scores;
+    int num_components;
+    double explained_fraction;
+};
+
+}
@@ -0,0 +1,58 @@
+/*
+ * ClusterRows
+ * Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <em.h>
+
+namespace gmm
+{
+
+/// @brief Memory and cores of the machine as seen by the planner.
+struct Resources
+{
+    /// memory that can be allocated without swapping, in MB (0 if unknown).
+    double memory_mb;
+    /// hardware threads.
+    int threads;
+};
+
+/// @brief Queries the available memory and the number of hardware threads.
+Resources available_resources();
+
+/// @brief An engine strategy with the options that select it and its estimated cost.
+struct Plan
+{
+    CRStrategy strategy;
+    /// the caller's options adjusted for the strategy.
+    GMMOptions options;
+    double estimated_ms;
+    double estimated_mb;
+};
+
+/// @brief Picks the strategy for clustering @p rows x @p cols inputs with @p options: each
+/// viable strategy is costed by a flop and byte count model, those exceeding the memory cap
+/// are dropped and the cheapest remaining one is taken, where the approximate strategies have
+/// to beat dense EM clearly. Epochs are reduced when the pick misses the time budget. When no
+/// in-memory strategy fits the streaming engine is used. The kd-tree and streaming engines are
+/// only considered for diagonal and full covariances, which are the ones they can fit.
+Plan plan_job(int rows, int cols, const GMMOptions& options, const Resources& resources);
+
+/// @brief Number of threads a batch of jobs with @p options should use, 0 if not capped.
+int planned_threads(const GMMOptions& options, const Resources& resources);
+
+}
@@ -0,0 +1,139 @@
+/*
+ * ClusterRows
+ * Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <em.h>
+#include <perfcounters.hxx>
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+
+namespace gmm
+{
+
+/// @brief Collects per-phase timings and counters of a clustering run.
+/// All engines accept a nullable Stats pointer; a null pointer disables collection.
+class Stats
+{
+public:
+    enum Phase
+    {
+        INIT = CR_PHASE_INIT,
+        ESTEP = CR_PHASE_ESTEP,
+        MSTEP = CR_PHASE_MSTEP,
+        SELECT = CR_PHASE_SELECT,
+        NUM_PHASES = CR_NUM_PHASES
+    };
+    using Counts = long long[util::PerfCounters::NUM_EVENTS];
+
+    /// @brief Times a scope and charges it to a phase of the (nullable) stats object, along
+    /// with the hardware counts of the scope if counters are enabled.
+    class Timer
+    {
+    public:
+        Timer(Stats* stats_, Phase phase_)
+            : stats(stats_)
+            , phase(phase_)
+        {
+            if (!stats)
+                return;
+            if (stats->counters)
+                stats->counters->read(start_counts);
+            start = std::chrono::steady_clock::now();
+        }
+
+        ~Timer()
+        {
+            if (!stats)
+                return;
+            stats->add_time(phase, std::chrono::duration<double, std::milli>(
+                                       std::chrono::steady_clock::now() - start)
+                                       .count());
+            if (stats->counters)
+                stats->add_counts(phase, start_counts);
+        }
+
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+
+    private:
+        Stats* stats;
+        Phase phase;
+        std::chrono::steady_clock::time_point start;
+        Counts start_counts;
+    };
+
+    Stats() = default;
+    Stats(const Stats&) = delete;
+    Stats& operator=(const Stats&) = delete;
+
+    /// @brief Opens the hardware counters of the calling thread, which then has to be the one
+    /// running the timed scopes. Work the scopes hand to util::ThreadPool is not counted.
+    /// Without permission to count, only the status is recorded.
+    void enable_counters();
+
+    void add_time(Phase phase, double ms) { phase_ms[phase] += ms; }
+    void add_candidate(int epochs);
+    void add_epoch(int iterations);
+    void add_alloc(size_t bytes);
+    void set_best_clusters(int clusters) { best_clusters = clusters; }
+    void set_threads(int threads_) { threads = threads_; }
+    void set_unique_rows(int rows) { unique_rows = rows; }
+    void set_pca_components(int components) { pca_components = components; }
+    void set_invalid_rows(int rows) { invalid_rows = rows; }
+    void add_regularized(int covariances) { regularized += covariances; }
+    void add_reseeded(int clusters) { reseeded += clusters; }
+    void set_plan(int strategy, double estimated_ms, double estimated_mb)
+    {
+        plan_strategy = strategy;
+        plan_ms = estimated_ms;
+        plan_mb = estimated_mb;
+    }
+
+    void export_to(GMMStats& out, double total_ms) const;
+
+private:
+    /// @brief Adds the counts since @p start_counts to @p phase.
+    void add_counts(Phase phase, const Counts& start_counts);
+
+    double phase_ms[NUM_PHASES]{};
+    int candidates = 0;
+    int epochs_per_k = 0;
+    int epochs = 0;
+    int iterations = 0;
+    int min_iterations = 0;
+    int max_iterations = 0;
+    int best_clusters = 0;
+    int threads = 1;
+    long long alloc_count = 0;
+    long long alloc_bytes = 0;
+    int unique_rows = 0;
+    int pca_components = 0;
+    int invalid_rows = 0;
+    int regularized = 0;
+    int reseeded = 0;
+    int plan_strategy = CR_STRATEGY_NONE;
+    double plan_ms = 0.0;
+    double plan_mb = 0.0;
+    std::unique_ptr<util::PerfCounters> counters; // null unless enabled and permitted
+    int counters_status = 0;
+    Counts phase_counts[NUM_PHASES]{};
+};
+
+}
@@ -0,0 +1,88 @@
+/*
+ * ClusterRows
+ * Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <gmm/mixture.hxx>
+#include <gmm/stats.hxx>
+
+#include <Eigen/Dense>
+
+#include <vector>
+
+namespace gmm
+{
+
+using namespace Eigen;
+
+/// @brief Pull based source of samples for out-of-core fitting.
+class ChunkReader
+{
+public:
+    virtual ~ChunkReader() = default;
+    /// @brief Number of dimensions of each sample.
+    [[nodiscard]] virtual int cols() const = 0;
+    /// @brief Copies up to @p max_rows samples in row major form into @p buffer.
+    /// @return number of samples copied, 0 at the end of the input and -1 on error.
+    virtual int read(double* buffer, int max_rows) = 0;
+    /// @brief Restarts reading from the first sample.
+    virtual void rewind() = 0;
+};
+
+/// @brief Sink for the labels produced by the final pass of the streaming engine.
+class LabelWriter
+{
+public:
+    virtual ~LabelWriter() = default;
+    virtual void write(const int* labels, const double* confidence_scores, int rows) = 0;
+};
+
+/// @brief Out-of-core EM: every iteration is one pass over the chunks of the reader which
+/// accumulates sufficient statistics, so memory does not depend on the number of samples.
+class StreamingModel
+{
+public:
+    /// @param seed seeds the sampling of the cluster seeds, 0 seeds it from the clock.
+    StreamingModel(ChunkReader& reader, int num_clusters, bool full_gmm, int chunk_rows,
+                   unsigned seed = 0, Stats* stats = nullptr);
+
+    [[nodiscard]] int clusters() const { return num_clusters; }
+
+    /// @brief Fits the model with @p num_epochs random restarts.
+    /// @return the best score (lower is better) or a negative value on read errors.
+    double fit(int num_epochs, int num_iterations);
+
+    /// @brief Streams the labels of all samples under the best parameters to @p writer.
+    /// @return false on read errors.
+    bool write_labels(LabelWriter& writer);
+
+private:
+    bool seed_pass(int num_epochs, std::vector<VectorXd>& seeds, MatrixXd& global_cov);
+    double run_pass(const GaussianMixture& mixture, SufficientStats& suff);
+
+    ChunkReader& reader;
+    const int num_clusters;
+    const bool full_gmm;
+    const int chunk_rows;
+    std::vector<double> chunk;
+    GaussianMixture best;
+    unsigned seed;
+    Stats* stats;
+};
+
+}
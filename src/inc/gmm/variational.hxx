@@ -0,0 +1,90 @@
+/*
+ * ClusterRows
+ * Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <gmm/data.hxx>
+#include <gmm/mixture_model.hxx>
+#include <gmm/stats.hxx>
+#include <gmm/workspace.hxx>
+
+#include <Eigen/Dense>
+
+#include <vector>
+
+namespace gmm
+{
+
+using namespace Eigen;
+
+/// @brief Variational Bayes GMM (Bishop, PRML 10.2) with a Dirichlet prior on the mixing
+/// weights and Gauss-Wishart priors on the components. It is fitted once with an upper bound on
+/// the number of clusters: a small Dirichlet concentration drives the weights of superfluous
+/// components to zero and those are pruned, so the fit also picks the number of clusters.
+/// Diagonal fits keep the Wishart scale matrices diagonal.
+class VariationalModel : public MixtureModel
+{
+public:
+    VariationalModel(const Data& data, int max_clusters, const GMMOptions& options,
+                     Stats* stats = nullptr);
+
+    /// @brief Number of components that survived pruning (the upper bound before fit()).
+    [[nodiscard]] int clusters() const override { return num_kept; }
+    /// @return the negated variational lower bound of the best restart.
+    double fit(int num_epochs, int num_iterations, Workspace& workspace) override;
+    void get_labels(int* labels, double* confidence_scores) const override;
+
+    /// Components expecting fewer than this fraction of the rows are pruned.
+    static constexpr double PRUNE_FRACTION = 1e-3;
+
+    /// @brief Variational posterior of a component.
+    struct Component
+    {
+        double alpha; // Dirichlet
+        double beta;  // precision scale of the mean
+        double nu;    // Wishart degrees of freedom
+        VectorXd mean;
+        MatrixXd scale;     // Wishart scale matrix W
+        MatrixXd scale_inv; // W^-1
+        double log_det_scale;
+        double count; // expected number of rows
+        bool active;
+    };
+
+private:
+    void init_responsibilities(MatrixXd& resp, Workspace& workspace) const;
+    void update_components(const MatrixXd& resp, std::vector<Component>& components) const;
+    void reset_to_prior(Component& component) const;
+    /// @return sum of the weighted r log r terms.
+    double update_responsibilities(MatrixXd& resp, const std::vector<Component>& components) const;
+    [[nodiscard]] double lower_bound(const std::vector<Component>& components,
+                                     double neg_entropy) const;
+
+    MatrixXd weights; // c x m responsibilities under the best components
+    std::vector<int> labels_of; // compact label of each kept component, -1 if pruned
+    const Data& data;
+    const int max_clusters;
+    const double concentration;
+    const bool full_gmm;
+    int num_kept;
+    VectorXd prior_mean;
+    MatrixXd prior_scale_inv;
+    Stats* stats;
+};
+
+}
@@ -0,0 +1,119 @@
+/*
+ * ClusterRows
+ * Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <gmm/stats.hxx>
+
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace gmm
+{
+
+using namespace Eigen;
+
+/// @brief Picks @p count distinct indices from [0, population) into @p out using Floyd's
+/// algorithm. Runs in O(count^2) which for the handful of cluster seeds is far cheaper than
+/// shuffling all of the population. At most @p population indices are picked.
+template <typename Generator>
+void select_distinct(int count, int population, std::vector<int>& out, Generator& generator)
+{
+    out.clear();
+    count = std::min(count, population);
+    for (int upper = population - count; upper < population; ++upper)
+    {
+        const int candidate = std::uniform_int_distribution<int>(0, upper)(generator);
+        bool taken = false;
+        for (int chosen : out)
+        {
+            if (chosen == candidate)
+            {
+                taken = true;
+                break;
+            }
+        }
+        out.push_back(taken ? upper : candidate);
+    }
+}
+
+/// @brief Truncated responsibilities: the @c k largest responsibilities of every sample and
+/// the clusters they belong to, stored sample major (entry j of sample s is at s * k + j).
+struct SparseResponsibilities
+{
+    void resize(int samples, int k_);
+    void swap(SparseResponsibilities& other) noexcept;
+    [[nodiscard]] size_t bytes() const
+    {
+        return clusters.size() * (sizeof(int) + sizeof(double));
+    }
+
+    int k = 0;
+    std::vector<int> clusters;
+    std::vector<double> weights;
+};
+
+/// @brief Owns the scratch buffers of a fit so that they are allocated once and reused by
+/// every epoch and iteration (and by consecutive candidate models where shapes allow).
+class Workspace
+{
+public:
+    explicit Workspace(Stats* stats_ = nullptr);
+
+    /// @brief Returns a c x m buffer for the responsibilities of the running epoch.
+    /// The contents are unspecified; it is reallocated only when the shape changes.
+    MatrixXd& epoch_weights(int num_clusters, int samples);
+
+    /// @brief Returns an m x k truncated responsibility buffer for the running epoch.
+    /// The contents are unspecified; it is reallocated only when the shape changes.
+    SparseResponsibilities& epoch_sparse_weights(int samples, int k);
+
+    /// @brief Returns a zero filled buffer of size m for the E-step normalizers.
+    std::vector<double>& normalizers(int samples);
+
+    /// @brief Returns a zero filled buffer of size c for the M-step cluster weights.
+    std::vector<double>& cluster_weights(int num_clusters);
+
+    /// @brief Returns a buffer of size m for the M-step weights of the samples in one cluster.
+    /// The contents are unspecified.
+    std::vector<double>& sample_weights(int samples);
+
+    /// @brief Picks @p count distinct sample indices from [0, population) as cluster seeds.
+    const std::vector<int>& select_seeds(int count, int population);
+
+    /// @brief Restarts the sequence of select_seeds() from @p value.
+    void seed(unsigned value) { generator.seed(value); }
+
+    Stats* statistics() const { return stats; }
+    void set_statistics(Stats* stats_) { stats = stats_; }
+
+private:
+    MatrixXd weights_buffer;
+    SparseResponsibilities sparse_buffer;
+    std::vector<double> normalizer_buffer;
+    std::vector<double> cluster_weight_buffer;
+    std::vector<double> sample_weight_buffer;
+    std::vector<int> seeds;
+    std::default_random_engine generator;
+    Stats* stats;
+};
+
+}
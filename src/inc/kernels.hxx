@@ -0,0 +1,101 @@
+/*
+ * ClusterRows
+ * Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "macros.h"
+
+namespace util::kernels
+{
+
+/// @brief Instruction set levels the kernels are compiled for. All levels are built into the
+/// library and the best one the CPU supports is picked at load time. Setting the environment
+/// variable CLUSTERROWS_ISA to generic, avx2 or avx512 lowers the choice (it is never raised
+/// above what the CPU supports).
+enum class Isa
+{
+    GENERIC,
+    AVX2,
+    AVX512
+};
+
+/// @brief Returns the best instruction set level supported by the CPU.
+CR_DLLPUBLIC_EXPORT Isa best_isa();
+
+/// @brief Returns the instruction set level of the kernels currently in use.
+CR_DLLPUBLIC_EXPORT Isa active_isa();
+
+/// @brief Switches all kernels to the level @p isa. Returns false (and keeps the current
+/// kernels) if the CPU does not support it. Not meant to be called while kernels run on other
+/// threads, it exists for benchmarks and tests.
+CR_DLLPUBLIC_EXPORT bool select_isa(Isa isa);
+
+/// @brief Returns the name of @p isa as accepted by CLUSTERROWS_ISA.
+CR_DLLPUBLIC_EXPORT const char* isa_name(Isa isa);
+
+/// @brief Computes C = A * op(B) for row-major operands without bounds checks.
+/// The product is cache blocked and register tiled so that the innermost loop works on
+/// packed, contiguous panels which the compiler can vectorize.
+/// @param m number of rows of A and C.
+/// @param n number of columns of op(B) and C.
+/// @param k number of columns of A and rows of op(B).
+/// @param A pointer to the first element of A.
+/// @param lda row stride of A.
+/// @param B pointer to the first element of B.
+/// @param ldb row stride of B.
+/// @param transpose_b if true op(B) = B^T (B is stored as n x k) else op(B) = B (k x n).
+/// @param C output matrix, must not alias A or B.
+/// @param ldc row stride of C.
+CR_DLLPUBLIC_EXPORT void gemm(int m, int n, int k, const double* A, int lda, const double* B,
+                              int ldb, bool transpose_b, double* C, int ldc);
+
+/// @brief Computes C = A * D or C = A * D^-1 where D is a diagonal matrix given by its
+/// diagonal vector @p diag of size n. A and C may alias.
+CR_DLLPUBLIC_EXPORT void scale_cols(int m, int n, const double* A, int lda, const double* diag,
+                                    bool inverse, double* C, int ldc);
+
+/// @brief Returns the inner product of the columns @p col1 and @p col2 of the m row matrix A.
+CR_DLLPUBLIC_EXPORT double cols_dot(int m, const double* A, int lda, int col1, int col2);
+
+/// @brief Applies in place the plane rotation by @p c = cos(theta), @p s = sin(theta) to the
+/// columns @p col1 and @p col2 of the m row matrix A:
+/// A[:, col1] = A[:, col1] * c + A[:, col2] * s and A[:, col2] = A[:, col2] * c - A[:, col1] * s.
+CR_DLLPUBLIC_EXPORT void rotate_cols(int m, double* A, int lda, int col1, int col2, double c,
+                                     double s);
+
+/// @brief Computes out[i * incout] = (x_i - mu)^T diag(inv_var) (x_i - mu) for the m rows x_i
+/// of the n column matrix X.
+CR_DLLPUBLIC_EXPORT void sq_mahalanobis_diag(int m, int n, const double* X, int ldx,
+                                             const double* mu, const double* inv_var, double* out,
+                                             int incout);
+
+/// @brief Computes out[i * incout] = (x_i - mu)^T P (x_i - mu) for the m rows x_i of the n
+/// column matrix X, where P is a symmetric n x n matrix with row stride @p ldp.
+CR_DLLPUBLIC_EXPORT void sq_mahalanobis_full(int m, int n, const double* X, int ldx,
+                                             const double* mu, const double* P, int ldp,
+                                             double* out, int incout);
+
+/// @brief Accumulates S += sum_i w[i] (x_i - mu) (x_i - mu)^T over the m rows x_i of the n
+/// column matrix X into the n x n matrix S with row stride @p lds.
+CR_DLLPUBLIC_EXPORT void weighted_scatter(int m, int n, const double* X, int ldx,
+                                          const double* mu, const double* w, double* S, int lds);
+
+/// @brief Accumulates v[j] += sum_i w[i] (x_ij - mu[j])^2, the diagonal of weighted_scatter().
+CR_DLLPUBLIC_EXPORT void weighted_sq_dev(int m, int n, const double* X, int ldx,
+                                         const double* mu, const double* w, double* v);
+
+}
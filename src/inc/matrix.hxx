@@ -60,17 +60,26 @@ public:
     [[nodiscard]] Matrix dot_transpose(const Matrix& right) const;
 
     [[nodiscard]] Matrix givens_rot(int col1, int col2, double theta) const;
+    void apply_givens_rot(int col1, int col2, double theta);
 
     [[nodiscard]] int rows() const { return m_rows; }
     [[nodiscard]] int cols() const { return m_cols; }
 
+    /// @brief Row major elements, for the kernels and factorizations that skip bounds checks.
+    [[nodiscard]] double* data() { return m_data.get(); }
+    [[nodiscard]] const double* data() const { return m_data.get(); }
+
     void set_identity();
     void set(double val);
 
     [[nodiscard]] double sum_of_squares() const;
     [[nodiscard]] double cols_inner_product(int col1, int col2) const;
 
+    /// @brief Inverse by partial pivot LU factorization, throws if the matrix is singular.
     [[nodiscard]] Matrix inverse() const;
+    [[nodiscard]] double determinant() const;
+    /// @brief Returns log |det|, -infinity for a singular matrix.
+    [[nodiscard]] double log_determinant() const;
 
     void display() const;
 
@@ -0,0 +1,60 @@
+/*
+* ClusterRows
+* Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "macros.h"
+
+namespace util
+{
+
+/// @brief Hardware performance counters of the calling thread, counted in user space through
+/// Linux perf_event_open(). The events are opened as one group so that they are scheduled
+/// together, and counts are scaled up if the kernel had to multiplex the group. Events the CPU,
+/// the kernel or its perf_event_paranoid setting does not allow read as -1; on other systems all
+/// of them do.
+class CR_DLLPUBLIC_EXPORT PerfCounters
+{
+public:
+    enum Event
+    {
+        CYCLES = 0,
+        INSTRUCTIONS,
+        /// last level cache misses.
+        CACHE_MISSES,
+        BRANCH_MISSES,
+        NUM_EVENTS
+    };
+
+    /// @brief Opens and starts the counters. Reads must be made on the same thread.
+    PerfCounters();
+    ~PerfCounters();
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    /// @brief True if at least one of the events is counted.
+    [[nodiscard]] bool available() const { return m_leader >= 0; }
+
+    /// @brief Stores the counts since construction in @p values, NUM_EVENTS entries.
+    void read(long long* values) const;
+
+private:
+    int m_fds[NUM_EVENTS];
+    int m_leader; // descriptor of the group leader, -1 if nothing could be opened
+};
+
+}
@@ -0,0 +1,70 @@
+/*
+* ClusterRows
+* Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "macros.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace util
+{
+
+/// @brief A fixed set of threads running the tasks of one parallel_for() at a time. The calling
+/// thread takes part, so a pool of n threads starts n - 1 workers that sleep between calls.
+class CR_DLLPUBLIC_EXPORT ThreadPool
+{
+public:
+    explicit ThreadPool(int num_threads);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    [[nodiscard]] int threads() const { return static_cast<int>(workers.size()) + 1; }
+
+    /// @brief Calls @p task (index, thread) for every index in [0, count) and returns when all
+    /// calls are done. Indices are handed out in increasing order as threads become free, and
+    /// thread is in [0, threads()) and unique among the running calls, so it can pick per thread
+    /// state. Concurrent calls are serialized; @p task must not call parallel_for() itself.
+    void parallel_for(int count, const std::function<void(int, int)>& task);
+
+    /// @brief The process wide pool with a thread per hardware thread, started on first use.
+    static ThreadPool& shared();
+
+private:
+    void work(int thread);
+    void drain(int thread);
+
+    std::vector<std::thread> workers;
+    std::mutex call_mutex; // serializes parallel_for()
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(int, int)>* current = nullptr;
+    int count = 0;
+    std::atomic<int> next{ 0 };
+    int busy = 0; // workers yet to finish the current call
+    unsigned generation = 0;
+    bool stopping = false;
+};
+
+}
@@ -0,0 +1,100 @@
+/*
+ * ClusterRows
+ * Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <cstdint>
+
+// Compile-time trace level. Spans above this level compile to nothing.
+#ifndef CR_TRACE_LEVEL
+#define CR_TRACE_LEVEL 0
+#endif
+
+namespace trace
+{
+
+// Span levels, coarse to fine.
+constexpr int FIT = 1;
+constexpr int EPOCH = 2;
+constexpr int ITERATION = 3;
+constexpr int STEP = 4;
+
+/// @brief Monotonic timestamp in nanoseconds since the tracer was first used.
+uint64_t now_ns();
+
+/// @brief Appends a complete event to the calling thread's ring buffer.
+/// This is lock-free except for the very first event of a thread which registers its buffer.
+/// @param name static string naming the span.
+/// @param arg span specific argument (epoch index, #clusters, score...).
+void record(const char* name, uint64_t begin_ns, uint64_t end_ns, double arg);
+
+/// @brief Writes all buffered events as Chrome trace-event JSON (viewable in Perfetto or
+/// chrome://tracing). Should be called when no engine threads are recording.
+/// @return true on success.
+bool dump_chrome_json(const char* path);
+
+/// @brief Dumps to the file named by the CLUSTERROWS_TRACE environment variable, if set.
+void dump_from_env();
+
+/// @brief Discards all buffered events.
+void clear();
+
+/// @brief RAII span that records [construction, destruction) if Level <= CR_TRACE_LEVEL.
+template <int Level> class Span
+{
+public:
+    explicit Span(const char* name_, double arg_ = 0.0)
+    {
+        if constexpr (enabled)
+        {
+            name = name_;
+            arg = arg_;
+            begin = now_ns();
+        }
+        else
+        {
+            (void)name_;
+            (void)arg_;
+        }
+    }
+
+    ~Span()
+    {
+        if constexpr (enabled)
+            record(name, begin, now_ns(), arg);
+    }
+
+    /// @brief Updates the argument, e.g. with a score known only at the end of the span.
+    void set_arg(double arg_)
+    {
+        if constexpr (enabled)
+            arg = arg_;
+        else
+            (void)arg_;
+    }
+
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+private:
+    static constexpr bool enabled = (Level <= CR_TRACE_LEVEL);
+    const char* name = nullptr;
+    uint64_t begin = 0;
+    double arg = 0.0;
+};
+
+}
@@ -15,7 +15,10 @@
 # along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 from typing import Tuple, Any, Optional
+from itertools import groupby
 
+import ctypes
+import re
 import sys
 import inspect
 import os
@@ -34,6 +37,7 @@ import crlogger
 import crplatform
 import crrange
 import crcolors
+import crgmm
 
 import unohelper
 import uno
@@ -48,6 +52,7 @@ from com.sun.star.table.CellContentType import TEXT as CellContentType_TEXT
 
 MAXROW = 1048575
 MAXCOL = 1023
+CLUSTER_STYLE_PATTERN = re.compile(r"ClusterRows_N\d+_Cluster_\d+")
 
 class CRJobImpl(unohelper.Base, XJob):
     def __init__(self, ctx, testMode=False):
@@ -84,6 +89,12 @@ class CRJobImpl(unohelper.Base, XJob):
     def _getLogPath(self) -> str:
         return os.path.join("build", self.platvars.osName) if self.testMode else self._getExtensionPath()
 
+    def _getGMMLibPath(self) -> str:
+        fname = self.platvars.dllName
+        if self.testMode:
+            return os.path.normpath(os.path.join("build", self.platvars.osName, fname))
+        return os.path.normpath(os.path.join(self._getExtensionPath(), fname))
+
     def _getSuccessReturn(self):
         if self.envType != "DISPATCH":
             return ()
@@ -136,7 +147,7 @@ class CRJobImpl(unohelper.Base, XJob):
             return False
 
         xdlFile = self._getExtensionURL() + "/ClusterRows.xdl"
-        dlgHandler = CRDialogHandler(self.ctx, self.logger, self.userRange)
+        dlgHandler = CRDialogHandler(self.ctx, self.logger, self.userRange, self._getGMMLibPath())
         self.dialog = dialogProvider.createDialogWithHandler(xdlFile, dlgHandler)
         if self.dialog is None:
             self.logger.error("CRJobImpl._createDialogAndExecute: cannot create dialog!")
@@ -191,7 +202,7 @@ class RangeAddress:
         self.Sheet = sheet
 
 class GMMArgs(object):
-    def __init__(self, numClusters: int = 0, numEpochs: int = 10, numIterations: int = 100, colorRows: int = True, hasHeader: bool = False, fullGMM: bool = False):
+    def __init__(self, numClusters: int = 0, numEpochs: int = 10, numIterations: int = 100, colorRows: int = True, hasHeader: bool = False, fullGMM: bool = False, liveColors: bool = False):
         self.rangeAddr: Optional[RangeAddress] = None
         self.outputAddr: Optional[CellAddress] = CellAddress()
         self.numClusters = numClusters
@@ -199,6 +210,7 @@ class GMMArgs(object):
         self.numIterations = numIterations
         self.fullGMM = fullGMM
         self.colorRows = colorRows
+        self.liveColors = liveColors
         self.hasHeader = hasHeader
 
     def __str__(self):
@@ -212,7 +224,7 @@ class GMMArgs(object):
         else:
             outputAddrStr = f"\n\t\tcol = {self.outputAddr.col}, row = {self.outputAddr.row}, sheet = {self.outputAddr.sheet}"
         paramStr = f"numClusters = {self.numClusters}, numEpochs = {self.numEpochs}, numIterations = {self.numIterations}"
-        paramStr += f"\ncolorRows = {self.colorRows}, hasHeader = {self.hasHeader}, fullGMM = {self.fullGMM}"
+        paramStr += f"\ncolorRows = {self.colorRows}, liveColors = {self.liveColors}, hasHeader = {self.hasHeader}, fullGMM = {self.fullGMM}"
         return f"GMMArgs(\n\trangeAddr({rangeAddrStr}),\n\toutputAddr({outputAddrStr})\n\t{paramStr})"
 
     def rows(self) -> int:
@@ -260,9 +272,11 @@ class GMMArgs(object):
         self.outputAddr.sheet = rangeAddr.Sheet
 
 class CRDialogHandler(unohelper.Base, XDialogEventHandler):
-    def __init__(self, ctx, logger, userRange):
+    def __init__(self, ctx, logger, userRange, gmmLibPath):
         self.ctx = ctx
         self.logger = logger
+        self.gmmLibPath = gmmLibPath
+        self.gmmModule = None
         self.logger.debug("INIT CRDialogHandler")
         self.dialog = None
         self.desktop = self.ctx.ServiceManager.createInstanceWithContext("com.sun.star.frame.Desktop", ctx)
@@ -451,6 +465,7 @@ class CRDialogHandler(unohelper.Base, XDialogEventHandler):
         self.gmmArgs.numIterations = int(self.dialog.getControl("NumericField_NumIter").getValue())
         self.gmmArgs.fullGMM = bool(self.dialog.getControl("CheckBox_FullGMM").getState())
         self.gmmArgs.colorRows = bool(self.dialog.getControl("CheckBox_ColorRows").getState())
+        self.gmmArgs.liveColors = bool(self.dialog.getControl("CheckBox_LiveColors").getState())
 
     def writeResults(self):
         self.readDialogInputs()
@@ -493,7 +508,8 @@ class CRDialogHandler(unohelper.Base, XDialogEventHandler):
 
         if self.gmmArgs.colorRows:
             self._addClusterStyles()
-            self._colorClusterData(dataRange, resultsRange)
+            if self.gmmArgs.liveColors or not self._colorClusterRuns(dataRange, resultsRange):
+                self._colorClusterData(dataRange, resultsRange)
 
         if not undoMgr is None:
             undoMgr.leaveUndoContext()
@@ -559,6 +575,70 @@ class CRDialogHandler(unohelper.Base, XDialogEventHandler):
 
         rangeObj.setPropertyValue("ConditionalFormat", cfEntries)
 
+    def _getGMMModule(self) -> Optional[ctypes.CDLL]:
+        if self.gmmModule is None:
+            try:
+                self.gmmModule = ctypes.CDLL(self.gmmLibPath)
+                crgmm.setupSignatures(self.gmmModule)
+            except OSError:
+                self.logger.exception(f"CRDialogHandler._getGMMModule: cannot load {self.gmmLibPath}")
+        return self.gmmModule
+
+    def _colorClusterRuns(self, dataRange, resultsRange) -> bool:
+        """Applies the cluster cell styles directly to the runs of rows of each cluster, with one
+        style call per cluster, so that nothing is evaluated when the sheet is repainted. Unlike
+        _colorClusterData() the colors do not follow later changes of the labels.
+        Returns False if the labels could not be converted to runs."""
+        gmmModule = self._getGMMModule()
+        if gmmModule is None:
+            return False
+
+        labelsRange = uno.createUnoStruct("com.sun.star.table.CellRangeAddress")
+        labelsRange.Sheet = resultsRange.Sheet
+        labelsRange.StartColumn = resultsRange.StartColumn
+        labelsRange.EndColumn = resultsRange.StartColumn
+        labelsRange.StartRow = resultsRange.StartRow
+        labelsRange.EndRow = resultsRange.EndRow
+        labelsObj: Any = crrange.rangeAddressToObject(labelsRange, self.model)
+        labels = [int(row[0]) if isinstance(row[0], float) else -1 for row in labelsObj.getDataArray()]
+        runs = crgmm.labelRuns(gmmModule, labels)
+
+        # Drop the conditional formats of an earlier live coloring and the styles of an earlier run.
+        rangeObj: Any = crrange.rangeAddressToObject(dataRange, self.model)
+        cfEntries = rangeObj.getPropertyValue("ConditionalFormat")
+        if cfEntries is not None and cfEntries.getCount() > 0:
+            cfEntries.clear()
+            rangeObj.setPropertyValue("ConditionalFormat", cfEntries)
+        self._resetClusterStyles(rangeObj)
+
+        numClusters = self.gmmArgs.numClusters
+        for label, clusterRuns in groupby(runs, key=lambda run: run[0]):
+            if label >= numClusters:
+                continue
+            addresses = []
+            for _, start, length in clusterRuns:
+                address = uno.createUnoStruct("com.sun.star.table.CellRangeAddress")
+                address.Sheet = dataRange.Sheet
+                address.StartColumn = dataRange.StartColumn
+                address.EndColumn = dataRange.EndColumn
+                address.StartRow = dataRange.StartRow + start
+                address.EndRow = dataRange.StartRow + start + length - 1
+                addresses.append(address)
+            cellRanges: Any = self.model.createInstance("com.sun.star.sheet.SheetCellRanges")
+            cellRanges.addRangeAddresses(tuple(addresses), False)
+            cellRanges.setPropertyValue("CellStyle", self._getStyleName(label, numClusters))
+            self.logger.debug(f"CRDialogHandler._colorClusterRuns: cluster {label} has {len(addresses)} runs")
+        return True
+
+    def _resetClusterStyles(self, rangeObj):
+        """Resets the cells of rangeObj that carry a cluster style of an earlier run to the default
+        style. Cells with any other style the user applied are left alone."""
+        formatRanges = rangeObj.getUniqueCellFormatRanges()
+        for idx in range(formatRanges.getCount()):
+            cellRanges = formatRanges.getByIndex(idx)
+            if CLUSTER_STYLE_PATTERN.fullmatch(cellRanges.getPropertyValue("CellStyle")):
+                cellRanges.setPropertyValue("CellStyle", "Default")
+
     def _getStyleName(self, clusterIndex, numClusters):
         return f"ClusterRows_N{numClusters}_Cluster_{clusterIndex}"
 
@@ -15,8 +15,7 @@
 # along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 import ctypes
-from itertools import chain
-from typing import Tuple
+from typing import Optional, Tuple
 import sys
 import inspect
 import os
@@ -34,6 +33,8 @@ if cmd_folder not in sys.path:
 from perf import PerfTimer
 import crlogger
 import crplatform
+import crgmm
+import crworker
 
 import unohelper
 
@@ -45,6 +46,8 @@ class DataClusterImpl(unohelper.Base, XDataCluster):
         self.ctx = ctx
         self.testMode = testMode
         self.platvars = crplatform.CRPlatForm()
+        self.gmmModule = None
+        self.workerClient = None
         self.logger = crlogger.setupLogger(self._getLogPath())
         self.logger.debug("INIT DataClusterImpl")
         self.logger.debug(self.platvars)
@@ -83,6 +86,20 @@ class DataClusterImpl(unohelper.Base, XDataCluster):
         extension_path = self._getExtensionPath()
         return os.path.normpath(os.path.join(extension_path, fname))
 
+    def _getGMMModule(self) -> ctypes.CDLL:
+        """Loads the native library once per add-in instance rather than on every call"""
+        if self.gmmModule is None:
+            self.gmmModule = ctypes.CDLL(self._getGMMLibPath())
+            crgmm.setupSignatures(self.gmmModule)
+        return self.gmmModule
+
+    def _getWorkerClient(self) -> Optional[crworker.WorkerClient]:
+        """The out-of-process worker next to the native library, if enabled"""
+        if self.workerClient is None and crworker.isEnabled():
+            workerPath = os.path.join(os.path.dirname(self._getGMMLibPath()), "crworker")
+            self.workerClient = crworker.WorkerClient(workerPath, self.logger)
+        return self.workerClient
+
     def gmmCluster(self, data: Tuple[Tuple[float, ...]], numClusters, numEpochs, numIterations, fullGMM) -> Tuple[Tuple[float, ...]]:
         """Compute clusters for each row of input data matrix with
         the given parameters"""
@@ -109,31 +126,78 @@ class DataClusterImpl(unohelper.Base, XDataCluster):
                             return ((-1, 0),)
         nrows = len(data)
         ncols = len(data[0])
+        gmmModule = self._getGMMModule()
+        options = crgmm.defaultOptions(gmmModule)
+        options.numClusters = int(numClusters)
+        options.numEpochs = int(numEpochs)
+        options.numIterations = int(numIterations)
+        options.fullGMM = int(fullGMM)
+        # Spreadsheet users do not tune the engine, let the planner pick its strategy.
+        options.autoPlan = 1
+
+        workerClient = self._getWorkerClient()
+        if workerClient is not None:
+            try:
+                workerPerf = PerfTimer("gmmWorker", level=1, logger=self.logger)
+                status, labels, confidences, stats = workerClient.cluster(data, options)
+                workerPerf.show()
+                self.logger.debug(f"gmm stats: {stats}")
+                self.logger.debug("gmm worker status = {}".format(status))
+                res = tuple(zip(labels, confidences)) if status == 0 else ((-1, 0),)
+                mainPerf.show()
+                return res
+            except crworker.WorkerUnavailable as e:
+                self.logger.warning(f"Clustering in-process, the worker is unavailable: {e}")
+
         tupleToArrayPerf = PerfTimer("tupleToArray", level=1, logger=self.logger)
-        arr = (ctypes.c_double * (ncols * nrows))(*chain.from_iterable(data))
+        values = crgmm.flatten(data)
+        arr = (ctypes.c_double * (ncols * nrows)).from_buffer(values)
         tupleToArrayPerf.show()
         labels = (ctypes.c_int * nrows)()
         confidences = (ctypes.c_double * nrows)()
-        gmmModule = ctypes.CDLL(self._getGMMLibPath())
-        gmm = gmmModule.gmmMain
-        gmm.argtypes = [
-            ctypes.POINTER(ctypes.c_double), # data
-            ctypes.c_int, # rows
-            ctypes.c_int, # cols
-            ctypes.c_int, # numClusters
-            ctypes.c_int, # numEpochs
-            ctypes.c_int, # numIterations
-            ctypes.POINTER(ctypes.c_int), # clusterLabels
-            ctypes.POINTER(ctypes.c_double), # labelConfidence
-            ctypes.c_int, # fullGMM
-        ]
-        gmm.restype = ctypes.c_int
+        stats = crgmm.GMMStats()
         gmmPerf = PerfTimer("gmm", level=1, logger=self.logger)
-        status = gmm(arr, nrows, ncols, int(numClusters), int(numEpochs), int(numIterations), labels, confidences, int(fullGMM))
+        status = gmmModule.gmmMainEx(arr, nrows, ncols, ctypes.byref(options), labels, confidences, ctypes.byref(stats))
         gmmPerf.show()
+        self.logger.debug(f"gmm stats: {stats}")
         self.logger.debug("gmm status = {}".format(status))
         resultsToTuplePerf = PerfTimer("resultsToTuple", level=1, logger=self.logger)
         res = tuple(zip(labels, confidences))
         resultsToTuplePerf.show()
         mainPerf.show()
         return res
+
+    def dbscanCluster(self, data: Tuple[Tuple[float, ...]], eps, minPoints) -> Tuple[Tuple[float, ...]]:
+        """Compute density based clusters for each row of input data matrix, rows in no dense
+        region get label -1"""
+        ret = ((-1, 0),)
+        try:
+            ret = self._dbscanCluster(data, eps=eps, minPoints=minPoints)
+        except Exception as e:
+            self.logger.exception("_dbscanCluster crashed.")
+        return ret
+
+    def _dbscanCluster(self, data: Tuple[Tuple[float, ...]], eps, minPoints) -> Tuple[Tuple[float, ...]]:
+        mainPerf = PerfTimer("dbscanCluster", showStart=True, logger=self.logger)
+        if eps is None: eps = 0
+        if minPoints is None: minPoints = 0
+        self.logger.debug(f"Params: eps = {eps} minPoints = {minPoints}")
+        if (not DataClusterImpl._isNumeric(eps)) \
+            or (not DataClusterImpl._isNumeric(minPoints)) \
+                or (not isinstance(data, tuple)) or len(data) == 0 \
+                    or (not isinstance(data[0], tuple)):
+                    return ((-1, 0),)
+        nrows = len(data)
+        ncols = len(data[0])
+        gmmModule = self._getGMMModule()
+        values = crgmm.flatten(data)
+        arr = (ctypes.c_double * (ncols * nrows)).from_buffer(values)
+        labels = (ctypes.c_int * nrows)()
+        confidences = (ctypes.c_double * nrows)()
+        dbscanPerf = PerfTimer("dbscan", level=1, logger=self.logger)
+        numClusters = gmmModule.dbscanMain(arr, nrows, ncols, float(eps), int(minPoints), labels, confidences)
+        dbscanPerf.show()
+        self.logger.debug("dbscan clusters = {}".format(numClusters))
+        res = tuple(zip(labels, confidences)) if numClusters >= 0 else ((-1, 0),)
+        mainPerf.show()
+        return res
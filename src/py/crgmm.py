@@ -0,0 +1,212 @@
+# ClusterRows
+# Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""ctypes mirrors of the native structs and entry points declared in em.h"""
+
+import array
+import ctypes
+from itertools import chain
+from typing import List, Sequence, Tuple
+
+# Values of GMMOptions.fullGMM (CRCovarianceType)
+COVARIANCE_DIAGONAL = 0
+COVARIANCE_FULL = 1
+COVARIANCE_SPHERICAL = 2
+COVARIANCE_TIED = 3
+
+# Values of GMMStats.planStrategy (CRStrategy)
+STRATEGY_NONE = 0
+STRATEGY_DENSE = 1
+STRATEGY_TREE = 2
+STRATEGY_TRUNCATED = 3
+STRATEGY_PCA = 4
+STRATEGY_STREAMING = 5
+
+# Indices of the per phase counters of GMMStats (CRPhase)
+PHASE_INIT = 0
+PHASE_ESTEP = 1
+PHASE_MSTEP = 2
+PHASE_SELECT = 3
+NUM_PHASES = 4
+
+class GMMOptions(ctypes.Structure):
+    _fields_ = [
+        ("numClusters", ctypes.c_int),
+        ("numEpochs", ctypes.c_int),
+        ("numIterations", ctypes.c_int),
+        ("fullGMM", ctypes.c_int),
+        ("chunkRows", ctypes.c_int),
+        ("treeTolerance", ctypes.c_double),
+        ("topK", ctypes.c_int),
+        ("topKRefresh", ctypes.c_int),
+        ("vbMaxClusters", ctypes.c_int),
+        ("vbConcentration", ctypes.c_double),
+        ("pcaVariance", ctypes.c_double),
+        ("orderSearchMaxClusters", ctypes.c_int),
+        ("autoPlan", ctypes.c_int),
+        ("maxMemoryMB", ctypes.c_double),
+        ("maxThreads", ctypes.c_int),
+        ("timeBudgetMs", ctypes.c_double),
+        ("perfCounters", ctypes.c_int),
+        ("normalize", ctypes.c_int),
+        ("seed", ctypes.c_uint),
+    ]
+
+class GMMStats(ctypes.Structure):
+    _fields_ = [
+        ("initTimeMs", ctypes.c_double),
+        ("eStepTimeMs", ctypes.c_double),
+        ("mStepTimeMs", ctypes.c_double),
+        ("totalTimeMs", ctypes.c_double),
+        ("numCandidates", ctypes.c_int),
+        ("epochsPerCandidate", ctypes.c_int),
+        ("totalEpochs", ctypes.c_int),
+        ("totalIterations", ctypes.c_int),
+        ("minIterationsPerEpoch", ctypes.c_int),
+        ("maxIterationsPerEpoch", ctypes.c_int),
+        ("bestNumClusters", ctypes.c_int),
+        ("threadsUsed", ctypes.c_int),
+        ("allocCount", ctypes.c_longlong),
+        ("allocBytes", ctypes.c_longlong),
+        ("uniqueRows", ctypes.c_int),
+        ("pcaComponents", ctypes.c_int),
+        ("regularizedCovariances", ctypes.c_int),
+        ("reseededClusters", ctypes.c_int),
+        ("planStrategy", ctypes.c_int),
+        ("planEstimatedMs", ctypes.c_double),
+        ("planEstimatedMB", ctypes.c_double),
+        ("selectTimeMs", ctypes.c_double),
+        ("perfStatus", ctypes.c_int),
+        ("perfCycles", ctypes.c_longlong * NUM_PHASES),
+        ("perfInstructions", ctypes.c_longlong * NUM_PHASES),
+        ("perfCacheMisses", ctypes.c_longlong * NUM_PHASES),
+        ("perfBranchMisses", ctypes.c_longlong * NUM_PHASES),
+        ("invalidRows", ctypes.c_int),
+    ]
+
+    def __str__(self) -> str:
+        def show(value):
+            return list(value) if isinstance(value, ctypes.Array) else value
+        return ", ".join(f"{name} = {show(getattr(self, name))}" for name, _ in self._fields_)
+
+class GMMJob(ctypes.Structure):
+    _fields_ = [
+        ("array", ctypes.POINTER(ctypes.c_double)),
+        ("rows", ctypes.c_int),
+        ("cols", ctypes.c_int),
+        ("options", ctypes.POINTER(GMMOptions)),
+        ("clusterLabels", ctypes.POINTER(ctypes.c_int)),
+        ("labelConfidence", ctypes.POINTER(ctypes.c_double)),
+        ("stats", ctypes.POINTER(GMMStats)),
+        ("status", ctypes.c_int),
+    ]
+
+def setupSignatures(gmmModule: ctypes.CDLL) -> None:
+    """Sets argument and return types of the native entry points"""
+    gmmModule.gmmInitOptions.argtypes = [ctypes.POINTER(GMMOptions)]
+    gmmModule.gmmInitOptions.restype = None
+
+    gmmModule.gmmMainEx.argtypes = [
+        ctypes.POINTER(ctypes.c_double), # data
+        ctypes.c_int, # rows
+        ctypes.c_int, # cols
+        ctypes.POINTER(GMMOptions), # options
+        ctypes.POINTER(ctypes.c_int), # clusterLabels
+        ctypes.POINTER(ctypes.c_double), # labelConfidence
+        ctypes.POINTER(GMMStats), # stats
+    ]
+    gmmModule.gmmMainEx.restype = ctypes.c_int
+
+    gmmModule.gmmBatchMain.argtypes = [
+        ctypes.POINTER(GMMJob), # jobs
+        ctypes.c_int, # numJobs
+        ctypes.c_int, # numThreads
+    ]
+    gmmModule.gmmBatchMain.restype = ctypes.c_int
+
+    gmmModule.gmmLabelRuns.argtypes = [
+        ctypes.POINTER(ctypes.c_int), # clusterLabels
+        ctypes.c_int, # rows
+        ctypes.POINTER(ctypes.c_int), # runLabels
+        ctypes.POINTER(ctypes.c_int), # runStarts
+        ctypes.POINTER(ctypes.c_int), # runLengths
+    ]
+    gmmModule.gmmLabelRuns.restype = ctypes.c_int
+
+    gmmModule.dbscanMain.argtypes = [
+        ctypes.POINTER(ctypes.c_double), # data
+        ctypes.c_int, # rows
+        ctypes.c_int, # cols
+        ctypes.c_double, # eps
+        ctypes.c_int, # minPoints
+        ctypes.POINTER(ctypes.c_int), # clusterLabels
+        ctypes.POINTER(ctypes.c_double), # labelConfidence
+    ]
+    gmmModule.dbscanMain.restype = ctypes.c_int
+
+def defaultOptions(gmmModule: ctypes.CDLL) -> GMMOptions:
+    options = GMMOptions()
+    gmmModule.gmmInitOptions(ctypes.byref(options))
+    return options
+
+def flatten(data: Sequence[Sequence[float]]) -> array.array:
+    """Returns the rows as one contiguous row major array of doubles, ready to be wrapped with
+    (ctypes.c_double * n).from_buffer() without a copy. Cells that are not numbers become NaN,
+    so the engine labels their rows -1."""
+    try:
+        return array.array("d", chain.from_iterable(data))
+    except TypeError:
+        nan = float("nan")
+        return array.array("d", (value if isinstance(value, (int, float)) else nan
+                                 for value in chain.from_iterable(data)))
+
+def clusterBatch(gmmModule: ctypes.CDLL, problems: Sequence[Tuple[Sequence[Sequence[float]], GMMOptions]],
+                 numThreads: int = 0) -> List[Tuple[int, List[Tuple[int, float]]]]:
+    """Clusters every (rows, options) problem in one native call, in parallel.
+    Returns (status, [(label, confidence) per row]) for each problem in the given order."""
+    jobs = (GMMJob * len(problems))()
+    buffers = []
+    for job, (data, options) in zip(jobs, problems):
+        nrows = len(data)
+        ncols = len(data[0]) if nrows else 0
+        values = flatten(data)
+        arr = (ctypes.c_double * (nrows * ncols)).from_buffer(values)
+        labels = (ctypes.c_int * nrows)()
+        confidences = (ctypes.c_double * nrows)()
+        buffers.append((values, labels, confidences, options))
+        job.array = arr
+        job.rows = nrows
+        job.cols = ncols
+        job.options = ctypes.pointer(options)
+        job.clusterLabels = labels
+        job.labelConfidence = confidences
+        job.stats = None
+        job.status = -1
+
+    gmmModule.gmmBatchMain(jobs, len(problems), numThreads)
+    return [(job.status, list(zip(labels, confidences)))
+            for job, (_, labels, confidences, _) in zip(jobs, buffers)]
+
+def labelRuns(gmmModule: ctypes.CDLL, labels: Sequence[int]) -> List[Tuple[int, int, int]]:
+    """Returns (label, firstRow, numRows) for each run of consecutive rows with the same
+    non-negative label, ordered by label and then by first row"""
+    nrows = len(labels)
+    labelArr = (ctypes.c_int * nrows)(*labels)
+    runLabels = (ctypes.c_int * nrows)()
+    runStarts = (ctypes.c_int * nrows)()
+    runLengths = (ctypes.c_int * nrows)()
+    numRuns = gmmModule.gmmLabelRuns(labelArr, nrows, runLabels, runStarts, runLengths)
+    return [(runLabels[idx], runStarts[idx], runLengths[idx]) for idx in range(max(numRuns, 0))]
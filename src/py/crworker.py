@@ -0,0 +1,202 @@
+# ClusterRows
+# Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""Client of the crworker process (tools/crworker.cxx), which runs the clustering outside of
+soffice. The matrix and the results are exchanged through a POSIX shared memory segment, so
+only the small request and response structs go over the socket."""
+
+import ctypes
+import logging
+import mmap
+import os
+import secrets
+import socket
+import subprocess
+import time
+from typing import List, Optional, Sequence, Tuple
+
+import crgmm
+
+# "CRWQ" and "CRWR" in little endian byte order.
+REQUEST_MAGIC = 0x51575243
+RESPONSE_MAGIC = 0x52575243
+STATUS_INCOMPATIBLE = -2
+
+# Linux keeps the shm_open() segments here, which lets us create them with plain file calls.
+SHM_DIR = "/dev/shm"
+
+class WorkerRequest(ctypes.Structure):
+    _fields_ = [
+        ("magic", ctypes.c_uint32),
+        ("optionsSize", ctypes.c_uint32),
+        ("statsSize", ctypes.c_uint32),
+        ("shmName", ctypes.c_char * 64),
+        ("rows", ctypes.c_int32),
+        ("cols", ctypes.c_int32),
+        ("options", crgmm.GMMOptions),
+    ]
+
+class WorkerResponse(ctypes.Structure):
+    _fields_ = [
+        ("magic", ctypes.c_uint32),
+        ("status", ctypes.c_int32),
+        ("stats", crgmm.GMMStats),
+    ]
+
+class WorkerUnavailable(Exception):
+    """The worker could not be reached or started, the caller should cluster in-process"""
+
+def isEnabled() -> bool:
+    """The worker is opt-in: set CLUSTERROWS_WORKER=1 in the environment of soffice"""
+    return os.environ.get("CLUSTERROWS_WORKER", "0") == "1" and os.path.isdir(SHM_DIR)
+
+def socketPath() -> str:
+    """Same rule as defaultSocketPath() of the worker"""
+    runtimeDir = os.environ.get("XDG_RUNTIME_DIR")
+    if runtimeDir:
+        return os.path.join(runtimeDir, "clusterrows-worker.sock")
+    return f"/tmp/clusterrows-worker-{os.getuid()}.sock"
+
+class WorkerClient(object):
+    """Sends clustering jobs to the worker, starting it on first use. The connection is kept and
+    reused for later jobs."""
+
+    def __init__(self, workerPath: str, logger: logging.Logger, startTimeout: float = 5.0):
+        self.workerPath = workerPath
+        self.logger = logger
+        self.startTimeout = startTimeout
+        self.sock: Optional[socket.socket] = None
+
+    def cluster(self, data: Sequence[Sequence[float]], options: crgmm.GMMOptions) \
+            -> Tuple[int, List[int], List[float], crgmm.GMMStats]:
+        """Clusters the rows of data and returns (status, labels, confidences, stats).
+        Raises WorkerUnavailable if the job could not be handed to the worker."""
+        nrows = len(data)
+        ncols = len(data[0]) if nrows else 0
+        if nrows == 0 or ncols == 0:
+            raise WorkerUnavailable("empty input")
+
+        name = f"/clusterrows-{os.getpid()}-{secrets.token_hex(8)}"
+        path = os.path.join(SHM_DIR, name[1:])
+        size = nrows * (ncols + 1) * ctypes.sizeof(ctypes.c_double) + nrows * ctypes.sizeof(ctypes.c_int32)
+        try:
+            fd = os.open(path, os.O_RDWR | os.O_CREAT | os.O_EXCL, 0o600)
+        except OSError as e:
+            raise WorkerUnavailable(f"cannot create {path}: {e}")
+
+        try:
+            os.ftruncate(fd, size)
+            with mmap.mmap(fd, size) as segment:
+                values = memoryview(segment)
+                values[:nrows * ncols * ctypes.sizeof(ctypes.c_double)] = memoryview(crgmm.flatten(data)).cast("B")
+                values.release()
+
+                request = WorkerRequest()
+                request.magic = REQUEST_MAGIC
+                request.optionsSize = ctypes.sizeof(crgmm.GMMOptions)
+                request.statsSize = ctypes.sizeof(crgmm.GMMStats)
+                request.shmName = name.encode()
+                request.rows = nrows
+                request.cols = ncols
+                request.options = options
+                response = self._call(request)
+
+                confidences = (ctypes.c_double * nrows).from_buffer(segment, nrows * ncols * ctypes.sizeof(ctypes.c_double))
+                labels = (ctypes.c_int32 * nrows).from_buffer(segment, nrows * (ncols + 1) * ctypes.sizeof(ctypes.c_double))
+                result = (response.status, list(labels), list(confidences), response.stats)
+                del confidences, labels
+                return result
+        finally:
+            os.close(fd)
+            os.unlink(path)
+
+    def close(self) -> None:
+        if self.sock is not None:
+            self.sock.close()
+            self.sock = None
+
+    def _call(self, request: WorkerRequest) -> WorkerResponse:
+        """Sends request and waits for the response. A dropped connection is retried once on
+        a new connection, the worker is started if nobody listens."""
+        for attempt in range(2):
+            if self.sock is None:
+                self.sock = self._connect()
+            try:
+                self.sock.sendall(bytes(request))
+                response = WorkerResponse.from_buffer_copy(self._recvAll(ctypes.sizeof(WorkerResponse)))
+            except OSError as e:
+                self.logger.warning(f"WorkerClient._call: connection lost (attempt {attempt}): {e}")
+                self.close()
+                continue
+
+            if response.magic != RESPONSE_MAGIC or response.status == STATUS_INCOMPATIBLE:
+                self.close()
+                raise WorkerUnavailable("worker speaks a different protocol version")
+            return response
+
+        # The worker died while running the job, don't repeat it in-process.
+        response = WorkerResponse()
+        response.status = -1
+        return response
+
+    def _recvAll(self, size: int) -> bytes:
+        chunks = []
+        while size > 0:
+            chunk = self.sock.recv(size)
+            if not chunk:
+                raise ConnectionResetError("worker closed the connection")
+            chunks.append(chunk)
+            size -= len(chunk)
+        return b"".join(chunks)
+
+    def _tryConnect(self) -> Optional[socket.socket]:
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        try:
+            sock.connect(socketPath())
+            return sock
+        except OSError:
+            sock.close()
+            return None
+
+    def _connect(self) -> socket.socket:
+        sock = self._tryConnect()
+        if sock is not None:
+            return sock
+
+        if not os.path.isfile(self.workerPath):
+            raise WorkerUnavailable(f"{self.workerPath} not found")
+        if not os.access(self.workerPath, os.X_OK):
+            # Extension packages do not keep the executable bit everywhere.
+            try:
+                os.chmod(self.workerPath, 0o755)
+            except OSError as e:
+                raise WorkerUnavailable(f"cannot make {self.workerPath} executable: {e}")
+
+        self.logger.debug(f"WorkerClient._connect: starting {self.workerPath}")
+        try:
+            subprocess.Popen([self.workerPath, "--socket", socketPath()], stdin=subprocess.DEVNULL,
+                             stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL, close_fds=True,
+                             start_new_session=True)
+        except OSError as e:
+            raise WorkerUnavailable(f"cannot start {self.workerPath}: {e}")
+
+        deadline = time.monotonic() + self.startTimeout
+        while time.monotonic() < deadline:
+            time.sleep(0.02)
+            sock = self._tryConnect()
+            if sock is not None:
+                return sock
+        raise WorkerUnavailable(f"{self.workerPath} did not start listening")
@@ -25,6 +25,8 @@ def main():
     data: Tuple[Tuple[float, float]] = tuple(((random.uniform(0,10), random.uniform(20, 30)) for i in range(100)))
     ret = clusterImpl.gmmCluster(data, numClusters=3, numEpochs=20, numIterations=100, fullGMM=0)
     print(ret)
+    ret = clusterImpl.dbscanCluster(data, eps=None, minPoints=None)
+    print(ret)
 
 if __name__ == "__main__":
     main()
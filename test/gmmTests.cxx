@@ -26,6 +26,9 @@
 #include <fstream>
 #include <chrono>
 #include <random>
+#include <vector>
+#include <algorithm>
+#include <numeric>
 
 testing::AssertionResult hasCorrectConstLabels(const int* labels, const double* confidences,
                                                int samples, int constLabel, double constConfidence,
@@ -119,8 +122,8 @@ TEST(GMMTests, ThreeClusterCaseDiagonal)
     for (int row = 0; row < rows; ++row)
         rowMap[row] = row;
 
-    unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
-    std::default_random_engine generator(seed);
+    // Fixed seeds for the data and the engine keep the test repeatable.
+    std::default_random_engine generator(3);
     std::shuffle(rowMap.begin(), rowMap.end(), generator);
 
     for (int row = 0; row < rows; ++row)
@@ -152,8 +155,15 @@ TEST(GMMTests, ThreeClusterCaseDiagonal)
     std::array<int, rows> gmmLabels{};
     std::array<double, rows> gmmConfidences{};
 
-    int ret = gmmMain(&data[0][0], rows, cols, numClusters, 10, 50, gmmLabels.data(),
-                      gmmConfidences.data(), 0);
+    GMMOptions options;
+    gmmInitOptions(&options);
+    options.numClusters = numClusters;
+    options.numEpochs = 10;
+    options.numIterations = 50;
+    options.fullGMM = 0;
+    options.seed = 1;
+    int ret = gmmMainEx(&data[0][0], rows, cols, &options, gmmLabels.data(),
+                        gmmConfidences.data(), nullptr);
     EXPECT_EQ(ret, 0);
 
     int confusion[numClusters][numClusters]{ { 0 } };
@@ -195,6 +205,13 @@ TEST(GMMTests, ThreeClusterCaseDiagonal)
     accuracy /= numClusters;
     EXPECT_GT(accuracy, 0.93);
     EXPECT_LE(accuracy, 1.0);
+
+    // The same seed gives the same labels.
+    std::array<int, rows> rerunLabels{};
+    ret = gmmMainEx(&data[0][0], rows, cols, &options, rerunLabels.data(), gmmConfidences.data(),
+                    nullptr);
+    EXPECT_EQ(ret, 0);
+    EXPECT_EQ(rerunLabels, gmmLabels);
 }
 
 TEST(GMMTests, ThreeClusterCaseFull)
@@ -210,8 +227,8 @@ TEST(GMMTests, ThreeClusterCaseFull)
     for (int row = 0; row < rows; ++row)
         rowMap[row] = row;
 
-    unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
-    std::default_random_engine generator(seed);
+    // Fixed seeds for the data and the engine keep the test repeatable.
+    std::default_random_engine generator(3);
     std::shuffle(rowMap.begin(), rowMap.end(), generator);
 
     for (int row = 0; row < rows; ++row)
@@ -272,8 +289,15 @@ TEST(GMMTests, ThreeClusterCaseFull)
     std::array<int, rows> gmmLabels{};
     std::array<double, rows> gmmConfidences{};
 
-    int ret = gmmMain(&data[0][0], rows, cols, numClusters, 10, 50, gmmLabels.data(),
-                      gmmConfidences.data(), 1);
+    GMMOptions options;
+    gmmInitOptions(&options);
+    options.numClusters = numClusters;
+    options.numEpochs = 10;
+    options.numIterations = 50;
+    options.fullGMM = 1;
+    options.seed = 1;
+    int ret = gmmMainEx(&data[0][0], rows, cols, &options, gmmLabels.data(),
+                        gmmConfidences.data(), nullptr);
     EXPECT_EQ(ret, 0);
 
     int confusion[numClusters][numClusters]{ { 0 } };
@@ -316,3 +340,985 @@ TEST(GMMTests, ThreeClusterCaseFull)
     EXPECT_GT(accuracy, 0.93);
     EXPECT_LE(accuracy, 1.0);
 }
+
+TEST(GMMTests, StatsReporting)
+{
+    constexpr int rows = 200;
+    constexpr int cols = 2;
+    double data[rows][cols];
+    std::default_random_engine generator(7);
+    std::normal_distribution<double> normalSampler(0.0, 1.0);
+    for (int row = 0; row < rows; ++row)
+    {
+        const double offset = (row % 2) ? 5.0 : -5.0;
+        for (int col = 0; col < cols; ++col)
+            data[row][col] = offset + normalSampler(generator);
+    }
+
+    std::array<int, rows> labels{};
+    std::array<double, rows> confidences{};
+    for (int fullGMM = 0; fullGMM < 2; ++fullGMM)
+    {
+        GMMOptions options;
+        gmmInitOptions(&options);
+        options.numClusters = 0;
+        options.numEpochs = 4;
+        options.numIterations = 30;
+        options.fullGMM = fullGMM;
+        GMMStats stats;
+        int ret = gmmMainEx(&data[0][0], rows, cols, &options, labels.data(), confidences.data(),
+                            &stats);
+        EXPECT_EQ(ret, 0);
+        EXPECT_EQ(stats.numCandidates, 4) << "fullGMM = " << fullGMM;
+        EXPECT_EQ(stats.epochsPerCandidate, 4);
+        EXPECT_EQ(stats.totalEpochs, 16);
+        EXPECT_GE(stats.totalIterations, stats.totalEpochs);
+        EXPECT_LE(stats.minIterationsPerEpoch, stats.maxIterationsPerEpoch);
+        EXPECT_LE(stats.maxIterationsPerEpoch, 30);
+        EXPECT_GE(stats.bestNumClusters, 2);
+        EXPECT_LE(stats.bestNumClusters, 5);
+        EXPECT_EQ(stats.threadsUsed, 1);
+        EXPECT_GT(stats.allocCount, 0);
+        EXPECT_GT(stats.allocBytes, 0);
+        EXPECT_GT(stats.eStepTimeMs, 0.0);
+        EXPECT_GE(stats.totalTimeMs, stats.initTimeMs + stats.eStepTimeMs + stats.mStepTimeMs);
+    }
+}
+
+TEST(GMMTests, WorkingBuffersReusedAcrossEpochs)
+{
+    constexpr int rows = 300;
+    constexpr int cols = 3;
+    double data[rows][cols];
+    std::default_random_engine generator(11);
+    std::normal_distribution<double> normalSampler(0.0, 1.0);
+    for (int row = 0; row < rows; ++row)
+        for (int col = 0; col < cols; ++col)
+            data[row][col] = (row % 3) * 4.0 + normalSampler(generator);
+
+    std::array<int, rows> labels{};
+    std::array<double, rows> confidences{};
+    for (int fullGMM = 0; fullGMM < 2; ++fullGMM)
+    {
+        long long allocCount[2]{};
+        const int epochs[2]{ 2, 8 };
+        for (int run = 0; run < 2; ++run)
+        {
+            GMMOptions options;
+            gmmInitOptions(&options);
+            options.numClusters = 3;
+            options.numEpochs = epochs[run];
+            options.fullGMM = fullGMM;
+            GMMStats stats;
+            ASSERT_EQ(gmmMainEx(&data[0][0], rows, cols, &options, labels.data(),
+                                confidences.data(), &stats),
+                      0);
+            allocCount[run] = stats.allocCount;
+        }
+
+        // Working buffers must not be reallocated per epoch or per iteration.
+        EXPECT_EQ(allocCount[0], allocCount[1]) << "fullGMM = " << fullGMM;
+    }
+}
+
+struct StreamSource
+{
+    const double* data;
+    int rows;
+    int cols;
+    int next;
+};
+
+struct StreamSink
+{
+    std::vector<int> labels;
+    std::vector<double> confidences;
+};
+
+static int streamRead(void* context, double* buffer, int maxRows)
+{
+    auto* source = static_cast<StreamSource*>(context);
+    const int count = std::min(maxRows, source->rows - source->next);
+    std::copy(source->data + source->next * source->cols,
+              source->data + (source->next + count) * source->cols, buffer);
+    source->next += count;
+    return count;
+}
+
+static void streamRewind(void* context) { static_cast<StreamSource*>(context)->next = 0; }
+
+static void streamWrite(void* context, const int* labels, const double* confidences, int rows)
+{
+    auto* sink = static_cast<StreamSink*>(context);
+    sink->labels.insert(sink->labels.end(), labels, labels + rows);
+    sink->confidences.insert(sink->confidences.end(), confidences, confidences + rows);
+}
+
+/// @brief Fraction of the rows that are not in the most common label of their true
+/// cluster. Rows with a negative truth are skipped, labels outside [0, numLabels) count as
+/// wrong unless @p skipUnlabelled lets rows labelled -1 be skipped too. 1 if no row is counted.
+static double mislabelledFraction(const std::vector<int>& labels, const std::vector<int>& truth,
+                                  int numLabels, bool skipUnlabelled = false)
+{
+    const int numTruths = *std::max_element(truth.begin(), truth.end()) + 1;
+    std::vector<int> counts(static_cast<size_t>(std::max(numTruths, 0)) * numLabels, 0);
+    int wrong = 0;
+    int total = 0;
+    for (size_t row = 0; row < labels.size(); ++row)
+    {
+        if (truth[row] < 0 || (skipUnlabelled && labels[row] == -1))
+            continue;
+        ++total;
+        if (labels[row] >= 0 && labels[row] < numLabels)
+            ++counts[truth[row] * numLabels + labels[row]];
+        else
+            ++wrong;
+    }
+    for (int cluster = 0; cluster < numTruths; ++cluster)
+    {
+        const auto begin = counts.begin() + cluster * numLabels;
+        wrong += std::accumulate(begin, begin + numLabels, 0)
+                 - *std::max_element(begin, begin + numLabels);
+    }
+    return total ? static_cast<double>(wrong) / total : 1.0;
+}
+
+TEST(GMMTests, StreamingThreeClusterCase)
+{
+    constexpr int numClusters = 3;
+    constexpr int rows = 3000;
+    constexpr int cols = 2;
+    std::vector<double> data(rows * cols);
+    std::vector<int> truth(rows);
+    std::default_random_engine generator(5);
+    std::normal_distribution<double> normalSampler(0.0, 1.0);
+    const double means[numClusters][cols]{ { 0.0, 0.0 }, { 6.0, 0.0 }, { 0.0, 6.0 } };
+    for (int row = 0; row < rows; ++row)
+    {
+        truth[row] = row % numClusters;
+        const double u = normalSampler(generator);
+        const double v = normalSampler(generator);
+        // Correlated noise exercises the full covariance path.
+        data[row * cols] = means[truth[row]][0] + u;
+        data[row * cols + 1] = means[truth[row]][1] + 0.8 * u + 0.6 * v;
+    }
+
+    for (int fullGMM = 0; fullGMM < 2; ++fullGMM)
+    {
+        GMMOptions options;
+        gmmInitOptions(&options);
+        options.numClusters = numClusters;
+        options.numEpochs = 4;
+        options.numIterations = 50;
+        options.fullGMM = fullGMM;
+        // Several chunks per pass with a partial last one.
+        options.chunkRows = 256;
+
+        StreamSource source{ data.data(), rows, cols, 0 };
+        StreamSink sink;
+        GMMStats stats;
+        ASSERT_EQ(gmmStreamMain(cols, streamRead, streamRewind, &source, &options, streamWrite,
+                                &sink, &stats),
+                  0);
+        ASSERT_EQ(sink.labels.size(), size_t(rows));
+        EXPECT_EQ(stats.bestNumClusters, numClusters);
+
+        EXPECT_GT(*std::min_element(sink.confidences.begin(), sink.confidences.end()), 0.0);
+        EXPECT_LT(mislabelledFraction(sink.labels, truth, numClusters), 0.1)
+            << "fullGMM = " << fullGMM;
+    }
+
+    EXPECT_EQ(gmmStreamMain(cols, nullptr, streamRewind, nullptr, nullptr, streamWrite, nullptr,
+                            nullptr),
+              -1);
+}
+
+TEST(GMMTests, RepeatedRowsCompressed)
+{
+    constexpr int numClusters = 3;
+    constexpr int rows = 3000;
+    constexpr int cols = 2;
+    std::vector<double> data(rows * cols);
+    std::vector<int> truth(rows);
+    std::default_random_engine generator(3);
+    std::normal_distribution<double> normalSampler(0.0, 1.0);
+    for (int row = 0; row < rows; ++row)
+    {
+        truth[row] = row % numClusters;
+        // Coarsely rounded values, as typically found in spreadsheets.
+        for (int col = 0; col < cols; ++col)
+            data[row * cols + col] =
+                std::round(truth[row] * (col ? 8.0 : -8.0) + normalSampler(generator));
+    }
+
+    std::vector<int> labels(rows);
+    std::vector<double> confidences(rows);
+    for (int fullGMM = 0; fullGMM < 2; ++fullGMM)
+    {
+        GMMOptions options;
+        gmmInitOptions(&options);
+        options.numClusters = numClusters;
+        options.fullGMM = fullGMM;
+        GMMStats stats;
+        ASSERT_EQ(gmmMainEx(data.data(), rows, cols, &options, labels.data(), confidences.data(),
+                            &stats),
+                  0);
+        EXPECT_GT(stats.uniqueRows, 0);
+        EXPECT_LT(stats.uniqueRows, rows / 2) << "fullGMM = " << fullGMM;
+
+        EXPECT_LT(mislabelledFraction(labels, truth, numClusters), 0.05)
+            << "fullGMM = " << fullGMM;
+
+        // Identical rows get identical results.
+        for (int row = 1; row < rows; ++row)
+        {
+            if (data[row * cols] == data[0] && data[row * cols + 1] == data[1])
+            {
+                EXPECT_EQ(labels[row], labels[0]);
+                EXPECT_DOUBLE_EQ(confidences[row], confidences[0]);
+            }
+        }
+    }
+}
+
+TEST(GMMTests, KDTreeAcceleratedEM)
+{
+    constexpr int numClusters = 3;
+    constexpr int rows = 20000;
+    constexpr int cols = 2;
+    std::vector<double> data(rows * cols);
+    std::vector<int> truth(rows);
+    std::default_random_engine generator(9);
+    std::normal_distribution<double> normalSampler(0.0, 1.0);
+    const double means[numClusters][cols]{ { 0.0, 0.0 }, { 7.0, 0.0 }, { 0.0, 7.0 } };
+    for (int row = 0; row < rows; ++row)
+    {
+        truth[row] = row % numClusters;
+        const double u = normalSampler(generator);
+        const double v = normalSampler(generator);
+        data[row * cols] = means[truth[row]][0] + u;
+        data[row * cols + 1] = means[truth[row]][1] + 0.8 * u + 0.6 * v;
+    }
+
+    std::vector<int> labels(rows);
+    std::vector<double> confidences(rows);
+    for (int fullGMM = 0; fullGMM < 2; ++fullGMM)
+    {
+        GMMOptions options;
+        gmmInitOptions(&options);
+        options.numClusters = numClusters;
+        options.numEpochs = 4;
+        options.fullGMM = fullGMM;
+        options.treeTolerance = 1e-3;
+        GMMStats stats;
+        ASSERT_EQ(gmmMainEx(data.data(), rows, cols, &options, labels.data(), confidences.data(),
+                            &stats),
+                  0);
+        EXPECT_EQ(stats.bestNumClusters, numClusters);
+
+        EXPECT_GT(*std::min_element(confidences.begin(), confidences.end()), 0.0);
+        EXPECT_LT(mislabelledFraction(labels, truth, numClusters), 0.05)
+            << "fullGMM = " << fullGMM;
+    }
+}
+
+TEST(GMMTests, FixedDimensionDispatch)
+{
+    // Covers the fixed size instantiations, the dynamic fallback and the d = 1 edge case.
+    constexpr int rows = 600;
+    for (int cols : { 1, 2, 3, 4, 6, 8, 9 })
+    {
+        std::vector<double> data(rows * cols);
+        std::default_random_engine generator(cols);
+        std::normal_distribution<double> normalSampler(0.0, 1.0);
+        for (int row = 0; row < rows; ++row)
+            for (int col = 0; col < cols; ++col)
+                data[row * cols + col] = (row % 2) * 10.0 + normalSampler(generator);
+
+        std::vector<int> labels(rows);
+        std::vector<double> confidences(rows);
+        GMMOptions options;
+        gmmInitOptions(&options);
+        options.numClusters = 2;
+        options.fullGMM = 1;
+        ASSERT_EQ(gmmMainEx(data.data(), rows, cols, &options, labels.data(), confidences.data(),
+                            nullptr),
+                  0);
+
+        int agree = 0;
+        for (int row = 0; row < rows; ++row)
+            agree += (labels[row] == labels[row % 2]);
+        EXPECT_GT(agree, rows * 95 / 100) << "cols = " << cols;
+    }
+}
+
+TEST(GMMTests, TruncatedResponsibilities)
+{
+    constexpr int numClusters = 10;
+    constexpr int rows = 2000;
+    constexpr int cols = 2;
+    std::vector<double> data(rows * cols);
+    std::vector<int> truth(rows);
+    std::default_random_engine generator(35);
+    std::normal_distribution<double> normalSampler(0.0, 1.0);
+    for (int row = 0; row < rows; ++row)
+    {
+        truth[row] = row % numClusters;
+        data[row * cols] = (truth[row] % 5) * 12.0 + normalSampler(generator);
+        data[row * cols + 1] = (truth[row] / 5) * 12.0 + normalSampler(generator);
+    }
+
+    std::vector<int> labels(rows);
+    std::vector<double> confidences(rows);
+    long long allocBytes[2]{};
+    for (int topK : { 0, 2 })
+    {
+        GMMOptions options;
+        gmmInitOptions(&options);
+        options.numClusters = numClusters;
+        options.numEpochs = 3;
+        options.numIterations = 30;
+        options.fullGMM = 1;
+        options.topK = topK;
+        options.seed = 35;
+        options.topKRefresh = 3;
+        GMMStats stats;
+        ASSERT_EQ(gmmMainEx(data.data(), rows, cols, &options, labels.data(), confidences.data(),
+                            &stats),
+                  0);
+        allocBytes[topK != 0] = stats.allocBytes;
+
+        EXPECT_GT(*std::min_element(confidences.begin(), confidences.end()), 0.0);
+        EXPECT_LE(*std::max_element(confidences.begin(), confidences.end()), 1.0);
+        EXPECT_LT(mislabelledFraction(labels, truth, numClusters), 0.2) << "topK = " << topK;
+    }
+
+    // The responsibility buffers shrink from c to K entries per row.
+    EXPECT_LT(allocBytes[1], allocBytes[0]);
+}
+
+TEST(GMMTests, VariationalClusterCount)
+{
+    // More clusters than the 2..5 search of the auto mode can find.
+    constexpr int numClusters = 7;
+    constexpr int rows = 2100;
+    constexpr int cols = 2;
+    std::vector<double> data(rows * cols);
+    std::vector<int> truth(rows);
+    std::default_random_engine generator(36);
+    std::normal_distribution<double> normalSampler(0.0, 1.0);
+    for (int row = 0; row < rows; ++row)
+    {
+        truth[row] = row % numClusters;
+        const double angle = truth[row] * 2.0 * M_PI / numClusters;
+        data[row * cols] = 15.0 * std::cos(angle) + normalSampler(generator);
+        data[row * cols + 1] = 15.0 * std::sin(angle) + normalSampler(generator);
+    }
+
+    std::vector<int> labels(rows);
+    std::vector<double> confidences(rows);
+    for (int fullGMM = 0; fullGMM < 2; ++fullGMM)
+    {
+        GMMOptions options;
+        gmmInitOptions(&options);
+        options.numClusters = 0;
+        options.fullGMM = fullGMM;
+        options.numEpochs = 3;
+        options.vbMaxClusters = 12;
+        options.seed = 36;
+        GMMStats stats;
+        ASSERT_EQ(gmmMainEx(data.data(), rows, cols, &options, labels.data(), confidences.data(),
+                            &stats),
+                  0);
+        EXPECT_EQ(stats.numCandidates, 1);
+        EXPECT_EQ(stats.bestNumClusters, numClusters) << "fullGMM = " << fullGMM;
+
+        EXPECT_GT(*std::min_element(confidences.begin(), confidences.end()), 0.0);
+        EXPECT_LT(mislabelledFraction(labels, truth, stats.bestNumClusters), 0.05)
+            << "fullGMM = " << fullGMM;
+    }
+}
+
+TEST(GMMTests, IncrementalOrderSearch)
+{
+    // Clusters on a 4 x 3 grid, found by splitting and merging up to 15 clusters.
+    constexpr int numClusters = 12;
+    constexpr int maxClusters = 15;
+    constexpr int rows = 6000;
+    constexpr int cols = 2;
+    std::vector<double> data(rows * cols);
+    std::vector<int> truth(rows);
+    std::default_random_engine generator(39);
+    std::normal_distribution<double> normalSampler(0.0, 1.0);
+    for (int row = 0; row < rows; ++row)
+    {
+        truth[row] = row % numClusters;
+        data[row * cols] = 10.0 * (truth[row] % 4) + normalSampler(generator);
+        data[row * cols + 1] = 10.0 * (truth[row] / 4) + normalSampler(generator);
+    }
+
+    std::vector<int> labels(rows);
+    std::vector<double> confidences(rows);
+    for (int fullGMM = 0; fullGMM < 2; ++fullGMM)
+    {
+        GMMOptions options;
+        gmmInitOptions(&options);
+        options.numClusters = 0;
+        options.fullGMM = fullGMM;
+        options.orderSearchMaxClusters = maxClusters;
+        GMMStats stats;
+        ASSERT_EQ(gmmMainEx(data.data(), rows, cols, &options, labels.data(), confidences.data(),
+                            &stats),
+                  0);
+        // One fit from scratch, then a split and a merge per larger count.
+        EXPECT_EQ(stats.numCandidates, 1 + 2 * (maxClusters - 2));
+        EXPECT_EQ(stats.bestNumClusters, numClusters) << "fullGMM = " << fullGMM;
+
+        EXPECT_GT(*std::min_element(confidences.begin(), confidences.end()), 0.0);
+        EXPECT_LT(mislabelledFraction(labels, truth, stats.bestNumClusters), 0.05)
+            << "fullGMM = " << fullGMM;
+    }
+}
+
+TEST(GMMTests, BatchOfJobs)
+{
+    // Jobs of varied sizes and cluster counts, plus an invalid one that must not spoil the rest.
+    constexpr int numJobs = 9;
+    constexpr int cols = 2;
+    std::default_random_engine generator(40);
+    std::normal_distribution<double> normalSampler(0.0, 1.0);
+    std::vector<std::vector<double>> data(numJobs);
+    std::vector<std::vector<int>> truth(numJobs);
+    std::vector<std::vector<int>> labels(numJobs);
+    std::vector<std::vector<double>> confidences(numJobs);
+    std::vector<GMMOptions> options(numJobs);
+    std::vector<GMMStats> stats(numJobs);
+    std::vector<GMMJob> jobs(numJobs);
+    for (int job = 0; job < numJobs; ++job)
+    {
+        const int numClusters = 2 + job % 2;
+        const int rows = 200 * (job + 1);
+        data[job].resize(rows * cols);
+        truth[job].resize(rows);
+        labels[job].resize(rows);
+        confidences[job].resize(rows);
+        for (int row = 0; row < rows; ++row)
+        {
+            truth[job][row] = row % numClusters;
+            data[job][row * cols] = 12.0 * truth[job][row] + normalSampler(generator);
+            data[job][row * cols + 1] = -7.0 * truth[job][row] + normalSampler(generator);
+        }
+
+        gmmInitOptions(&options[job]);
+        options[job].numClusters = numClusters;
+        options[job].fullGMM = (job / 2) % 2;
+        jobs[job] = GMMJob{ data[job].data(),      rows,        cols, &options[job],
+                            labels[job].data(), confidences[job].data(), &stats[job], 1 };
+    }
+    jobs[numJobs - 1].array = nullptr;
+
+    EXPECT_EQ(gmmBatchMain(jobs.data(), numJobs, 3), -1);
+    for (int job = 0; job < numJobs - 1; ++job)
+    {
+        ASSERT_EQ(jobs[job].status, 0) << "job = " << job;
+        EXPECT_EQ(stats[job].bestNumClusters, options[job].numClusters) << "job = " << job;
+        EXPECT_LT(mislabelledFraction(labels[job], truth[job], options[job].numClusters), 0.05)
+            << "job = " << job;
+    }
+    EXPECT_EQ(jobs[numJobs - 1].status, -1);
+}
+
+TEST(GMMTests, LabelRuns)
+{
+    constexpr int rows = 12;
+    constexpr int labels[rows] = { 1, 1, 0, 0, 0, -1, 1, 2, 2, -1, -1, 0 };
+    int runLabels[rows];
+    int runStarts[rows];
+    int runLengths[rows];
+    ASSERT_EQ(gmmLabelRuns(labels, rows, runLabels, runStarts, runLengths), 5);
+
+    // Ordered by label, then by first row, with the unlabelled rows left out.
+    constexpr int expectedLabels[] = { 0, 0, 1, 1, 2 };
+    constexpr int expectedStarts[] = { 2, 11, 0, 6, 7 };
+    constexpr int expectedLengths[] = { 3, 1, 2, 1, 2 };
+    for (int run = 0; run < 5; ++run)
+    {
+        EXPECT_EQ(runLabels[run], expectedLabels[run]) << "run = " << run;
+        EXPECT_EQ(runStarts[run], expectedStarts[run]) << "run = " << run;
+        EXPECT_EQ(runLengths[run], expectedLengths[run]) << "run = " << run;
+    }
+
+    EXPECT_EQ(gmmLabelRuns(labels, 0, runLabels, runStarts, runLengths), 0);
+    EXPECT_EQ(gmmLabelRuns(nullptr, rows, runLabels, runStarts, runLengths), -1);
+}
+
+TEST(GMMTests, CovarianceStructures)
+{
+    constexpr int numClusters = 3;
+    constexpr int rows = 3000;
+    constexpr int cols = 3;
+    std::vector<double> data(rows * cols);
+    std::vector<int> truth(rows);
+    std::default_random_engine generator(37);
+    std::normal_distribution<double> normalSampler(0.0, 1.0);
+    const double means[numClusters][cols]{ { 0.0, 0.0, 0.0 }, { 8.0, 0.0, 0.0 }, { 0.0, 8.0, 8.0 } };
+    for (int row = 0; row < rows; ++row)
+    {
+        truth[row] = row % numClusters;
+        // The same correlated noise in every cluster.
+        const double u = normalSampler(generator);
+        const double v = normalSampler(generator);
+        const double w = normalSampler(generator);
+        data[row * cols] = means[truth[row]][0] + u;
+        data[row * cols + 1] = means[truth[row]][1] + 0.6 * u + 0.8 * v;
+        data[row * cols + 2] = means[truth[row]][2] + w;
+    }
+
+    std::vector<int> labels(rows);
+    std::vector<double> confidences(rows);
+    for (int covariance : { CR_COVARIANCE_DIAGONAL, CR_COVARIANCE_FULL, CR_COVARIANCE_SPHERICAL,
+                            CR_COVARIANCE_TIED })
+    {
+        GMMOptions options;
+        gmmInitOptions(&options);
+        options.numClusters = numClusters;
+        options.fullGMM = covariance;
+        ASSERT_EQ(gmmMainEx(data.data(), rows, cols, &options, labels.data(), confidences.data(),
+                            nullptr),
+                  0);
+
+        EXPECT_GT(*std::min_element(confidences.begin(), confidences.end()), 0.0);
+        EXPECT_LT(mislabelledFraction(labels, truth, numClusters), 0.05)
+            << "covariance = " << covariance;
+    }
+}
+
+TEST(GMMTests, ScaleInvariance)
+{
+    constexpr int numClusters = 3;
+    constexpr int rows = 600;
+    constexpr int cols = 2;
+    std::vector<double> data(rows * cols);
+    std::default_random_engine generator(100);
+    std::normal_distribution<double> normalSampler(0.0, 1.0);
+    const double means[numClusters][cols]{ { 0.0, 0.0 }, { 10.0, 0.0 }, { 0.0, 10.0 } };
+    for (int row = 0; row < rows; ++row)
+        for (int col = 0; col < cols; ++col)
+            data[row * cols + col] = means[row % numClusters][col] + normalSampler(generator);
+
+    // With the same seed, scaling the input must not change the partition.
+    std::vector<int> labels(rows);
+    std::vector<int> scaledLabels(rows);
+    std::vector<double> confidences(rows);
+    std::vector<double> scaled(data.size());
+    for (int covariance : { CR_COVARIANCE_DIAGONAL, CR_COVARIANCE_FULL, CR_COVARIANCE_SPHERICAL,
+                            CR_COVARIANCE_TIED })
+    {
+        GMMOptions options;
+        gmmInitOptions(&options);
+        options.numClusters = numClusters;
+        options.fullGMM = covariance;
+        options.seed = 5;
+        ASSERT_EQ(gmmMainEx(data.data(), rows, cols, &options, labels.data(), confidences.data(),
+                            nullptr),
+                  0);
+        for (double scale : { 100.0, 1000.0 })
+        {
+            for (size_t idx = 0; idx < data.size(); ++idx)
+                scaled[idx] = data[idx] * scale;
+            ASSERT_EQ(gmmMainEx(scaled.data(), rows, cols, &options, scaledLabels.data(),
+                                confidences.data(), nullptr),
+                      0);
+            EXPECT_EQ(scaledLabels, labels)
+                << "covariance = " << covariance << " scale = " << scale;
+            for (int row = 0; row < rows; ++row)
+                ASSERT_TRUE(std::isfinite(confidences[row])) << " for row " << row;
+        }
+
+        int counts[numClusters]{};
+        for (int row = 0; row < rows; ++row)
+        {
+            ASSERT_GE(labels[row], 0);
+            ASSERT_LT(labels[row], numClusters);
+            ++counts[labels[row]];
+        }
+        for (int cluster = 0; cluster < numClusters; ++cluster)
+            EXPECT_EQ(counts[cluster], rows / numClusters) << "covariance = " << covariance;
+    }
+}
+
+TEST(GMMTests, PrincipalComponentsProjection)
+{
+    // Wide rows whose clusters live in a 3 dimensional subspace, plus a little noise elsewhere.
+    constexpr int numClusters = 3;
+    constexpr int rows = 3000;
+    constexpr int cols = 40;
+    constexpr int latent = 3;
+    std::default_random_engine generator(38);
+    std::normal_distribution<double> normalSampler(0.0, 1.0);
+    double mixing[latent][cols];
+    for (auto& axis : mixing)
+        for (double& value : axis)
+            value = normalSampler(generator);
+
+    std::vector<double> data(rows * cols);
+    std::vector<int> truth(rows);
+    for (int row = 0; row < rows; ++row)
+    {
+        truth[row] = row % numClusters;
+        double z[latent];
+        for (int dim = 0; dim < latent; ++dim)
+            z[dim] = (dim == truth[row] ? 6.0 : 0.0) + normalSampler(generator);
+        for (int col = 0; col < cols; ++col)
+        {
+            double value = 0.1 * normalSampler(generator);
+            for (int dim = 0; dim < latent; ++dim)
+                value += z[dim] * mixing[dim][col];
+            data[row * cols + col] = value;
+        }
+    }
+
+    std::vector<int> labels(rows);
+    std::vector<double> confidences(rows);
+    GMMOptions options;
+    gmmInitOptions(&options);
+    options.numClusters = numClusters;
+    options.fullGMM = 1;
+    options.pcaVariance = 0.9;
+    GMMStats stats;
+    ASSERT_EQ(
+        gmmMainEx(data.data(), rows, cols, &options, labels.data(), confidences.data(), &stats),
+        0);
+    EXPECT_GE(stats.pcaComponents, 1);
+    EXPECT_LE(stats.pcaComponents, latent);
+
+    EXPECT_LT(mislabelledFraction(labels, truth, numClusters), 0.05);
+
+    // Without the option nothing is projected.
+    options.pcaVariance = 0.0;
+    ASSERT_EQ(
+        gmmMainEx(data.data(), rows, cols, &options, labels.data(), confidences.data(), &stats),
+        0);
+    EXPECT_EQ(stats.pcaComponents, 0);
+}
+
+TEST(GMMTests, DegenerateClusterIsRegularized)
+{
+    // Half of the rows are the same point, so the covariance of its cluster is singular.
+    constexpr int rows = 100;
+    constexpr int cols = 2;
+    std::mt19937 generator(7);
+    std::normal_distribution<double> normal(0.0, 1.0);
+    std::vector<double> data(rows * cols);
+    for (int row = 0; row < rows; ++row)
+    {
+        for (int col = 0; col < cols; ++col)
+            data[row * cols + col] = row < rows / 2 ? 5.0 : normal(generator);
+    }
+
+    for (int fullGMM : { CR_COVARIANCE_DIAGONAL, CR_COVARIANCE_FULL, CR_COVARIANCE_SPHERICAL })
+    {
+        GMMOptions options;
+        gmmInitOptions(&options);
+        options.numClusters = 2;
+        options.fullGMM = fullGMM;
+        std::vector<int> labels(rows);
+        std::vector<double> confidences(rows);
+        GMMStats stats;
+        ASSERT_EQ(gmmMainEx(data.data(), rows, cols, &options, labels.data(), confidences.data(),
+                            &stats),
+                  0);
+        EXPECT_GT(stats.regularizedCovariances, 0) << "fullGMM = " << fullGMM;
+        EXPECT_GE(stats.reseededClusters, 0);
+
+        int together = 0;
+        for (int row = 0; row < rows; ++row)
+        {
+            ASSERT_TRUE(std::isfinite(confidences[row])) << "row " << row;
+            together += labels[row] == labels[0];
+        }
+        // The repeated point gets a cluster of its own.
+        EXPECT_GE(together, rows / 2) << "fullGMM = " << fullGMM;
+        EXPECT_LT(together, rows - rows / 4) << "fullGMM = " << fullGMM;
+    }
+    // Truncated EM reseeds too: with three distinct rows keeping two clusters each, at least two
+    // of eight clusters are in no kept list.
+    for (int row = 0; row < rows; ++row)
+        for (int col = 0; col < cols; ++col)
+            data[row * cols + col] = (row % 3) * 10.0 + col;
+    GMMOptions options;
+    gmmInitOptions(&options);
+    options.numClusters = 8;
+    options.topK = 2;
+    options.seed = 46;
+    std::vector<int> labels(rows);
+    std::vector<double> confidences(rows);
+    GMMStats stats;
+    ASSERT_EQ(
+        gmmMainEx(data.data(), rows, cols, &options, labels.data(), confidences.data(), &stats),
+        0);
+    EXPECT_GT(stats.reseededClusters, 0);
+    for (int row = 0; row < rows; ++row)
+    {
+        ASSERT_TRUE(std::isfinite(confidences[row])) << "row " << row;
+        EXPECT_EQ(labels[row], labels[row % 3]) << "row " << row;
+    }
+}
+
+TEST(GMMTests, PlannerPicksStrategy)
+{
+    constexpr int numClusters = 2;
+    constexpr int rows = 20000;
+    constexpr int cols = 2;
+    std::vector<double> data(rows * cols);
+    std::default_random_engine generator(47);
+    std::normal_distribution<double> normalSampler(0.0, 1.0);
+    for (int row = 0; row < rows; ++row)
+    {
+        data[row * cols] = (row % numClusters) * 10.0 + normalSampler(generator);
+        data[row * cols + 1] = normalSampler(generator);
+    }
+
+    GMMOptions options;
+    gmmInitOptions(&options);
+    options.numClusters = numClusters;
+    options.numEpochs = 4;
+    options.autoPlan = 1;
+    std::vector<int> labels(rows);
+    std::vector<double> confidences(rows);
+    GMMStats stats;
+
+    // Many rows with few columns take the kd-tree.
+    ASSERT_EQ(
+        gmmMainEx(data.data(), rows, cols, &options, labels.data(), confidences.data(), &stats),
+        0);
+    EXPECT_EQ(stats.planStrategy, CR_STRATEGY_TREE);
+    EXPECT_GT(stats.planEstimatedMs, 0.0);
+    EXPECT_GT(stats.planEstimatedMB, 0.0);
+
+    // The in-memory engines need about a MB, under a smaller cap the rows are streamed.
+    options.maxMemoryMB = 0.25;
+    ASSERT_EQ(
+        gmmMainEx(data.data(), rows, cols, &options, labels.data(), confidences.data(), &stats),
+        0);
+    EXPECT_EQ(stats.planStrategy, CR_STRATEGY_STREAMING);
+    EXPECT_LE(stats.planEstimatedMB, options.maxMemoryMB);
+    EXPECT_EQ(stats.bestNumClusters, numClusters);
+    for (int row = 0; row < rows; ++row)
+    {
+        ASSERT_GE(labels[row], 0);
+        ASSERT_LT(labels[row], numClusters);
+    }
+
+    // The kd-tree and streaming engines cannot fit spherical or tied covariances.
+    for (int covariance : { CR_COVARIANCE_SPHERICAL, CR_COVARIANCE_TIED })
+    {
+        options.fullGMM = covariance;
+        for (double maxMemoryMB : { 0.0, 0.25 })
+        {
+            options.maxMemoryMB = maxMemoryMB;
+            ASSERT_EQ(gmmMainEx(data.data(), rows, cols, &options, labels.data(),
+                                confidences.data(), &stats),
+                      0);
+            EXPECT_EQ(stats.planStrategy, CR_STRATEGY_DENSE) << "covariance = " << covariance;
+        }
+    }
+    options.fullGMM = CR_COVARIANCE_DIAGONAL;
+
+    // A tight time budget cuts the epochs.
+    options.maxMemoryMB = 0.0;
+    options.timeBudgetMs = 1e-3;
+    ASSERT_EQ(
+        gmmMainEx(data.data(), rows, cols, &options, labels.data(), confidences.data(), &stats),
+        0);
+    EXPECT_EQ(stats.totalEpochs, 1);
+
+    // Without the planner nothing is reported.
+    options.autoPlan = 0;
+    ASSERT_EQ(
+        gmmMainEx(data.data(), rows, cols, &options, labels.data(), confidences.data(), &stats),
+        0);
+    EXPECT_EQ(stats.planStrategy, CR_STRATEGY_NONE);
+}
+
+TEST(GMMTests, HardwareCountersPerPhase)
+{
+    constexpr int rows = 2000;
+    constexpr int cols = 3;
+    std::vector<double> data(rows * cols);
+    std::default_random_engine generator(48);
+    std::normal_distribution<double> normalSampler(0.0, 1.0);
+    for (int row = 0; row < rows; ++row)
+        for (int col = 0; col < cols; ++col)
+            data[row * cols + col] = (row % 2) * 8.0 + normalSampler(generator);
+
+    GMMOptions options;
+    gmmInitOptions(&options);
+    options.numClusters = 2;
+    std::vector<int> labels(rows);
+    std::vector<double> confidences(rows);
+    GMMStats stats;
+    ASSERT_EQ(
+        gmmMainEx(data.data(), rows, cols, &options, labels.data(), confidences.data(), &stats),
+        0);
+    EXPECT_EQ(stats.perfStatus, 0);
+    EXPECT_EQ(stats.perfCycles[CR_PHASE_ESTEP], 0);
+
+    // Counting may not be permitted (e.g. in containers), the run must succeed either way.
+    options.perfCounters = 1;
+    ASSERT_EQ(
+        gmmMainEx(data.data(), rows, cols, &options, labels.data(), confidences.data(), &stats),
+        0);
+    EXPECT_EQ(stats.bestNumClusters, 2);
+    if (stats.perfStatus < 0)
+    {
+        for (int phase = 0; phase < CR_NUM_PHASES; ++phase)
+        {
+            EXPECT_EQ(stats.perfCycles[phase], -1);
+            EXPECT_EQ(stats.perfInstructions[phase], -1);
+            EXPECT_EQ(stats.perfCacheMisses[phase], -1);
+            EXPECT_EQ(stats.perfBranchMisses[phase], -1);
+        }
+        GTEST_SKIP() << "hardware performance counters are not permitted";
+    }
+
+    ASSERT_EQ(stats.perfStatus, 1);
+    if (stats.perfCycles[CR_PHASE_ESTEP] >= 0)
+    {
+        EXPECT_GT(stats.perfCycles[CR_PHASE_ESTEP], 0);
+    }
+    if (stats.perfInstructions[CR_PHASE_ESTEP] >= 0)
+    {
+        EXPECT_GT(stats.perfInstructions[CR_PHASE_ESTEP], rows);
+    }
+    // No candidate scoring without an order search.
+    EXPECT_LE(stats.perfCycles[CR_PHASE_SELECT], 0);
+}
+
+/// Fraction of the rows whose label differs from the one most of their true cluster got.
+TEST(GMMTests, IngestionSkipsNonFiniteRows)
+{
+    constexpr int numClusters = 2;
+    // Enough cells for the ingestion to run in parallel blocks.
+    constexpr int rows = 40000;
+    constexpr int cols = 8;
+    std::vector<double> data(rows * cols);
+    std::vector<int> truth(rows);
+    std::default_random_engine generator(49);
+    std::normal_distribution<double> normalSampler(0.0, 1.0);
+    for (int row = 0; row < rows; ++row)
+    {
+        truth[row] = row % numClusters;
+        for (int col = 0; col < cols; ++col)
+            data[row * cols + col] = truth[row] * 8.0 + normalSampler(generator);
+        // A column on a much larger scale.
+        data[row * cols + cols - 1] *= 1000.0;
+    }
+    int invalid = 0;
+    for (int row = 5; row < rows; row += 97, ++invalid)
+        data[row * cols + row % cols] = (row % 3) ? std::nan("") : -HUGE_VAL;
+
+    GMMOptions options;
+    gmmInitOptions(&options);
+    options.numClusters = numClusters;
+    options.seed = 49;
+    std::vector<int> labels(rows);
+    std::vector<int> rawLabels;
+    std::vector<double> confidences(rows);
+    GMMStats stats;
+    for (int normalize = 0; normalize < 2; ++normalize)
+    {
+        options.normalize = normalize;
+        ASSERT_EQ(
+            gmmMainEx(data.data(), rows, cols, &options, labels.data(), confidences.data(), &stats),
+            0);
+        EXPECT_EQ(stats.invalidRows, invalid);
+        for (int row = 0; row < rows; ++row)
+        {
+            if ((row - 5) % 97 == 0 && row >= 5)
+            {
+                ASSERT_EQ(labels[row], -1) << "row " << row;
+                ASSERT_EQ(confidences[row], 0.0);
+            }
+            else
+            {
+                ASSERT_GE(labels[row], 0) << "row " << row;
+                ASSERT_LT(labels[row], numClusters);
+            }
+        }
+        EXPECT_LT(mislabelledFraction(labels, truth, numClusters, true), 0.01)
+            << "normalize " << normalize;
+        // The initial covariances follow the column variances, so standardizing the columns
+        // does not change the partition.
+        if (normalize)
+            EXPECT_EQ(labels, rawLabels);
+        else
+            rawLabels = labels;
+    }
+
+    // Too few valid rows to cluster.
+    std::vector<double> small(12 * cols, std::nan(""));
+    std::fill(small.begin(), small.begin() + 5 * cols, 1.0);
+    ASSERT_EQ(
+        gmmMainEx(small.data(), 12, cols, &options, labels.data(), confidences.data(), &stats), 0);
+    EXPECT_EQ(stats.invalidRows, 7);
+    for (int row = 0; row < 12; ++row)
+        EXPECT_EQ(labels[row], -1);
+}
+
+TEST(GMMTests, DensityBasedRings)
+{
+    // Two concentric rings, which no mixture of Gaussians separates, and far outliers.
+    constexpr int ringRows = 3000;
+    constexpr int outliers = 4;
+    constexpr int rows = 2 * ringRows + outliers + 1;
+    constexpr int cols = 2;
+    std::vector<double> data(rows * cols);
+    std::vector<int> truth(rows, -1);
+    std::default_random_engine generator(50);
+    std::uniform_real_distribution<double> angleSampler(0.0, 2 * M_PI);
+    std::normal_distribution<double> noiseSampler(0.0, 0.1);
+    for (int row = 0; row < 2 * ringRows; ++row)
+    {
+        truth[row] = row % 2;
+        const double radius = truth[row] ? 5.0 : 1.0;
+        const double angle = angleSampler(generator);
+        data[row * cols] = radius * std::cos(angle) + noiseSampler(generator);
+        data[row * cols + 1] = radius * std::sin(angle) + noiseSampler(generator);
+    }
+    for (int idx = 0; idx < outliers; ++idx)
+    {
+        data[(2 * ringRows + idx) * cols] = 20.0 * (idx % 2 ? 1 : -1);
+        data[(2 * ringRows + idx) * cols + 1] = 20.0 * (idx / 2 ? 1 : -1);
+    }
+    data[(rows - 1) * cols] = std::nan("");
+
+    std::vector<int> labels(rows);
+    std::vector<double> confidences(rows);
+    EXPECT_EQ(dbscanMain(data.data(), rows, 9, 0.5, 0, labels.data(), confidences.data()), -1);
+    EXPECT_EQ(dbscanMain(nullptr, rows, cols, 0.5, 0, labels.data(), confidences.data()), -1);
+
+    // Given and estimated radius.
+    for (double eps : { 0.5, 0.0 })
+    {
+        ASSERT_EQ(
+            dbscanMain(data.data(), rows, cols, eps, 0, labels.data(), confidences.data()), 2)
+            << "eps " << eps;
+        EXPECT_EQ(mislabelledFraction(labels, truth, 2, true), 0.0);
+        int noise = 0;
+        for (int row = 0; row < 2 * ringRows; ++row)
+        {
+            noise += labels[row] < 0;
+            ASSERT_GE(confidences[row], 0.0);
+            ASSERT_LE(confidences[row], 1.0);
+        }
+        EXPECT_LT(noise, ringRows / 100);
+        // Labels follow the first row of each cluster.
+        EXPECT_EQ(labels[0], 0);
+        for (int row = 2 * ringRows; row < rows; ++row)
+        {
+            EXPECT_EQ(labels[row], -1);
+            EXPECT_EQ(confidences[row], 0.0);
+        }
+    }
+}
@@ -19,8 +19,13 @@
 #include <gtest/gtest.h>
 #include <matrix.hxx>
 #include <diagonal.hxx>
+#include <factorize.hxx>
+#include <kernels.hxx>
 #include <svd.hxx>
+#include <threadpool.hxx>
+#include <atomic>
 #include <cmath>
+#include <vector>
 
 TEST(UtilTests, MatrixMoveConstructor)
 {
@@ -275,3 +280,241 @@ TEST(UtilTests, MatrixDeterminant)
 
     EXPECT_EQ(factors.determinant(), 30.0);
 }
+
+TEST(UtilTests, MatrixDeterminantLU)
+{
+    constexpr int rows = 3;
+    constexpr int cols = 3;
+    constexpr double matA[rows][cols] = { { 0, 2, 0 }, { 0, 0, 3 }, { 5, 0, 0 } };
+    constexpr double matB[rows][cols] = { { 0, 2, 0 }, { 3, 0, 0 }, { 0, 0, 5 } };
+
+    util::Matrix mA(rows, cols, reinterpret_cast<const double*>(matA));
+    util::Matrix mB(rows, cols, reinterpret_cast<const double*>(matB));
+    EXPECT_NEAR(mA.determinant(), 30.0, 1e-12);
+    EXPECT_NEAR(mB.determinant(), -30.0, 1e-12);
+    EXPECT_NEAR(mB.log_determinant(), std::log(30.0), 1e-12);
+}
+
+TEST(UtilTests, Factorizations)
+{
+    constexpr int size = 5;
+    constexpr int rhs = 2;
+    util::Matrix mA(size, size);
+    util::Matrix mSPD(size, size);
+    util::Matrix mB(size, rhs);
+    for (int row = 0; row < size; ++row)
+    {
+        for (int col = 0; col < size; ++col)
+            mA.at(row, col)
+                = std::sin(1.0 + row * 1.7 + col * col * 0.9) + (row == col ? 2.0 : 0.0);
+        for (int col = 0; col < rhs; ++col)
+            mB.at(row, col) = std::cos(row * 0.3 + col);
+    }
+    for (int row = 0; row < size; ++row)
+    {
+        for (int col = 0; col < size; ++col)
+        {
+            double val = (row == col) ? 1.0 : 0.0;
+            for (int k = 0; k < size; ++k)
+                val += mA.at(k, row) * mA.at(k, col);
+            mSPD.at(row, col) = val;
+        }
+    }
+
+    util::Matrix mI(size, size);
+    mI.set_identity();
+    const double logdet = std::log(std::abs(mA.determinant()));
+
+    {
+        util::Matrix factors(mA);
+        int pivots[size];
+        const util::LU lu(factors, pivots);
+        ASSERT_FALSE(lu.is_singular());
+        util::Matrix mX(mB);
+        lu.solve(mX);
+        EXPECT_EQ(mA.dot(mX), mB);
+        util::Matrix inverse(size, size);
+        lu.inverse(inverse);
+        EXPECT_EQ(mA.dot(inverse), mI);
+        EXPECT_NEAR(lu.log_determinant(), logdet, 1e-9);
+    }
+    {
+        util::Matrix factors(mA);
+        double tau[size];
+        const util::QR qr(factors, tau);
+        ASSERT_FALSE(qr.is_rank_deficient());
+        util::Matrix mX(mB);
+        qr.solve(mX);
+        EXPECT_EQ(mA.dot(mX), mB);
+        util::Matrix inverse(size, size);
+        qr.inverse(inverse);
+        EXPECT_EQ(inverse.dot(mA), mI);
+        EXPECT_NEAR(qr.log_determinant(), logdet, 1e-9);
+    }
+    {
+        util::Matrix factors(mSPD);
+        const util::Cholesky cholesky(factors);
+        ASSERT_TRUE(cholesky.is_positive_definite());
+        EXPECT_EQ(factors.dot_transpose(factors), mSPD);
+        util::Matrix mX(mB);
+        cholesky.solve(mX);
+        EXPECT_EQ(mSPD.dot(mX), mB);
+        util::Matrix inverse(size, size);
+        cholesky.inverse(inverse);
+        EXPECT_EQ(mSPD.dot(inverse), mI);
+        EXPECT_NEAR(cholesky.log_determinant(), mSPD.log_determinant(), 1e-9);
+    }
+
+    util::Matrix singular(mA);
+    for (int col = 0; col < size; ++col)
+        singular.at(2, col) = singular.at(0, col);
+    int pivots[size];
+    EXPECT_TRUE(util::LU(singular, pivots).is_singular());
+    EXPECT_THROW((void)util::Matrix(size, size).inverse(), std::runtime_error);
+}
+
+TEST(UtilTests, MatrixBlockedMultiplication)
+{
+    // Sizes that are not multiples of the register tile and span several cache blocks.
+    constexpr int rows = 67;
+    constexpr int inner = 301;
+    constexpr int cols = 517;
+    util::Matrix mA(rows, inner);
+    util::Matrix mB(inner, cols);
+    util::Matrix mBT(cols, inner);
+    for (int row = 0; row < rows; ++row)
+        for (int col = 0; col < inner; ++col)
+            mA.at(row, col) = std::sin(row * 0.37 + col * 0.11);
+    for (int row = 0; row < inner; ++row)
+    {
+        for (int col = 0; col < cols; ++col)
+        {
+            mB.at(row, col) = std::cos(row * 0.23 - col * 0.07);
+            mBT.at(col, row) = mB.at(row, col);
+        }
+    }
+
+    util::Matrix expected(rows, cols);
+    for (int row = 0; row < rows; ++row)
+    {
+        for (int col = 0; col < cols; ++col)
+        {
+            double val = 0;
+            for (int k = 0; k < inner; ++k)
+                val += mA.at(row, k) * mB.at(k, col);
+            expected.at(row, col) = val;
+        }
+    }
+
+    EXPECT_EQ(mA.dot(mB), expected);
+    EXPECT_EQ(mA.dot_transpose(mBT), expected);
+}
+
+TEST(UtilTests, KernelsAgreeAcrossIsa)
+{
+    using util::kernels::Isa;
+    // Sample and column counts that leave partial sample blocks and register tiles.
+    constexpr int m = 29;
+    constexpr int n = 11;
+    std::vector<double> X(m * n), mu(n), inv_var(n), P(n * n), w(m);
+    for (int row = 0; row < m; ++row)
+    {
+        w[row] = 0.25 + (row % 3);
+        for (int col = 0; col < n; ++col)
+            X[row * n + col] = std::sin(row * 0.31 + col * 0.17);
+    }
+    for (int a = 0; a < n; ++a)
+    {
+        mu[a] = std::cos(a * 0.5);
+        inv_var[a] = 1.0 + 0.1 * a;
+        for (int b = 0; b < n; ++b)
+            P[a * n + b] = (a == b ? 2.0 : 0.1 / (1 + a + b));
+    }
+
+    std::vector<double> diag(m), full(m), scatter(n * n, 0.0), sq_dev(n, 0.0);
+    for (int row = 0; row < m; ++row)
+    {
+        for (int a = 0; a < n; ++a)
+        {
+            const double da = X[row * n + a] - mu[a];
+            diag[row] += da * da * inv_var[a];
+            sq_dev[a] += w[row] * da * da;
+            for (int b = 0; b < n; ++b)
+            {
+                const double db = X[row * n + b] - mu[b];
+                full[row] += da * P[a * n + b] * db;
+                scatter[a * n + b] += w[row] * da * db;
+            }
+        }
+    }
+
+    const Isa initial = util::kernels::active_isa();
+    for (Isa isa : { Isa::GENERIC, Isa::AVX2, Isa::AVX512 })
+    {
+        if (!util::kernels::select_isa(isa))
+        {
+            EXPECT_GT(isa, util::kernels::best_isa());
+            continue;
+        }
+        EXPECT_EQ(util::kernels::active_isa(), isa);
+        SCOPED_TRACE(util::kernels::isa_name(isa));
+
+        std::vector<double> out(2 * m, -1.0);
+        util::kernels::sq_mahalanobis_diag(m, n, X.data(), n, mu.data(), inv_var.data(),
+                                           out.data(), 2);
+        for (int row = 0; row < m; ++row)
+            EXPECT_NEAR(out[2 * row], diag[row], 1e-12);
+        EXPECT_EQ(out[1], -1.0);
+
+        util::kernels::sq_mahalanobis_full(m, n, X.data(), n, mu.data(), P.data(), n, out.data(),
+                                           1);
+        for (int row = 0; row < m; ++row)
+            EXPECT_NEAR(out[row], full[row], 1e-12);
+
+        std::vector<double> S(n * n, 0.0), v(n, 0.0);
+        util::kernels::weighted_scatter(m, n, X.data(), n, mu.data(), w.data(), S.data(), n);
+        util::kernels::weighted_sq_dev(m, n, X.data(), n, mu.data(), w.data(), v.data());
+        for (int a = 0; a < n; ++a)
+        {
+            EXPECT_NEAR(v[a], sq_dev[a], 1e-12);
+            for (int b = 0; b < n; ++b)
+                EXPECT_NEAR(S[a * n + b], scatter[a * n + b], 1e-12);
+        }
+
+        std::vector<double> C(m * m);
+        util::kernels::gemm(m, m, n, X.data(), n, X.data(), n, true, C.data(), m);
+        for (int row = 0; row < m; ++row)
+        {
+            for (int col = 0; col < m; ++col)
+            {
+                double dot = 0.0;
+                for (int k = 0; k < n; ++k)
+                    dot += X[row * n + k] * X[col * n + k];
+                EXPECT_NEAR(C[row * m + col], dot, 1e-12);
+            }
+        }
+    }
+    EXPECT_TRUE(util::kernels::select_isa(initial));
+}
+
+TEST(UtilTests, ThreadPoolRunsEveryIndexOnce)
+{
+    util::ThreadPool pool(4);
+    EXPECT_EQ(pool.threads(), 4);
+    for (int round = 0; round < 3; ++round)
+    {
+        constexpr int count = 1000;
+        std::vector<std::atomic<int>> calls(count);
+        std::vector<std::atomic<int>> running(pool.threads());
+        std::atomic<bool> shared_thread{ false };
+        pool.parallel_for(count, [&](int index, int thread) {
+            if (running[thread]++ != 0)
+                shared_thread = true;
+            ++calls[index];
+            --running[thread];
+        });
+        EXPECT_FALSE(shared_thread);
+        for (int index = 0; index < count; ++index)
+            ASSERT_EQ(calls[index], 1) << "index = " << index;
+    }
+}
@@ -0,0 +1,710 @@
+/*
+ * ClusterRows
+ * Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// crcluster : command line front end of the clustering engine.
+//
+// Input is either a raw little endian matrix of doubles in row major order (needs --cols) which
+// is memory mapped and handed to the engine without a copy, or a CSV file which is memory mapped
+// and parsed by several threads. Output is either CSV ("label,confidence" per row) or binary
+// packed records of { int32 label; float64 confidence; }.
+
+#include <em.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+enum class Format
+{
+    AUTO,
+    BINARY,
+    CSV
+};
+
+struct CliOptions
+{
+    std::string input;
+    std::string output;
+    Format inputFormat = Format::AUTO;
+    Format outputFormat = Format::AUTO;
+    int cols = 0;
+    bool header = false;
+    int threads = 0;
+    bool stream = false;
+    bool printStats = false;
+    GMMOptions engine;
+};
+
+void usage(const char* program)
+{
+    std::fprintf(
+        stderr,
+        "Usage: %s [options] <input> <output>\n"
+        "\n"
+        "Clusters the rows of <input> and writes a label and confidence per row to <output>.\n"
+        "The format of a file is taken from its extension (.csv or anything else for binary)\n"
+        "unless given explicitly.\n"
+        "\n"
+        "Input options:\n"
+        "  --input-format bin|csv   raw row major float64 matrix or comma separated values\n"
+        "  --cols N                 number of columns of a binary input (required for binary)\n"
+        "  --header                 skip the first line of a CSV input\n"
+        "  --threads N              CSV parser threads (default: hardware concurrency)\n"
+        "\n"
+        "Engine options:\n"
+        "  -k, --clusters N         number of clusters, 0 to choose automatically (default 0)\n"
+        "  --epochs N               number of random restarts (default 10)\n"
+        "  --iterations N           maximum EM iterations per epoch (default 100)\n"
+        "  --full                   full covariance GMM instead of diagonal\n"
+        "  --covariance TYPE        diag, full, spherical or tied (one matrix for all clusters)\n"
+        "  --stream                 out-of-core fitting, one pass over the input per iteration\n"
+        "  --chunk-rows N           rows per chunk in --stream mode (default 65536)\n"
+        "  --tree-tolerance T       kd-tree accelerated EM for up to 6 columns, T is the allowed\n"
+        "                           responsibility variation within a tree node (0 disables)\n"
+        "  --top-k K                truncated EM keeping the K most responsible clusters per row\n"
+        "                           (0 keeps all, default)\n"
+        "  --top-k-refresh N        re-evaluate all clusters every N iterations (default 5)\n"
+        "  --vb-max-clusters N      without -k: one variational Bayes fit with at most N\n"
+        "                           clusters instead of trying 2..5\n"
+        "  --vb-concentration A     Dirichlet prior of the mixing weights (default 0.001)\n"
+        "  --pca-variance F         cluster the principal components explaining the fraction F\n"
+        "                           of the variance, for wide inputs (0 disables, default)\n"
+        "  --order-search N         without -k: grow from 2 to N clusters by splitting and\n"
+        "                           merging clusters, picking the count by BIC\n"
+        "  --auto-plan              pick the engine strategy from the input shape and the\n"
+        "                           resources, overriding the tree, top-k and PCA options\n"
+        "  --max-memory MB          with --auto-plan: memory cap of the engine\n"
+        "  --time-budget MS         with --auto-plan: run time to aim for, by cheaper strategies\n"
+        "                           and fewer epochs\n"
+        "  --normalize              standardize the columns to zero mean and unit variance\n"
+        "  --seed N                 seed of the random cluster seeds, for repeatable runs\n"
+        "                           (0 seeds from the clock, default)\n"
+        "\n"
+        "Output options:\n"
+        "  --output-format bin|csv  packed {int32 label, float64 confidence} records or CSV\n"
+        "  --stats                  print timings and counters to stderr\n"
+        "  --perf-counters          with --stats: also print hardware counters per phase\n"
+        "                           (cycles, instructions, cache and branch misses)\n",
+        program);
+}
+
+bool parseFormat(const char* text, Format& format)
+{
+    if (!std::strcmp(text, "bin"))
+        format = Format::BINARY;
+    else if (!std::strcmp(text, "csv"))
+        format = Format::CSV;
+    else
+        return false;
+    return true;
+}
+
+bool parseCovariance(const char* text, int& covariance)
+{
+    if (!std::strcmp(text, "diag"))
+        covariance = CR_COVARIANCE_DIAGONAL;
+    else if (!std::strcmp(text, "full"))
+        covariance = CR_COVARIANCE_FULL;
+    else if (!std::strcmp(text, "spherical"))
+        covariance = CR_COVARIANCE_SPHERICAL;
+    else if (!std::strcmp(text, "tied"))
+        covariance = CR_COVARIANCE_TIED;
+    else
+        return false;
+    return true;
+}
+
+template <typename T> bool parseNumber(const char* text, T& value)
+{
+    const char* end = text + std::strlen(text);
+    auto [ptr, ec] = std::from_chars(text, end, value);
+    return ec == std::errc() && ptr == end;
+}
+
+Format formatFromPath(const std::string& path)
+{
+    const std::string_view ext(".csv");
+    if (path.size() >= ext.size() && path.compare(path.size() - ext.size(), ext.size(), ext) == 0)
+        return Format::CSV;
+    return Format::BINARY;
+}
+
+bool parseArgs(int argc, char** argv, CliOptions& opts)
+{
+    gmmInitOptions(&opts.engine);
+    std::vector<const char*> positional;
+    for (int idx = 1; idx < argc; ++idx)
+    {
+        const std::string_view arg(argv[idx]);
+        const bool hasValue = idx + 1 < argc;
+        bool ok = true;
+        if (arg == "-h" || arg == "--help")
+            return false;
+        else if (arg == "--header")
+            opts.header = true;
+        else if (arg == "--full")
+            opts.engine.fullGMM = 1;
+        else if (arg == "--stream")
+            opts.stream = true;
+        else if (arg == "--stats")
+            opts.printStats = true;
+        else if (arg == "--perf-counters")
+            opts.engine.perfCounters = 1;
+        else if (arg == "--auto-plan")
+            opts.engine.autoPlan = 1;
+        else if (arg == "--normalize")
+            opts.engine.normalize = 1;
+        else if (!arg.starts_with("-") || arg == "-")
+            positional.push_back(argv[idx]);
+        else if (!hasValue)
+            ok = false;
+        else if (arg == "--input-format")
+            ok = parseFormat(argv[++idx], opts.inputFormat);
+        else if (arg == "--output-format")
+            ok = parseFormat(argv[++idx], opts.outputFormat);
+        else if (arg == "--covariance")
+            ok = parseCovariance(argv[++idx], opts.engine.fullGMM);
+        else if (arg == "--cols")
+            ok = parseNumber(argv[++idx], opts.cols) && opts.cols > 0;
+        else if (arg == "--threads")
+            ok = parseNumber(argv[++idx], opts.threads) && opts.threads >= 0;
+        else if (arg == "-k" || arg == "--clusters")
+            ok = parseNumber(argv[++idx], opts.engine.numClusters) && opts.engine.numClusters >= 0;
+        else if (arg == "--epochs")
+            ok = parseNumber(argv[++idx], opts.engine.numEpochs) && opts.engine.numEpochs > 0;
+        else if (arg == "--iterations")
+            ok = parseNumber(argv[++idx], opts.engine.numIterations)
+                 && opts.engine.numIterations > 0;
+        else if (arg == "--chunk-rows")
+            ok = parseNumber(argv[++idx], opts.engine.chunkRows) && opts.engine.chunkRows > 0;
+        else if (arg == "--tree-tolerance")
+            ok = parseNumber(argv[++idx], opts.engine.treeTolerance)
+                 && opts.engine.treeTolerance >= 0.0;
+        else if (arg == "--top-k")
+            ok = parseNumber(argv[++idx], opts.engine.topK) && opts.engine.topK >= 0;
+        else if (arg == "--top-k-refresh")
+            ok = parseNumber(argv[++idx], opts.engine.topKRefresh) && opts.engine.topKRefresh > 0;
+        else if (arg == "--vb-max-clusters")
+            ok = parseNumber(argv[++idx], opts.engine.vbMaxClusters)
+                 && opts.engine.vbMaxClusters >= 0;
+        else if (arg == "--pca-variance")
+            ok = parseNumber(argv[++idx], opts.engine.pcaVariance)
+                 && opts.engine.pcaVariance >= 0.0 && opts.engine.pcaVariance <= 1.0;
+        else if (arg == "--order-search")
+            ok = parseNumber(argv[++idx], opts.engine.orderSearchMaxClusters)
+                 && opts.engine.orderSearchMaxClusters >= 0;
+        else if (arg == "--max-memory")
+            ok = parseNumber(argv[++idx], opts.engine.maxMemoryMB)
+                 && opts.engine.maxMemoryMB >= 0.0;
+        else if (arg == "--time-budget")
+            ok = parseNumber(argv[++idx], opts.engine.timeBudgetMs)
+                 && opts.engine.timeBudgetMs >= 0.0;
+        else if (arg == "--seed")
+            ok = parseNumber(argv[++idx], opts.engine.seed);
+        else if (arg == "--vb-concentration")
+            ok = parseNumber(argv[++idx], opts.engine.vbConcentration)
+                 && opts.engine.vbConcentration > 0.0;
+        else
+            ok = false;
+
+        if (!ok)
+        {
+            std::fprintf(stderr, "crcluster: invalid argument '%s'\n", argv[idx]);
+            return false;
+        }
+    }
+
+    if (positional.size() != 2)
+        return false;
+
+    opts.input = positional[0];
+    opts.output = positional[1];
+    if (opts.inputFormat == Format::AUTO)
+        opts.inputFormat = formatFromPath(opts.input);
+    if (opts.outputFormat == Format::AUTO)
+        opts.outputFormat = formatFromPath(opts.output);
+    if (opts.inputFormat == Format::BINARY && opts.cols <= 0)
+    {
+        std::fprintf(stderr, "crcluster: --cols is required for binary input\n");
+        return false;
+    }
+    if (opts.threads == 0)
+        opts.threads = std::max(1u, std::thread::hardware_concurrency());
+
+    return true;
+}
+
+/// @brief Read only memory mapping of a whole file.
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string& path)
+    {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+
+        struct stat info;
+        if (::fstat(fd, &info) == 0)
+        {
+            // An empty file is valid but cannot be mapped.
+            empty = info.st_size == 0;
+            void* addr = empty ? MAP_FAILED
+                               : ::mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED)
+            {
+                base = static_cast<const char*>(addr);
+                length = info.st_size;
+                ::madvise(addr, length, MADV_SEQUENTIAL);
+            }
+        }
+        ::close(fd);
+    }
+
+    ~MappedFile()
+    {
+        if (base)
+            ::munmap(const_cast<char*>(base), length);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    [[nodiscard]] bool valid() const { return base || empty; }
+    [[nodiscard]] const char* begin() const { return base; }
+    [[nodiscard]] const char* end() const { return base + length; }
+    [[nodiscard]] size_t size() const { return length; }
+
+private:
+    const char* base = nullptr;
+    size_t length = 0;
+    bool empty = false;
+};
+
+const char* nextLine(const char* pos, const char* end)
+{
+    const char* eol = static_cast<const char*>(std::memchr(pos, '\n', end - pos));
+    return eol ? eol + 1 : end;
+}
+
+/// @brief Parses one CSV line into @p out.
+/// @return number of fields parsed or -1 if a field is not a number.
+int parseCsvLine(const char* pos, const char* end, double* out, int maxFields)
+{
+    while (end > pos && (end[-1] == '\n' || end[-1] == '\r'))
+        --end;
+
+    int fields = 0;
+    while (true)
+    {
+        while (pos < end && (*pos == ' ' || *pos == '\t'))
+            ++pos;
+        if (pos < end && *pos == '+')
+            ++pos;
+        double value;
+        auto [ptr, ec] = std::from_chars(pos, end, value);
+        if (ec != std::errc() || fields == maxFields)
+            return -1;
+        out[fields++] = value;
+        pos = ptr;
+        while (pos < end && (*pos == ' ' || *pos == '\t'))
+            ++pos;
+        if (pos == end)
+            return fields;
+        if (*pos != ',')
+            return -1;
+        ++pos;
+    }
+}
+
+bool isBlankLine(const char* pos, const char* end)
+{
+    for (; pos < end; ++pos)
+        if (*pos != ' ' && *pos != '\t' && *pos != '\r' && *pos != '\n')
+            return false;
+    return true;
+}
+
+int countCsvFields(const char* pos, const char* end)
+{
+    return 1 + static_cast<int>(std::count(pos, nextLine(pos, end), ','));
+}
+
+/// @brief Parses the CSV text [begin, end) in parallel. Each thread takes a slice of the text
+/// starting at a line boundary and parses it into its own buffer; the buffers are then
+/// concatenated in order.
+bool parseCsv(const char* begin, const char* end, int threads, std::vector<double>& values,
+              int& rows, int& cols)
+{
+    while (begin < end && isBlankLine(begin, nextLine(begin, end)))
+        begin = nextLine(begin, end);
+    if (begin == end)
+        return false;
+
+    cols = countCsvFields(begin, end);
+    const size_t bytes = end - begin;
+    threads = static_cast<int>(std::min<size_t>(threads, bytes / (1 << 16) + 1));
+
+    std::vector<const char*> bounds(threads + 1);
+    bounds[0] = begin;
+    bounds[threads] = end;
+    for (int idx = 1; idx < threads; ++idx)
+        bounds[idx] = std::max(bounds[idx - 1], nextLine(begin + bytes * idx / threads, end));
+
+    std::vector<std::vector<double>> parts(threads);
+    std::vector<char> failed(threads, 0);
+    auto worker = [&](int idx)
+    {
+        std::vector<double>& part = parts[idx];
+        // Assume short numbers to size the buffer once.
+        part.reserve((bounds[idx + 1] - bounds[idx]) / 4);
+        for (const char* pos = bounds[idx]; pos < bounds[idx + 1];)
+        {
+            const char* eol = nextLine(pos, bounds[idx + 1]);
+            if (!isBlankLine(pos, eol))
+            {
+                const size_t offset = part.size();
+                part.resize(offset + cols);
+                if (parseCsvLine(pos, eol, part.data() + offset, cols) != cols)
+                {
+                    failed[idx] = 1;
+                    return;
+                }
+            }
+            pos = eol;
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int idx = 1; idx < threads; ++idx)
+        pool.emplace_back(worker, idx);
+    worker(0);
+    for (auto& thread : pool)
+        thread.join();
+
+    if (std::find(failed.begin(), failed.end(), 1) != failed.end())
+        return false;
+
+    size_t total = 0;
+    for (const auto& part : parts)
+        total += part.size();
+    if (total / cols > static_cast<size_t>(std::numeric_limits<int>::max()))
+        return false;
+
+    values.clear();
+    values.reserve(total);
+    for (auto& part : parts)
+    {
+        values.insert(values.end(), part.begin(), part.end());
+        std::vector<double>().swap(part);
+    }
+    rows = static_cast<int>(total / cols);
+    return true;
+}
+
+/// @brief Writes labels and confidences in the requested output format.
+class OutputWriter
+{
+public:
+    OutputWriter(const std::string& path, Format format_)
+        : file(path == "-" ? stdout : std::fopen(path.c_str(), "wb"))
+        , format(format_)
+    {
+        if (file)
+            std::setvbuf(file, nullptr, _IOFBF, 1 << 20);
+    }
+
+    ~OutputWriter()
+    {
+        if (file && file != stdout)
+            std::fclose(file);
+    }
+
+    OutputWriter(const OutputWriter&) = delete;
+    OutputWriter& operator=(const OutputWriter&) = delete;
+
+    [[nodiscard]] bool valid() const { return file && !error; }
+
+    void write(const int* labels, const double* confidences, int rows)
+    {
+        if (!file)
+            return;
+
+        char line[64];
+        for (int row = 0; row < rows; ++row)
+        {
+            if (format == Format::CSV)
+            {
+                const int len = std::snprintf(line, sizeof(line), "%d,%.6g\n", labels[row],
+                                              confidences[row]);
+                error |= std::fwrite(line, 1, len, file) != size_t(len);
+            }
+            else
+            {
+                const std::int32_t label = labels[row];
+                error |= std::fwrite(&label, sizeof(label), 1, file) != 1;
+                error |= std::fwrite(&confidences[row], sizeof(double), 1, file) != 1;
+            }
+        }
+    }
+
+    bool flush() { return file && std::fflush(file) == 0 && !error; }
+
+    static void callback(void* context, const int* labels, const double* confidences, int rows)
+    {
+        static_cast<OutputWriter*>(context)->write(labels, confidences, rows);
+    }
+
+private:
+    FILE* file;
+    const Format format;
+    bool error = false;
+};
+
+/// @brief Chunk source for gmmStreamMain() over a mapped binary matrix.
+struct BinarySource
+{
+    const double* data;
+    long long rows;
+    int cols;
+    long long next;
+
+    static int read(void* context, double* buffer, int maxRows)
+    {
+        auto* source = static_cast<BinarySource*>(context);
+        const int count =
+            static_cast<int>(std::min<long long>(maxRows, source->rows - source->next));
+        std::memcpy(buffer, source->data + source->next * source->cols,
+                    sizeof(double) * count * source->cols);
+        source->next += count;
+        return count;
+    }
+
+    static void rewind(void* context) { static_cast<BinarySource*>(context)->next = 0; }
+};
+
+/// @brief Chunk source for gmmStreamMain() parsing a mapped CSV file line by line.
+struct CsvSource
+{
+    const char* begin;
+    const char* end;
+    int cols;
+    const char* next;
+
+    static int read(void* context, double* buffer, int maxRows)
+    {
+        auto* source = static_cast<CsvSource*>(context);
+        int count = 0;
+        while (count < maxRows && source->next < source->end)
+        {
+            const char* eol = nextLine(source->next, source->end);
+            if (!isBlankLine(source->next, eol))
+            {
+                if (parseCsvLine(source->next, eol, buffer + count * source->cols, source->cols)
+                    != source->cols)
+                    return -1;
+                ++count;
+            }
+            source->next = eol;
+        }
+        return count;
+    }
+
+    static void rewind(void* context)
+    {
+        auto* source = static_cast<CsvSource*>(context);
+        source->next = source->begin;
+    }
+};
+
+void printStats(const GMMStats& stats, double ioTimeMs)
+{
+    std::fprintf(stderr,
+                 "ioTimeMs=%.3f\ninitTimeMs=%.3f\neStepTimeMs=%.3f\nmStepTimeMs=%.3f\n"
+                 "totalTimeMs=%.3f\nnumCandidates=%d\nepochsPerCandidate=%d\ntotalEpochs=%d\n"
+                 "totalIterations=%d\nminIterationsPerEpoch=%d\nmaxIterationsPerEpoch=%d\n"
+                 "bestNumClusters=%d\nthreadsUsed=%d\nallocCount=%lld\nallocBytes=%lld\n"
+                 "uniqueRows=%d\npcaComponents=%d\nregularizedCovariances=%d\n"
+                 "reseededClusters=%d\nplanStrategy=%d\nplanEstimatedMs=%.3f\n"
+                 "planEstimatedMB=%.3f\nselectTimeMs=%.3f\nperfStatus=%d\ninvalidRows=%d\n",
+                 ioTimeMs, stats.initTimeMs, stats.eStepTimeMs, stats.mStepTimeMs,
+                 stats.totalTimeMs, stats.numCandidates, stats.epochsPerCandidate,
+                 stats.totalEpochs, stats.totalIterations, stats.minIterationsPerEpoch,
+                 stats.maxIterationsPerEpoch, stats.bestNumClusters, stats.threadsUsed,
+                 stats.allocCount, stats.allocBytes, stats.uniqueRows, stats.pcaComponents,
+                 stats.regularizedCovariances, stats.reseededClusters, stats.planStrategy,
+                 stats.planEstimatedMs, stats.planEstimatedMB, stats.selectTimeMs,
+                 stats.perfStatus, stats.invalidRows);
+    if (stats.perfStatus == 0)
+        return;
+
+    static const char* const phases[CR_NUM_PHASES]{ "init", "eStep", "mStep", "select" };
+    for (int phase = 0; phase < CR_NUM_PHASES; ++phase)
+    {
+        std::fprintf(stderr,
+                     "%sCycles=%lld\n%sInstructions=%lld\n%sCacheMisses=%lld\n"
+                     "%sBranchMisses=%lld\n",
+                     phases[phase], stats.perfCycles[phase], phases[phase],
+                     stats.perfInstructions[phase], phases[phase], stats.perfCacheMisses[phase],
+                     phases[phase], stats.perfBranchMisses[phase]);
+    }
+}
+
+double elapsedMs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+        .count();
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    CliOptions opts;
+    if (!parseArgs(argc, argv, opts))
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    MappedFile input(opts.input);
+    if (!input.valid())
+    {
+        std::fprintf(stderr, "crcluster: cannot read '%s': %s\n", opts.input.c_str(),
+                     std::strerror(errno));
+        return 1;
+    }
+
+    const char* text = input.begin();
+    const char* textEnd = input.end();
+    if (opts.inputFormat == Format::CSV && opts.header && text)
+        text = nextLine(text, textEnd);
+
+    OutputWriter writer(opts.output, opts.outputFormat);
+    if (!writer.valid())
+    {
+        std::fprintf(stderr, "crcluster: cannot write '%s': %s\n", opts.output.c_str(),
+                     std::strerror(errno));
+        return 1;
+    }
+
+    GMMStats stats;
+    int ret = 0;
+    double ioTimeMs = 0.0;
+    if (opts.inputFormat == Format::BINARY)
+    {
+        const size_t rowBytes = sizeof(double) * opts.cols;
+        if (input.size() % rowBytes)
+        {
+            std::fprintf(stderr, "crcluster: input size is not a multiple of %d doubles\n",
+                         opts.cols);
+            return 1;
+        }
+
+        const long long rows = input.size() / rowBytes;
+        const auto* data = reinterpret_cast<const double*>(text);
+        if (opts.stream)
+        {
+            BinarySource source{ data, rows, opts.cols, 0 };
+            ret = gmmStreamMain(opts.cols, BinarySource::read, BinarySource::rewind, &source,
+                                &opts.engine, OutputWriter::callback, &writer, &stats);
+        }
+        else if (rows > std::numeric_limits<int>::max())
+        {
+            std::fprintf(stderr, "crcluster: too many rows for in-memory mode, use --stream\n");
+            return 1;
+        }
+        else
+        {
+            std::vector<int> labels(rows);
+            std::vector<double> confidences(rows);
+            ret = gmmMainEx(data, static_cast<int>(rows), opts.cols, &opts.engine, labels.data(),
+                            confidences.data(), &stats);
+            if (ret == 0)
+                writer.write(labels.data(), confidences.data(), static_cast<int>(rows));
+        }
+    }
+    else if (opts.stream)
+    {
+        while (text < textEnd && isBlankLine(text, nextLine(text, textEnd)))
+            text = nextLine(text, textEnd);
+        if (text == textEnd)
+        {
+            std::fprintf(stderr, "crcluster: no data rows in '%s'\n", opts.input.c_str());
+            return 1;
+        }
+        const int cols = countCsvFields(text, textEnd);
+        CsvSource source{ text, textEnd, cols, text };
+        ret = gmmStreamMain(cols, CsvSource::read, CsvSource::rewind, &source, &opts.engine,
+                            OutputWriter::callback, &writer, &stats);
+    }
+    else
+    {
+        std::vector<double> values;
+        int rows = 0;
+        int cols = 0;
+        if (!text || !parseCsv(text, textEnd, opts.threads, values, rows, cols))
+        {
+            std::fprintf(stderr, "crcluster: '%s' is not a numeric CSV matrix\n",
+                         opts.input.c_str());
+            return 1;
+        }
+        ioTimeMs = elapsedMs(start);
+
+        std::vector<int> labels(rows);
+        std::vector<double> confidences(rows);
+        ret = gmmMainEx(values.data(), rows, cols, &opts.engine, labels.data(),
+                        confidences.data(), &stats);
+        if (ret == 0)
+            writer.write(labels.data(), confidences.data(), rows);
+    }
+
+    if (ret != 0)
+    {
+        std::fprintf(stderr, "crcluster: clustering failed\n");
+        return 1;
+    }
+    if (!writer.flush())
+    {
+        std::fprintf(stderr, "crcluster: error writing '%s'\n", opts.output.c_str());
+        return 1;
+    }
+    if (opts.printStats)
+        printStats(stats, ioTimeMs);
+
+    return 0;
+}
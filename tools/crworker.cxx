@@ -0,0 +1,449 @@
+/*
+ * ClusterRows
+ * Copyright (c) 2024 Dennis Francis <dennisfrancis.in@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// crworker : local clustering server, so that fits run outside the soffice process.
+//
+// Clients connect to a Unix domain socket and send fixed size WorkerRequest messages, each
+// naming a POSIX shared memory segment that holds the row major input matrix followed by room
+// for the results:
+//
+//     double data[rows * cols]; double labelConfidence[rows]; int32 clusterLabels[rows];
+//
+// The worker maps the segment, fills in the results and replies with a WorkerResponse. Requests
+// of all connections are collected into batches for gmmBatchMain(), which runs them on the
+// shared thread pool whose working buffers stay allocated between batches. The worker exits
+// after a while without requests, even if clients keep their connections open, and closes those
+// connections so that the clients reconnect to a new worker. src/py/crworker.py is the client
+// used by the add-in.
+
+#include <em.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace
+{
+
+/// "CRWQ" and "CRWR" in little endian byte order.
+constexpr std::uint32_t requestMagic = 0x51575243;
+constexpr std::uint32_t responseMagic = 0x52575243;
+
+/// Status of a response whose request was built against a different GMMOptions or GMMStats.
+constexpr int statusIncompatible = -2;
+
+struct WorkerRequest
+{
+    std::uint32_t magic;
+    /// sizeof(GMMOptions) and sizeof(GMMStats) of the client, which must match the worker's.
+    std::uint32_t optionsSize;
+    std::uint32_t statsSize;
+    /// shm_open() name of the segment, NUL terminated.
+    char shmName[64];
+    std::int32_t rows;
+    std::int32_t cols;
+    GMMOptions options;
+};
+
+struct WorkerResponse
+{
+    std::uint32_t magic;
+    /// what gmmMainEx() returned, or statusIncompatible.
+    std::int32_t status;
+    GMMStats stats;
+};
+
+struct CliOptions
+{
+    std::string socketPath;
+    int idleTimeoutSec = 300;
+};
+
+std::string defaultSocketPath()
+{
+    // Same rule as crworker.socketPath() of the client.
+    if (const char* runtimeDir = std::getenv("XDG_RUNTIME_DIR"); runtimeDir && *runtimeDir)
+        return std::string(runtimeDir) + "/clusterrows-worker.sock";
+    return "/tmp/clusterrows-worker-" + std::to_string(::getuid()) + ".sock";
+}
+
+void usage(const char* program)
+{
+    std::fprintf(stderr,
+                 "Usage: %s [options]\n"
+                 "\n"
+                 "Serves clustering requests of the ClusterRows add-in over a Unix domain socket,\n"
+                 "with the matrices passed in POSIX shared memory.\n"
+                 "\n"
+                 "  --socket PATH            socket to listen on (default: %s)\n"
+                 "  --idle-timeout N         exit after N seconds without requests, 0 to never\n"
+                 "                           exit (default 300)\n",
+                 program, defaultSocketPath().c_str());
+}
+
+bool parseArgs(int argc, char** argv, CliOptions& opts)
+{
+    opts.socketPath = defaultSocketPath();
+    for (int idx = 1; idx < argc; ++idx)
+    {
+        const std::string_view arg(argv[idx]);
+        if (arg == "-h" || arg == "--help" || idx + 1 >= argc)
+            return false;
+
+        const char* value = argv[++idx];
+        if (arg == "--socket")
+            opts.socketPath = value;
+        else if (arg == "--idle-timeout")
+        {
+            const char* end = value + std::strlen(value);
+            auto [ptr, ec] = std::from_chars(value, end, opts.idleTimeoutSec);
+            if (ec != std::errc() || ptr != end || opts.idleTimeoutSec < 0)
+                return false;
+        }
+        else
+            return false;
+    }
+    return !opts.socketPath.empty() && opts.socketPath.size() < sizeof(sockaddr_un::sun_path);
+}
+
+bool readAll(int fd, void* buffer, size_t size)
+{
+    auto* bytes = static_cast<char*>(buffer);
+    while (size)
+    {
+        const ssize_t count = ::read(fd, bytes, size);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+        bytes += count;
+        size -= count;
+    }
+    return true;
+}
+
+bool writeAll(int fd, const void* buffer, size_t size)
+{
+    const auto* bytes = static_cast<const char*>(buffer);
+    while (size)
+    {
+        const ssize_t count = ::send(fd, bytes, size, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+        bytes += count;
+        size -= count;
+    }
+    return true;
+}
+
+/// @brief The shared memory segment of a request, mapped for the duration of the job.
+class Segment
+{
+public:
+    Segment(const char* name, int rows, int cols)
+    {
+        // Only plain "/name" segments, the input rows and the results must fit.
+        if (name[0] != '/' || std::strchr(name + 1, '/') || rows < 0 || cols <= 0)
+            return;
+        const long double needed = static_cast<long double>(rows) * (cols + 1) * sizeof(double)
+                                   + static_cast<long double>(rows) * sizeof(std::int32_t);
+        if (needed > static_cast<long double>(std::numeric_limits<std::int64_t>::max()))
+            return;
+
+        const int fd = ::shm_open(name, O_RDWR, 0);
+        if (fd < 0)
+            return;
+
+        struct stat info;
+        if (::fstat(fd, &info) == 0 && info.st_size > 0
+            && static_cast<long double>(info.st_size) >= needed)
+        {
+            void* addr
+                = ::mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (addr != MAP_FAILED)
+            {
+                base = static_cast<char*>(addr);
+                length = info.st_size;
+                data = reinterpret_cast<const double*>(base);
+                labelConfidence
+                    = reinterpret_cast<double*>(base) + static_cast<size_t>(rows) * cols;
+                clusterLabels = reinterpret_cast<int*>(labelConfidence + rows);
+            }
+        }
+        ::close(fd);
+    }
+
+    ~Segment()
+    {
+        if (base)
+            ::munmap(base, length);
+    }
+
+    Segment(const Segment&) = delete;
+    Segment& operator=(const Segment&) = delete;
+
+    [[nodiscard]] bool valid() const { return base; }
+
+    const double* data = nullptr;
+    double* labelConfidence = nullptr;
+    int* clusterLabels = nullptr;
+
+private:
+    char* base = nullptr;
+    size_t length = 0;
+};
+
+/// @brief Runs the jobs submitted by the connection threads, all jobs queued while a batch is
+/// running going into the next gmmBatchMain() call.
+class BatchRunner
+{
+public:
+    BatchRunner()
+        : thread(&BatchRunner::run, this)
+    {
+        thread.detach();
+    }
+
+    /// @brief Runs @p job and returns its status once done.
+    int submit(GMMJob& job)
+    {
+        Pending pending{ &job, false };
+        std::unique_lock<std::mutex> lock(mutex);
+        queue.push_back(&pending);
+        wake.notify_one();
+        done.wait(lock, [&pending] { return pending.finished; });
+        return job.status;
+    }
+
+private:
+    struct Pending
+    {
+        GMMJob* job;
+        bool finished;
+    };
+
+    void run()
+    {
+        std::vector<Pending*> batch;
+        std::vector<GMMJob> jobs;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return !queue.empty(); });
+                batch.swap(queue);
+            }
+
+            jobs.clear();
+            for (const Pending* pending : batch)
+                jobs.push_back(*pending->job);
+            gmmBatchMain(jobs.data(), static_cast<int>(jobs.size()), 0);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (size_t idx = 0; idx < batch.size(); ++idx)
+                {
+                    batch[idx]->job->status = jobs[idx].status;
+                    batch[idx]->finished = true;
+                }
+            }
+            done.notify_all();
+            batch.clear();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::vector<Pending*> queue;
+    std::thread thread;
+};
+
+// Requests being run, the worker is idle when there are none whatever the open connections.
+std::atomic<int> activeRequests{ 0 };
+std::atomic<long long> lastActivityMs{ 0 };
+std::mutex connectionsMutex;
+std::unordered_set<int> connections;
+
+long long nowMs()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void serve(int fd, BatchRunner& runner)
+{
+    WorkerRequest request;
+    while (readAll(fd, &request, sizeof(request)))
+    {
+        if (request.magic != requestMagic)
+            break;
+
+        ++activeRequests;
+        WorkerResponse response{};
+        response.magic = responseMagic;
+        response.status = -1;
+        request.shmName[sizeof(request.shmName) - 1] = '\0';
+        if (request.optionsSize != sizeof(GMMOptions) || request.statsSize != sizeof(GMMStats))
+            response.status = statusIncompatible;
+        else if (Segment segment(request.shmName, request.rows, request.cols); segment.valid())
+        {
+            GMMJob job{ segment.data,          request.rows,           request.cols,
+                        &request.options,      segment.clusterLabels, segment.labelConfidence,
+                        &response.stats,       -1 };
+            response.status = runner.submit(job);
+        }
+
+        lastActivityMs = nowMs();
+        const bool sent = writeAll(fd, &response, sizeof(response));
+        --activeRequests;
+        if (!sent)
+            break;
+    }
+    {
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        connections.erase(fd);
+    }
+    ::close(fd);
+}
+
+/// @brief Wakes the connection threads of the clients still connected, which then close their
+/// sockets, so that the clients see the worker gone.
+void closeConnections()
+{
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    for (int fd : connections)
+        ::shutdown(fd, SHUT_RDWR);
+}
+
+/// @brief Binds @p path, replacing a stale socket left by a worker that did not exit cleanly.
+/// Returns -1 if another worker is listening there already.
+int listenOn(const std::string& path)
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    const auto* addr = reinterpret_cast<const sockaddr*>(&address);
+
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    if (::bind(fd, addr, sizeof(address)) != 0 && errno == EADDRINUSE)
+    {
+        const int probe = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        const bool inUse = probe >= 0 && ::connect(probe, addr, sizeof(address)) == 0;
+        if (probe >= 0)
+            ::close(probe);
+        if (inUse || ::unlink(path.c_str()) != 0 || ::bind(fd, addr, sizeof(address)) != 0)
+        {
+            ::close(fd);
+            return -1;
+        }
+    }
+
+    if (::listen(fd, 16) != 0)
+    {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    CliOptions opts;
+    if (!parseArgs(argc, argv, opts))
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    ::signal(SIGPIPE, SIG_IGN);
+    // The socket and the segments are for the current user only.
+    ::umask(077);
+
+    const int listenFd = listenOn(opts.socketPath);
+    if (listenFd < 0)
+    {
+        std::fprintf(stderr, "crworker: cannot listen on '%s': %s\n", opts.socketPath.c_str(),
+                     std::strerror(errno));
+        return 1;
+    }
+
+    // Never destroyed, its detached thread may still be waiting for work when main() returns.
+    auto* runner = new BatchRunner;
+    lastActivityMs = nowMs();
+    const long long idleTimeoutMs = opts.idleTimeoutSec * 1000LL;
+    for (;;)
+    {
+        pollfd entry{ listenFd, POLLIN, 0 };
+        const int ready = ::poll(&entry, 1, 1000);
+        if (ready < 0 && errno != EINTR)
+            break;
+        if (ready <= 0)
+        {
+            if (idleTimeoutMs && activeRequests == 0
+                && nowMs() - lastActivityMs >= idleTimeoutMs)
+                break;
+            continue;
+        }
+
+        const int fd = ::accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0)
+            continue;
+        lastActivityMs = nowMs();
+        {
+            std::lock_guard<std::mutex> lock(connectionsMutex);
+            connections.insert(fd);
+        }
+        std::thread(serve, fd, std::ref(*runner)).detach();
+    }
+
+    ::close(listenFd);
+    ::unlink(opts.socketPath.c_str());
+    closeConnections();
+    return 0;
+}